@@ -18,10 +18,15 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
+#include <future>
+#include <iterator>
 #include <map>
+#include <mutex>
 #include <sstream>
+#include <string_view>
 #include <utility>
 
 using ethutils::AbiDecoder;
@@ -37,6 +42,41 @@ DEFINE_int32 (eth_rpc_timeout_ms, 10'000,
               "timeout for RPC calls to the EVM node");
 DEFINE_string (eth_rpc_headers, "",
                "extra headers to send with EVM JSON-RPC requests");
+DEFINE_int32 (eth_rpc_pool_size, 8,
+              "maximum number of idle keep-alive connections to the EVM node");
+
+DEFINE_int32 (eth_batch_min_blocks, 8,
+              "minimum number of blocks requested in one sub-batch");
+DEFINE_int32 (eth_batch_max_blocks, 1'024,
+              "maximum number of blocks requested in one sub-batch");
+DEFINE_int32 (eth_batch_target_ms, 2'000,
+              "targeted latency for one sub-batch of block requests, based on"
+              " which the sub-batch size is adapted");
+DEFINE_int32 (eth_parallel_batches, 4,
+              "maximum number of sub-batches requested concurrently");
+
+DEFINE_int32 (eth_header_cache_size, 256,
+              "number of recent block headers from newHeads notifications"
+              " that are cached in memory (0 to disable)");
+DEFINE_int32 (eth_pending_workers, 2,
+              "number of threads simulating pending transactions");
+DEFINE_int32 (eth_pending_queue_size, 1'024,
+              "maximum number of queued pending transactions, beyond which"
+              " the oldest ones are dropped");
+DEFINE_int32 (eth_pending_batch_size, 16,
+              "maximum number of pending transactions simulated in one"
+              " batch request");
+
+DEFINE_int32 (eth_mempool_reverify_ms, 30'000,
+              "age after which tracked pending transactions are verified"
+              " again with the node when the mempool is queried");
+
+DEFINE_int32 (eth_checksum_cache_size, 1'024,
+              "number of receiver addresses in moves for which the checksummed"
+              " form is cached");
+DEFINE_bool (eth_push_logs, false,
+             "subscribe to move logs through the websocket, so that recent"
+             " blocks without moves need no eth_getLogs requests");
 
 namespace
 {
@@ -56,21 +96,139 @@ template <typename A, typename B>
 
 /* ************************************************************************** */
 
-class EthChain::EthRpc
-    : public RpcClient<EthRpcClient, jsonrpc::JSONRPC_CLIENT_V2>
+class EthChain::RpcPool
+    : public RpcClientPool<EthRpcClient, jsonrpc::JSONRPC_CLIENT_V2>
 {
 
 public:
 
-  EthRpc (const EthChain& parent)
-    : RpcClient(parent.endpoint)
+  explicit RpcPool (const EthChain& parent)
+    : RpcClientPool(parent.endpoint, FLAGS_eth_rpc_pool_size,
+                    [&parent] (Client& c)
+                      {
+                        c.SetTimeout (std::chrono::milliseconds (
+                            FLAGS_eth_rpc_timeout_ms));
+                        c.AddHeaders (parent.headers);
+                      })
   {
-    SetTimeout (std::chrono::milliseconds (FLAGS_eth_rpc_timeout_ms));
-    AddHeaders (parent.headers);
+    CHECK_GE (FLAGS_eth_rpc_pool_size, 0) << "Invalid --eth_rpc_pool_size";
   }
 
 };
 
+/**
+ * Adaptive size for sub-batches of block ranges.  After each sub-batch,
+ * the latency (and whether or not it succeeded) is reported, and the size
+ * is updated to get closer to the targeted latency.  On errors, the size
+ * is reduced quickly, as they may be caused by the node struggling with
+ * too large requests.
+ */
+class EthChain::BatchSizer
+{
+
+private:
+
+  /** The initial size before any latency has been observed.  */
+  static constexpr double INITIAL_SIZE = 128;
+
+  /**
+   * Weight given to the newest observation when updating the size.
+   * The rest is kept from the previous value, which smoothes out
+   * outliers in the latency.
+   */
+  static constexpr double NEW_WEIGHT = 0.5;
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /** The current size (as double, so that small adjustments add up).  */
+  double size;
+
+  /** The configured minimum size.  */
+  const double minSize;
+
+  /** The configured maximum size.  */
+  const double maxSize;
+
+  /**
+   * Clamps the size into the configured range.
+   */
+  void
+  Clamp ()
+  {
+    size = std::max (minSize, std::min (maxSize, size));
+  }
+
+public:
+
+  BatchSizer ()
+    : size(INITIAL_SIZE),
+      minSize(FLAGS_eth_batch_min_blocks), maxSize(FLAGS_eth_batch_max_blocks)
+  {
+    CHECK_GT (FLAGS_eth_batch_min_blocks, 0)
+        << "Invalid --eth_batch_min_blocks";
+    CHECK_GE (FLAGS_eth_batch_max_blocks, FLAGS_eth_batch_min_blocks)
+        << "Invalid --eth_batch_max_blocks";
+    CHECK_GT (FLAGS_eth_batch_target_ms, 0) << "Invalid --eth_batch_target_ms";
+    Clamp ();
+  }
+
+  /**
+   * Returns the number of blocks that should be requested in one sub-batch.
+   */
+  int64_t
+  Get () const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return std::llround (size);
+  }
+
+  /**
+   * Reports the result of a sub-batch request with the given number of blocks
+   * and latency.
+   */
+  void
+  Report (const int64_t numBlocks, const std::chrono::nanoseconds latency,
+          const bool success)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    if (!success)
+      size /= 2;
+    else
+      {
+        using Millis = std::chrono::duration<double, std::milli>;
+        const double ms = std::max (1.0, Millis (latency).count ());
+        const double ideal = numBlocks * FLAGS_eth_batch_target_ms / ms;
+        size = (1 - NEW_WEIGHT) * size + NEW_WEIGHT * ideal;
+      }
+
+    Clamp ();
+    VLOG (1)
+        << "Sub-batch of " << numBlocks << " blocks took "
+        << std::chrono::duration_cast<std::chrono::milliseconds> (latency)
+              .count ()
+        << " ms (" << (success ? "success" : "failure") << "),"
+        << " new batch size: " << size;
+  }
+
+};
+
+/**
+ * RPC client for a single request (or sequence of requests), checked out
+ * from the parent's pool.
+ */
+class EthChain::EthRpc : public EthChain::RpcPool::Handle
+{
+
+public:
+
+  explicit EthRpc (const EthChain& parent)
+    : Handle(*parent.rpcPool)
+  {}
+
+};
+
 namespace
 {
 
@@ -128,6 +286,17 @@ ExtractBaseData (const Json::Value& val)
   return res;
 }
 
+/**
+ * Returns the cache of checksummed receiver addresses used when
+ * extracting moves.
+ */
+ChecksumCache&
+GetChecksumCache ()
+{
+  static ChecksumCache cache(std::max (0, FLAGS_eth_checksum_cache_size));
+  return cache;
+}
+
 /**
  * Extracts move data from a log event JSON.
  */
@@ -158,13 +327,12 @@ GetMoveDataFromLogs (AbiDecoder& dec)
   dec.ReadUint (160);
 
   const int64_t amount = AbiDecoder::ParseInt (dec.ReadUint (256));
-  const ethutils::Address receiver(dec.ReadUint (160));
-  CHECK (receiver) << "Invalid receiver address returned from RPC";
+  const std::string receiver = dec.ReadUint (160);
 
   Json::Value out(Json::objectValue);
   CHECK_GE (amount, 0);
   if (amount > 0)
-    out[receiver.GetChecksummed ()]
+    out[GetChecksumCache ().GetChecksummed (receiver)]
         = static_cast<double> (amount) / std::pow (10.0, DECIMALS);
   res.metadata["out"] = out;
 
@@ -191,10 +359,11 @@ GetMoveDataFromLogs (AbiDecoder& dec)
      the entire context and history.  */
 
   const std::string dataHex = dec.GetAllDataRead ();
-  CHECK_EQ (dataHex.substr (0, 2), "0x");
+  const std::string_view hexView(dataHex);
+  CHECK_EQ (hexView.substr (0, 2), "0x");
   std::string dataBin;
-  CHECK (ethutils::Unhexlify (dataHex.substr (2), dataBin));
-  res.metadata["mvid"] = ethutils::Hexlify (ethutils::Keccak256 (dataBin));
+  CHECK (DecodeHex (hexView.substr (2), dataBin));
+  res.metadata["mvid"] = EncodeHex (ethutils::Keccak256 (dataBin));
 
   return res;
 }
@@ -204,7 +373,11 @@ GetMoveDataFromLogs (AbiDecoder& dec)
 EthChain::EthChain (const std::string& httpEndpoint,
                     const std::string& wsEndpoint,
                     const std::string& acc)
-  : endpoint(httpEndpoint), headers(ParseRpcHeaders (FLAGS_eth_rpc_headers))
+  : endpoint(httpEndpoint), headers(ParseRpcHeaders (FLAGS_eth_rpc_headers)),
+    rpcPool(std::make_unique<RpcPool> (*this)),
+    batchSizer(std::make_unique<BatchSizer> ()),
+    mempool(std::chrono::milliseconds (FLAGS_eth_mempool_reverify_ms)),
+    headerCache(std::max (0, FLAGS_eth_header_cache_size))
 {
   if (wsEndpoint.empty ())
     LOG (WARNING) << "Not using WebSocket subscriptions";
@@ -218,47 +391,97 @@ EthChain::EthChain (const std::string& httpEndpoint,
   CHECK (accAddr) << "Accounts contract address is invalid";
   accountsContract = accAddr.GetLowerCase ();
 
+  if (FLAGS_eth_push_logs)
+    {
+      if (sub == nullptr)
+        LOG (WARNING) << "Pushed logs require a WebSocket endpoint";
+      else
+        {
+          pushedLogs = std::make_unique<PushedLogs> (
+              std::max (1, FLAGS_eth_header_cache_size),
+              accountsContract, MOVE_EVENT);
+          sub->EnableLogs (GetLogsOptions ());
+        }
+    }
+
   EthRpc rpc(*this);
   chainId = AbiDecoder::ParseInt (rpc->eth_chainId ());
 }
 
+EthChain::~EthChain () = default;
+
 void
-EthChain::NewTip (const std::string& tip)
+EthChain::EnableHeaderStore (const std::string& file)
 {
-  /* We use block hashes without 0x prefix internally, so need to strip
-     off the prefix here as well (even though in the end it is just a string
-     in this place and not a true uint256 value).  */
-  TipChanged (ConvertUint256 (tip));
+  CHECK (headerStore == nullptr) << "Header store is already enabled";
+  headerStore = std::make_unique<HeaderStore> (file);
+  LOG (INFO) << "Using header store for finalised blocks: " << file;
+}
+
+void
+EthChain::NewTip (const Json::Value& head)
+{
+  /* The header contains all the base data of the block, so we keep it
+     around for when the sync asks for the new tip or blocks around it.
+     This also strips the 0x prefix off the hash, as we use it without
+     internally.  */
+  const BlockData blk = ExtractBaseData (head);
+  headerCache.Add (blk);
+  if (pushedLogs != nullptr)
+    pushedLogs->AddHeader (blk, head["logsBloom"].asString ());
+
+  TipChanged (blk.hash);
 }
 
 void
 EthChain::NewPendingTx (const std::string& txid)
 {
-  CHECK (pending != nullptr)
+  CHECK (pendingQueue != nullptr)
       << "Pending move received, but tracking is not turned on";
+  pendingQueue->Push (txid);
+}
 
+void
+EthChain::ProcessPending (const std::vector<std::string>& txids)
+{
   EthRpc rpc(*this);
-  std::vector<MoveData> moves;
+  std::vector<std::pair<std::string, std::vector<MoveData>>> movesPerTx;
   try
     {
-      moves = pending->GetMoves (*rpc, txid);
+      movesPerTx = pending->GetMovesBatch (*rpc, txids);
     }
   catch (const jsonrpc::JsonRpcException& exc)
     {
       /* Just ignore pending moves in case the RPC has currently
          issues.  It might recover later, and pendings are best-effort
          only anyway.  */
-      LOG (WARNING) << "Ethereum RPC error for pending move: " << exc.what ();
+      LOG (WARNING) << "Ethereum RPC error for pending moves: " << exc.what ();
       return;
     }
 
-  if (!moves.empty ())
+  /* PendingMoves expects all moves of one call to be from the same
+     transaction, so we notify for each of them separately.  */
+  for (const auto& entry : movesPerTx)
     {
-      mempool.Add (ConvertUint256 (txid));
-      PendingMoves (moves);
+      mempool.Add (ConvertUint256 (entry.first));
+      PendingMoves (entry.second);
     }
 }
 
+void
+EthChain::LogsSubscribed ()
+{
+  CHECK (pushedLogs != nullptr);
+  pushedLogs->SetActive ();
+}
+
+void
+EthChain::NewLog (const Json::Value& log)
+{
+  CHECK (pushedLogs != nullptr);
+  pushedLogs->AddLog (log);
+}
+
 void
 EthChain::Start ()
 {
@@ -275,6 +498,19 @@ EthChain::EnablePending ()
   CHECK (pending == nullptr) << "Already tracking pending moves";
   EthRpc rpc(*this);
   pending = std::make_unique<PendingDataExtractor> (*rpc, accountsContract);
+
+  CHECK_GT (FLAGS_eth_pending_workers, 0) << "Invalid --eth_pending_workers";
+  CHECK_GT (FLAGS_eth_pending_queue_size, 0)
+      << "Invalid --eth_pending_queue_size";
+  CHECK_GT (FLAGS_eth_pending_batch_size, 0)
+      << "Invalid --eth_pending_batch_size";
+  pendingQueue = std::make_unique<PendingQueue> (
+      FLAGS_eth_pending_workers, FLAGS_eth_pending_queue_size,
+      FLAGS_eth_pending_batch_size,
+      [this] (const std::vector<std::string>& txids)
+        {
+          ProcessPending (txids);
+        });
   if (sub != nullptr)
     sub->EnablePending ();
   return true;
@@ -301,29 +537,45 @@ EthChain::GetLogsOptions () const
 }
 
 bool
-EthChain::TryBlockRange (EthRpc& rpc, const int64_t startHeight,
-                         int64_t endHeight, std::vector<BlockData>& res) const
+EthChain::TryHeaderBatch (EthRpc& rpc, const int64_t startHeight,
+                          const int64_t endHeight, const int64_t tipHeight,
+                          std::vector<BlockData>& res) const
 {
   CHECK (res.empty ());
-
-  /* As the first step, reduce the endHeight if it is beyond the current tip.
-     Afterwards, we expect to get blocks exactly up to endHeight.  */
-  const int64_t tipHeight = AbiDecoder::ParseInt (rpc->eth_blockNumber ());
-  if (tipHeight < endHeight)
-    endHeight = tipHeight;
-  if (endHeight < startHeight)
-    {
-      /* res is empty */
-      return true;
-    }
-
-  /* Query for the base block data using a batch request over the entire range
-     of heights we want.  */
+  CHECK_LE (startHeight, endHeight);
+  CHECK_LE (endHeight, tipHeight);
+
+  /* Blocks far enough behind the tip are treated as final (see below for
+     how we get their moves).  Their headers may already be known from
+     the local header store, in which case we do not need to query
+     for them again.  */
+  const bool deep = (endHeight + FLAGS_ethchain_fast_logs_depth < tipHeight);
+  std::map<uint64_t, BlockData> known;
+  if (deep && headerStore != nullptr)
+    known = headerStore->GetRange (startHeight, endHeight);
+
+  /* Recent headers may be known from newHeads notifications.  If they are
+     stale due to a reorg we have not been notified about, the parent
+     hashes will not match up below and the cache is cleared before
+     the next try.  */
+  if (!deep)
+    for (int64_t h = startHeight; h <= endHeight; ++h)
+      {
+        BlockData hdr;
+        if (headerCache.GetByHeight (h, hdr))
+          known.emplace (h, std::move (hdr));
+      }
+
+  /* Query for the base block data of all other blocks using a batch request
+     over the heights we want.  */
   jsonrpc::BatchCall req;
   std::vector<int> ids;
   std::map<int, int64_t> heightForId;
   for (int64_t h = startHeight; h <= endHeight; ++h)
     {
+      if (known.count (h) > 0)
+        continue;
+
       Json::Value params(Json::arrayValue);
       params.append (EncodeHexInt (h));
       params.append (false);
@@ -331,55 +583,84 @@ EthChain::TryBlockRange (EthRpc& rpc, const int64_t startHeight,
       ids.push_back (id);
       heightForId.emplace (id, h);
     }
-  jsonrpc::BatchResponse resp = rpc->CallProcedures (req);
-  for (const auto id : ids)
-    {
-      Json::Value idVal(id);
-      const int err = resp.getErrorCode (idVal);
-      CHECK_EQ (err, 0)
-          << "Error " << err << " retrieving block at height "
-          << heightForId.at (id) << ":\n"
-          << err << resp.getErrorMessage (idVal);
 
-      const auto blockJson = resp.getResult (id);
-      if (blockJson.isNull ())
-        {
-          /* The block does not exist, maybe due to a race condition.  */
-          LOG (WARNING)
-              << "Block at height " << heightForId.at (id)
-              << " was not found";
-          return false;
-        }
-
-      BlockData blk = ExtractBaseData (blockJson);
-      if (res.empty ())
-        CHECK_EQ (blk.height, startHeight);
-      else
+  std::vector<BlockData> fetched;
+  if (!ids.empty ())
+    {
+      jsonrpc::BatchResponse resp = rpc->CallProcedures (req);
+      for (const auto id : ids)
         {
-          CHECK_EQ (blk.height, res.back ().height + 1);
-          /* If the block does not fit into the chain we are building up,
-             it may be due to a race condition.  */
-          if (blk.parent != res.back ().hash)
+          Json::Value idVal(id);
+          const int err = resp.getErrorCode (idVal);
+          CHECK_EQ (err, 0)
+              << "Error " << err << " retrieving block at height "
+              << heightForId.at (id) << ":\n"
+              << err << resp.getErrorMessage (idVal);
+
+          const auto blockJson = resp.getResult (id);
+          if (blockJson.isNull ())
             {
+              /* The block does not exist, maybe due to a race condition.  */
               LOG (WARNING)
-                  << "Mismatch between parent hash of block "
-                  << heightForId.at (id) << " (" << blk.parent << ")"
-                  << " and previous block hash " << res.back ().hash;
+                  << "Block at height " << heightForId.at (id)
+                  << " was not found";
               return false;
             }
+
+          BlockData blk = ExtractBaseData (blockJson);
+          CHECK_EQ (blk.height, heightForId.at (id));
+          fetched.push_back (blk);
+          known.emplace (blk.height, std::move (blk));
+        }
+    }
+  else
+    VLOG (1)
+        << "All headers for " << startHeight << " to " << endHeight
+        << " are known locally";
+
+  for (int64_t h = startHeight; h <= endHeight; ++h)
+    {
+      auto mit = known.find (h);
+      CHECK (mit != known.end ());
+      BlockData& blk = mit->second;
+
+      /* If the block does not fit into the chain we are building up,
+         it may be due to a race condition.  */
+      if (!res.empty () && blk.parent != res.back ().hash)
+        {
+          LOG (WARNING)
+              << "Mismatch between parent hash of block "
+              << h << " (" << blk.parent << ")"
+              << " and previous block hash " << res.back ().hash;
+          return false;
         }
 
       res.push_back (std::move (blk));
     }
   CHECK_EQ (res.back ().height, endHeight);
 
+  if (deep && headerStore != nullptr && !fetched.empty ())
+    headerStore->Store (fetched);
+
+  return true;
+}
+
+bool
+EthChain::TryBlockBatch (EthRpc& rpc, const int64_t startHeight,
+                         const int64_t endHeight, const int64_t tipHeight,
+                         std::vector<BlockData>& res) const
+{
+  if (!TryHeaderBatch (rpc, startHeight, endHeight, tipHeight, res))
+    return false;
+
   /* Add in the move data from logs.  There are two methods to do this:
      The safe way is to query for move logs for each block by hash individually,
      and the fast is to query for all logs in a given height range.  The latter
      is susceptible to (potentially undetectable) race conditions in case
      of a reorg, so we only want to use it if the end height is already
      far behind the current tip, i.e. for the bulk of syncing.  */
-  if (endHeight + FLAGS_ethchain_fast_logs_depth < tipHeight)
+  const bool deep = (endHeight + FLAGS_ethchain_fast_logs_depth < tipHeight);
+  if (deep)
     {
       AddMovesFromHeightRange (rpc, res);
       return true;
@@ -388,6 +669,106 @@ EthChain::TryBlockRange (EthRpc& rpc, const int64_t startHeight,
   return AddMovesOneByOne (rpc, res);
 }
 
+bool
+EthChain::TryBlockRange (EthRpc& rpc, const int64_t startHeight,
+                         int64_t endHeight, std::vector<BlockData>& res) const
+{
+  CHECK (res.empty ());
+
+  /* As the first step, reduce the endHeight if it is beyond the current tip.
+     Afterwards, we expect to get blocks exactly up to endHeight.  */
+  const int64_t tipHeight = AbiDecoder::ParseInt (rpc->eth_blockNumber ());
+  if (tipHeight < endHeight)
+    endHeight = tipHeight;
+  if (endHeight < startHeight)
+    {
+      /* res is empty */
+      return true;
+    }
+
+  /* Requests one sub-batch and reports the outcome to the batch sizer.  */
+  const auto runBatch = [this, tipHeight] (EthRpc& r, const int64_t from,
+                                           const int64_t to,
+                                           std::vector<BlockData>& out)
+    {
+      const auto before = std::chrono::steady_clock::now ();
+      bool success = false;
+      try
+        {
+          success = TryBlockBatch (r, from, to, tipHeight, out);
+        }
+      catch (...)
+        {
+          batchSizer->Report (to - from + 1,
+                              std::chrono::steady_clock::now () - before,
+                              false);
+          throw;
+        }
+      batchSizer->Report (to - from + 1,
+                          std::chrono::steady_clock::now () - before, success);
+      return success;
+    };
+
+  const int64_t batchSize = batchSizer->Get ();
+  if (endHeight - startHeight + 1 <= batchSize)
+    return runBatch (rpc, startHeight, endHeight, res);
+
+  std::vector<std::pair<int64_t, int64_t>> batches;
+  for (int64_t from = startHeight; from <= endHeight; from += batchSize)
+    batches.emplace_back (from, std::min (from + batchSize - 1, endHeight));
+
+  /* Request the sub-batches concurrently, each with its own client checked
+     out from the pool.  We run them in groups of at most the configured
+     number of parallel requests.  */
+  const size_t parallel = std::max (1, FLAGS_eth_parallel_batches);
+  std::vector<std::vector<BlockData>> parts(batches.size ());
+  for (size_t i = 0; i < batches.size (); i += parallel)
+    {
+      std::vector<std::future<bool>> running;
+      for (size_t j = i; j < std::min (i + parallel, batches.size ()); ++j)
+        running.push_back (std::async (std::launch::async,
+            [this, &runBatch, &batches, &parts, j] ()
+              {
+                EthRpc r(*this);
+                return runBatch (r, batches[j].first, batches[j].second,
+                                 parts[j]);
+              }));
+
+      bool success = true;
+      for (auto& f : running)
+        if (!f.get ())
+          success = false;
+      if (!success)
+        return false;
+    }
+
+  /* Put the results back together in order.  Each part is a consistent chain
+     in itself, but we still need to verify that they link up with each
+     other, as a reorg might have happened between the requests.  */
+  res = std::move (parts.front ());
+  for (size_t i = 1; i < parts.size (); ++i)
+    {
+      auto& part = parts[i];
+      CHECK (!part.empty ());
+      CHECK_EQ (part.front ().height, res.back ().height + 1);
+      if (part.front ().parent != res.back ().hash)
+        {
+          LOG (WARNING)
+              << "Mismatch between parent hash of block "
+              << part.front ().height << " (" << part.front ().parent << ")"
+              << " and previous block hash " << res.back ().hash
+              << " across sub-batches";
+          res.clear ();
+          return false;
+        }
+      res.insert (res.end (), std::make_move_iterator (part.begin ()),
+                  std::make_move_iterator (part.end ()));
+    }
+  CHECK_EQ (res.back ().height, endHeight);
+
+  return true;
+}
+
 /**
  * Helper class for extracting move data from an eth_getLogs response
  * and adding them to a given block.  We require moves to be ordered,
@@ -429,9 +810,16 @@ public:
   {
     CHECK (log.isObject ());
 
-    const ethutils::Address logAddr(log["address"].asString ());
-    CHECK (logAddr) << "Address returned for log is invalid";
-    CHECK_EQ (logAddr.GetLowerCase (), parent.accountsContract);
+    /* Nodes return the address in lower case, so that we can usually
+       compare it directly to accountsContract.  Only if that fails do we
+       parse it fully, in case it is in some other valid form.  */
+    const std::string addrStr = log["address"].asString ();
+    if (addrStr != parent.accountsContract)
+      {
+        const ethutils::Address logAddr(addrStr);
+        CHECK (logAddr) << "Address returned for log is invalid";
+        CHECK_EQ (logAddr.GetLowerCase (), parent.accountsContract);
+      }
 
     CHECK_EQ (log["topics"][0].asString (), MOVE_EVENT);
     CHECK_EQ (ConvertUint256 (log["blockHash"].asString ()), blk.hash);
@@ -460,6 +848,15 @@ EthChain::AddMovesOneByOne (EthRpc& rpc, std::vector<BlockData>& blocks) const
   std::map<int, BlockData*> blkForId;
   for (auto& blk : blocks)
     {
+      std::vector<Json::Value> pushed;
+      if (pushedLogs != nullptr && pushedLogs->GetLogs (blk.hash, pushed))
+        {
+          BlockMoveExtractor extractor(*this, blk);
+          for (const auto& l : pushed)
+            extractor.ProcessLogEntry (l);
+          continue;
+        }
+
       auto options = GetLogsOptions ();
       options["blockHash"] = "0x" + blk.hash;
       Json::Value params(Json::arrayValue);
@@ -470,6 +867,9 @@ EthChain::AddMovesOneByOne (EthRpc& rpc, std::vector<BlockData>& blocks) const
       blkForId.emplace (id, &blk);
     }
 
+  if (ids.empty ())
+    return true;
+
   jsonrpc::BatchResponse resp = rpc->CallProcedures (req);
   for (const auto id : ids)
     {
@@ -558,13 +958,48 @@ EthChain::GetBlockRange (const uint64_t start, const uint64_t count)
     {
       std::vector<BlockData> res;
       if (TryBlockRange (rpc, start, endHeight, res))
-        return res;
+        {
+          mempool.RemoveConfirmed (res);
+          return res;
+        }
+
+      /* The failure may have been caused by stale cached headers, so make
+         sure we query everything from the node on the next try.  */
+      headerCache.Clear ();
+    }
+}
+
+bool
+EthChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  EthRpc rpc(*this);
+
+  if (!headerCache.GetByHash (hash, blk))
+    {
+      const auto data = rpc->eth_getBlockByHash ("0x" + hash, false);
+      if (data.isNull ())
+        return false;
+      blk = ExtractBaseData (data);
     }
+
+  std::vector<BlockData> blocks = {std::move (blk)};
+  if (!AddMovesOneByOne (rpc, blocks))
+    return false;
+
+  mempool.RemoveConfirmed (blocks);
+  blk = std::move (blocks.front ());
+  return true;
 }
 
 int64_t
 EthChain::GetMainchainHeight (const std::string& hash)
 {
+  /* All headers in the cache are on the main chain as of the latest
+     newHeads notification, so we can answer directly for them.  */
+  BlockData hdr;
+  if (headerCache.GetByHash (hash, hdr))
+    return hdr.height;
+
   const std::string prefixHash = "0x" + hash;
 
   EthRpc rpc(*this);
@@ -604,6 +1039,135 @@ EthChain::GetMainchainHeight (const std::string& hash)
   return AbiDecoder::ParseInt (heightHex);
 }
 
+std::vector<BlockData>
+EthChain::GetBlockHeaders (const uint64_t start, const uint64_t count)
+{
+  if (count == 0)
+    return {};
+
+  EthRpc rpc(*this);
+
+  /* This works like GetBlockRange, except that we never query for logs.
+     Since header requests are cheap, we do them sequentially in chunks
+     of the current batch size, and just retry the whole range if some
+     race condition makes them not link up.  */
+  while (true)
+    {
+      const int64_t tipHeight = AbiDecoder::ParseInt (rpc->eth_blockNumber ());
+      const int64_t endHeight
+          = std::min<int64_t> (start + count - 1, tipHeight);
+      if (endHeight < static_cast<int64_t> (start))
+        return {};
+
+      const int64_t batchSize = batchSizer->Get ();
+      std::vector<BlockData> res;
+      bool success = true;
+      for (int64_t from = start; from <= endHeight; from += batchSize)
+        {
+          const int64_t to = std::min (from + batchSize - 1, endHeight);
+          std::vector<BlockData> part;
+          if (!TryHeaderBatch (rpc, from, to, tipHeight, part)
+                || (!res.empty () && part.front ().parent != res.back ().hash))
+            {
+              success = false;
+              break;
+            }
+          for (auto& blk : part)
+            res.push_back (std::move (blk));
+        }
+
+      if (success)
+        return res;
+
+      headerCache.Clear ();
+    }
+}
+
+std::vector<int64_t>
+EthChain::GetMainchainHeights (const std::vector<std::string>& hashes)
+{
+  std::vector<int64_t> res(hashes.size (), -1);
+
+  /* Answer what we can from the header cache (like GetMainchainHeight),
+     and look up all other hashes with one batch for the blocks by hash
+     and one for the main-chain blocks at their heights.  */
+  jsonrpc::BatchCall byHash;
+  std::map<int, size_t> indexForId;
+  for (size_t i = 0; i < hashes.size (); ++i)
+    {
+      BlockData hdr;
+      if (headerCache.GetByHash (hashes[i], hdr))
+        {
+          res[i] = hdr.height;
+          continue;
+        }
+
+      Json::Value params(Json::arrayValue);
+      params.append ("0x" + hashes[i]);
+      params.append (false);
+      indexForId.emplace (byHash.addCall ("eth_getBlockByHash", params), i);
+    }
+
+  if (indexForId.empty ())
+    return res;
+
+  EthRpc rpc(*this);
+
+  jsonrpc::BatchCall byNumber;
+  std::map<int, std::pair<size_t, std::string>> heightForId;
+  jsonrpc::BatchResponse hashResp = rpc->CallProcedures (byHash);
+  for (const auto& entry : indexForId)
+    {
+      Json::Value idVal(entry.first);
+      if (hashResp.getErrorCode (idVal) != 0)
+        {
+          LOG (WARNING)
+              << "RPC error from eth_getBlockByHash: "
+              << hashResp.getErrorMessage (idVal);
+          continue;
+        }
+
+      const auto data = hashResp.getResult (entry.first);
+      if (data.isNull ())
+        continue;
+      CHECK (data.isObject ());
+      const std::string heightHex = data["number"].asString ();
+
+      Json::Value params(Json::arrayValue);
+      params.append (heightHex);
+      params.append (false);
+      heightForId.emplace (byNumber.addCall ("eth_getBlockByNumber", params),
+                           std::make_pair (entry.second, heightHex));
+    }
+
+  if (heightForId.empty ())
+    return res;
+
+  jsonrpc::BatchResponse numberResp = rpc->CallProcedures (byNumber);
+  for (const auto& entry : heightForId)
+    {
+      Json::Value idVal(entry.first);
+      const int err = numberResp.getErrorCode (idVal);
+      CHECK_EQ (err, 0)
+          << "Error " << err << " retrieving block at height "
+          << entry.second.second << ":\n"
+          << numberResp.getErrorMessage (idVal);
+
+      /* As in GetMainchainHeight, the block might have just been detached
+         or be on a branch extending beyond the current tip.  */
+      const auto mainchain = numberResp.getResult (entry.first);
+      if (mainchain.isNull ())
+        continue;
+      CHECK (mainchain.isObject ());
+
+      const size_t i = entry.second.first;
+      if (mainchain["hash"] == "0x" + hashes[i])
+        res[i] = AbiDecoder::ParseInt (entry.second.second);
+    }
+
+  return res;
+}
+
 std::vector<std::string>
 EthChain::GetMempool ()
 {
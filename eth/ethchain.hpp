@@ -5,7 +5,11 @@
 #ifndef XAYAX_ETH_ETHCHAIN_HPP
 #define XAYAX_ETH_ETHCHAIN_HPP
 
+#include "headercache.hpp"
+#include "headerstore.hpp"
 #include "pending.hpp"
+#include "pendingqueue.hpp"
+#include "pushedlogs.hpp"
 #include "websocket.hpp"
 
 #include "basechain.hpp"
@@ -33,22 +37,39 @@ class EthChain : public BaseChain, private WebSocketSubscriber::Callbacks
 
 private:
 
+  class BatchSizer;
   class BlockMoveExtractor;
   class EthRpc;
+  class RpcPool;
 
   /** EthUtils ECDSA precomputed data.  */
   const ethutils::ECDSA ecdsa;
 
-  /**
-   * RPC endpoint for Ethereum.  We store the endpoint as string and
-   * establish a new HTTP connection and RPC client for each request, so
-   * that they work in a thread-safe way without any fuss.
-   */
+  /** RPC endpoint for Ethereum.  */
   const std::string endpoint;
 
   /** Pre-parsed headers for RPC requests.  */
   const RpcHeaders headers;
 
+  /**
+   * Pool of RPC clients for the endpoint.  Each request checks out a client
+   * (so that it works in a thread-safe way without any fuss), but the
+   * underlying keep-alive connections are reused.
+   */
+  std::unique_ptr<RpcPool> rpcPool;
+
+  /**
+   * Tracker for the size of sub-batches in which we request block ranges,
+   * adapted based on observed latency and errors.
+   */
+  std::unique_ptr<BatchSizer> batchSizer;
+
+  /**
+   * If enabled, the store used to persist headers of finalised blocks,
+   * so that they need not be queried again from the node.
+   */
+  std::unique_ptr<HeaderStore> headerStore;
+
   /** Contract address of the Xaya account registry.  */
   std::string accountsContract;
 
@@ -64,9 +85,33 @@ private:
   /** Local cache of the mempool of tracked transactions.  */
   PendingMempool mempool;
 
+  /**
+   * Queue and worker pool processing notified pending transactions.
+   * This is set up by EnablePending.
+   */
+  std::unique_ptr<PendingQueue> pendingQueue;
+
+  /**
+   * Cache of the most recent headers we have been notified about through
+   * the websocket.  This allows requests for blocks near the tip to only
+   * query for the moves.
+   */
+  HeaderCache headerCache;
+
+  /**
+   * If enabled, the buffer of move logs pushed to us through a websocket
+   * subscription, from which we can tell that recent blocks have no moves
+   * without eth_getLogs requests.
+   */
+  std::unique_ptr<PushedLogs> pushedLogs;
+
   /**
    * The websocket subscriber we use to get notified about new tips.  It is
    * created if we actually have a ws endpoing.
+   *
+   * Its worker thread invokes our callbacks until it is destructed, so it
+   * must be declared after all members those use (and is thus destructed
+   * before them).
    */
   std::unique_ptr<WebSocketSubscriber> sub;
 
@@ -80,6 +125,8 @@ private:
   /**
    * Requests move logs for a given list of blocks one-by-one (based on the
    * hashes of the blocks in question) and adds them into the block data.
+   * Blocks known from the logs subscription to have no moves
+   * are filled in without a request.
    * Returns false if something failed, like a block was reorged and the logs
    * are not available anymore.
    */
@@ -95,15 +142,46 @@ private:
                                 std::vector<BlockData>& blocks) const;
 
   /**
-   * Queries for a range of blocks in a given range of heights.  This method
-   * may return false if some error happened, for instance a race condition
-   * while doing RPC requests made something inconsistent.
+   * Queries for the headers (without moves) of blocks in a given range of
+   * heights with a single batch request, using locally known headers where
+   * possible.  The range must not extend beyond the given tip height.
+   * Returns false if some error happened, e.g. a race condition with
+   * a reorg made the headers not link up.
+   */
+  bool TryHeaderBatch (EthRpc& rpc, int64_t startHeight, int64_t endHeight,
+                       int64_t tipHeight, std::vector<BlockData>& res) const;
+
+  /**
+   * Queries for the blocks in a given range of heights with a single batch
+   * request (plus the log requests for moves).  The range must not extend
+   * beyond the given tip height.  Returns false if some error happened,
+   * for instance a race condition while doing RPC requests made something
+   * inconsistent.
+   */
+  bool TryBlockBatch (EthRpc& rpc, int64_t startHeight, int64_t endHeight,
+                      int64_t tipHeight, std::vector<BlockData>& res) const;
+
+  /**
+   * Queries for a range of blocks in a given range of heights.  Large ranges
+   * are split into sub-batches (sized adaptively by batchSizer), which are
+   * requested concurrently over separate connections and then put back
+   * together.  This method may return false if some error happened,
+   * for instance a race condition while doing RPC requests made something
+   * inconsistent.
    */
   bool TryBlockRange (EthRpc& rpc, const int64_t startHeight, int64_t endHeight,
                       std::vector<BlockData>& res) const;
 
-  void NewTip (const std::string& tip) override;
+  /**
+   * Simulates a batch of pending transactions and notifies about the moves
+   * they contain.  This is run on the pending queue's workers.
+   */
+  void ProcessPending (const std::vector<std::string>& txids);
+
+  void NewTip (const Json::Value& head) override;
   void NewPendingTx (const std::string& txid) override;
+  void LogsSubscribed () override;
+  void NewLog (const Json::Value& log) override;
 
 public:
 
@@ -116,6 +194,14 @@ public:
                      const std::string& wsEndpoint,
                      const std::string& acc);
 
+  ~EthChain ();
+
+  /**
+   * Turns on a persisted header store for finalised blocks, using the
+   * given SQLite file.  This must be called before the instance is in use.
+   */
+  void EnableHeaderStore (const std::string& file);
+
   /**
    * Adds the given address as a transaction target contract that can
    * potentially trigger moves (so that we watch it in pending
@@ -129,7 +215,12 @@ public:
   uint64_t GetTipHeight () override;
   std::vector<BlockData> GetBlockRange (uint64_t start,
                                         uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
   int64_t GetMainchainHeight (const std::string& hash) override;
+  std::vector<BlockData> GetBlockHeaders (uint64_t start,
+                                          uint64_t count) override;
+  std::vector<int64_t> GetMainchainHeights (
+      const std::vector<std::string>& hashes) override;
   std::vector<std::string> GetMempool () override;
   bool VerifyMessage (const std::string& msg, const std::string& signature,
                       std::string& addr) override;
@@ -0,0 +1,141 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "ethchain.hpp"
+#include "hexutils.hpp"
+
+#include <eth-utils/hexutils.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * Returns a hex-encoded 32-byte ABI word holding the given number.
+ */
+std::string
+AbiWord (const uint64_t val)
+{
+  std::string bin(32, '\0');
+  for (unsigned i = 0; i < 8; ++i)
+    bin[31 - i] = static_cast<char> ((val >> (8 * i)) & 0xFF);
+  return EncodeHex (bin);
+}
+
+/**
+ * Returns the hex-encoded ABI tail for a string value.
+ */
+std::string
+AbiString (const std::string& str)
+{
+  std::string padded = str;
+  padded.resize ((str.size () + 31) / 32 * 32, '\0');
+  return AbiWord (str.size ()) + EncodeHex (padded);
+}
+
+/**
+ * Constructs the data of a move log as returned by eth_getLogs,
+ * with a move of the given size (in bytes) and a CHI payment
+ * to one of a few receivers.
+ */
+std::string
+MoveLogData (const unsigned index, const size_t moveSize)
+{
+  const std::string ns = "p";
+  const std::string name = "player" + std::to_string (index);
+  std::string mv = R"({"g":{"game":")";
+  mv.append (moveSize, 'x');
+  mv += R"("}})";
+
+  const std::string nsTail = AbiString (ns);
+  const std::string nameTail = AbiString (name);
+  const std::string mvTail = AbiString (mv);
+
+  /* The head consists of seven words (three string offsets, nonce,
+     mover, amount and receiver).  */
+  const size_t headSize = 7 * 32;
+  std::string res = "0x";
+  res += AbiWord (headSize);
+  res += AbiWord (headSize + nsTail.size () / 2);
+  res += AbiWord (headSize + (nsTail.size () + nameTail.size ()) / 2);
+  res += AbiWord (index);
+  res += AbiWord (0x1234);
+  res += AbiWord (1'000'000);
+  res += AbiWord (0xabcdef00 + index % 4);
+  res += nsTail + nameTail + mvTail;
+
+  return res;
+}
+
+/**
+ * Extracts the move data from a batch of move logs (with the move size
+ * as argument), as is done for every move retrieved with eth_getLogs.
+ */
+void
+BM_GetMoveDataFromLogs (benchmark::State& state)
+{
+  std::vector<std::string> logs;
+  for (unsigned i = 0; i < 100; ++i)
+    logs.push_back (MoveLogData (i, state.range (0)));
+
+  for (auto _ : state)
+    for (const auto& data : logs)
+      {
+        ethutils::AbiDecoder dec(data);
+        MoveData mv = GetMoveDataFromLogs (dec);
+        benchmark::DoNotOptimize (mv);
+      }
+
+  state.SetItemsProcessed (state.iterations () * logs.size ());
+}
+BENCHMARK (BM_GetMoveDataFromLogs)->Arg (10)->Arg (1'000)->Arg (100'000);
+
+/**
+ * Decodes hex data of the given size (in bytes) with our DecodeHex.
+ */
+void
+BM_DecodeHex (benchmark::State& state)
+{
+  const std::string hex(2 * state.range (0), 'a');
+
+  for (auto _ : state)
+    {
+      std::string bin;
+      CHECK (DecodeHex (hex, bin));
+      benchmark::DoNotOptimize (bin);
+    }
+
+  state.SetBytesProcessed (state.iterations () * hex.size ());
+}
+BENCHMARK (BM_DecodeHex)->Arg (32)->Arg (1'000)->Arg (100'000);
+
+/**
+ * Decodes hex data with ethutils::Unhexlify for comparison.
+ */
+void
+BM_DecodeHexEthUtils (benchmark::State& state)
+{
+  const std::string hex(2 * state.range (0), 'a');
+
+  for (auto _ : state)
+    {
+      std::string bin;
+      CHECK (ethutils::Unhexlify (hex, bin));
+      benchmark::DoNotOptimize (bin);
+    }
+
+  state.SetBytesProcessed (state.iterations () * hex.size ());
+}
+BENCHMARK (BM_DecodeHexEthUtils)->Arg (32)->Arg (1'000)->Arg (100'000);
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,109 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headercache.hpp"
+
+#include <glog/logging.h>
+
+namespace xayax
+{
+
+HeaderCache::HeaderCache (const size_t c)
+  : capacity(c)
+{}
+
+void
+HeaderCache::EraseFrom (std::map<uint64_t, BlockData>::iterator it)
+{
+  while (it != byHeight.end ())
+    {
+      byHash.erase (it->second.hash);
+      it = byHeight.erase (it);
+    }
+}
+
+void
+HeaderCache::Add (const BlockData& hdr)
+{
+  if (capacity == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  /* The new header is the tip, so everything at its height or above
+     is not part of the main chain anymore.  */
+  EraseFrom (byHeight.lower_bound (hdr.height));
+
+  /* If the header does not link up with the previous one we have, then
+     we do not know how the remaining entries relate to the new chain.  */
+  if (!byHeight.empty ())
+    {
+      const auto& last = byHeight.rbegin ()->second;
+      if (last.height + 1 != hdr.height || last.hash != hdr.parent)
+        {
+          VLOG (1)
+              << "Header " << hdr.hash << " at height " << hdr.height
+              << " does not link up with cached headers, clearing cache";
+          byHeight.clear ();
+          byHash.clear ();
+        }
+    }
+
+  BlockData& entry = byHeight[hdr.height];
+  entry.hash = hdr.hash;
+  entry.parent = hdr.parent;
+  entry.height = hdr.height;
+  entry.rngseed = hdr.rngseed;
+  entry.metadata = hdr.metadata;
+  byHash[hdr.hash] = hdr.height;
+
+  while (byHeight.size () > capacity)
+    {
+      byHash.erase (byHeight.begin ()->second.hash);
+      byHeight.erase (byHeight.begin ());
+    }
+}
+
+bool
+HeaderCache::GetByHash (const std::string& hash, BlockData& hdr) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = byHash.find (hash);
+  if (mit == byHash.end ())
+    return false;
+
+  hdr = byHeight.at (mit->second);
+  return true;
+}
+
+bool
+HeaderCache::GetByHeight (const uint64_t height, BlockData& hdr) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = byHeight.find (height);
+  if (mit == byHeight.end ())
+    return false;
+
+  hdr = mit->second;
+  return true;
+}
+
+void
+HeaderCache::Clear ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  byHeight.clear ();
+  byHash.clear ();
+}
+
+size_t
+HeaderCache::Size () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return byHeight.size ();
+}
+
+} // namespace xayax
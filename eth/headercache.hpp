@@ -0,0 +1,100 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_ETH_HEADERCACHE_HPP
+#define XAYAX_ETH_HEADERCACHE_HPP
+
+#include "blockdata.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace xayax
+{
+
+/**
+ * In-memory cache of the most recent block headers (base data without moves)
+ * on the EVM chain, filled from the newHeads websocket notifications.  With
+ * it, requests for blocks near the tip need not query the headers again
+ * from the node.
+ *
+ * The cache always holds a single chain of headers linked by their parent
+ * hashes and ending in the most recently notified tip.  When a new header
+ * does not fit onto that chain (e.g. in a reorg), the previous entries that
+ * are no longer known to link up with it are dropped.  Thus all cached
+ * headers are on the node's main chain as of the last notification.
+ *
+ * This class is thread-safe.
+ */
+class HeaderCache
+{
+
+private:
+
+  /** Maximum number of headers kept.  */
+  const size_t capacity;
+
+  /** Lock for the cached data.  */
+  mutable std::mutex mut;
+
+  /** The cached headers by height.  */
+  std::map<uint64_t, BlockData> byHeight;
+
+  /** Heights of the cached headers by their hash.  */
+  std::map<std::string, uint64_t> byHash;
+
+  /**
+   * Removes all entries from the given iterator onwards.  The caller must
+   * hold the lock.
+   */
+  void EraseFrom (std::map<uint64_t, BlockData>::iterator it);
+
+public:
+
+  /**
+   * Constructs an empty cache holding up to the given number of headers.
+   * If the capacity is zero, nothing is ever cached.
+   */
+  explicit HeaderCache (size_t c);
+
+  HeaderCache () = delete;
+  HeaderCache (const HeaderCache&) = delete;
+  void operator= (const HeaderCache&) = delete;
+
+  /**
+   * Adds the header of a new tip.  Moves (if any) are ignored.
+   */
+  void Add (const BlockData& hdr);
+
+  /**
+   * Looks up a header by hash.  Returns false if it is not cached.
+   */
+  bool GetByHash (const std::string& hash, BlockData& hdr) const;
+
+  /**
+   * Looks up the header at the given height.  Returns false if it is
+   * not cached.
+   */
+  bool GetByHeight (uint64_t height, BlockData& hdr) const;
+
+  /**
+   * Removes all entries.  This is used when the cache turned out to be
+   * inconsistent with the node, e.g. because of a reorg we have not
+   * been notified about.
+   */
+  void Clear ();
+
+  /**
+   * Returns the number of cached headers.
+   */
+  size_t Size () const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_ETH_HEADERCACHE_HPP
@@ -0,0 +1,157 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headercache.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xayax
+{
+namespace
+{
+
+/* ************************************************************************** */
+
+class HeaderCacheTests : public testing::Test
+{
+
+protected:
+
+  /**
+   * Constructs a block with the given height and hashes.
+   */
+  static BlockData
+  Header (const uint64_t height, const std::string& hash,
+          const std::string& parent)
+  {
+    BlockData res;
+    res.height = height;
+    res.hash = hash;
+    res.parent = parent;
+    res.rngseed = hash;
+    res.metadata = Json::Value (Json::objectValue);
+    res.metadata["timestamp"] = static_cast<Json::Int64> (1'000 + height);
+    return res;
+  }
+
+  /**
+   * Expects that the cache has the given hash at the given height,
+   * both when looked up by height and by hash.
+   */
+  static void
+  ExpectCached (const HeaderCache& cache, const uint64_t height,
+                const std::string& hash)
+  {
+    BlockData hdr;
+    ASSERT_TRUE (cache.GetByHeight (height, hdr));
+    EXPECT_EQ (hdr.hash, hash);
+
+    ASSERT_TRUE (cache.GetByHash (hash, hdr));
+    EXPECT_EQ (hdr.height, height);
+  }
+
+};
+
+TEST_F (HeaderCacheTests, Basic)
+{
+  HeaderCache cache(10);
+  cache.Add (Header (10, "a", "x"));
+
+  auto b = Header (11, "b", "a");
+  b.moves.emplace_back ();
+  cache.Add (b);
+
+  EXPECT_EQ (cache.Size (), 2);
+  ExpectCached (cache, 10, "a");
+  ExpectCached (cache, 11, "b");
+
+  BlockData hdr;
+  ASSERT_TRUE (cache.GetByHash ("b", hdr));
+  EXPECT_EQ (hdr.parent, "a");
+  EXPECT_EQ (hdr.rngseed, "b");
+  EXPECT_EQ (hdr.metadata["timestamp"].asInt64 (), 1'011);
+  EXPECT_TRUE (hdr.moves.empty ());
+
+  EXPECT_FALSE (cache.GetByHeight (12, hdr));
+  EXPECT_FALSE (cache.GetByHash ("x", hdr));
+}
+
+TEST_F (HeaderCacheTests, Capacity)
+{
+  HeaderCache cache(2);
+  cache.Add (Header (10, "a", "x"));
+  cache.Add (Header (11, "b", "a"));
+  cache.Add (Header (12, "c", "b"));
+
+  BlockData hdr;
+  EXPECT_EQ (cache.Size (), 2);
+  EXPECT_FALSE (cache.GetByHash ("a", hdr));
+  EXPECT_FALSE (cache.GetByHeight (10, hdr));
+  ExpectCached (cache, 11, "b");
+  ExpectCached (cache, 12, "c");
+}
+
+TEST_F (HeaderCacheTests, Disabled)
+{
+  HeaderCache cache(0);
+  cache.Add (Header (10, "a", "x"));
+
+  BlockData hdr;
+  EXPECT_EQ (cache.Size (), 0);
+  EXPECT_FALSE (cache.GetByHash ("a", hdr));
+}
+
+TEST_F (HeaderCacheTests, ReorgLinkingUp)
+{
+  HeaderCache cache(10);
+  cache.Add (Header (10, "a", "x"));
+  cache.Add (Header (11, "b", "a"));
+  cache.Add (Header (12, "c", "b"));
+  cache.Add (Header (11, "b2", "a"));
+
+  BlockData hdr;
+  EXPECT_EQ (cache.Size (), 2);
+  ExpectCached (cache, 10, "a");
+  ExpectCached (cache, 11, "b2");
+  EXPECT_FALSE (cache.GetByHash ("b", hdr));
+  EXPECT_FALSE (cache.GetByHash ("c", hdr));
+  EXPECT_FALSE (cache.GetByHeight (12, hdr));
+}
+
+TEST_F (HeaderCacheTests, NotLinkingUp)
+{
+  HeaderCache cache(10);
+  cache.Add (Header (10, "a", "x"));
+  cache.Add (Header (11, "b", "a"));
+
+  /* A header on a different branch.  */
+  cache.Add (Header (12, "c", "other"));
+  EXPECT_EQ (cache.Size (), 1);
+  ExpectCached (cache, 12, "c");
+
+  /* A gap in the notifications.  */
+  cache.Add (Header (14, "e", "d"));
+  EXPECT_EQ (cache.Size (), 1);
+  ExpectCached (cache, 14, "e");
+}
+
+TEST_F (HeaderCacheTests, Clear)
+{
+  HeaderCache cache(10);
+  cache.Add (Header (10, "a", "x"));
+  cache.Clear ();
+
+  BlockData hdr;
+  EXPECT_EQ (cache.Size (), 0);
+  EXPECT_FALSE (cache.GetByHash ("a", hdr));
+  EXPECT_FALSE (cache.GetByHeight (10, hdr));
+
+  cache.Add (Header (11, "b", "a"));
+  ExpectCached (cache, 11, "b");
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
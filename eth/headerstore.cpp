@@ -0,0 +1,90 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headerstore.hpp"
+
+#include <glog/logging.h>
+
+namespace xayax
+{
+
+HeaderStore::HeaderStore (const std::string& file)
+  : db(file)
+{
+  db.Execute (R"(
+
+    CREATE TABLE IF NOT EXISTS `headers` (
+      `height` INTEGER NOT NULL PRIMARY KEY,
+      `hash` TEXT NOT NULL,
+      `parent` TEXT NOT NULL,
+      `timestamp` INTEGER NOT NULL
+    );
+
+  )");
+}
+
+void
+HeaderStore::Store (const std::vector<BlockData>& blocks)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  db.Execute ("BEGIN");
+  for (const auto& blk : blocks)
+    {
+      CHECK (blk.metadata.isObject ());
+      const auto& timestamp = blk.metadata["timestamp"];
+      CHECK (timestamp.isInt64 ())
+          << "Invalid timestamp for block " << blk.hash << ": " << timestamp;
+
+      auto stmt = db.Prepare (R"(
+        INSERT OR REPLACE INTO `headers`
+          (`height`, `hash`, `parent`, `timestamp`)
+          VALUES (?1, ?2, ?3, ?4)
+      )");
+      stmt.Bind (1, blk.height);
+      stmt.Bind (2, blk.hash);
+      stmt.Bind (3, blk.parent);
+      stmt.Bind<int64_t> (4, timestamp.asInt64 ());
+      stmt.Execute ();
+    }
+  db.Execute ("COMMIT");
+
+  VLOG (1) << "Stored " << blocks.size () << " block headers";
+}
+
+std::map<uint64_t, BlockData>
+HeaderStore::GetRange (const uint64_t startHeight,
+                       const uint64_t endHeight) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  auto stmt = db.PrepareRo (R"(
+    SELECT `height`, `hash`, `parent`, `timestamp`
+      FROM `headers`
+      WHERE `height` >= ?1 AND `height` <= ?2
+  )");
+  stmt.Bind (1, startHeight);
+  stmt.Bind (2, endHeight);
+
+  std::map<uint64_t, BlockData> res;
+  while (stmt.Step ())
+    {
+      BlockData blk;
+      blk.height = stmt.Get<uint64_t> (0);
+      blk.hash = stmt.Get<std::string> (1);
+      blk.parent = stmt.Get<std::string> (2);
+      /* This matches what EthChain does for blocks it retrieves.  */
+      blk.rngseed = blk.hash;
+      blk.metadata = Json::Value (Json::objectValue);
+      blk.metadata["timestamp"]
+          = static_cast<Json::Int64> (stmt.Get<int64_t> (3));
+
+      const auto h = blk.height;
+      CHECK (res.emplace (h, std::move (blk)).second);
+    }
+
+  return res;
+}
+
+} // namespace xayax
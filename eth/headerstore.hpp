@@ -0,0 +1,73 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_ETH_HEADERSTORE_HPP
+#define XAYAX_ETH_HEADERSTORE_HPP
+
+#include "blockdata.hpp"
+#include "database.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Local, persisted store of block headers (hash, parent and timestamp)
+ * for finalised blocks on the EVM chain, keyed by height.  During a historic
+ * sync, the moves for deep blocks can be retrieved with a single eth_getLogs
+ * request over the full range, but the headers would still need to be
+ * queried one-by-one.  With this store, that only has to be done once, and
+ * later resyncs (or restarts) get the headers from disk instead.
+ *
+ * Since the headers stored here are never reorged, this must only be
+ * used for blocks that are buried deeply enough in the chain.
+ *
+ * This class is thread-safe.
+ */
+class HeaderStore
+{
+
+private:
+
+  /** The underlying database.  */
+  Database db;
+
+  /** Lock for the database.  */
+  mutable std::mutex mut;
+
+public:
+
+  /**
+   * Opens the store at the given file, creating it if it does not yet exist.
+   */
+  explicit HeaderStore (const std::string& file);
+
+  HeaderStore () = delete;
+  HeaderStore (const HeaderStore&) = delete;
+  void operator= (const HeaderStore&) = delete;
+
+  /**
+   * Stores the headers of the given blocks.  Moves (if any) are ignored,
+   * and existing entries for the same heights are replaced.
+   */
+  void Store (const std::vector<BlockData>& blocks);
+
+  /**
+   * Retrieves all stored headers for heights in the given range (inclusive).
+   * The returned BlockData objects have no moves.  Heights that are not
+   * stored are simply missing from the result.
+   */
+  std::map<uint64_t, BlockData> GetRange (uint64_t startHeight,
+                                          uint64_t endHeight) const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_ETH_HEADERSTORE_HPP
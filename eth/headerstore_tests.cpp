@@ -0,0 +1,90 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headerstore.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+namespace xayax
+{
+namespace
+{
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+using testing::Key;
+
+/* ************************************************************************** */
+
+class HeaderStoreTests : public testing::Test
+{
+
+protected:
+
+  HeaderStore store;
+
+  HeaderStoreTests ()
+    : store(":memory:")
+  {}
+
+  /**
+   * Constructs a block with the given height and hashes.
+   */
+  static BlockData
+  Header (const uint64_t height, const std::string& hash,
+          const std::string& parent)
+  {
+    BlockData res;
+    res.height = height;
+    res.hash = hash;
+    res.parent = parent;
+    res.rngseed = hash;
+    res.metadata = Json::Value (Json::objectValue);
+    res.metadata["timestamp"] = static_cast<Json::Int64> (1'000 + height);
+    return res;
+  }
+
+};
+
+TEST_F (HeaderStoreTests, Empty)
+{
+  EXPECT_THAT (store.GetRange (0, 100), IsEmpty ());
+}
+
+TEST_F (HeaderStoreTests, RoundTrip)
+{
+  const auto a = Header (10, "a", "x");
+  const auto b = Header (11, "b", "a");
+  auto withMove = Header (12, "c", "b");
+  withMove.moves.emplace_back ();
+  store.Store ({a, b, withMove});
+
+  const auto res = store.GetRange (11, 12);
+  ASSERT_THAT (res, ElementsAre (Key (11), Key (12)));
+  EXPECT_EQ (res.at (11), b);
+  EXPECT_EQ (res.at (12), Header (12, "c", "b"));
+}
+
+TEST_F (HeaderStoreTests, Gaps)
+{
+  store.Store ({Header (10, "a", "x"), Header (12, "c", "b")});
+  EXPECT_THAT (store.GetRange (9, 13), ElementsAre (Key (10), Key (12)));
+  EXPECT_THAT (store.GetRange (11, 11), IsEmpty ());
+}
+
+TEST_F (HeaderStoreTests, Replace)
+{
+  store.Store ({Header (10, "a", "x")});
+  store.Store ({Header (10, "b", "y")});
+
+  const auto res = store.GetRange (10, 10);
+  ASSERT_THAT (res, ElementsAre (Key (10)));
+  EXPECT_EQ (res.at (10), Header (10, "b", "y"));
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
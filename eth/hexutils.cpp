@@ -1,11 +1,17 @@
-// Copyright (C) 2021 The Xaya developers
+// Copyright (C) 2021-2024 The Xaya developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hexutils.hpp"
 
+#include <eth-utils/address.hpp>
+
 #include <glog/logging.h>
 
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
 namespace xayax
 {
 
@@ -16,4 +22,169 @@ ConvertUint256 (const std::string& withPrefix)
   return withPrefix.substr (2);
 }
 
+namespace
+{
+
+/**
+ * Decodes a single hex character to its value.  Returns -1 if the
+ * character is not a valid hex digit.
+ */
+int
+DecodeNibble (const char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+constexpr const char* HEX_CHARS = "0123456789abcdef";
+
+#ifdef __SSE2__
+
+/**
+ * Decodes 16 hex characters from in to 8 bytes at out.  Returns false
+ * if any of them is not a valid hex digit.
+ */
+bool
+DecodeBlock16 (const char* in, char* out)
+{
+  const __m128i v = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (in));
+
+  /* Setting the 0x20 bit maps upper-case to lower-case letters, and leaves
+     digits unchanged.  Digits are checked on the original input, so that
+     other characters do not get mapped into the valid range.  Bytes with
+     the high bit set are negative and thus fail the signed comparisons.  */
+  const __m128i lower = _mm_or_si128 (v, _mm_set1_epi8 (0x20));
+  const __m128i isDigit
+      = _mm_and_si128 (_mm_cmpgt_epi8 (v, _mm_set1_epi8 ('0' - 1)),
+                       _mm_cmpgt_epi8 (_mm_set1_epi8 ('9' + 1), v));
+  const __m128i isAlpha
+      = _mm_and_si128 (_mm_cmpgt_epi8 (lower, _mm_set1_epi8 ('a' - 1)),
+                       _mm_cmpgt_epi8 (_mm_set1_epi8 ('f' + 1), lower));
+  if (_mm_movemask_epi8 (_mm_or_si128 (isDigit, isAlpha)) != 0xFFFF)
+    return false;
+
+  /* For valid input, lower is equal to v for digits.  */
+  __m128i nibbles = _mm_sub_epi8 (lower, _mm_set1_epi8 ('0'));
+  nibbles = _mm_sub_epi8 (nibbles,
+                          _mm_and_si128 (isAlpha,
+                                         _mm_set1_epi8 ('a' - '0' - 10)));
+
+  /* Each 16-bit lane holds the high nibble in its low byte and the low
+     nibble in its high byte.  Combine them and pack to bytes.  */
+  const __m128i hi = _mm_and_si128 (nibbles, _mm_set1_epi16 (0x00FF));
+  const __m128i lo = _mm_srli_epi16 (nibbles, 8);
+  const __m128i bytes = _mm_or_si128 (_mm_slli_epi16 (hi, 4), lo);
+  _mm_storel_epi64 (reinterpret_cast<__m128i*> (out),
+                    _mm_packus_epi16 (bytes, _mm_setzero_si128 ()));
+
+  return true;
+}
+
+/**
+ * Encodes 16 bytes from in as 32 hex characters at out.
+ */
+void
+EncodeBlock16 (const char* in, char* out)
+{
+  const __m128i v = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (in));
+  const __m128i mask = _mm_set1_epi8 (0x0F);
+
+  const __m128i hi = _mm_and_si128 (_mm_srli_epi16 (v, 4), mask);
+  const __m128i lo = _mm_and_si128 (v, mask);
+
+  const auto toChars = [] (const __m128i n)
+    {
+      const __m128i letter = _mm_cmpgt_epi8 (n, _mm_set1_epi8 (9));
+      return _mm_add_epi8 (_mm_add_epi8 (n, _mm_set1_epi8 ('0')),
+                           _mm_and_si128 (letter,
+                                          _mm_set1_epi8 ('a' - '0' - 10)));
+    };
+
+  _mm_storeu_si128 (reinterpret_cast<__m128i*> (out),
+                    toChars (_mm_unpacklo_epi8 (hi, lo)));
+  _mm_storeu_si128 (reinterpret_cast<__m128i*> (out + 16),
+                    toChars (_mm_unpackhi_epi8 (hi, lo)));
+}
+
+#endif // __SSE2__
+
+} // anonymous namespace
+
+bool
+DecodeHex (const std::string_view hex, std::string& out)
+{
+  if (hex.size () % 2 != 0)
+    return false;
+
+  out.resize (hex.size () / 2);
+  const char* in = hex.data ();
+  char* res = out.data ();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 16 <= hex.size (); i += 16)
+    if (!DecodeBlock16 (in + i, res + i / 2))
+      return false;
+#endif // __SSE2__
+
+  for (; i < hex.size (); i += 2)
+    {
+      const int hi = DecodeNibble (in[i]);
+      const int lo = DecodeNibble (in[i + 1]);
+      if (hi < 0 || lo < 0)
+        return false;
+      res[i / 2] = static_cast<char> ((hi << 4) | lo);
+    }
+
+  return true;
+}
+
+std::string
+EncodeHex (const std::string_view data)
+{
+  std::string res(2 * data.size (), '\0');
+  const char* in = data.data ();
+  char* out = res.data ();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 16 <= data.size (); i += 16)
+    EncodeBlock16 (in + i, out + 2 * i);
+#endif // __SSE2__
+
+  for (; i < data.size (); ++i)
+    {
+      const auto byte = static_cast<unsigned char> (in[i]);
+      out[2 * i] = HEX_CHARS[byte >> 4];
+      out[2 * i + 1] = HEX_CHARS[byte & 0x0F];
+    }
+
+  return res;
+}
+
+std::string
+ChecksumCache::GetChecksummed (const std::string& addr)
+{
+  std::string res;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    if (cache.Get (addr, res))
+      return res;
+  }
+
+  const ethutils::Address parsed(addr);
+  CHECK (parsed) << "Invalid address: " << addr;
+  res = parsed.GetChecksummed ();
+
+  std::lock_guard<std::mutex> lock(mut);
+  cache.Put (addr, res);
+
+  return res;
+}
+
 } // namespace xayax
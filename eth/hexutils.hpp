@@ -1,11 +1,16 @@
-// Copyright (C) 2021 The Xaya developers
+// Copyright (C) 2021-2024 The Xaya developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #ifndef XAYAX_ETH_HEXUTILS_HPP
 #define XAYAX_ETH_HEXUTILS_HPP
 
+#include "lrucache.hpp"
+
+#include <cstddef>
+#include <mutex>
 #include <string>
+#include <string_view>
 
 namespace xayax
 {
@@ -16,6 +21,57 @@ namespace xayax
  */
 std::string ConvertUint256 (const std::string& withPrefix);
 
+/**
+ * Decodes a hex string (without 0x prefix, upper or lower case) into binary
+ * data.  Returns false if the string is not valid hex.  This is equivalent
+ * to ethutils::Unhexlify, but uses SIMD instructions where available, which
+ * matters for the (potentially large) ABI data of every move log.
+ */
+bool DecodeHex (std::string_view hex, std::string& out);
+
+/**
+ * Encodes binary data as lower-case hex string (without prefix).  This is
+ * the counterpart to DecodeHex and equivalent to ethutils::Hexlify.
+ */
+std::string EncodeHex (std::string_view data);
+
+/**
+ * Memoised conversion of addresses (as hex strings in any form accepted
+ * by ethutils::Address) to their EIP-55 checksummed form.  Computing the
+ * checksum requires a Keccak hash, and the same few addresses (e.g. the
+ * receivers of payments for a game) typically show up in many moves.
+ *
+ * This class is thread-safe.
+ */
+class ChecksumCache
+{
+
+private:
+
+  /** The cached checksummed addresses by their input string.  */
+  LruCache<std::string, std::string> cache;
+
+  /** Lock for the cache.  */
+  std::mutex mut;
+
+public:
+
+  explicit ChecksumCache (const size_t size)
+    : cache(size)
+  {}
+
+  ChecksumCache () = delete;
+  ChecksumCache (const ChecksumCache&) = delete;
+  void operator= (const ChecksumCache&) = delete;
+
+  /**
+   * Returns the checksummed form of the given address.  CHECK fails
+   * if the address is invalid.
+   */
+  std::string GetChecksummed (const std::string& addr);
+
+};
+
 } // namespace xayax
 
 #endif // XAYAX_ETH_HEXUTILS_HPP
@@ -0,0 +1,137 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hexutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace xayax
+{
+namespace
+{
+
+/* ************************************************************************** */
+
+/**
+ * Returns a binary string of the given length with all byte values
+ * showing up in it.
+ */
+std::string
+TestBytes (const size_t len)
+{
+  std::string res;
+  for (size_t i = 0; i < len; ++i)
+    res.push_back (static_cast<char> ((i * 37 + 11) % 256));
+  return res;
+}
+
+/**
+ * Encodes the given data byte by byte as reference.
+ */
+std::string
+ReferenceHex (const std::string& data)
+{
+  static const char* chars = "0123456789abcdef";
+  std::string res;
+  for (const char c : data)
+    {
+      const auto byte = static_cast<unsigned char> (c);
+      res.push_back (chars[byte >> 4]);
+      res.push_back (chars[byte & 0x0F]);
+    }
+  return res;
+}
+
+TEST (HexCodecTests, Basic)
+{
+  EXPECT_EQ (EncodeHex (""), "");
+  EXPECT_EQ (EncodeHex (std::string ("\x00\x01\xab\xff", 4)), "0001abff");
+
+  std::string out;
+  ASSERT_TRUE (DecodeHex ("", out));
+  EXPECT_EQ (out, "");
+  ASSERT_TRUE (DecodeHex ("0001abff", out));
+  EXPECT_EQ (out, std::string ("\x00\x01\xab\xff", 4));
+}
+
+TEST (HexCodecTests, RoundTrip)
+{
+  /* Test various lengths around the SIMD block sizes.  */
+  for (size_t len = 0; len < 100; ++len)
+    {
+      const std::string data = TestBytes (len);
+      const std::string hex = EncodeHex (data);
+      EXPECT_EQ (hex, ReferenceHex (data));
+
+      std::string decoded;
+      ASSERT_TRUE (DecodeHex (hex, decoded)) << hex;
+      EXPECT_EQ (decoded, data);
+    }
+}
+
+TEST (HexCodecTests, UpperCase)
+{
+  std::string out;
+  ASSERT_TRUE (DecodeHex ("ABCDEFabcdef0123456789AbCdEf", out));
+  EXPECT_EQ (EncodeHex (out), "abcdefabcdef0123456789abcdef");
+}
+
+TEST (HexCodecTests, Invalid)
+{
+  std::string out;
+  EXPECT_FALSE (DecodeHex ("abc", out));
+  EXPECT_FALSE (DecodeHex ("0x00", out));
+
+  /* Place invalid characters (including ones that map to valid
+     characters when changing case or ignoring the high bit) at every
+     position of a string long enough for SIMD and the tail.  */
+  const std::string valid(40, 'a');
+  for (const char c : {'g', 'G', 'x', ' ', '/', ':', '@', '`', '\x10',
+                       static_cast<char> (0xC1), '\x00'})
+    for (size_t i = 0; i < valid.size (); ++i)
+      {
+        std::string hex = valid;
+        hex[i] = c;
+        EXPECT_FALSE (DecodeHex (hex, out))
+            << "Accepted " << static_cast<int> (c) << " at " << i;
+      }
+}
+
+/* ************************************************************************** */
+
+TEST (ChecksumCacheTests, Checksummed)
+{
+  ChecksumCache cache(10);
+
+  const std::string expected = "0x5aAeb6053F3E94C9b9A09f33669435E7Ef1BeAed";
+  EXPECT_EQ (cache.GetChecksummed ("0x5aaeb6053f3e94c9b9a09f33669435e7ef1beaed"),
+             expected);
+  EXPECT_EQ (cache.GetChecksummed ("0x5aaeb6053f3e94c9b9a09f33669435e7ef1beaed"),
+             expected);
+  EXPECT_EQ (cache.GetChecksummed (expected), expected);
+}
+
+TEST (ChecksumCacheTests, Disabled)
+{
+  ChecksumCache cache(0);
+
+  const std::string expected = "0xfB6916095ca1df60bB79Ce92cE3Ea74c37c5d359";
+  EXPECT_EQ (cache.GetChecksummed ("0xfb6916095ca1df60bb79ce92ce3ea74c37c5d359"),
+             expected);
+  EXPECT_EQ (cache.GetChecksummed ("0xfb6916095ca1df60bb79ce92ce3ea74c37c5d359"),
+             expected);
+}
+
+TEST (ChecksumCacheTests, Invalid)
+{
+  ChecksumCache cache(10);
+  EXPECT_DEATH (cache.GetChecksummed ("0xabc"), "Invalid address");
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
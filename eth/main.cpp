@@ -6,6 +6,7 @@
 
 #include "blockcache.hpp"
 #include "controller.hpp"
+#include "metrics.hpp"
 
 #include "ethchain.hpp"
 
@@ -34,9 +35,15 @@ DEFINE_bool (listen_locally, true,
              "whether or not the RPC server should only bind on localhost");
 DEFINE_string (zmq_address, "",
                "the address to bind the ZMQ publisher to");
+DEFINE_int32 (metrics_port, 0,
+              "if set, serve metrics in the Prometheus format over HTTP"
+              " on this port");
 
 DEFINE_int32 (max_reorg_depth, 1'000,
               "maximum supported depth of reorgs");
+DEFINE_string (import_snapshot, "",
+               "if set and there is no local state yet, bootstrap from this"
+               " snapshot file (as written by the exportsnapshot RPC method)");
 
 DEFINE_string (watch_for_pending_moves, "",
                "comma-separated list of addresses of contracts that we watch"
@@ -44,10 +51,25 @@ DEFINE_string (watch_for_pending_moves, "",
 DEFINE_bool (sanity_checks, false,
              "whether or not to run slow sanity checks for testing");
 
+DEFINE_string (header_store, "",
+               "if set, persist headers of finalised blocks in this SQLite"
+               " file, so that they need not be requested again");
+
 DEFINE_bool (blockcache_memory, false,
              "if enabled, cache blocks in memory (useful for testing)");
 DEFINE_string (blockcache_mysql, "",
                "if set to a mysql:// URL, use it as block cache");
+DEFINE_string (blockcache_lmdb, "",
+               "if set to a directory, use a local LMDB database there"
+               " as block cache");
+DEFINE_int64 (blockcache_lmdb_size_mb, 100'000,
+              "maximum size of the LMDB block cache in MiB");
+DEFINE_int64 (blockcache_lru_mb, 0,
+              "if positive, keep up to this many MiB of recently used blocks"
+              " in memory in front of the block cache");
+DEFINE_int64 (blockcache_warmup_from, -1,
+              "if not negative, fill the block cache in the background with"
+              " all finalised blocks from this height onwards");
 
 /**
  * Parses the comma-separated list of addresses and adds them to the
@@ -95,11 +117,19 @@ main (int argc, char* argv[])
         throw std::runtime_error ("--datadir must be set");
       if (FLAGS_max_reorg_depth < 0)
         throw std::runtime_error ("--max_reorg_depth must not be negative");
+      if (FLAGS_metrics_port < 0)
+        throw std::runtime_error ("--metrics_port must not be negative");
 
       xayax::EthChain base(FLAGS_eth_rpc_url, FLAGS_eth_ws_url,
                            FLAGS_accounts_contract);
+      if (!FLAGS_header_store.empty ())
+        base.EnableHeaderStore (FLAGS_header_store);
       base.Start ();
 
+      /* Metrics are recorded for the calls that actually go to the
+         Ethereum node, i.e. below the block cache (if any).  */
+      xayax::InstrumentedChain instrumented(base);
+
       std::unique_ptr<xayax::BlockCacheChain::Storage> cacheStore;
       if (FLAGS_blockcache_memory)
         {
@@ -121,12 +151,46 @@ main (int argc, char* argv[])
           cacheStore = std::move (mysqlStore);
           LOG (INFO) << "Using MySQL block cache";
         }
+      if (!FLAGS_blockcache_lmdb.empty ())
+        {
+          if (cacheStore != nullptr)
+            throw std::runtime_error ("only one block cache can be chosen");
+          if (FLAGS_blockcache_lmdb_size_mb <= 0)
+            throw std::runtime_error ("--blockcache_lmdb_size_mb is invalid");
+          auto lmdbStore = std::make_unique<xayax::LmdbBlockStorage> ();
+          if (!lmdbStore->Open (FLAGS_blockcache_lmdb,
+                                FLAGS_blockcache_lmdb_size_mb << 20))
+            throw std::runtime_error ("--blockcache_lmdb is invalid");
+
+          cacheStore = std::move (lmdbStore);
+          LOG (INFO) << "Using LMDB block cache";
+        }
+      std::unique_ptr<xayax::LruBlockStorage> lruStore;
+      if (FLAGS_blockcache_lru_mb > 0)
+        {
+          if (cacheStore == nullptr)
+            throw std::runtime_error ("--blockcache_lru_mb requires a cache");
+          lruStore = std::make_unique<xayax::LruBlockStorage> (
+                        *cacheStore, FLAGS_blockcache_lru_mb << 20);
+          LOG (INFO)
+              << "Keeping up to " << FLAGS_blockcache_lru_mb
+              << " MiB of blocks in memory";
+        }
       std::unique_ptr<xayax::BlockCacheChain> cache;
       if (cacheStore != nullptr)
-        cache = std::make_unique<xayax::BlockCacheChain> (
-                    base, *cacheStore, FLAGS_max_reorg_depth);
+        {
+          xayax::BlockCacheChain::Storage* store = cacheStore.get ();
+          if (lruStore != nullptr)
+            store = lruStore.get ();
+          cache = std::make_unique<xayax::BlockCacheChain> (
+                      instrumented, *store, FLAGS_max_reorg_depth);
+          if (FLAGS_blockcache_warmup_from >= 0)
+            cache->EnableWarmup (FLAGS_blockcache_warmup_from);
+        }
+      else if (FLAGS_blockcache_warmup_from >= 0)
+        throw std::runtime_error ("--blockcache_warmup_from requires a cache");
 
-      xayax::BaseChain* baseOrCache = &base;
+      xayax::BaseChain* baseOrCache = &instrumented;
       if (cache != nullptr)
         baseOrCache = cache.get ();
 
@@ -134,6 +198,9 @@ main (int argc, char* argv[])
       controller.SetMaxReorgDepth (FLAGS_max_reorg_depth);
       controller.SetZmqEndpoint (FLAGS_zmq_address);
       controller.SetRpcBinding (FLAGS_port, FLAGS_listen_locally);
+      controller.SetMetricsPort (FLAGS_metrics_port);
+      if (!FLAGS_import_snapshot.empty ())
+        controller.SetSnapshot (FLAGS_import_snapshot);
       if (!FLAGS_watch_for_pending_moves.empty ())
         {
           controller.EnablePending ();
@@ -91,20 +91,17 @@ PendingDataExtractor::AddWatchedContract (const std::string& addr)
   watchedContracts.insert (parsed.GetChecksummed ());
 }
 
-std::vector<MoveData>
-PendingDataExtractor::GetMoves (EthRpcClient& rpc,
-                                const std::string& txid) const
+bool
+PendingDataExtractor::BuildSimulation (const Json::Value& data,
+                                       Json::Value& tx,
+                                       Json::Value& overlay) const
 {
-  const auto data = rpc.eth_getTransactionByHash (txid);
   CHECK (data.isObject ());
 
-  VLOG (1) << "Received pending transaction: " << txid;
-  VLOG (2) << "Transaction details:\n" << data;
-
   /* If this is not a pending transaction anymore or is a contract
      deployment, just ignore it.  */
   if (!data["blockHash"].isNull () || data["to"].isNull ())
-    return {};
+    return false;
 
   const ethutils::Address from(data["from"].asString ());
   const ethutils::Address to(data["to"].asString ());
@@ -116,7 +113,7 @@ PendingDataExtractor::GetMoves (EthRpcClient& rpc,
   if (watchedContracts.count (to.GetChecksummed ()) == 0)
     {
       VLOG (1) << "Ignoring pending transaction to non-watched target " << to;
-      return {};
+      return false;
     }
 
   AbiEncoder execArgs(2);
@@ -126,14 +123,14 @@ PendingDataExtractor::GetMoves (EthRpcClient& rpc,
   /* Construct the call-forwarder transaction overlaid onto the
      from address.  This mimics the actual transaction as closely as
      possible, while returning any move events generated.  */
-  Json::Value tx(Json::objectValue);
+  tx = Json::Value (Json::objectValue);
   tx["to"] = from.GetChecksummed ();
   tx["from"] = from.GetChecksummed ();
   tx["value"] = data["value"];
   tx["data"] = AbiEncoder::ConcatHex (FORWARDER_EXECUTE_FCN,
                                       execArgs.Finalise ());
 
-  Json::Value overlay(Json::objectValue);
+  overlay = Json::Value (Json::objectValue);
 
   Json::Value state(Json::objectValue);
   state["code"] = fwdCode;
@@ -141,6 +138,23 @@ PendingDataExtractor::GetMoves (EthRpcClient& rpc,
   state["code"] = accountsOverlayCode;
   overlay[accountsContract] = state;
 
+  return true;
+}
+
+std::vector<MoveData>
+PendingDataExtractor::GetMoves (EthRpcClient& rpc,
+                                const std::string& txid) const
+{
+  const auto data = rpc.eth_getTransactionByHash (txid);
+  CHECK (data.isObject ());
+
+  VLOG (1) << "Received pending transaction: " << txid;
+  VLOG (2) << "Transaction details:\n" << data;
+
+  Json::Value tx, overlay;
+  if (!BuildSimulation (data, tx, overlay))
+    return {};
+
   try
     {
       const auto res = rpc.eth_call (tx, "latest", overlay);
@@ -157,6 +171,86 @@ PendingDataExtractor::GetMoves (EthRpcClient& rpc,
     }
 }
 
+std::vector<std::pair<std::string, std::vector<MoveData>>>
+PendingDataExtractor::GetMovesBatch (
+    EthRpcClient& rpc, const std::vector<std::string>& txids) const
+{
+  if (txids.empty ())
+    return {};
+
+  jsonrpc::BatchCall dataReq;
+  std::vector<int> dataIds;
+  for (const auto& txid : txids)
+    {
+      Json::Value params(Json::arrayValue);
+      params.append (txid);
+      dataIds.push_back (dataReq.addCall ("eth_getTransactionByHash", params));
+    }
+  auto dataResp = rpc.CallProcedures (dataReq);
+
+  jsonrpc::BatchCall simReq;
+  std::vector<std::pair<int, std::string>> simIds;
+  for (size_t i = 0; i < txids.size (); ++i)
+    {
+      Json::Value idVal(dataIds[i]);
+      const int err = dataResp.getErrorCode (idVal);
+      if (err != 0)
+        {
+          LOG (WARNING)
+              << "Error " << err << " retrieving pending transaction "
+              << txids[i] << ":\n" << dataResp.getErrorMessage (idVal);
+          continue;
+        }
+
+      /* The transaction may have been dropped from the mempool already
+         while it was waiting in our queue.  */
+      const auto data = dataResp.getResult (dataIds[i]);
+      if (data.isNull ())
+        continue;
+
+      VLOG (1) << "Received pending transaction: " << txids[i];
+      VLOG (2) << "Transaction details:\n" << data;
+
+      Json::Value tx, overlay;
+      if (!BuildSimulation (data, tx, overlay))
+        continue;
+
+      Json::Value params(Json::arrayValue);
+      params.append (tx);
+      params.append ("latest");
+      params.append (overlay);
+      simIds.emplace_back (simReq.addCall ("eth_call", params), txids[i]);
+    }
+
+  if (simIds.empty ())
+    return {};
+
+  auto simResp = rpc.CallProcedures (simReq);
+
+  std::vector<std::pair<std::string, std::vector<MoveData>>> res;
+  for (const auto& entry : simIds)
+    {
+      Json::Value idVal(entry.first);
+      const int err = simResp.getErrorCode (idVal);
+      if (err != 0)
+        {
+          /* As with GetMoves, this most likely means that the call
+             reverted, and we just ignore the transaction.  */
+          LOG (WARNING)
+              << "eth_call for pending transaction failed:\n"
+              << simResp.getErrorMessage (idVal);
+          continue;
+        }
+
+      auto moves = DecodeMoveLogs (entry.second,
+                                   simResp.getResult (entry.first).asString ());
+      if (!moves.empty ())
+        res.emplace_back (entry.second, std::move (moves));
+    }
+
+  return res;
+}
+
 std::vector<MoveData>
 PendingDataExtractor::DecodeMoveLogs (const std::string& txid,
                                       const std::string& hexStr)
@@ -179,11 +273,34 @@ PendingDataExtractor::DecodeMoveLogs (const std::string& txid,
 
 /* ************************************************************************** */
 
+PendingMempool::PendingMempool (const std::chrono::steady_clock::duration age)
+  : maxAge(age)
+{}
+
 void
 PendingMempool::Add (const std::string& txid)
 {
   std::lock_guard<std::mutex> lock(mut);
-  pool.insert (txid);
+  if (pool.emplace (txid, Entry ()).second)
+    dirty = true;
+}
+
+void
+PendingMempool::RemoveConfirmed (const std::vector<BlockData>& blocks)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  if (pool.empty ())
+    return;
+
+  for (const auto& blk : blocks)
+    for (const auto& mv : blk.moves)
+      if (pool.erase (mv.txid) > 0)
+        {
+          VLOG (1)
+              << "Transaction " << mv.txid << " has been confirmed in block "
+              << blk.hash << ", removing from mempool";
+          dirty = true;
+        }
 }
 
 namespace
@@ -214,28 +331,57 @@ IsEarlierForMempool (const Json::Value& a, const Json::Value& b)
 
 } // anonymous namespace
 
+void
+PendingMempool::UpdateOrdered ()
+{
+  /* Order the transactions properly.  The important criterion is that we
+     order within one sender address by nonce, and we do order by sender as
+     well to ensure a well-defined result ordering.  */
+  std::vector<const Json::Value*> transactions;
+  for (const auto& entry : pool)
+    if (!entry.second.data.isNull ())
+      transactions.push_back (&entry.second.data);
+  std::sort (transactions.begin (), transactions.end (),
+             [] (const Json::Value* a, const Json::Value* b)
+               {
+                 return IsEarlierForMempool (*a, *b);
+               });
+
+  ordered.clear ();
+  for (const auto* tx : transactions)
+    ordered.push_back (ConvertUint256 ((*tx)["hash"].asString ()));
+
+  dirty = false;
+}
+
 std::vector<std::string>
 PendingMempool::GetContent (EthRpcClient& rpc)
 {
-  /* We check the underlying node's status of each transaction that is in our
-     local pool (with a single batch call).  */
+  /* We check the underlying node's status of each transaction that is not
+     yet verified or whose verification is too old (with a single batch
+     call).  If there are none, the cached content can be returned, or at
+     least be recomputed without any RPC calls.  */
   jsonrpc::BatchCall req;
   std::vector<std::pair<int, std::string>> idsWithTxid;
   {
     std::lock_guard<std::mutex> lock(mut);
 
-    /* Avoid empty batch calls (and also speed up matters) in the
-       not-so-uncommon situation that we don't have any tracked transactions
-       pending at the moment.  */
-    if (pool.empty ())
-      return {};
-
-    for (const auto& txid : pool)
+    const auto now = std::chrono::steady_clock::now ();
+    for (const auto& entry : pool)
+      if (entry.second.data.isNull ()
+            || now - entry.second.verified >= maxAge)
+        {
+          Json::Value params(Json::arrayValue);
+          params.append ("0x" + entry.first);
+          const int id = req.addCall ("eth_getTransactionByHash", params);
+          idsWithTxid.emplace_back (id, entry.first);
+        }
+
+    if (idsWithTxid.empty ())
       {
-        Json::Value params(Json::arrayValue);
-        params.append ("0x" + txid);
-        const int id = req.addCall ("eth_getTransactionByHash", params);
-        idsWithTxid.emplace_back (id, txid);
+        if (dirty)
+          UpdateOrdered ();
+        return ordered;
       }
   }
 
@@ -244,65 +390,60 @@ PendingMempool::GetContent (EthRpcClient& rpc)
      now or some removed by a parallel call, but that's fine.  */
   auto resp = rpc.CallProcedures (req);
 
-  /* Transactions that come back with a null blockHash are still pending, those
-     are the ones we return from the call.  Transactions that are not found
-     or that have a non-null blockHash can be removed.
+  /* Transactions that come back with a null blockHash are still pending.
+     Transactions that are not found or that have a non-null blockHash
+     can be removed.
 
      Note that in case of a race condition, the returned transactions may not
-     exactly match the current pool.  Transactions in the pool which are not
-     in the RPC response will just be ignored here (neither returned from the
-     method nor removed).  */
-  std::vector<Json::Value> transactions;
-  {
-    std::lock_guard<std::mutex> lock(mut);
-    for (const auto& entry : idsWithTxid)
-      {
-        Json::Value idVal(entry.first);
-        const int err = resp.getErrorCode (idVal);
-        CHECK_EQ (err, 0)
-            << "Error " << err << " retrieving transaction data"
-            << " for " << entry.second << ":\n"
-            << resp.getErrorMessage (idVal);
-
-        const auto txJson = resp.getResult (entry.first);
-        if (txJson.isNull ())
-          {
-            VLOG (1)
-                << "Transaction " << entry.second
-                << " is unknown, removing from mempool";
-            pool.erase (entry.second);
-            continue;
-          }
-
-        CHECK (txJson.isObject ());
-        CHECK_EQ (txJson["hash"].asString (), "0x" + entry.second);
-
-        if (txJson["blockHash"].isNull ())
-          {
-            VLOG (2)
-                << "Transaction " << entry.second << " is still pending";
-            transactions.push_back (txJson);
-          }
-        else
-          {
-            VLOG (1)
-                << "Transaction " << entry.second
-                << " has been confirmed, removing from mempool";
-            pool.erase (entry.second);
-          }
-      }
-  }
-
-  /* Order the transactions properly and return the final result.
-     The important criterion is that we order within one sender address
-     by nonce, and we do order by sender as well to ensure a well-defined
-     result ordering.  */
-  std::sort (transactions.begin (), transactions.end (), &IsEarlierForMempool);
-  std::vector<std::string> res;
-  for (const auto& tx : transactions)
-    res.push_back (ConvertUint256 (tx["hash"].asString ()));
+     exactly match the current pool.  Transactions which are no longer in the
+     pool are ignored, and transactions that have been added in the mean time
+     remain unverified (and thus not returned) until the next call.  */
+  std::lock_guard<std::mutex> lock(mut);
+  const auto now = std::chrono::steady_clock::now ();
+  for (const auto& entry : idsWithTxid)
+    {
+      Json::Value idVal(entry.first);
+      const int err = resp.getErrorCode (idVal);
+      CHECK_EQ (err, 0)
+          << "Error " << err << " retrieving transaction data"
+          << " for " << entry.second << ":\n"
+          << resp.getErrorMessage (idVal);
+
+      auto mit = pool.find (entry.second);
+      if (mit == pool.end ())
+        continue;
+
+      const auto txJson = resp.getResult (entry.first);
+      if (txJson.isNull ())
+        {
+          VLOG (1)
+              << "Transaction " << entry.second
+              << " is unknown, removing from mempool";
+          pool.erase (mit);
+          continue;
+        }
+
+      CHECK (txJson.isObject ());
+      CHECK_EQ (txJson["hash"].asString (), "0x" + entry.second);
+
+      if (txJson["blockHash"].isNull ())
+        {
+          VLOG (2)
+              << "Transaction " << entry.second << " is still pending";
+          mit->second.data = txJson;
+          mit->second.verified = now;
+        }
+      else
+        {
+          VLOG (1)
+              << "Transaction " << entry.second
+              << " has been confirmed, removing from mempool";
+          pool.erase (mit);
+        }
+    }
 
-  return res;
+  UpdateOrdered ();
+  return ordered;
 }
 
 /* ************************************************************************** */
@@ -9,9 +9,14 @@
 
 #include "rpc-stubs/ethrpcclient.h"
 
+#include <json/json.h>
+
+#include <chrono>
+#include <map>
 #include <mutex>
 #include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace xayax
@@ -56,6 +61,14 @@ private:
   static std::vector<MoveData> DecodeMoveLogs (const std::string& txid,
                                                const std::string& hexStr);
 
+  /**
+   * Constructs the eth_call transaction and state overlay to simulate
+   * a pending transaction, given its data from eth_getTransactionByHash.
+   * Returns false if the transaction should be ignored instead.
+   */
+  bool BuildSimulation (const Json::Value& data, Json::Value& tx,
+                        Json::Value& overlay) const;
+
   friend class PendingDataExtractorTests;
 
 public:
@@ -72,6 +85,15 @@ public:
   std::vector<MoveData> GetMoves (EthRpcClient& rpc,
                                   const std::string& txid) const;
 
+  /**
+   * Extracts the moves from multiple pending transactions, using one batch
+   * request for the transaction data and one for the simulations.  Returns
+   * the moves for all transactions that have some, in the order of the
+   * input txids.
+   */
+  std::vector<std::pair<std::string, std::vector<MoveData>>> GetMovesBatch (
+      EthRpcClient& rpc, const std::vector<std::string>& txids) const;
+
   /**
    * Adds a contract address to the list of addresses we consider as potentially
    * triggering moves.
@@ -83,17 +105,47 @@ public:
 /**
  * A class keeping track of the pending transactions in the mempool
  * (those that we are interested in in the first place).  It gets updated
- * from notifications about new pending transactions, and updates itself
- * based on eth_getTransactionByHash calls to check which transactions
- * are still in the mempool whenever the content is queried.
+ * from notifications about new pending transactions, and transactions
+ * are removed when their moves are confirmed in blocks.  To catch other
+ * reasons for a transaction to leave the node's mempool (e.g. replacements
+ * or confirmations without moves), entries are re-verified with
+ * eth_getTransactionByHash once their last verification is older
+ * than a configured age.
+ *
+ * The ordered content is cached, so that querying it repeatedly is cheap
+ * as long as nothing changed and no entry needs to be re-verified.
  */
 class PendingMempool
 {
 
 private:
 
-  /** The txid's of transactions that we think are in the mempool.  */
-  std::set<std::string> pool;
+  /** Data about one transaction in the pool.  */
+  struct Entry
+  {
+
+    /**
+     * The transaction data as returned by eth_getTransactionByHash,
+     * or null if it has not been verified yet.
+     */
+    Json::Value data;
+
+    /** When the entry was last verified with the node.  */
+    std::chrono::steady_clock::time_point verified;
+
+  };
+
+  /** Age after which entries are verified again.  */
+  const std::chrono::steady_clock::duration maxAge;
+
+  /** The transactions that we think are in the mempool, by txid.  */
+  std::map<std::string, Entry> pool;
+
+  /** The cached, ordered content of the pool.  */
+  std::vector<std::string> ordered;
+
+  /** Set if the pool changed since ordered was computed.  */
+  bool dirty = false;
 
   /**
    * Lock for this instance (so it can be queried in parallel from multiple
@@ -101,19 +153,39 @@ private:
    */
   std::mutex mut;
 
+  /**
+   * Recomputes the ordered content from all verified entries.  The caller
+   * must hold the lock.
+   */
+  void UpdateOrdered ();
+
 public:
 
-  PendingMempool () = default;
+  /**
+   * Constructs an empty pool, which re-verifies entries after the given age.
+   */
+  explicit PendingMempool (std::chrono::steady_clock::duration age);
+
+  PendingMempool () = delete;
+  PendingMempool (const PendingMempool&) = delete;
+  void operator= (const PendingMempool&) = delete;
 
   /**
    * Insert a transaction that we received from a notification into the pool.
    */
   void Add (const std::string& txid);
 
+  /**
+   * Removes all transactions whose moves are contained in the given blocks,
+   * since they have been confirmed.
+   */
+  void RemoveConfirmed (const std::vector<BlockData>& blocks);
+
   /**
    * Retrieve the content of the mempool.  This queries the underlying
-   * Ethereum node via RPC to make sure we remove transactions that are
-   * no longer in the node's mempool.
+   * Ethereum node via RPC for entries that have not yet been verified or
+   * whose last verification is too old, to make sure we remove transactions
+   * that are no longer in the node's mempool.
    *
    * The transactions are returned in one possible order, in particular by nonce
    * within a particular sender address.
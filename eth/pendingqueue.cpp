@@ -0,0 +1,151 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pendingqueue.hpp"
+
+#include "metrics.hpp"
+
+#include <glog/logging.h>
+
+#include <utility>
+
+namespace xayax
+{
+
+namespace
+{
+
+/**
+ * Metrics about the pending queue.
+ */
+struct PendingQueueMetrics
+{
+
+  MetricsCounter& processed;
+  MetricsCounter& dropped;
+  MetricsGauge& length;
+
+  PendingQueueMetrics ()
+    : processed(MetricsRegistry::Get ().GetCounter (
+          "xayax_eth_pending_processed_total",
+          "Number of pending transactions processed")),
+      dropped(MetricsRegistry::Get ().GetCounter (
+          "xayax_eth_pending_dropped_total",
+          "Number of pending transactions dropped because the queue"
+          " was full")),
+      length(MetricsRegistry::Get ().GetGauge (
+          "xayax_eth_pending_queue_length",
+          "Number of pending transactions waiting to be processed"))
+  {}
+
+  static PendingQueueMetrics&
+  Get ()
+  {
+    static PendingQueueMetrics instance;
+    return instance;
+  }
+
+};
+
+} // anonymous namespace
+
+PendingQueue::PendingQueue (const size_t numWorkers, const size_t cap,
+                            const size_t batch, Processor p)
+  : capacity(cap), batchSize(batch), seenSize(4 * cap),
+    process(std::move (p))
+{
+  CHECK_GT (numWorkers, 0);
+  CHECK_GT (capacity, 0);
+  CHECK_GT (batchSize, 0);
+
+  for (size_t i = 0; i < numWorkers; ++i)
+    workers.emplace_back ([this] ()
+      {
+        Run ();
+      });
+}
+
+PendingQueue::~PendingQueue ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shouldStop = true;
+    cv.notify_all ();
+  }
+
+  for (auto& w : workers)
+    w.join ();
+}
+
+void
+PendingQueue::Push (const std::string& txid)
+{
+  auto& metrics = PendingQueueMetrics::Get ();
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (!seen.insert (txid).second)
+    {
+      VLOG (2) << "Ignoring duplicate pending transaction " << txid;
+      return;
+    }
+  seenOrder.push_back (txid);
+  while (seenOrder.size () > seenSize)
+    {
+      seen.erase (seenOrder.front ());
+      seenOrder.pop_front ();
+    }
+
+  queue.push_back (txid);
+  if (queue.size () > capacity)
+    {
+      VLOG (1)
+          << "Pending queue is full, dropping transaction "
+          << queue.front ();
+      queue.pop_front ();
+      ++dropped;
+      metrics.dropped.Inc ();
+    }
+
+  metrics.length.Set (queue.size ());
+  cv.notify_one ();
+}
+
+uint64_t
+PendingQueue::GetNumDropped () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return dropped;
+}
+
+void
+PendingQueue::Run ()
+{
+  auto& metrics = PendingQueueMetrics::Get ();
+
+  while (true)
+    {
+      std::vector<std::string> batch;
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        cv.wait (lock, [this] ()
+          {
+            return shouldStop || !queue.empty ();
+          });
+        if (shouldStop)
+          return;
+
+        while (!queue.empty () && batch.size () < batchSize)
+          {
+            batch.push_back (std::move (queue.front ()));
+            queue.pop_front ();
+          }
+        metrics.length.Set (queue.size ());
+      }
+
+      process (batch);
+      metrics.processed.Inc (batch.size ());
+    }
+}
+
+} // namespace xayax
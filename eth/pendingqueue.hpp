@@ -0,0 +1,121 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_ETH_PENDINGQUEUE_HPP
+#define XAYAX_ETH_PENDINGQUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Bounded queue of pending transactions to process, together with a pool
+ * of worker threads taking batches of them off the queue.  This decouples
+ * the (potentially slow) simulation of pending transactions from the
+ * websocket thread receiving the notifications.
+ *
+ * Repeated notifications for the same txid are ignored.  Since pending
+ * moves are best-effort only, the oldest queued transactions are dropped
+ * if the queue is full, so that we keep up with the newest ones.
+ *
+ * This class is thread-safe.
+ */
+class PendingQueue
+{
+
+public:
+
+  /**
+   * Function called on a worker thread to process a batch of txids.
+   */
+  using Processor = std::function<void (const std::vector<std::string>&)>;
+
+private:
+
+  /** Maximum number of queued transactions.  */
+  const size_t capacity;
+
+  /** Maximum number of transactions passed to the processor at once.  */
+  const size_t batchSize;
+
+  /** Number of recent txids remembered for deduplication.  */
+  const size_t seenSize;
+
+  /** The processing function.  */
+  const Processor process;
+
+  /** Lock for the queue state.  */
+  mutable std::mutex mut;
+
+  /** Notified when transactions are queued or the workers should stop.  */
+  std::condition_variable cv;
+
+  /** The queued transactions, oldest first.  */
+  std::deque<std::string> queue;
+
+  /** Recently pushed txids, used to ignore duplicates.  */
+  std::set<std::string> seen;
+
+  /** The txids in seen in the order they were added.  */
+  std::deque<std::string> seenOrder;
+
+  /** Number of transactions dropped because the queue was full.  */
+  uint64_t dropped = 0;
+
+  /** Set to true when the workers should exit.  */
+  bool shouldStop = false;
+
+  /** The worker threads.  */
+  std::vector<std::thread> workers;
+
+  /**
+   * Main loop of a worker thread.
+   */
+  void Run ();
+
+public:
+
+  /**
+   * Constructs the queue and starts the worker threads.
+   */
+  explicit PendingQueue (size_t numWorkers, size_t cap, size_t batch,
+                         Processor p);
+
+  /**
+   * Stops the workers.  Transactions that are still queued are
+   * discarded.
+   */
+  ~PendingQueue ();
+
+  PendingQueue () = delete;
+  PendingQueue (const PendingQueue&) = delete;
+  void operator= (const PendingQueue&) = delete;
+
+  /**
+   * Queues a new pending transaction for processing, unless it has
+   * been seen recently.
+   */
+  void Push (const std::string& txid);
+
+  /**
+   * Returns the number of transactions that have been dropped so far
+   * because the queue was full.
+   */
+  uint64_t GetNumDropped () const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_ETH_PENDINGQUEUE_HPP
@@ -0,0 +1,187 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pendingqueue.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+
+namespace xayax
+{
+namespace
+{
+
+using testing::ElementsAre;
+using testing::UnorderedElementsAre;
+
+/* ************************************************************************** */
+
+/**
+ * Processor for the tests, which records all processed txids and batches.
+ * It can also be blocked, so that the tests can fill up the queue.
+ */
+class TestProcessor
+{
+
+private:
+
+  std::mutex mut;
+  std::condition_variable cv;
+
+  /** Whether processing is blocked.  */
+  bool blocked = false;
+
+  /** Number of batches that started processing.  */
+  unsigned started = 0;
+
+public:
+
+  /** All processed txids in order.  */
+  std::vector<std::string> processed;
+
+  /** The sizes of all processed batches.  */
+  std::vector<size_t> batches;
+
+  void
+  Process (const std::vector<std::string>& txids)
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    ++started;
+    cv.notify_all ();
+    cv.wait (lock, [this] () { return !blocked; });
+
+    processed.insert (processed.end (), txids.begin (), txids.end ());
+    batches.push_back (txids.size ());
+    cv.notify_all ();
+  }
+
+  PendingQueue::Processor
+  Get ()
+  {
+    return [this] (const std::vector<std::string>& txids)
+      {
+        Process (txids);
+      };
+  }
+
+  void
+  SetBlocked (const bool val)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    blocked = val;
+    cv.notify_all ();
+  }
+
+  /**
+   * Waits until the given number of batches started processing.
+   */
+  void
+  WaitForStarted (const unsigned num)
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait (lock, [this, num] () { return started >= num; });
+  }
+
+  /**
+   * Waits until the given number of txids have been processed.
+   */
+  void
+  WaitForProcessed (const size_t num)
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait (lock, [this, num] () { return processed.size () >= num; });
+  }
+
+};
+
+using PendingQueueTests = testing::Test;
+
+TEST_F (PendingQueueTests, Basic)
+{
+  TestProcessor proc;
+  PendingQueue queue(2, 10, 5, proc.Get ());
+
+  queue.Push ("a");
+  queue.Push ("b");
+  queue.Push ("c");
+  proc.WaitForProcessed (3);
+
+  EXPECT_THAT (proc.processed, UnorderedElementsAre ("a", "b", "c"));
+  EXPECT_EQ (queue.GetNumDropped (), 0);
+}
+
+TEST_F (PendingQueueTests, Batching)
+{
+  TestProcessor proc;
+  proc.SetBlocked (true);
+  PendingQueue queue(1, 10, 3, proc.Get ());
+
+  queue.Push ("a");
+  proc.WaitForStarted (1);
+  for (const std::string txid : {"b", "c", "d", "e"})
+    queue.Push (txid);
+  proc.SetBlocked (false);
+  proc.WaitForProcessed (5);
+
+  EXPECT_THAT (proc.processed, ElementsAre ("a", "b", "c", "d", "e"));
+  EXPECT_THAT (proc.batches, ElementsAre (1, 3, 1));
+}
+
+TEST_F (PendingQueueTests, Deduplication)
+{
+  TestProcessor proc;
+  PendingQueue queue(1, 10, 1, proc.Get ());
+
+  queue.Push ("a");
+  queue.Push ("a");
+  proc.WaitForProcessed (1);
+  queue.Push ("a");
+  queue.Push ("b");
+  proc.WaitForProcessed (2);
+
+  EXPECT_THAT (proc.processed, ElementsAre ("a", "b"));
+}
+
+TEST_F (PendingQueueTests, DropsOldest)
+{
+  TestProcessor proc;
+  proc.SetBlocked (true);
+  PendingQueue queue(1, 2, 10, proc.Get ());
+
+  queue.Push ("a");
+  proc.WaitForStarted (1);
+  for (const std::string txid : {"b", "c", "d"})
+    queue.Push (txid);
+  EXPECT_EQ (queue.GetNumDropped (), 1);
+
+  proc.SetBlocked (false);
+  proc.WaitForProcessed (3);
+  EXPECT_THAT (proc.processed, ElementsAre ("a", "c", "d"));
+}
+
+TEST_F (PendingQueueTests, StopsWithQueuedWork)
+{
+  TestProcessor proc;
+  proc.SetBlocked (true);
+  {
+    PendingQueue queue(1, 10, 1, proc.Get ());
+    queue.Push ("a");
+    proc.WaitForStarted (1);
+    queue.Push ("b");
+    proc.SetBlocked (false);
+  }
+
+  /* The batch in progress is finished, but "b" may or may not have been
+     processed before the queue shut down.  */
+  ASSERT_GE (proc.processed.size (), 1);
+  EXPECT_EQ (proc.processed.front (), "a");
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,163 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pushedlogs.hpp"
+
+#include "hexutils.hpp"
+
+#include <eth-utils/abi.hpp>
+#include <eth-utils/keccak.hpp>
+
+#include <glog/logging.h>
+
+#include <string_view>
+
+namespace xayax
+{
+
+namespace
+{
+
+/** Size of a logs bloom filter in bytes.  */
+constexpr size_t BLOOM_BYTES = 256;
+
+/**
+ * Decodes a hex string with 0x prefix (as from the RPC interface)
+ * to binary.  Returns false if it is invalid.
+ */
+bool
+DecodePrefixedHex (const std::string_view hex, std::string& bin)
+{
+  if (hex.substr (0, 2) != "0x")
+    return false;
+  return DecodeHex (hex.substr (2), bin);
+}
+
+} // anonymous namespace
+
+bool
+BloomMayContain (const std::string& bloomHex, const std::string& item)
+{
+  /* If we cannot decode the bloom filter, we have to assume that
+     anything may be in there.  */
+  std::string bloom;
+  if (!DecodePrefixedHex (bloomHex, bloom) || bloom.size () != BLOOM_BYTES)
+    return true;
+
+  /* Each item sets three bits in the 2048-bit filter, determined by the
+     low 11 bits of the first three byte pairs of its Keccak hash.  */
+  const std::string hash = ethutils::Keccak256 (item);
+  for (size_t i = 0; i < 6; i += 2)
+    {
+      const unsigned bit
+          = ((static_cast<uint8_t> (hash[i]) << 8)
+                | static_cast<uint8_t> (hash[i + 1]))
+              & 2'047;
+      const uint8_t byte = bloom[BLOOM_BYTES - 1 - bit / 8];
+      if ((byte & (1 << (bit % 8))) == 0)
+        return false;
+    }
+
+  return true;
+}
+
+/* ************************************************************************** */
+
+PushedLogs::PushedLogs (const size_t d, const std::string& addr,
+                        const std::string& moveTopic)
+  : depth(d)
+{
+  CHECK (DecodePrefixedHex (addr, address)) << "Invalid address: " << addr;
+  CHECK (DecodePrefixedHex (moveTopic, topic))
+      << "Invalid topic: " << moveTopic;
+}
+
+void
+PushedLogs::Prune ()
+{
+  for (auto it = blocks.begin (); it != blocks.end (); )
+    if (it->second.height + depth < maxHeight)
+      it = blocks.erase (it);
+    else
+      ++it;
+}
+
+void
+PushedLogs::SetActive ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  active = true;
+}
+
+void
+PushedLogs::AddHeader (const BlockData& blk, const std::string& logsBloom)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  if (!active)
+    return;
+
+  auto& entry = blocks[blk.hash];
+  entry.height = blk.height;
+  entry.header = true;
+  entry.noMoves = !BloomMayContain (logsBloom, address)
+                    || !BloomMayContain (logsBloom, topic);
+
+  if (blk.height > maxHeight)
+    {
+      maxHeight = blk.height;
+      Prune ();
+    }
+}
+
+void
+PushedLogs::AddLog (const Json::Value& log)
+{
+  CHECK (log.isObject ());
+
+  const std::string hash = ConvertUint256 (log["blockHash"].asString ());
+  const auto height
+      = ethutils::AbiDecoder::ParseInt (log["blockNumber"].asString ());
+  const auto key = std::make_pair (
+      ethutils::AbiDecoder::ParseInt (log["transactionIndex"].asString ()),
+      ethutils::AbiDecoder::ParseInt (log["logIndex"].asString ()));
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (log.isMember ("removed") && log["removed"].asBool ())
+    {
+      auto mit = blocks.find (hash);
+      if (mit != blocks.end ())
+        mit->second.logs.erase (key);
+      return;
+    }
+
+  auto& entry = blocks[hash];
+  entry.height = height;
+  entry.logs[key] = log;
+}
+
+bool
+PushedLogs::GetLogs (const std::string& hash,
+                     std::vector<Json::Value>& logs) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = blocks.find (hash);
+  if (mit == blocks.end ())
+    return false;
+
+  /* If the bloom filter allows moves, we cannot know whether all of them
+     have been pushed already.  If it excludes moves but we still got some,
+     then something is wrong.  In both cases, we better ask the node.  */
+  const auto& entry = mit->second;
+  if (!entry.header || !entry.noMoves || !entry.logs.empty ())
+    return false;
+
+  logs.clear ();
+  return true;
+}
+
+/* ************************************************************************** */
+
+} // namespace xayax
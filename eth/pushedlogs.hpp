@@ -0,0 +1,141 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_ETH_PUSHEDLOGS_HPP
+#define XAYAX_ETH_PUSHEDLOGS_HPP
+
+#include "blockdata.hpp"
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Checks if the logs bloom filter of a block (as hex string with 0x prefix
+ * from the RPC interface) may contain the given (binary) item, e.g. the
+ * address of a contract or an event topic.
+ */
+bool BloomMayContain (const std::string& bloomHex, const std::string& item);
+
+/**
+ * Buffer of move logs pushed to us through a websocket "logs" subscription,
+ * together with the newHeads headers.  From this, we can tell for recent
+ * blocks that they have no moves without an eth_getLogs request.
+ *
+ * Notifications do not tell us when all logs of a block have been pushed,
+ * and the logs and newHeads subscriptions are not ordered with respect
+ * to each other.  Thus we never consider pushed logs complete.  Only if
+ * a block's header bloom filter shows that it has no move logs at all,
+ * and none have been pushed either, do we know its (empty) moves for sure.
+ * All other blocks need to be queried from the node.  Headers are only
+ * tracked once the logs subscription is active, so that we do not miss
+ * logs sent before.
+ *
+ * This class is thread-safe.
+ */
+class PushedLogs
+{
+
+private:
+
+  /** Data we have for one block.  */
+  struct BlockEntry
+  {
+
+    /** The block's height.  */
+    uint64_t height = 0;
+
+    /** Set if we received the block's header.  */
+    bool header = false;
+
+    /** Set if the header's bloom filter shows there are no moves.  */
+    bool noMoves = false;
+
+    /** Pushed logs by their transactionIndex/logIndex pair.  */
+    std::map<std::pair<int64_t, int64_t>, Json::Value> logs;
+
+  };
+
+  /** Number of recent blocks (by height) for which data is kept.  */
+  const size_t depth;
+
+  /** The address of the accounts contract, for the bloom check.  */
+  std::string address;
+
+  /** The topic of move events, for the bloom check.  */
+  std::string topic;
+
+  /** Lock for the buffered data.  */
+  mutable std::mutex mut;
+
+  /** Whether the logs subscription is active.  */
+  bool active = false;
+
+  /** The data we have by block hash.  */
+  std::map<std::string, BlockEntry> blocks;
+
+  /** Largest height of a received header.  */
+  uint64_t maxHeight = 0;
+
+  /**
+   * Removes entries for blocks that are too old.  The caller must hold
+   * the lock.
+   */
+  void Prune ();
+
+public:
+
+  /**
+   * Constructs the buffer, keeping data for the given number of recent
+   * blocks.  Logs of the given contract address and move event topic
+   * (both as hex strings with 0x prefix) are tracked.
+   */
+  explicit PushedLogs (size_t d, const std::string& addr,
+                       const std::string& moveTopic);
+
+  PushedLogs () = delete;
+  PushedLogs (const PushedLogs&) = delete;
+  void operator= (const PushedLogs&) = delete;
+
+  /**
+   * Marks the logs subscription as active.  Before this call, headers
+   * are ignored and no block is considered complete.
+   */
+  void SetActive ();
+
+  /**
+   * Adds the header of a new block notified through newHeads, together
+   * with its logs bloom filter.
+   */
+  void AddHeader (const BlockData& blk, const std::string& logsBloom);
+
+  /**
+   * Adds a log received through the subscription.  Logs with "removed"
+   * set (during a reorg) are removed again from the buffer.
+   */
+  void AddLog (const Json::Value& log);
+
+  /**
+   * Returns the logs for the given block hash (ordered by transaction
+   * and log index) if we know them completely.  This is only the case
+   * for blocks known to have no move logs at all (see the class comment).
+   * Returns false if they may be incomplete, in which case they need to be
+   * queried from the node.
+   */
+  bool GetLogs (const std::string& hash, std::vector<Json::Value>& logs) const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_ETH_PUSHEDLOGS_HPP
@@ -0,0 +1,189 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pushedlogs.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace xayax
+{
+namespace
+{
+
+/* ************************************************************************** */
+
+/** A bloom filter with no bits set.  */
+const std::string EMPTY_BLOOM = "0x" + std::string (512, '0');
+
+/** A bloom filter with all bits set.  */
+const std::string FULL_BLOOM = "0x" + std::string (512, 'f');
+
+using BloomTests = testing::Test;
+
+TEST_F (BloomTests, EmptyItem)
+{
+  /* Keccak of the empty string is c5d246...a470, which sets the bits
+     0x5d2, 0x601 and 0x6f7.  */
+  const std::string bloom
+      = "0x0000000000000000000000000000000000000000000000000000000000000000"
+        "0080000000000000000000000000000000000000000000000000000000000002"
+        "0000000000040000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000";
+  EXPECT_TRUE (BloomMayContain (bloom, ""));
+  EXPECT_FALSE (BloomMayContain (EMPTY_BLOOM, ""));
+  EXPECT_TRUE (BloomMayContain (FULL_BLOOM, ""));
+
+  /* Only two of the three bits set.  */
+  const std::string partial
+      = "0x0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000002"
+        "0000000000040000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000";
+  EXPECT_FALSE (BloomMayContain (partial, ""));
+}
+
+TEST_F (BloomTests, Invalid)
+{
+  EXPECT_TRUE (BloomMayContain ("", "foo"));
+  EXPECT_TRUE (BloomMayContain ("0x1234", "foo"));
+  EXPECT_TRUE (BloomMayContain ("0x" + std::string (512, 'x'), "foo"));
+}
+
+/* ************************************************************************** */
+
+class PushedLogsTests : public testing::Test
+{
+
+protected:
+
+  PushedLogs logs;
+
+  PushedLogsTests ()
+    : logs(10, "0x12", "0x34")
+  {
+    logs.SetActive ();
+  }
+
+  /**
+   * Constructs a block header with the given height and hashes.
+   */
+  static BlockData
+  Header (const uint64_t height, const std::string& hash,
+          const std::string& parent)
+  {
+    BlockData res;
+    res.height = height;
+    res.hash = hash;
+    res.parent = parent;
+    return res;
+  }
+
+  /**
+   * Constructs a log entry for the given block and indices.
+   */
+  static Json::Value
+  Log (const uint64_t height, const std::string& hash,
+       const unsigned txIndex, const unsigned logIndex,
+       const bool removed = false)
+  {
+    const auto hex = [] (const unsigned n)
+      {
+        std::ostringstream out;
+        out << "0x" << std::hex << n;
+        return out.str ();
+      };
+
+    Json::Value res(Json::objectValue);
+    res["blockHash"] = "0x" + hash;
+    res["blockNumber"] = hex (height);
+    res["transactionIndex"] = hex (txIndex);
+    res["logIndex"] = hex (logIndex);
+    res["removed"] = removed;
+    return res;
+  }
+
+};
+
+TEST_F (PushedLogsTests, NoMovesFromBloom)
+{
+  std::vector<Json::Value> res;
+  logs.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+  ASSERT_TRUE (logs.GetLogs ("a", res));
+  EXPECT_TRUE (res.empty ());
+
+  EXPECT_FALSE (logs.GetLogs ("b", res));
+}
+
+TEST_F (PushedLogsTests, NotCompleteWithMoves)
+{
+  std::vector<Json::Value> res;
+
+  logs.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+  logs.AddLog (Log (11, "b", 1, 2));
+  logs.AddLog (Log (11, "b", 0, 5));
+  logs.AddHeader (Header (11, "b", "a"), FULL_BLOOM);
+  EXPECT_FALSE (logs.GetLogs ("b", res));
+
+  /* Even a child block does not mean that all logs of b have been
+     pushed already, as the subscriptions are not ordered.  */
+  logs.AddHeader (Header (12, "c", "b"), FULL_BLOOM);
+  EXPECT_FALSE (logs.GetLogs ("b", res));
+  EXPECT_FALSE (logs.GetLogs ("c", res));
+}
+
+TEST_F (PushedLogsTests, Removed)
+{
+  std::vector<Json::Value> res;
+
+  logs.AddLog (Log (10, "a", 0, 1));
+  logs.AddLog (Log (10, "a", 0, 1, true));
+  logs.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+
+  ASSERT_TRUE (logs.GetLogs ("a", res));
+  EXPECT_TRUE (res.empty ());
+}
+
+TEST_F (PushedLogsTests, MovesDespiteBloom)
+{
+  std::vector<Json::Value> res;
+  logs.AddLog (Log (10, "a", 0, 1));
+  logs.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+  EXPECT_FALSE (logs.GetLogs ("a", res));
+}
+
+TEST_F (PushedLogsTests, NotActive)
+{
+  PushedLogs inactive(10, "0x12", "0x34");
+  inactive.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+
+  std::vector<Json::Value> res;
+  EXPECT_FALSE (inactive.GetLogs ("a", res));
+}
+
+TEST_F (PushedLogsTests, Pruning)
+{
+  std::vector<Json::Value> res;
+  logs.AddHeader (Header (10, "a", "x"), EMPTY_BLOOM);
+  logs.AddHeader (Header (20, "b", "y"), EMPTY_BLOOM);
+  EXPECT_TRUE (logs.GetLogs ("a", res));
+
+  logs.AddHeader (Header (21, "c", "b"), EMPTY_BLOOM);
+  EXPECT_FALSE (logs.GetLogs ("a", res));
+  EXPECT_TRUE (logs.GetLogs ("b", res));
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2024 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Benchmark for the end-to-end sync throughput of Xaya X on Ethereum.
+
+Xaya X is started with a fresh data directory against a mock EVM
+JSON-RPC server, which replays a recorded fixture of blocks and move logs
+with injected latency.  We measure the time until Xaya X is synced to
+the fixture's tip, and report blocks per second, RPC calls per block and
+the time the sync held the chain lock.
+
+If no existing fixture is given with --fixture, a new one is recorded
+first from a local test chain with moves in every block.  It can be
+saved with --save_fixture for reuse, so that different versions can be
+compared on the exact same data.
+
+This is not a regression test and thus not run by "make check".
+"""
+
+
+from xayax import eth, replay, testcase
+
+import glob
+import json
+import os
+import os.path
+import re
+import time
+
+
+class SyncBenchFixture (testcase.Fixture):
+
+  def addArguments (self, parser):
+    parser.add_argument ("--xeth_binary", default="",
+                         help="xayax-eth binary to use")
+    parser.add_argument ("--fixture", default="",
+                         help="recorded fixture to replay")
+    parser.add_argument ("--save_fixture", default="",
+                         help="file to save a newly recorded fixture to")
+    parser.add_argument ("--blocks", type=int, default=500,
+                         help="number of blocks to record for a new fixture")
+    parser.add_argument ("--moves_per_block", type=int, default=5,
+                         help="number of moves per block for a new fixture")
+    parser.add_argument ("--latency_ms", type=float, default=10,
+                         help="latency to inject for each RPC request")
+    parser.add_argument ("--blockcache", default="none",
+                         choices=["none", "memory", "lmdb"],
+                         help="block cache to use in Xaya X")
+    parser.add_argument ("--runs", type=int, default=1,
+                         help="number of times to sync from scratch")
+    parser.add_argument ("--xeth_args", default="",
+                         help="extra arguments for xayax-eth"
+                              " (separated by spaces)")
+
+  def getXethBinary (self):
+    if self.args.xeth_binary:
+      return self.args.xeth_binary
+
+    top_builddir = os.getenv ("top_builddir")
+    if top_builddir is None:
+      top_builddir = "../.."
+    return os.path.join (top_builddir, "eth", "xayax-eth")
+
+  def recordFixture (self):
+    """
+    Records a new fixture from a local test chain.
+    """
+
+    self.mainLogger.info ("Recording fixture with %d blocks..."
+                            % self.args.blocks)
+
+    env = eth.Environment (self.basedir, self.portgen,
+                           [self.getXethBinary ()])
+    with env.run ():
+      names = ["bench%d" % i for i in range (self.args.moves_per_block)]
+      for nm in names:
+        env.register ("p", nm)
+      env.generate (1)
+
+      for i in range (self.args.blocks):
+        for nm in names:
+          env.move ("p", nm, json.dumps ({"g": {"bench": {"block": i}}}))
+        env.generate (1)
+
+      _, tipHeight = env.getChainTip ()
+      return replay.record (env.createEvmRpc (),
+                            env.contracts.registry.address, 0, tipHeight)
+
+  def getLockHeldMs (self, datadir):
+    """
+    Extracts the chain lock time reported by the last catch-up summary
+    in the logs of Xaya X.
+    """
+
+    pattern = re.compile (r"Caught up to height \d+: .*"
+                          r" chain lock held for ([0-9.e+]+) ms")
+
+    res = None
+    for fileName in glob.glob (os.path.join (datadir, "*.INFO")):
+      with open (fileName, "rt") as f:
+        for line in f:
+          m = pattern.search (line)
+          if m:
+            res = float (m.group (1))
+
+    return res
+
+  def runSync (self, server, fixture, extraArgs):
+    """
+    Runs Xaya X with a fresh data directory until it is synced to the
+    fixture's tip, and returns the elapsed time in seconds and the chain
+    lock time in milliseconds.
+    """
+
+    tipHash = fixture["blocks"][-1]["hash"]
+    assert tipHash[:2] == "0x"
+    tipHash = tipHash[2:]
+
+    # The replayed chain starts at height zero, so that we need to allow
+    # a reorg depth of the full chain for a cold start from genesis.
+    cmd = [self.getXethBinary ()] + extraArgs
+    cmd.append ("--max_reorg_depth=%d" % (len (fixture["blocks"]) - 1))
+
+    instance = eth.Instance (self.basedir, self.portgen, cmd)
+    server.resetStats ()
+    start = time.monotonic ()
+    with instance.run (fixture["contract"], server.url, sanityChecks=False):
+      rpc = instance.createRpc ()
+      while rpc.getblockchaininfo ()["bestblockhash"] != tipHash:
+        time.sleep (0.01)
+      elapsed = time.monotonic () - start
+
+    return elapsed, self.getLockHeldMs (instance.datadir)
+
+
+if __name__ == "__main__":
+  with SyncBenchFixture () as f:
+    if f.args.fixture:
+      fixture = replay.loadFixture (f.args.fixture)
+    else:
+      fixture = f.recordFixture ()
+      if f.args.save_fixture:
+        replay.saveFixture (f.args.save_fixture, fixture)
+        f.mainLogger.info ("Saved fixture to %s" % f.args.save_fixture)
+
+    extraArgs = []
+    if f.args.blockcache == "memory":
+      extraArgs.append ("--blockcache_memory")
+    elif f.args.blockcache == "lmdb":
+      # The LMDB cache is kept between runs, so that later runs can
+      # benefit from it.
+      cacheDir = os.path.join (f.basedir, "blockcache")
+      os.makedirs (cacheDir, exist_ok=True)
+      extraArgs.append ("--blockcache_lmdb=%s" % cacheDir)
+    extraArgs.extend ([a for a in f.args.xeth_args.split (" ") if a])
+
+    numBlocks = len (fixture["blocks"])
+    server = replay.ReplayServer (("localhost", next (f.portgen)), fixture,
+                                  latency=f.args.latency_ms / 1_000)
+    with server.run ():
+      for i in range (f.args.runs):
+        elapsed, lockMs = f.runSync (server, fixture, extraArgs)
+        requests, calls = server.getStats ()
+        totalCalls = sum (calls.values ())
+
+        f.mainLogger.info ("Run %d: synced %d blocks in %.2f s"
+                              % (i + 1, numBlocks, elapsed))
+        f.mainLogger.info ("  %.1f blocks/s" % (numBlocks / elapsed))
+        f.mainLogger.info ("  %.2f RPC calls per block (%.2f HTTP requests)"
+                              % (totalCalls / numBlocks,
+                                 requests / numBlocks))
+        for method, cnt in sorted (calls.items ()):
+          f.mainLogger.info ("    %s: %d" % (method, cnt))
+        if lockMs is None:
+          f.mainLogger.info ("  chain lock time not found in the logs")
+        else:
+          f.mainLogger.info ("  chain lock held for %.1f ms (%.3f ms per block)"
+                                % (lockMs, lockMs / numBlocks))
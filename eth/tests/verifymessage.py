@@ -1,6 +1,6 @@
 #!/usr/bin/env python3
 
-# Copyright (C) 2021-2022 The Xaya developers
+# Copyright (C) 2021-2024 The Xaya developers
 # Distributed under the MIT software license, see the accompanying
 # file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -50,3 +50,23 @@ if __name__ == "__main__":
     addr = f.env.createSignerAddress ()
     sgn = f.env.signMessage (addr, msg)
     f.assertEqual (verify (xrpc, addr, msg, sgn), True)
+
+    # Verifying the same signature again is answered from the cache
+    # and must give the same result.
+    f.assertEqual (verify (xrpc, addr, msg, sgn), True)
+    f.assertEqual (verify (xrpc, addr, "wrong", sgn), False)
+
+    # Test batched verification with verifymessages.
+    requests = [
+      {"message": msg, "signature": sgn},
+      {"address": addr, "message": msg, "signature": sgn},
+      {"address": addr, "message": "wrong", "signature": sgn},
+      {"message": msg, "signature": invalidSgn},
+    ]
+    f.assertEqual (xrpc.verifymessages (requests=requests), [
+      {"valid": True, "address": addr},
+      True,
+      False,
+      {"valid": False},
+    ])
+    f.assertEqual (xrpc.verifymessages (requests=[]), [])
@@ -34,11 +34,15 @@ private:
   static constexpr int ID_NEW_HEADS = 1;
   /** ID value sent for the subscribe request to new pendings.  */
   static constexpr int ID_PENDING_TX = 2;
+  /** ID value sent for the subscribe request to logs.  */
+  static constexpr int ID_LOGS = 3;
 
   /** The subscription ID for new heads.  */
   std::string subNewHeads;
   /** The subscription ID for pending transactions.  */
   std::string subPendingTx;
+  /** The subscription ID for logs.  */
+  std::string subLogs;
 
   /** The callbacks to invoke.  */
   Callbacks& cb;
@@ -67,14 +71,21 @@ private:
 
   /**
    * Sends an eth_subscribe method call with the given ID and the
-   * given subscription parameter.
+   * given subscription parameter, plus an extra parameter (like the
+   * filter for logs) if it is not null.
    */
   void SendSubscribe (Client::connection_ptr conn,
-                      int id, const std::string& type);
+                      int id, const std::string& type,
+                      const Json::Value& extra = Json::Value ());
 
 public:
 
-  explicit Connection (const std::string& url, Callbacks& c);
+  /**
+   * Opens the connection.  If logsFilter is not null, we also subscribe
+   * to logs with it.
+   */
+  explicit Connection (const std::string& url, const Json::Value& logsFilter,
+                       Callbacks& c);
   ~Connection ();
 
   /**
@@ -85,7 +96,7 @@ public:
 };
 
 WebSocketSubscriber::Connection::Connection (
-    const std::string& url, Callbacks& c)
+    const std::string& url, const Json::Value& logsFilter, Callbacks& c)
   : cb(c), shouldStop(false)
 {
   try
@@ -94,9 +105,13 @@ WebSocketSubscriber::Connection::Connection (
       endpoint.init_asio ();
 
       endpoint.set_open_handler (
-        [this] (const websocketpp::connection_hdl h)
+        [this, logsFilter] (const websocketpp::connection_hdl h)
           {
             auto conn = endpoint.get_con_from_hdl (h);
+            /* Subscribe to logs first, so that they are active by the
+               time we receive the first new head.  */
+            if (!logsFilter.isNull ())
+              SendSubscribe (conn, ID_LOGS, "logs", logsFilter);
             SendSubscribe (conn, ID_NEW_HEADS, "newHeads");
           });
 
@@ -166,7 +181,7 @@ WebSocketSubscriber::Connection::EnablePending ()
 void
 WebSocketSubscriber::Connection::SendSubscribe (
     const Client::connection_ptr conn,
-    const int id, const std::string& type)
+    const int id, const std::string& type, const Json::Value& extra)
 {
   Json::Value req(Json::objectValue);
 
@@ -176,6 +191,8 @@ WebSocketSubscriber::Connection::SendSubscribe (
 
   Json::Value params(Json::arrayValue);
   params.append (type);
+  if (!extra.isNull ())
+    params.append (extra);
   req["params"] = params;
 
   std::ostringstream out;
@@ -206,6 +223,12 @@ WebSocketSubscriber::Connection::HandleMessage (
           LOG (INFO) << "Subscribed to pending transactions: " << subPendingTx;
           break;
 
+        case ID_LOGS:
+          subLogs = data["result"].asString ();
+          LOG (INFO) << "Subscribed to logs: " << subLogs;
+          cb.LogsSubscribed ();
+          break;
+
         default:
           LOG (FATAL) << "Unexpected ID received: " << id;
         }
@@ -223,13 +246,18 @@ WebSocketSubscriber::Connection::HandleMessage (
       if (sub == subNewHeads)
         {
           CHECK (result.isObject ());
-          cb.NewTip (result["hash"].asString ());
+          cb.NewTip (result);
         }
       else if (sub == subPendingTx)
         {
           CHECK (result.isString ());
           cb.NewPendingTx (result.asString ());
         }
+      else if (sub == subLogs)
+        {
+          CHECK (result.isObject ());
+          cb.NewLog (result);
+        }
     }
 }
 
@@ -247,7 +275,15 @@ WebSocketSubscriber::~WebSocketSubscriber ()
 void
 WebSocketSubscriber::Start (Callbacks& cb)
 {
-  connection = std::make_unique<Connection> (endpoint, cb);
+  connection = std::make_unique<Connection> (endpoint, logsFilter, cb);
+}
+
+void
+WebSocketSubscriber::EnableLogs (const Json::Value& filter)
+{
+  CHECK (connection == nullptr) << "WebSocketSubscriber is already started";
+  CHECK (filter.isObject ());
+  logsFilter = filter;
 }
 
 void
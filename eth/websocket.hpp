@@ -5,6 +5,8 @@
 #ifndef XAYAX_ETH_WEBSOCKET_HPP
 #define XAYAX_ETH_WEBSOCKET_HPP
 
+#include <json/json.h>
+
 #include <memory>
 #include <string>
 
@@ -26,6 +28,12 @@ private:
   /** The endpoint to connect to.  */
   const std::string endpoint;
 
+  /**
+   * The filter for the logs subscription, or null if we do not
+   * subscribe to logs.
+   */
+  Json::Value logsFilter;
+
   /** The active connection (if any).  */
   std::unique_ptr<Connection> connection;
 
@@ -42,6 +50,13 @@ public:
    */
   void Start (Callbacks& cb);
 
+  /**
+   * Requests a subscription to logs matching the given filter (as for
+   * eth_getLogs, but without block range).  This must be called before
+   * Start.
+   */
+  void EnableLogs (const Json::Value& filter);
+
   /**
    * Adds a subscription for pending moves to the already running listener.
    */
@@ -65,10 +80,11 @@ public:
   virtual ~Callbacks () = default;
 
   /**
-   * Invoked when a new chain tip is found.
+   * Invoked when a new chain tip is found, with its block header
+   * as sent in the newHeads notification.
    */
   virtual void
-  NewTip (const std::string& tip)
+  NewTip (const Json::Value& head)
   {}
 
   /**
@@ -78,6 +94,23 @@ public:
   NewPendingTx (const std::string& txid)
   {}
 
+  /**
+   * Invoked when the logs subscription has been confirmed.  All logs
+   * emitted by the node afterwards will be notified.
+   */
+  virtual void
+  LogsSubscribed ()
+  {}
+
+  /**
+   * Invoked when a log entry is pushed through the logs subscription.
+   * This includes entries with "removed" set, when the block they
+   * are in has been detached in a reorg.
+   */
+  virtual void
+  NewLog (const Json::Value& log)
+  {}
+
 };
 
 } // namespace xayax
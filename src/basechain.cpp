@@ -4,6 +4,8 @@
 
 #include "basechain.hpp"
 
+#include "private/executor.hpp"
+
 namespace xayax
 {
 
@@ -30,4 +32,45 @@ BaseChain::PendingMoves (const std::vector<MoveData>& moves)
     cb->PendingMoves (moves);
 }
 
+std::vector<BlockData>
+BaseChain::GetBlockHeaders (const uint64_t start, const uint64_t count)
+{
+  auto res = GetBlockRange (start, count);
+  for (auto& blk : res)
+    {
+      blk.moves.clear ();
+      blk.gameIndex.reset ();
+      blk.serialised.reset ();
+    }
+  return res;
+}
+
+std::vector<int64_t>
+BaseChain::GetMainchainHeights (const std::vector<std::string>& hashes)
+{
+  std::vector<int64_t> res;
+  res.reserve (hashes.size ());
+  for (const auto& h : hashes)
+    res.push_back (GetMainchainHeight (h));
+  return res;
+}
+
+std::future<std::vector<BlockData>>
+BaseChain::GetBlockRangeAsync (const uint64_t start, const uint64_t count)
+{
+  return Executor::Shared ().Submit ([this, start, count] ()
+    {
+      return GetBlockRange (start, count);
+    });
+}
+
+std::future<int64_t>
+BaseChain::GetMainchainHeightAsync (const std::string& hash)
+{
+  return Executor::Shared ().Submit ([this, hash] ()
+    {
+      return GetMainchainHeight (hash);
+    });
+}
+
 } // namespace xayax
@@ -8,6 +8,7 @@
 #include "blockdata.hpp"
 
 #include <cstdint>
+#include <future>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -102,12 +103,66 @@ public:
   virtual std::vector<BlockData> GetBlockRange (uint64_t start,
                                                 uint64_t count) = 0;
 
+  /**
+   * Retrieves the block with the given hash with all associated data,
+   * no matter whether or not it is on the main chain.  Implementing this
+   * is optional; if it is implemented, the sync uses it to attach a new tip
+   * right away when it gets notified about it and it builds on the current
+   * tip, without any further queries.  Returns false if the block is not
+   * known or this is not supported (which is the default).
+   */
+  virtual bool
+  GetBlockByHash (const std::string& hash, BlockData& blk)
+  {
+    return false;
+  }
+
   /**
    * Queries for a block by hash, and returns that block's height
    * if it is known and on the main chain, and -1 otherwise.
    */
   virtual int64_t GetMainchainHeight (const std::string& hash) = 0;
 
+  /**
+   * Retrieves a slice of block headers on the main chain, like
+   * GetBlockRange but without the moves.  This is used where only the
+   * hashes and heights of blocks are needed, and implementations can
+   * override it to avoid querying for the moves.
+   *
+   * The default implementation calls GetBlockRange and drops the moves.
+   */
+  virtual std::vector<BlockData> GetBlockHeaders (uint64_t start,
+                                                  uint64_t count);
+
+  /**
+   * Looks up the main-chain heights of multiple blocks at once, returning
+   * for each hash in order the same as GetMainchainHeight would.
+   * Implementations can override this to batch the lookups.
+   *
+   * The default implementation calls GetMainchainHeight for each hash.
+   */
+  virtual std::vector<int64_t> GetMainchainHeights (
+      const std::vector<std::string>& hashes);
+
+  /**
+   * Starts a GetBlockRange request in the background and returns a future
+   * for its result.  This allows callers to overlap multiple requests, or
+   * a request with other work.
+   *
+   * The default implementation runs GetBlockRange on a shared pool of
+   * worker threads.  Implementations can override it with something that
+   * works better for them.
+   */
+  virtual std::future<std::vector<BlockData>> GetBlockRangeAsync (
+      uint64_t start, uint64_t count);
+
+  /**
+   * Starts a GetMainchainHeight request in the background, similar to
+   * GetBlockRangeAsync.
+   */
+  virtual std::future<int64_t> GetMainchainHeightAsync (
+      const std::string& hash);
+
   /**
    * Returns the current mempool of pending transactions (the txids),
    * where the order may be significant.  This is used for tracking
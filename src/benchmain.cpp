@@ -0,0 +1,26 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <benchmark/benchmark.h>
+
+#include <glog/logging.h>
+
+int
+main (int argc, char** argv)
+{
+  google::InitGoogleLogging (argv[0]);
+
+  /* The code under benchmark logs e.g. every new tip at INFO level,
+     which would distort the timings.  */
+  FLAGS_minloglevel = google::GLOG_WARNING;
+
+  benchmark::Initialize (&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments (argc, argv))
+    return 1;
+
+  benchmark::RunSpecifiedBenchmarks ();
+  benchmark::Shutdown ();
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "benchutils.hpp"
+
+#include <sstream>
+
+namespace xayax
+{
+
+std::string
+BlockGenerator::RandomHex (const size_t len)
+{
+  static const char* digits = "0123456789abcdef";
+
+  std::string res;
+  res.reserve (len);
+  for (size_t i = 0; i < len; ++i)
+    res.push_back (digits[rnd () % 16]);
+
+  return res;
+}
+
+std::string
+BlockGenerator::GameId (const unsigned n)
+{
+  std::ostringstream res;
+  res << "game" << n;
+  return res.str ();
+}
+
+std::string
+BlockGenerator::NewHash ()
+{
+  ++counter;
+
+  /* Make sure the hashes are unique even with random collisions, by
+     including the counter in them.  */
+  std::ostringstream res;
+  res << RandomHex (48);
+  res.width (16);
+  res.fill ('0');
+  res << std::hex << counter;
+
+  return res.str ();
+}
+
+MoveData
+BlockGenerator::NewMove ()
+{
+  MoveData res;
+  res.txid = NewHash ();
+  res.ns = "p";
+
+  std::ostringstream name;
+  name << "player" << (rnd () % 10'000);
+  res.name = name.str ();
+
+  /* The move itself resembles typical game moves, with some nested
+     objects, numbers and strings.  */
+  const std::string game = GameId (rnd () % numGames);
+  std::ostringstream mv;
+  mv << R"({"g":{")" << game << R"(":{"m":{"x":)" << (rnd () % 1'000)
+     << R"(,"y":)" << (rnd () % 1'000)
+     << R"(,"wp":[[1,2],[3,4],[5,6]])"
+     << R"(,"msg":")" << RandomHex (32) << R"("}}}})";
+  res.mv = mv.str ();
+
+  if (rnd () % 10 == 0)
+    res.burns.emplace (game, 0.01);
+
+  res.metadata = Json::Value (Json::objectValue);
+  res.metadata["btxid"] = NewHash ();
+  res.metadata["out"] = Json::Value (Json::objectValue);
+  res.metadata["out"]["0x" + RandomHex (40)] = "1.5";
+
+  return res;
+}
+
+BlockData
+BlockGenerator::NewBlock (const std::string& parent, const uint64_t height,
+                          const unsigned numMoves)
+{
+  BlockData res;
+  res.hash = NewHash ();
+  res.parent = parent;
+  res.height = height;
+  res.rngseed = RandomHex (64);
+
+  res.metadata = Json::Value (Json::objectValue);
+  res.metadata["timestamp"] = static_cast<Json::Int64> (1'700'000'000 + height);
+  res.metadata["mediantime"]
+      = static_cast<Json::Int64> (1'700'000'000 + height);
+
+  for (unsigned i = 0; i < numMoves; ++i)
+    res.moves.push_back (NewMove ());
+
+  return res;
+}
+
+std::vector<BlockData>
+BlockGenerator::NewChain (const BlockData& parent, const unsigned num,
+                          const unsigned movesPerBlock)
+{
+  std::vector<BlockData> res;
+  res.reserve (num);
+  const BlockData* prev = &parent;
+  for (unsigned i = 0; i < num; ++i)
+    {
+      res.push_back (NewBlock (prev->hash, prev->height + 1, movesPerBlock));
+      prev = &res.back ();
+    }
+
+  return res;
+}
+
+} // namespace xayax
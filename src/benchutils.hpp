@@ -0,0 +1,89 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_BENCHUTILS_HPP
+#define XAYAX_BENCHUTILS_HPP
+
+#include "blockdata.hpp"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Generator for synthetic (but realistic-looking) blocks and moves
+ * for use in benchmarks.  It is deterministic for a given seed.
+ */
+class BlockGenerator
+{
+
+private:
+
+  /** The random number generator used.  */
+  std::mt19937_64 rnd;
+
+  /** Counter used to produce unique hashes and txids.  */
+  uint64_t counter = 0;
+
+  /** Number of distinct games that moves are sent to.  */
+  unsigned numGames = 1;
+
+  /**
+   * Returns a random hex string of the given length (in characters).
+   */
+  std::string RandomHex (size_t len);
+
+public:
+
+  explicit BlockGenerator (const uint64_t seed = 42)
+    : rnd(seed)
+  {}
+
+  /**
+   * Sets the number of games that generated moves are distributed over.
+   */
+  void
+  SetNumGames (const unsigned n)
+  {
+    numGames = n;
+  }
+
+  /**
+   * Returns the game ID for the game with the given number.
+   */
+  static std::string GameId (unsigned n);
+
+  /**
+   * Returns a new unique 256-bit hash as hex string.
+   */
+  std::string NewHash ();
+
+  /**
+   * Generates a player move with typical structure and size, for
+   * one (random) of the games.
+   */
+  MoveData NewMove ();
+
+  /**
+   * Generates a block with the given parent and height, and containing
+   * the given number of moves.
+   */
+  BlockData NewBlock (const std::string& parent, uint64_t height,
+                      unsigned numMoves);
+
+  /**
+   * Generates a chain of blocks, starting from the given parent.
+   */
+  std::vector<BlockData> NewChain (const BlockData& parent, unsigned num,
+                                   unsigned movesPerBlock);
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_BENCHUTILS_HPP
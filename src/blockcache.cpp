@@ -4,13 +4,215 @@
 
 #include "blockcache.hpp"
 
+#include "metrics.hpp"
+
+#include "private/compactblock.hpp"
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>
+
 namespace xayax
 {
 
+DEFINE_int32 (xayax_blockcache_warmup_chunk, 1'000,
+              "number of blocks requested at once by the block cache warm-up");
+DEFINE_int32 (xayax_blockcache_warmup_interval_ms, 1'000,
+              "pause in milliseconds between chunks of the block cache"
+              " warm-up, to limit the load it puts onto the base chain");
+
 /* ************************************************************************** */
 
+namespace
+{
+
+/**
+ * RAII helper that increments a counter (protected by a mutex) for as long
+ * as it is in scope.
+ */
+class ActiveRequest
+{
+
+private:
+
+  std::mutex& mut;
+  unsigned& counter;
+
+public:
+
+  explicit ActiveRequest (std::mutex& m, unsigned& c)
+    : mut(m), counter(c)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ++counter;
+  }
+
+  ~ActiveRequest ()
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    CHECK_GT (counter, 0);
+    --counter;
+  }
+
+  ActiveRequest () = delete;
+  ActiveRequest (const ActiveRequest&) = delete;
+  void operator= (const ActiveRequest&) = delete;
+
+};
+
+/**
+ * Metrics for the blocks requested through the cache.
+ */
+struct CacheMetrics
+{
+
+  MetricsCounter& hits;
+  MetricsCounter& misses;
+  MetricsCounter& bypassed;
+
+  CacheMetrics ()
+    : hits(Get ("hit")), misses(Get ("miss")), bypassed(Get ("bypass"))
+  {}
+
+  static MetricsCounter&
+  Get (const std::string& result)
+  {
+    return MetricsRegistry::Get ().GetCounter (
+        "xayax_blockcache_blocks_total",
+        "Number of blocks requested through the block cache, by whether"
+        " they were served from the cache, fetched from the base chain"
+        " or too close to the tip for caching",
+        {{"result", result}});
+  }
+
+};
+
+CacheMetrics&
+GetCacheMetrics ()
+{
+  static CacheMetrics metrics;
+  return metrics;
+}
+
+} // anonymous namespace
+
+BlockCacheChain::~BlockCacheChain ()
+{
+  if (warmup == nullptr)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stopWarmup = true;
+    cvWarmup.notify_all ();
+  }
+
+  warmup->join ();
+  warmup.reset ();
+}
+
+void
+BlockCacheChain::EnableWarmup (const uint64_t fromHeight)
+{
+  CHECK (warmup == nullptr) << "Warm-up is already enabled";
+  CHECK_GT (FLAGS_xayax_blockcache_warmup_chunk, 0)
+      << "Invalid --xayax_blockcache_warmup_chunk";
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    warmHeight = std::max (fromHeight, store.GetWarmHeight ());
+    LOG (INFO) << "Starting block cache warm-up from height " << warmHeight;
+  }
+
+  warmup = std::make_unique<std::thread> ([this] ()
+    {
+      RunWarmup ();
+    });
+}
+
+uint64_t
+BlockCacheChain::GetWarmHeight ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return warmHeight;
+}
+
+void
+BlockCacheChain::RunWarmup ()
+{
+  const std::chrono::milliseconds interval(
+      FLAGS_xayax_blockcache_warmup_interval_ms);
+
+  std::unique_lock<std::mutex> lock(mut);
+  while (!stopWarmup)
+    {
+      lock.unlock ();
+      WarmupStep ();
+      lock.lock ();
+
+      /* Wait in any case before the next step, which rate-limits the
+         work we do, and also makes sure we do not hog the base chain.  */
+      cvWarmup.wait_for (lock, interval, [this] () { return stopWarmup; });
+    }
+}
+
+bool
+BlockCacheChain::WarmupStep ()
+{
+  uint64_t start, count;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    /* Only do work if we are otherwise idle.  */
+    if (activeRequests > 0)
+      return false;
+
+    /* The last block that we can cache is the one with at least minDepth
+       blocks after it (same condition as in GetBlockRange).  */
+    if (lastTipHeight < minDepth || warmHeight + minDepth > lastTipHeight)
+      return false;
+    const uint64_t maxHeight = lastTipHeight - minDepth;
+
+    start = warmHeight;
+    count = std::min<uint64_t> (FLAGS_xayax_blockcache_warmup_chunk,
+                                maxHeight - start + 1);
+
+    /* If the chunk is already cached (e.g. served to a GSP before),
+       we can just skip over it.  */
+    if (store.GetRange (start, count).size () == count)
+      {
+        warmHeight = start + count;
+        store.SetWarmHeight (warmHeight);
+        VLOG (1) << "Warm-up range " << start << "+" << count << " is cached";
+        return true;
+      }
+  }
+
+  auto blocks = base.GetBlockRange (start, count);
+  for (auto& blk : blocks)
+    blk.CacheSerialised ();
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  /* If we got fewer blocks than requested for some reason (e.g. a reorg
+     of the base chain), it does not matter.  We just store what we have,
+     and continue with the rest next time.  */
+  if (blocks.empty ())
+    return false;
+  CHECK_EQ (blocks.front ().height, start);
+  store.Store (blocks);
+
+  warmHeight = blocks.back ().height + 1;
+  store.SetWarmHeight (warmHeight);
+  VLOG (1)
+      << "Warm-up stored range " << start << "+" << blocks.size ()
+      << " in the cache, warm up to height " << warmHeight;
+
+  return true;
+}
+
 void
 BlockCacheChain::SetCallbacks (Callbacks* c)
 {
@@ -36,46 +238,198 @@ BlockCacheChain::EnablePending ()
 uint64_t
 BlockCacheChain::GetTipHeight ()
 {
-  lastTipHeight = base.GetTipHeight ();
-  return lastTipHeight;
+  const uint64_t res = base.GetTipHeight ();
+
+  std::lock_guard<std::mutex> lock(mut);
+  lastTipHeight = res;
+
+  return res;
+}
+
+namespace
+{
+
+/**
+ * Checks if the given blocks form a chain, i.e. each block's parent is
+ * the previous block.
+ */
+bool
+IsChained (const std::vector<BlockData>& blocks)
+{
+  for (size_t i = 1; i < blocks.size (); ++i)
+    if (blocks[i].parent != blocks[i - 1].hash
+          || blocks[i].height != blocks[i - 1].height + 1)
+      return false;
+  return true;
+}
+
+} // anonymous namespace
+
+bool
+BlockCacheChain::FillGaps (const uint64_t start, const uint64_t count,
+                           std::vector<BlockData>& cached,
+                           std::vector<BlockData>& fetched)
+{
+  std::vector<BlockData> res;
+  bool complete = true;
+  unsigned numRanges = 0;
+
+  /* Fetches all blocks from the next height we need until the given end
+     height (exclusive) from the base chain.  */
+  uint64_t next = start;
+  const auto fetchUntil = [&] (const uint64_t end)
+    {
+      if (next >= end)
+        return;
+
+      auto part = base.GetBlockRange (next, end - next);
+      ++numRanges;
+      if (part.size () != end - next)
+        complete = false;
+
+      for (auto& blk : part)
+        {
+          blk.CacheSerialised ();
+          fetched.push_back (blk);
+          res.push_back (std::move (blk));
+        }
+      next = end;
+    };
+
+  for (auto& blk : cached)
+    {
+      const uint64_t h = blk.height;
+      CHECK_GE (h, next) << "Storage returned blocks out of order";
+      CHECK_LT (h, start + count) << "Storage returned block outside of range";
+
+      fetchUntil (h);
+      res.push_back (std::move (blk));
+      next = h + 1;
+    }
+  fetchUntil (start + count);
+
+  VLOG (1)
+      << "Fetched " << fetched.size () << " missing blocks for range "
+      << start << "+" << count << " in " << numRanges << " sub-ranges";
+
+  /* The cached blocks are finalised, but the base chain may have changed
+     in between (e.g. the range was just at the depth limit).  If anything
+     does not fit together, the caller falls back to a full query.  */
+  if (!complete || !IsChained (res))
+    {
+      LOG (WARNING)
+          << "Cached and fetched blocks for range " << start << "+" << count
+          << " do not match up";
+      return false;
+    }
+
+  cached = std::move (res);
+  return true;
 }
 
 std::vector<BlockData>
 BlockCacheChain::GetBlockRange (const uint64_t start, const uint64_t count)
 {
-  /* If this range is close to the tip, do not work with the cache at all
-     (neither try to query, as the blocks won't be there, nor store).  */
-  if (start + count + minDepth > lastTipHeight + 1)
+  std::vector<BlockData> res;
+  bool useCache;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    /* If this range is close to the tip, do not work with the cache at all
+       (neither try to query, as the blocks won't be there, nor store).  */
+    useCache = (start + count + minDepth <= lastTipHeight + 1);
+    if (!useCache)
+      {
+        VLOG (1)
+            << "Not using block cache for range "
+            << start << "+" << count
+            << " close to the tip @" << lastTipHeight;
+      }
+    else
+      {
+        /* Check if we have all blocks cached.  */
+        res = store.GetRange (start, count);
+        if (res.size () == count)
+          {
+            GetCacheMetrics ().hits.Inc (count);
+            VLOG (1)
+                << "All blocks for range " << start << "+" << count
+                << " cached";
+            return res;
+          }
+      }
+  }
+
+  /* Otherwise, query the base chain, and save in the cache (if not
+     close to the tip).  */
+  ActiveRequest active(mut, activeRequests);
+  auto& metrics = GetCacheMetrics ();
+  if (!useCache)
     {
-      VLOG (1)
-          << "Not using block cache for range "
-          << start << "+" << count
-          << " close to the tip @" << lastTipHeight;
-      return base.GetBlockRange (start, count);
+      auto bypassed = base.GetBlockRange (start, count);
+      metrics.bypassed.Inc (bypassed.size ());
+      return bypassed;
     }
 
-  /* Check if we have all blocks cached.  */
-  auto res = store.GetRange (start, count);
-  if (res.size () == count)
+  /* If some blocks are cached, we only query the missing ones.  */
+  std::vector<BlockData> fetched;
+  const std::vector<BlockData>* toStore = &fetched;
+  if (res.empty () || !FillGaps (start, count, res, fetched))
     {
-      VLOG (1) << "All blocks for range " << start << "+" << count << " cached";
-      return res;
+      res = base.GetBlockRange (start, count);
+
+      /* Index the moves by game before storing the blocks, so that the stored
+         (and returned) blocks carry the index.  This also serialises them
+         without holding the lock.  */
+      for (auto& blk : res)
+        blk.CacheSerialised ();
+
+      /* All blocks were fetched, so store them directly instead of
+         copying them over to fetched first.  */
+      fetched.clear ();
+      toStore = &res;
     }
 
-  /* Otherwise, query the base chain, and save in the cache.  */
-  res = base.GetBlockRange (start, count);
-  store.Store (res);
-  VLOG (1) << "Stored range " << start << "+" << count << " in the cache";
+  metrics.misses.Inc (toStore->size ());
+  if (res.size () > toStore->size ())
+    metrics.hits.Inc (res.size () - toStore->size ());
+
+  std::lock_guard<std::mutex> lock(mut);
+  store.Store (*toStore);
+  VLOG (1)
+      << "Stored " << toStore->size () << " blocks of range "
+      << start << "+" << count << " in the cache";
 
   return res;
 }
 
+bool
+BlockCacheChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  /* This is used for new tips, which are never in the cache.  */
+  return base.GetBlockByHash (hash, blk);
+}
+
 int64_t
 BlockCacheChain::GetMainchainHeight (const std::string& hash)
 {
   return base.GetMainchainHeight (hash);
 }
 
+std::vector<BlockData>
+BlockCacheChain::GetBlockHeaders (const uint64_t start, const uint64_t count)
+{
+  /* Headers are cheap to get from the base chain, and we do not want to
+     pollute the cache with blocks that are missing their moves.  */
+  return base.GetBlockHeaders (start, count);
+}
+
+std::vector<int64_t>
+BlockCacheChain::GetMainchainHeights (const std::vector<std::string>& hashes)
+{
+  return base.GetMainchainHeights (hashes);
+}
+
 std::vector<std::string>
 BlockCacheChain::GetMempool ()
 {
@@ -104,38 +458,39 @@ BlockCacheChain::GetVersion ()
 
 /* ************************************************************************** */
 
+InMemoryBlockStorage::InMemoryBlockStorage () = default;
+InMemoryBlockStorage::~InMemoryBlockStorage () = default;
+
 void
 InMemoryBlockStorage::Store (const std::vector<BlockData>& blocks)
 {
   for (const auto& blk : blocks)
-    data.emplace (blk.height, blk);
+    data[blk.height] = std::make_unique<CompactBlock> (blk);
 }
 
 std::vector<BlockData>
 InMemoryBlockStorage::GetRange (const uint64_t start, const uint64_t count)
 {
-  /* Look for the starting height.  If we find it, go from there (as the
-     map is ordered) and see if we can get a consecutive range.  */
-  auto mit = data.find (start);
-  if (mit == data.end ())
-    return {};
-
   std::vector<BlockData> res;
-  res.push_back (mit->second);
-
-  while (res.size () < count)
-    {
-      ++mit;
-      if (mit == data.end ())
-        return {};
-      if (mit->second.height != res.back ().height + 1)
-        return {};
-      res.push_back (mit->second);
-    }
+  const auto end = data.lower_bound (start + count);
+  for (auto mit = data.lower_bound (start); mit != end; ++mit)
+    res.push_back (mit->second->ToBlockData ());
 
   return res;
 }
 
+uint64_t
+InMemoryBlockStorage::GetWarmHeight ()
+{
+  return warmHeight;
+}
+
+void
+InMemoryBlockStorage::SetWarmHeight (const uint64_t h)
+{
+  warmHeight = h;
+}
+
 /* ************************************************************************** */
 
 } // namespace xayax
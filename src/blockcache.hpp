@@ -7,12 +7,17 @@
 
 #include "basechain.hpp"
 
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 namespace xayax
 {
 
+class CompactBlock;
+
 /**
  * This is an implementation of BaseChain, which uses another BaseChain
  * as "ground truth".  On top of that, it caches blocks seen to some storage
@@ -25,6 +30,10 @@ namespace xayax
  * the underlying blockchain client compared to using the underlying
  * BaseChain directly, but that it avoids expensive GetBlockRange calls
  * where it already retrieved those blocks previously.
+ *
+ * Optionally, a warm-up worker can be enabled.  In that case, extra calls
+ * are made explicitly in the background (while no other requests are
+ * being made) to fill the cache with all finalised blocks.
  */
 class BlockCacheChain : public BaseChain
 {
@@ -41,6 +50,14 @@ private:
   /** The storage to use for block caching.  */
   Storage& store;
 
+  /**
+   * Lock for the storage and lastTipHeight.  The storage implementations
+   * need not be thread-safe, but our methods may be called in parallel
+   * (e.g. from the sync worker and prefetching as well as RPC calls).
+   * The lock is not held while the base chain is queried.
+   */
+  std::mutex mut;
+
   /**
    * Block depth behind tip before blocks are cached.  A block is cached
    * if there are at least minDepth blocks following it in the chain.
@@ -56,12 +73,70 @@ private:
    */
   uint64_t lastTipHeight = 0;
 
+  /**
+   * Number of GetBlockRange calls currently querying the base chain.
+   * The warm-up worker only does its work while this is zero.
+   */
+  unsigned activeRequests = 0;
+
+  /**
+   * The next height to be fetched by the warm-up worker.  All blocks from
+   * the warm-up start up to (excluding) this are in the cache.
+   */
+  uint64_t warmHeight = 0;
+
+  /** The warm-up worker thread, if enabled.  */
+  std::unique_ptr<std::thread> warmup;
+
+  /** Set to true to signal the warm-up worker to stop.  */
+  bool stopWarmup = false;
+
+  /** Condition variable used to wake up the warm-up worker.  */
+  std::condition_variable cvWarmup;
+
+  /**
+   * Fills in the blocks missing from a partial list of cached blocks
+   * by querying the base chain for them.  The blocks retrieved from the
+   * base chain are added to fetched.  On success, cached is replaced by the
+   * full range.  Returns false if the result is not a consistent chain,
+   * in which case the full range should be queried instead.
+   */
+  bool FillGaps (uint64_t start, uint64_t count,
+                 std::vector<BlockData>& cached,
+                 std::vector<BlockData>& fetched);
+
+  /**
+   * Runs the loop of the warm-up worker thread.
+   */
+  void RunWarmup ();
+
+  /**
+   * Performs one step of the warm-up, i.e. caches one chunk of blocks
+   * if there is anything to do.  Returns true if blocks were cached.
+   */
+  bool WarmupStep ();
+
 public:
 
   explicit BlockCacheChain (BaseChain& b, Storage& s, const uint64_t md)
     : base(b), store(s), minDepth(md)
   {}
 
+  ~BlockCacheChain ();
+
+  /**
+   * Starts the warm-up worker, which fills the cache in the background
+   * with all finalised blocks from the given height onwards.  If the storage
+   * has a persisted warm-up height beyond that, it resumes from there.
+   */
+  void EnableWarmup (uint64_t fromHeight);
+
+  /**
+   * Returns the current height of the warm-up worker, i.e. all blocks
+   * from the warm-up start until before it are cached.
+   */
+  uint64_t GetWarmHeight ();
+
   void SetCallbacks (Callbacks* c) override;
 
   void Start () override;
@@ -69,7 +144,12 @@ public:
   uint64_t GetTipHeight () override;
   std::vector<BlockData> GetBlockRange (uint64_t start,
                                         uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
   int64_t GetMainchainHeight (const std::string& hash) override;
+  std::vector<BlockData> GetBlockHeaders (uint64_t start,
+                                          uint64_t count) override;
+  std::vector<int64_t> GetMainchainHeights (
+      const std::vector<std::string>& hashes) override;
   std::vector<std::string> GetMempool () override;
   bool VerifyMessage (const std::string& msg,
                       const std::string& signature,
@@ -98,13 +178,31 @@ public:
   virtual void Store (const std::vector<BlockData>& blocks) = 0;
 
   /**
-   * Tries to retrieve blocks from the given range from storage.  If all
-   * of the blocks are cached, they should be returned in the right
-   * order.  Otherwise, a partial vector of the blocks that are known
-   * can be returned.
+   * Tries to retrieve blocks from the given range from storage.  All blocks
+   * in the range that are cached should be returned, ordered by height.
+   * If some are missing, the result has gaps, for which the caller will
+   * query the base chain instead.
    */
   virtual std::vector<BlockData> GetRange (uint64_t start, uint64_t count) = 0;
 
+  /**
+   * Returns the persisted progress of the warm-up worker, i.e. the height
+   * up to which (excluding) it has cached all blocks.  Returns zero if
+   * nothing is stored.  By default, the progress is not persisted.
+   */
+  virtual uint64_t
+  GetWarmHeight ()
+  {
+    return 0;
+  }
+
+  /**
+   * Persists the progress of the warm-up worker.
+   */
+  virtual void
+  SetWarmHeight (const uint64_t h)
+  {}
+
 };
 
 /**
@@ -117,13 +215,24 @@ class InMemoryBlockStorage : public BlockCacheChain::Storage
 
 private:
 
-  /** The blocks stored, keyed by height.  */
-  std::map<uint64_t, BlockData> data;
+  /**
+   * The blocks stored, keyed by height.  They are kept in their compact
+   * form, which needs much less memory and fewer allocations.
+   */
+  std::map<uint64_t, std::unique_ptr<CompactBlock>> data;
+
+  /** The warm-up progress.  */
+  uint64_t warmHeight = 0;
 
 public:
 
+  InMemoryBlockStorage ();
+  ~InMemoryBlockStorage ();
+
   void Store (const std::vector<BlockData>& blocks) override;
   std::vector<BlockData> GetRange (uint64_t start, uint64_t count) override;
+  uint64_t GetWarmHeight () override;
+  void SetWarmHeight (uint64_t h) override;
 
 };
 
@@ -164,6 +273,100 @@ public:
 
   void Store (const std::vector<BlockData>& blocks) override;
   std::vector<BlockData> GetRange (uint64_t start, uint64_t count) override;
+  uint64_t GetWarmHeight () override;
+  void SetWarmHeight (uint64_t h) override;
+
+};
+
+/**
+ * A storage tier that keeps recently used blocks in memory, in front of
+ * another (persistent) storage.  Blocks are held in serialised form, with
+ * a budget on the total number of bytes, evicting the least-recently
+ * used ones when it is exceeded.  Both lookups and stores go through to
+ * the underlying storage as needed.
+ */
+class LruBlockStorage : public BlockCacheChain::Storage
+{
+
+private:
+
+  class Implementation;
+
+  /** The implementation, which hides the LRU cache from this header.  */
+  std::unique_ptr<Implementation> impl;
+
+public:
+
+  /**
+   * Constructs the tier in front of the given storage, with the given
+   * budget (in bytes) of serialised block data to keep in memory.
+   */
+  explicit LruBlockStorage (BlockCacheChain::Storage& b, uint64_t maxBytes);
+
+  ~LruBlockStorage ();
+
+  void Store (const std::vector<BlockData>& blocks) override;
+  std::vector<BlockData> GetRange (uint64_t start, uint64_t count) override;
+  uint64_t GetWarmHeight () override;
+  void SetWarmHeight (uint64_t h) override;
+
+  /**
+   * Returns the number of blocks that were found in memory.
+   */
+  uint64_t GetHits () const;
+
+  /**
+   * Returns the number of blocks that were looked up and not found
+   * in memory.
+   */
+  uint64_t GetMisses () const;
+
+  /**
+   * Returns the number of bytes of block data held in memory.
+   */
+  uint64_t GetBytes () const;
+
+};
+
+/**
+ * An implementation of BlockCacheChain::Storage that uses a local LMDB
+ * database.  Blocks are keyed by their big-endian height, so that ranges
+ * map to ordered cursor scans.  Reads parse the block data directly from
+ * the memory-mapped database file without copying it first.
+ */
+class LmdbBlockStorage : public BlockCacheChain::Storage
+{
+
+private:
+
+  class Implementation;
+
+  /**
+   * The implementation, which depends on the LMDB library that is hidden
+   * from the public header here.
+   */
+  std::unique_ptr<Implementation> impl;
+
+public:
+
+  /**
+   * Constructs an instance, without opening a database yet.  Before it
+   * can be used, Open must be called.
+   */
+  LmdbBlockStorage ();
+
+  ~LmdbBlockStorage ();
+
+  /**
+   * Opens (or creates) the database in the given directory, with the
+   * given maximum size in bytes.  Returns false if that fails.
+   */
+  bool Open (const std::string& dir, uint64_t mapSize);
+
+  void Store (const std::vector<BlockData>& blocks) override;
+  std::vector<BlockData> GetRange (uint64_t start, uint64_t count) override;
+  uint64_t GetWarmHeight () override;
+  void SetWarmHeight (uint64_t h) override;
 
 };
 
@@ -8,18 +8,28 @@
 
 #include <mypp/tempdb.hpp>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <cstdlib>
+#include <experimental/filesystem>
 #include <sstream>
+#include <thread>
 
 namespace xayax
 {
+
+DECLARE_int32 (xayax_blockcache_warmup_chunk);
+DECLARE_int32 (xayax_blockcache_warmup_interval_ms);
+
 namespace
 {
 
+namespace fs = std::experimental::filesystem;
+
 using testing::ElementsAre;
 
 /** Environment variable holding the connection URL for the MySQL temp db.  */
@@ -84,21 +94,105 @@ TEST_F (InMemoryBlockStorageTests, NotFullRangeInStore)
 
   EXPECT_THAT (store.GetRange (9, 1), ElementsAre ());
   EXPECT_THAT (store.GetRange (14, 1), ElementsAre ());
-  EXPECT_THAT (store.GetRange (10, 5), ElementsAre ());
   EXPECT_THAT (store.GetRange (25, 1), ElementsAre ());
+
+  /* Partial ranges return the blocks that are there.  */
+  EXPECT_THAT (store.GetRange (12, 5),
+               ElementsAre (GetBlock (12), GetBlock (13),
+                            GetBlock (15), GetBlock (16)));
+  EXPECT_THAT (store.GetRange (8, 4),
+               ElementsAre (GetBlock (10), GetBlock (11)));
+  EXPECT_THAT (store.GetRange (24, 3), ElementsAre (GetBlock (24)));
 }
 
 /* ************************************************************************** */
 
-class BlockCacheChainTests : public testing::Test
+class LruBlockStorageTests : public testing::Test
 {
 
-private:
+protected:
 
-  InMemoryBlockStorage store;
+  InMemoryBlockStorage base;
+
+  /** Size of one serialised test block.  */
+  const size_t blockSize;
+
+  LruBlockStorageTests ()
+    : blockSize(GetBlock (10).Serialise ().size ())
+  {}
+
+};
+
+TEST_F (LruBlockStorageTests, ServesFromMemory)
+{
+  LruBlockStorage store(base, 100 * blockSize);
+  store.Store (GetRange (10, 10));
+  EXPECT_THAT (base.GetRange (10, 10), GetRange (10, 10));
+  EXPECT_EQ (store.GetBytes (), 10 * blockSize);
+
+  /* Modify the underlying storage, so that we can tell whether or not
+     the blocks were served from memory.  */
+  auto modified = GetBlock (12);
+  modified.hash = "modified";
+  base.Store ({modified});
+
+  EXPECT_THAT (store.GetRange (11, 3),
+               ElementsAre (GetBlock (11), GetBlock (12), GetBlock (13)));
+  EXPECT_EQ (store.GetHits (), 3);
+  EXPECT_EQ (store.GetMisses (), 0);
+}
+
+TEST_F (LruBlockStorageTests, FetchesMissingFromBase)
+{
+  base.Store (GetRange (10, 20));
+  LruBlockStorage store(base, 100 * blockSize);
+  store.Store ({GetBlock (12), GetBlock (15)});
+
+  EXPECT_THAT (store.GetRange (8, 10),
+               ElementsAre (GetBlock (10), GetBlock (11), GetBlock (12),
+                            GetBlock (13), GetBlock (14), GetBlock (15),
+                            GetBlock (16), GetBlock (17)));
+  EXPECT_EQ (store.GetHits (), 2);
+  EXPECT_EQ (store.GetMisses (), 8);
+
+  /* Now all existing blocks are in memory.  */
+  EXPECT_THAT (store.GetRange (10, 8), GetRange (10, 8));
+  EXPECT_EQ (store.GetHits (), 10);
+  EXPECT_EQ (store.GetMisses (), 8);
+}
+
+TEST_F (LruBlockStorageTests, MemoryBudget)
+{
+  base.Store (GetRange (10, 20));
+  LruBlockStorage store(base, 5 * blockSize);
+
+  EXPECT_THAT (store.GetRange (10, 20), GetRange (10, 20));
+  EXPECT_EQ (store.GetBytes (), 5 * blockSize);
+
+  /* Only the last blocks are still in memory.  */
+  EXPECT_THAT (store.GetRange (25, 5), GetRange (25, 5));
+  EXPECT_EQ (store.GetHits (), 5);
+  EXPECT_THAT (store.GetRange (10, 1), ElementsAre (GetBlock (10)));
+  EXPECT_EQ (store.GetHits (), 5);
+}
+
+TEST_F (LruBlockStorageTests, WarmHeight)
+{
+  LruBlockStorage store(base, 100 * blockSize);
+  store.SetWarmHeight (42);
+  EXPECT_EQ (base.GetWarmHeight (), 42);
+  EXPECT_EQ (store.GetWarmHeight (), 42);
+}
+
+/* ************************************************************************** */
+
+class BlockCacheChainTests : public testing::Test
+{
 
 protected:
 
+  InMemoryBlockStorage store;
+
   TestBaseChain base;
   BlockCacheChain chain;
 
@@ -154,6 +248,40 @@ TEST_F (BlockCacheChainTests, UsesCacheWhenPossible)
   EXPECT_EQ (base.GetBlockRangeCalls (), 3);
 }
 
+TEST_F (BlockCacheChainTests, PartialCacheHits)
+{
+  EXPECT_EQ (chain.GetBlockRange (10, 5), GetStoredRange (10, 5));
+  EXPECT_EQ (chain.GetBlockRange (16, 4), GetStoredRange (16, 4));
+  EXPECT_EQ (chain.GetBlockRange (22, 2), GetStoredRange (22, 2));
+  EXPECT_EQ (base.GetBlockRangeCalls (), 3);
+
+  /* This is missing blocks 8 and 9 at the start, 15, 20 and 21 in between
+     and 24 at the end.  Each gap is fetched separately.  */
+  EXPECT_EQ (chain.GetBlockRange (8, 17), GetStoredRange (8, 17));
+  EXPECT_EQ (base.GetBlockRangeCalls (), 7);
+
+  /* Now everything is cached.  */
+  EXPECT_EQ (chain.GetBlockRange (8, 17), GetStoredRange (8, 17));
+  EXPECT_EQ (base.GetBlockRangeCalls (), 7);
+}
+
+TEST_F (BlockCacheChainTests, PartialCacheMismatch)
+{
+  /* Put a "wrong" block into the cache (not matching the real base chain),
+     which means that the partial cache hit does not chain up.  We then
+     query the full range from the base chain.  */
+  BlockData wrong = blocks[12];
+  wrong.hash = "wrong";
+  store.Store ({wrong});
+
+  EXPECT_EQ (chain.GetBlockRange (10, 5), GetStoredRange (10, 5));
+  EXPECT_EQ (base.GetBlockRangeCalls (), 3);
+
+  /* The wrong block has been replaced in the cache.  */
+  EXPECT_EQ (chain.GetBlockRange (10, 5), GetStoredRange (10, 5));
+  EXPECT_EQ (base.GetBlockRangeCalls (), 3);
+}
+
 TEST_F (BlockCacheChainTests, OnlyCachesAfterMinDepth)
 {
   /* The cache is set up to only consider block ranges that have at least
@@ -180,6 +308,163 @@ TEST_F (BlockCacheChainTests, OnlyCachesAfterMinDepth)
 
 /* ************************************************************************** */
 
+class BlockCacheWarmupTests : public testing::Test
+{
+
+protected:
+
+  InMemoryBlockStorage store;
+  TestBaseChain base;
+
+  BlockCacheWarmupTests ()
+  {
+    FLAGS_xayax_blockcache_warmup_chunk = 10;
+    FLAGS_xayax_blockcache_warmup_interval_ms = 1;
+
+    base.SetGenesis (base.NewGenesis (0));
+    for (unsigned i = 0; i < 100; ++i)
+      base.SetTip (base.NewBlock ());
+  }
+
+  /**
+   * Waits for the warm-up of the given chain to reach the desired height.
+   */
+  static void
+  WaitForWarmHeight (BlockCacheChain& chain, const uint64_t h)
+  {
+    while (chain.GetWarmHeight () < h)
+      std::this_thread::sleep_for (std::chrono::milliseconds (1));
+    EXPECT_EQ (chain.GetWarmHeight (), h);
+  }
+
+};
+
+TEST_F (BlockCacheWarmupTests, CachesFinalisedBlocks)
+{
+  BlockCacheChain chain(base, store, 2);
+  chain.EnableWarmup (50);
+  chain.GetTipHeight ();
+
+  /* Heights up to 98 have at least two blocks confirming them.  */
+  WaitForWarmHeight (chain, 99);
+  EXPECT_EQ (store.GetWarmHeight (), 99);
+  EXPECT_EQ (base.GetBlockRangeCalls (), 5);
+
+  EXPECT_EQ (chain.GetBlockRange (50, 49).size (), 49);
+  EXPECT_EQ (base.GetBlockRangeCalls (), 5);
+
+  /* New blocks get warmed up as well.  */
+  for (unsigned i = 0; i < 5; ++i)
+    base.SetTip (base.NewBlock ());
+  chain.GetTipHeight ();
+  WaitForWarmHeight (chain, 104);
+}
+
+TEST_F (BlockCacheWarmupTests, SkipsCachedRanges)
+{
+  BlockCacheChain chain(base, store, 2);
+  chain.GetTipHeight ();
+  chain.GetBlockRange (10, 30);
+  EXPECT_EQ (base.GetBlockRangeCalls (), 1);
+
+  chain.EnableWarmup (10);
+  WaitForWarmHeight (chain, 99);
+  EXPECT_EQ (base.GetBlockRangeCalls (), 1 + 6);
+}
+
+TEST_F (BlockCacheWarmupTests, ResumesFromPersistedHeight)
+{
+  {
+    BlockCacheChain chain(base, store, 2);
+    chain.GetTipHeight ();
+    chain.EnableWarmup (0);
+    WaitForWarmHeight (chain, 99);
+  }
+  EXPECT_EQ (base.GetBlockRangeCalls (), 10);
+
+  BlockCacheChain chain(base, store, 2);
+  chain.EnableWarmup (0);
+  EXPECT_EQ (chain.GetWarmHeight (), 99);
+  chain.GetTipHeight ();
+  std::this_thread::sleep_for (std::chrono::milliseconds (10));
+  EXPECT_EQ (chain.GetWarmHeight (), 99);
+  EXPECT_EQ (base.GetBlockRangeCalls (), 10);
+}
+
+/* ************************************************************************** */
+
+class LmdbBlockStorageTests : public testing::Test
+{
+
+protected:
+
+  /** Temporary directory for the database.  */
+  const fs::path dir;
+
+  std::unique_ptr<LmdbBlockStorage> store;
+
+  LmdbBlockStorageTests ()
+    : dir(fs::temp_directory_path () / "xayax-lmdb-tests")
+  {
+    fs::remove_all (dir);
+    CHECK (fs::create_directories (dir));
+    Reopen ();
+  }
+
+  ~LmdbBlockStorageTests ()
+  {
+    store.reset ();
+    fs::remove_all (dir);
+  }
+
+  /**
+   * Closes and reopens the storage.
+   */
+  void
+  Reopen ()
+  {
+    store.reset ();
+    store = std::make_unique<LmdbBlockStorage> ();
+    CHECK (store->Open (dir.string (), 1 << 24));
+  }
+
+};
+
+TEST_F (LmdbBlockStorageTests, Storage)
+{
+  store->Store (GetRange (10, 30));
+  EXPECT_THAT (store->GetRange (10, 2),
+               ElementsAre (GetBlock (10), GetBlock (11)));
+  EXPECT_THAT (store->GetRange (15, 3),
+               ElementsAre (GetBlock (15), GetBlock (16), GetBlock (17)));
+  EXPECT_THAT (store->GetRange (39, 1), ElementsAre (GetBlock (39)));
+  EXPECT_THAT (store->GetRange (100, 2), ElementsAre ());
+  EXPECT_THAT (store->GetRange (8, 4),
+               ElementsAre (GetBlock (10), GetBlock (11)));
+}
+
+TEST_F (LmdbBlockStorageTests, OrderedByHeight)
+{
+  /* Heights that would be misordered with little-endian keys.  */
+  store->Store ({GetBlock (256), GetBlock (1), GetBlock (2), GetBlock (257)});
+  EXPECT_THAT (store->GetRange (0, 1'000),
+               ElementsAre (GetBlock (1), GetBlock (2),
+                            GetBlock (256), GetBlock (257)));
+}
+
+TEST_F (LmdbBlockStorageTests, Persistence)
+{
+  store->Store (GetRange (10, 5));
+  EXPECT_EQ (store->GetWarmHeight (), 0);
+  store->SetWarmHeight (15);
+
+  Reopen ();
+  EXPECT_EQ (store->GetRange (10, 5), GetRange (10, 5));
+  EXPECT_EQ (store->GetWarmHeight (), 15);
+}
+
+/* ************************************************************************** */
+
 class MySqlBlockStorageTests : public testing::Test
 {
 
@@ -233,6 +518,28 @@ TEST_F (MySqlBlockStorageTests, Storage)
                ElementsAre (GetBlock (10), GetBlock (11)));
 }
 
+TEST_F (MySqlBlockStorageTests, ManyBlocksAndReplace)
+{
+  /* This is more than fits into a single insert statement, and also
+     exercises the reuse of prepared statements.  */
+  store->Store (GetRange (0, 150));
+  store->Store (GetRange (200, 150));
+  EXPECT_EQ (store->GetRange (0, 350).size (), 300);
+  EXPECT_EQ (store->GetRange (100, 100), GetRange (100, 50));
+
+  auto changed = GetRange (140, 20);
+  for (auto& blk : changed)
+    blk.hash = "changed";
+  store->Store (changed);
+
+  const auto res = store->GetRange (139, 22);
+  ASSERT_EQ (res.size (), 22);
+  EXPECT_EQ (res.front (), GetBlock (139));
+  for (unsigned i = 1; i < 21; ++i)
+    EXPECT_EQ (res[i].hash, "changed");
+  EXPECT_EQ (res.back (), GetBlock (160));
+}
+
 /* ************************************************************************** */
 
 } // anonymous namespace
@@ -4,7 +4,10 @@
 
 #include "blockdata.hpp"
 
+#include "private/blockdataview.hpp"
+#include "private/compression.hpp"
 #include "private/jsonutils.hpp"
+#include "private/movejson.hpp"
 #include "proto/blockdata.pb.h"
 
 #include <glog/logging.h>
@@ -12,6 +15,52 @@
 namespace xayax
 {
 
+namespace
+{
+
+/**
+ * Computes the game index for a list of moves.  This follows the same
+ * rules as the ZMQ publisher for which games a move is relevant for,
+ * i.e. player moves for all games in their "g" object, and admin commands
+ * for the game if they have a "cmd" field.
+ */
+BlockData::GameIndex
+ComputeGameIndex (const std::vector<MoveData>& moves)
+{
+  BlockData::GameIndex res;
+  for (uint32_t i = 0; i < moves.size (); ++i)
+    {
+      const auto& mv = moves[i];
+      if (mv.ns != "g" && mv.ns != "p")
+        continue;
+
+      Json::Value value;
+      if (!ReadMoveJson (mv.mv, value))
+        continue;
+      CHECK (value.isObject ());
+
+      if (mv.ns == "g")
+        {
+          if (value.isMember ("cmd"))
+            res[mv.name].push_back (i);
+          continue;
+        }
+
+      const auto& g = value["g"];
+      if (!g.isObject ())
+        continue;
+      for (auto it = g.begin (); it != g.end (); ++it)
+        {
+          CHECK (it.key ().isString ());
+          res[it.key ().asString ()].push_back (i);
+        }
+    }
+
+  return res;
+}
+
+} // anonymous namespace
+
 std::ostream&
 operator<< (std::ostream& out, const MoveData& x)
 {
@@ -23,9 +72,46 @@ operator<< (std::ostream& out, const MoveData& x)
   return out;
 }
 
+void
+BlockData::IndexGames ()
+{
+  if (!gameIndex.has_value ())
+    gameIndex = ComputeGameIndex (moves);
+}
+
+BlockData::GameIndex
+BlockData::GetGameIndex () const
+{
+  if (gameIndex.has_value ())
+    return *gameIndex;
+  return ComputeGameIndex (moves);
+}
+
+void
+BlockData::CacheSerialised ()
+{
+  IndexGames ();
+  if (serialised == nullptr)
+    serialised = std::make_shared<const std::string> (Serialise ());
+}
+
 std::string
 BlockData::Serialise () const
 {
+  if (serialised != nullptr)
+    return *serialised;
+
+  if (gameIndex.has_value ())
+    return Serialise (*gameIndex);
+  return Serialise (ComputeGameIndex (moves));
+}
+
+std::string
+BlockData::Serialise (const GameIndex& index) const
+{
+  if (serialised != nullptr)
+    return *serialised;
+
   /* We use protocol buffers internally to implement the serialisation,
      but this is not exposed on the outside.  */
 
@@ -50,38 +136,28 @@ BlockData::Serialise () const
       mpb.set_metadata (StoreJson (mv.metadata));
     }
 
+  blk.set_has_game_index (true);
+  for (const auto& entry : index)
+    {
+      proto::GameMoves pb;
+      for (const auto i : entry.second)
+        {
+          CHECK_LT (i, moves.size ());
+          pb.add_moves (i);
+        }
+      blk.mutable_game_index ()->insert ({entry.first, std::move (pb)});
+    }
+  CHECK_EQ (blk.game_index_size (), index.size ());
+
   std::string res;
   blk.SerializeToString (&res);
-  return res;
+  return CompressBlockData (std::move (res));
 }
 
 void
 BlockData::Deserialise (const std::string& data)
 {
-  proto::Block blk;
-  CHECK (blk.ParseFromString (data)) << "Failed to parse Block protocol buffer";
-
-  hash = blk.hash ();
-  parent = blk.parent ();
-  height = blk.height ();
-  rngseed = blk.rngseed ();
-  metadata = LoadJson (blk.metadata ());
-
-  moves.clear ();
-  for (const auto& mpb : blk.moves ())
-    {
-      moves.emplace_back ();
-      auto& mv = moves.back ();
-      mv.txid = mpb.txid ();
-      mv.ns = mpb.ns ();
-      mv.name = mpb.name ();
-      mv.mv = mpb.mv ();
-      mv.burns.clear ();
-      for (const auto& entry : mpb.burns ())
-        mv.burns.emplace (entry.first, LoadJson (entry.second));
-      CHECK_EQ (mv.burns.size (), mpb.burns_size ());
-      mv.metadata = LoadJson (mpb.metadata ());
-    }
+  *this = BlockDataView (data).ToBlockData ();
 }
 
 } // namespace xayax
@@ -9,6 +9,8 @@
 
 #include <cstdint>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -109,6 +111,35 @@ struct BlockData
   /** All moves inside this block.  */
   std::vector<MoveData> moves;
 
+  /**
+   * Type for an index of the moves in a block by game.  It maps each game ID
+   * to the indices (into moves) of all moves that contain player moves
+   * or admin commands for that game, in ascending order.
+   */
+  using GameIndex = std::map<std::string, std::vector<uint32_t>>;
+
+  /**
+   * If set, the index of moves by game for this block.  Games that are not
+   * part of it have no data in the block at all.  This is derived from
+   * the moves themselves (see IndexGames), but computing it requires parsing
+   * all the moves.  Thus it is computed once and stored together with the
+   * block data, so that blocks retrieved from storage carry it.
+   *
+   * It is not taken into account when comparing blocks.
+   */
+  std::optional<GameIndex> gameIndex;
+
+  /**
+   * If set, the result of Serialise for this block, computed ahead of time
+   * by CacheSerialised.  With compression enabled, serialisation is not
+   * cheap, and this allows doing it before e.g. the chainstate lock is
+   * taken for storing the block.  It must only be set if the block
+   * is not modified anymore afterwards.
+   *
+   * It is not taken into account when comparing blocks.
+   */
+  std::shared_ptr<const std::string> serialised;
+
   BlockData () = default;
   BlockData (const BlockData&) = default;
   BlockData (BlockData&&) = default;
@@ -116,12 +147,38 @@ struct BlockData
   BlockData& operator= (const BlockData&) = default;
   BlockData& operator= (BlockData&&) = default;
 
+  /**
+   * Computes and sets gameIndex from the moves, if it is not set yet.
+   */
+  void IndexGames ();
+
+  /**
+   * Returns the game index of this block.  If gameIndex is not set, it is
+   * computed from the moves (without storing it in the instance).
+   */
+  GameIndex GetGameIndex () const;
+
   /**
    * Serialises the BlockData instance to a string of bytes (e.g. for storing
-   * in a database).
+   * in a database).  This includes the game index, which is computed
+   * if not yet present.  The data is compressed if configured, and the
+   * precomputed value is returned if serialised is set.
    */
   std::string Serialise () const;
 
+  /**
+   * Serialises the block with the given game index, which must be the one
+   * for its moves.  This can be used to avoid computing the index again
+   * when it is already known for a block that does not have gameIndex set.
+   */
+  std::string Serialise (const GameIndex& index) const;
+
+  /**
+   * Computes and sets serialised (including the game index), if it is
+   * not set yet.
+   */
+  void CacheSerialised ();
+
   /**
    * Deserialises from a string of bytes into this instance.  CHECK fails if
    * there is an error.
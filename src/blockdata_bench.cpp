@@ -0,0 +1,87 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdata.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * Serialises a block with the number of moves given as argument.
+ */
+void
+BM_BlockDataSerialise (benchmark::State& state)
+{
+  BlockGenerator gen;
+  auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (0));
+  blk.IndexGames ();
+
+  size_t bytes = 0;
+  for (auto _ : state)
+    {
+      const std::string data = blk.Serialise ();
+      bytes += data.size ();
+      benchmark::DoNotOptimize (data);
+    }
+
+  state.SetBytesProcessed (bytes);
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_BlockDataSerialise)->Arg (1)->Arg (10)->Arg (100)
+    ->Arg (1'000)->Arg (5'000);
+
+/**
+ * Deserialises a block with the number of moves given as argument.
+ */
+void
+BM_BlockDataDeserialise (benchmark::State& state)
+{
+  BlockGenerator gen;
+  const auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (0));
+  const std::string data = blk.Serialise ();
+
+  for (auto _ : state)
+    {
+      BlockData res;
+      res.Deserialise (data);
+      benchmark::DoNotOptimize (res);
+    }
+
+  state.SetBytesProcessed (state.iterations () * data.size ());
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_BlockDataDeserialise)->Arg (1)->Arg (10)->Arg (100)
+    ->Arg (1'000)->Arg (5'000);
+
+/**
+ * Computes the game index for a block with the number of moves given
+ * as first argument, spread over the number of games given as second.
+ */
+void
+BM_BlockDataIndexGames (benchmark::State& state)
+{
+  BlockGenerator gen;
+  gen.SetNumGames (state.range (1));
+  const auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (0));
+
+  for (auto _ : state)
+    {
+      BlockData copy = blk;
+      copy.IndexGames ();
+      benchmark::DoNotOptimize (copy.gameIndex);
+    }
+
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_BlockDataIndexGames)
+    ->ArgsProduct ({{10, 1'000}, {1, 100}});
+
+} // anonymous namespace
+} // namespace xayax
@@ -6,6 +6,8 @@
 
 #include "testutils.hpp"
 
+#include "proto/blockdata.pb.h"
+
 #include <gtest/gtest.h>
 
 namespace xayax
@@ -50,6 +52,97 @@ TEST_F (BlockDataTests, RoundTrip)
   EXPECT_EQ (blk2, blk);
 }
 
+TEST_F (BlockDataTests, GameIndex)
+{
+  BlockData blk;
+  const auto addMove = [&blk] (const std::string& ns, const std::string& name,
+                               const std::string& mv)
+    {
+      MoveData m;
+      m.txid = "tx " + std::to_string (blk.moves.size ());
+      m.ns = ns;
+      m.name = name;
+      m.mv = mv;
+      blk.moves.push_back (m);
+    };
+
+  addMove ("p", "domob", R"({"g": {"foo": 1, "bar": 2}})");
+  addMove ("p", "domob", R"({"g": {"foo": 1, "foo": 2}})");
+  addMove ("p", "domob", R"({"g": [1, 2, 3]})");
+  addMove ("g", "foo", R"({"cmd": null})");
+  addMove ("g", "bar", R"({"g": {"baz": 1}})");
+  addMove ("x", "domob", R"({"g": {"baz": 1}})");
+  addMove ("p", "andy", R"({"g": {"bar": {}}})");
+
+  const BlockData::GameIndex expected = {
+    {"foo", {0, 3}},
+    {"bar", {0, 6}},
+  };
+
+  EXPECT_EQ (blk.GetGameIndex (), expected);
+  EXPECT_FALSE (blk.gameIndex.has_value ());
+
+  blk.IndexGames ();
+  ASSERT_TRUE (blk.gameIndex.has_value ());
+  EXPECT_EQ (*blk.gameIndex, expected);
+
+  /* The index is stored with the serialised data, even if it has not
+     been computed explicitly before.  */
+  BlockData copy = blk;
+  copy.gameIndex.reset ();
+  BlockData blk2;
+  blk2.Deserialise (copy.Serialise ());
+  ASSERT_TRUE (blk2.gameIndex.has_value ());
+  EXPECT_EQ (*blk2.gameIndex, expected);
+
+  /* An index computed elsewhere can be passed in explicitly.  */
+  blk2.Deserialise (copy.Serialise (expected));
+  ASSERT_TRUE (blk2.gameIndex.has_value ());
+  EXPECT_EQ (*blk2.gameIndex, expected);
+
+  /* An existing index is serialised as it is.  */
+  blk.gameIndex = BlockData::GameIndex ({{"foo", {1}}});
+  blk2.Deserialise (blk.Serialise ());
+  EXPECT_EQ (*blk2.gameIndex, *blk.gameIndex);
+  EXPECT_EQ (blk.GetGameIndex (), *blk.gameIndex);
+}
+
+TEST_F (BlockDataTests, WithoutGameIndex)
+{
+  /* Data stored by older versions does not have the game index.  */
+  proto::Block pb;
+  pb.set_hash ("block");
+  pb.set_metadata ("null");
+  auto& mv = *pb.add_moves ();
+  mv.set_mv (R"({"g": {"foo": 42}})");
+  mv.set_metadata ("null");
+
+  std::string data;
+  ASSERT_TRUE (pb.SerializeToString (&data));
+
+  BlockData blk;
+  blk.gameIndex.emplace ();
+  blk.Deserialise (data);
+  EXPECT_EQ (blk.hash, "block");
+  ASSERT_EQ (blk.moves.size (), 1);
+  EXPECT_FALSE (blk.gameIndex.has_value ());
+}
+
+TEST_F (BlockDataTests, InvalidGameIndex)
+{
+  proto::Block pb;
+  pb.set_metadata ("null");
+  pb.add_moves ()->set_metadata ("null");
+  pb.set_has_game_index (true);
+  (*pb.mutable_game_index ())["foo"].add_moves (1);
+
+  std::string data;
+  ASSERT_TRUE (pb.SerializeToString (&data));
+
+  BlockData blk;
+  EXPECT_DEATH (blk.Deserialise (data), "Invalid game index");
+}
+
 TEST_F (BlockDataTests, Invalid)
 {
   BlockData blk;
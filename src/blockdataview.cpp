@@ -0,0 +1,89 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/blockdataview.hpp"
+
+#include "private/compression.hpp"
+#include "private/jsonutils.hpp"
+
+#include <glog/logging.h>
+
+namespace xayax
+{
+
+BlockDataView::BlockDataView (const std::string_view data)
+{
+  std::string raw;
+  const std::string_view payload
+      = DecompressBlockData (data, raw) ? std::string_view (raw) : data;
+  CHECK (pb.ParseFromArray (payload.data (), payload.size ()))
+      << "Failed to parse Block protocol buffer";
+}
+
+const Json::Value&
+BlockDataView::GetMetadata () const
+{
+  if (!metadata.has_value ())
+    metadata = LoadJson (pb.metadata ());
+  return *metadata;
+}
+
+MoveData
+BlockDataView::GetMove (const size_t i) const
+{
+  const auto& mpb = pb.moves (i);
+
+  MoveData mv;
+  mv.txid = mpb.txid ();
+  mv.ns = mpb.ns ();
+  mv.name = mpb.name ();
+  mv.mv = mpb.mv ();
+  for (const auto& entry : mpb.burns ())
+    mv.burns.emplace (entry.first, LoadJson (entry.second));
+  CHECK_EQ (mv.burns.size (), mpb.burns_size ());
+  mv.metadata = LoadJson (mpb.metadata ());
+
+  return mv;
+}
+
+std::optional<BlockData::GameIndex>
+BlockDataView::GetGameIndex () const
+{
+  if (!pb.has_game_index ())
+    return {};
+
+  BlockData::GameIndex res;
+  for (const auto& entry : pb.game_index ())
+    {
+      auto& indices = res[entry.first];
+      for (const auto i : entry.second.moves ())
+        {
+          CHECK_LT (i, pb.moves_size ()) << "Invalid game index";
+          indices.push_back (i);
+        }
+    }
+
+  return res;
+}
+
+BlockData
+BlockDataView::ToBlockData () const
+{
+  BlockData res;
+  res.hash = GetHash ();
+  res.parent = GetParent ();
+  res.height = GetHeight ();
+  res.rngseed = GetRngSeed ();
+  res.metadata = GetMetadata ();
+
+  res.moves.reserve (GetNumMoves ());
+  for (size_t i = 0; i < GetNumMoves (); ++i)
+    res.moves.push_back (GetMove (i));
+
+  res.gameIndex = GetGameIndex ();
+
+  return res;
+}
+
+} // namespace xayax
@@ -0,0 +1,84 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/blockdataview.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xayax
+{
+namespace
+{
+
+class BlockDataViewTests : public testing::Test
+{
+
+protected:
+
+  BlockData blk;
+
+  BlockDataViewTests ()
+  {
+    blk.hash = "block hash";
+    blk.parent = "parent hash";
+    blk.height = 42;
+    blk.rngseed = "abcdef";
+    blk.metadata = ParseJson (R"({"foo": "bar"})");
+
+    MoveData m;
+    m.txid = "tx 1";
+    m.ns = "p";
+    m.name = "domob";
+    m.mv = R"({"g": {"x": 123}})";
+    m.metadata = ParseJson (R"([1, 2, 3])");
+    m.burns = {{"x", ParseJson ("5.5")}};
+    blk.moves.push_back (m);
+
+    m.txid = "tx 2";
+    m.ns = "g";
+    m.name = "x";
+    m.mv = R"({"cmd": true})";
+    m.metadata = ParseJson ("null");
+    m.burns = {};
+    blk.moves.push_back (m);
+  }
+
+};
+
+TEST_F (BlockDataViewTests, Accessors)
+{
+  const BlockDataView view(blk.Serialise ());
+
+  EXPECT_EQ (view.GetHash (), "block hash");
+  EXPECT_EQ (view.GetParent (), "parent hash");
+  EXPECT_EQ (view.GetHeight (), 42);
+  EXPECT_EQ (view.GetRngSeed (), "abcdef");
+  EXPECT_EQ (view.GetMetadata (), blk.metadata);
+
+  ASSERT_EQ (view.GetNumMoves (), 2);
+  EXPECT_EQ (view.GetRawMove (0), blk.moves[0].mv);
+  EXPECT_EQ (view.GetMove (1), blk.moves[1]);
+
+  const auto index = view.GetGameIndex ();
+  ASSERT_TRUE (index.has_value ());
+  EXPECT_EQ (*index, BlockData::GameIndex ({{"x", {0, 1}}}));
+}
+
+TEST_F (BlockDataViewTests, ToBlockData)
+{
+  const BlockDataView view(blk.Serialise ());
+  const BlockData materialised = view.ToBlockData ();
+  EXPECT_EQ (materialised, blk);
+  EXPECT_TRUE (materialised.gameIndex.has_value ());
+}
+
+TEST_F (BlockDataViewTests, Invalid)
+{
+  EXPECT_DEATH (BlockDataView ("abc"), "Failed to parse");
+}
+
+} // anonymous namespace
+} // namespace xayax
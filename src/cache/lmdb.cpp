@@ -0,0 +1,346 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.hpp"
+
+#include "private/blockdataview.hpp"
+
+#include <lmdb.h>
+
+#include <glog/logging.h>
+
+#include <string_view>
+
+/* The LMDB cache uses two named databases inside an LMDB environment:
+   "blocks" maps the height (as 8-byte big-endian integer, so that the
+   byte order matches the numerical order) to the serialised block data,
+   and "state" holds other values like the warm-up progress.  */
+
+namespace xayax
+{
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/** Number of bytes of an encoded height key.  */
+constexpr size_t KEY_SIZE = 8;
+
+/** Key for the warm-up height in the state database.  */
+constexpr std::string_view WARM_HEIGHT_KEY = "warmheight";
+
+/**
+ * Encodes an integer as big-endian key.
+ */
+void
+EncodeKey (const uint64_t val, unsigned char (&key)[KEY_SIZE])
+{
+  for (size_t i = 0; i < KEY_SIZE; ++i)
+    key[i] = (val >> (8 * (KEY_SIZE - 1 - i))) & 0xFF;
+}
+
+/**
+ * Decodes a big-endian key.
+ */
+uint64_t
+DecodeKey (const MDB_val& key)
+{
+  CHECK_EQ (key.mv_size, KEY_SIZE) << "Invalid key in LMDB block storage";
+  const auto* data = static_cast<const unsigned char*> (key.mv_data);
+
+  uint64_t res = 0;
+  for (size_t i = 0; i < KEY_SIZE; ++i)
+    res = (res << 8) | data[i];
+
+  return res;
+}
+
+/**
+ * RAII wrapper around an LMDB transaction.  It is aborted when destructed,
+ * unless it has been committed.
+ */
+class Transaction
+{
+
+private:
+
+  MDB_txn* txn = nullptr;
+
+public:
+
+  explicit Transaction (MDB_env* env, const unsigned flags)
+  {
+    const int rc = mdb_txn_begin (env, nullptr, flags, &txn);
+    CHECK_EQ (rc, MDB_SUCCESS)
+        << "Failed to begin LMDB transaction: " << mdb_strerror (rc);
+  }
+
+  ~Transaction ()
+  {
+    if (txn != nullptr)
+      mdb_txn_abort (txn);
+  }
+
+  Transaction () = delete;
+  Transaction (const Transaction&) = delete;
+  void operator= (const Transaction&) = delete;
+
+  MDB_txn*
+  operator* () const
+  {
+    CHECK (txn != nullptr);
+    return txn;
+  }
+
+  /**
+   * Commits the transaction.  Returns the LMDB result code.
+   */
+  int
+  Commit ()
+  {
+    CHECK (txn != nullptr);
+    const int rc = mdb_txn_commit (txn);
+    txn = nullptr;
+    return rc;
+  }
+
+};
+
+} // anonymous namespace
+
+class LmdbBlockStorage::Implementation
+{
+
+private:
+
+  /** The LMDB environment.  */
+  MDB_env* env = nullptr;
+
+  /** The database with the blocks.  */
+  MDB_dbi blocks;
+
+  /** The database with state values.  */
+  MDB_dbi state;
+
+public:
+
+  Implementation () = default;
+  ~Implementation ();
+
+  Implementation (const Implementation&) = delete;
+  void operator= (const Implementation&) = delete;
+
+  /**
+   * Opens the database.  Returns false if it fails.
+   */
+  bool Open (const std::string& dir, uint64_t mapSize);
+
+  void Store (const std::vector<BlockData>& blocks);
+  std::vector<BlockData> GetRange (uint64_t start, uint64_t count);
+  uint64_t GetWarmHeight ();
+  void SetWarmHeight (uint64_t h);
+
+};
+
+LmdbBlockStorage::Implementation::~Implementation ()
+{
+  if (env != nullptr)
+    mdb_env_close (env);
+}
+
+bool
+LmdbBlockStorage::Implementation::Open (const std::string& dir,
+                                        const uint64_t mapSize)
+{
+  CHECK (env == nullptr);
+  int rc = mdb_env_create (&env);
+  CHECK_EQ (rc, MDB_SUCCESS)
+      << "Failed to create LMDB environment: " << mdb_strerror (rc);
+
+  CHECK_EQ (mdb_env_set_maxdbs (env, 2), MDB_SUCCESS);
+  rc = mdb_env_set_mapsize (env, mapSize);
+  if (rc != MDB_SUCCESS)
+    {
+      LOG (ERROR) << "Failed to set LMDB map size: " << mdb_strerror (rc);
+      return false;
+    }
+
+  /* We use transactions from multiple threads (although never in
+     parallel), so they must not be tied to threads.  */
+  rc = mdb_env_open (env, dir.c_str (), MDB_NOTLS, 0644);
+  if (rc != MDB_SUCCESS)
+    {
+      LOG (ERROR)
+          << "Failed to open LMDB environment at " << dir << ": "
+          << mdb_strerror (rc);
+      return false;
+    }
+
+  Transaction txn(env, 0);
+  CHECK_EQ (mdb_dbi_open (*txn, "blocks", MDB_CREATE, &blocks), MDB_SUCCESS);
+  CHECK_EQ (mdb_dbi_open (*txn, "state", MDB_CREATE, &state), MDB_SUCCESS);
+  rc = txn.Commit ();
+  CHECK_EQ (rc, MDB_SUCCESS)
+      << "Failed to set up LMDB databases: " << mdb_strerror (rc);
+
+  LOG (INFO) << "Opened LMDB block storage at " << dir;
+  return true;
+}
+
+void
+LmdbBlockStorage::Implementation::Store (const std::vector<BlockData>& blks)
+{
+  Transaction txn(env, 0);
+  for (const auto& b : blks)
+    {
+      unsigned char keyData[KEY_SIZE];
+      EncodeKey (b.height, keyData);
+      MDB_val key;
+      key.mv_size = KEY_SIZE;
+      key.mv_data = keyData;
+
+      const std::string data = b.Serialise ();
+      MDB_val val;
+      val.mv_size = data.size ();
+      val.mv_data = const_cast<char*> (data.data ());
+
+      const int rc = mdb_put (*txn, blocks, &key, &val, 0);
+      if (rc != MDB_SUCCESS)
+        {
+          /* This can happen e.g. if the map is full.  Failing to cache
+             blocks is not fatal, so we just drop this batch.  */
+          LOG (WARNING)
+              << "Failed to store block " << b.height << " in LMDB: "
+              << mdb_strerror (rc);
+          return;
+        }
+    }
+
+  const int rc = txn.Commit ();
+  if (rc != MDB_SUCCESS)
+    LOG (WARNING) << "Failed to commit LMDB transaction: " << mdb_strerror (rc);
+}
+
+std::vector<BlockData>
+LmdbBlockStorage::Implementation::GetRange (const uint64_t start,
+                                            const uint64_t count)
+{
+  Transaction txn(env, MDB_RDONLY);
+
+  MDB_cursor* cursor;
+  CHECK_EQ (mdb_cursor_open (*txn, blocks, &cursor), MDB_SUCCESS);
+
+  unsigned char keyData[KEY_SIZE];
+  EncodeKey (start, keyData);
+  MDB_val key;
+  key.mv_size = KEY_SIZE;
+  key.mv_data = keyData;
+  MDB_val val;
+
+  std::vector<BlockData> res;
+  int rc = mdb_cursor_get (cursor, &key, &val, MDB_SET_RANGE);
+  while (rc == MDB_SUCCESS && DecodeKey (key) < start + count)
+    {
+      /* The view parses directly from the memory map, which is valid
+         until the transaction ends.  */
+      const BlockDataView view(std::string_view (
+          static_cast<const char*> (val.mv_data), val.mv_size));
+      res.push_back (view.ToBlockData ());
+
+      rc = mdb_cursor_get (cursor, &key, &val, MDB_NEXT);
+    }
+  CHECK (rc == MDB_SUCCESS || rc == MDB_NOTFOUND)
+      << "Failed to read from LMDB: " << mdb_strerror (rc);
+
+  mdb_cursor_close (cursor);
+  return res;
+}
+
+uint64_t
+LmdbBlockStorage::Implementation::GetWarmHeight ()
+{
+  Transaction txn(env, MDB_RDONLY);
+
+  MDB_val key;
+  key.mv_size = WARM_HEIGHT_KEY.size ();
+  key.mv_data = const_cast<char*> (WARM_HEIGHT_KEY.data ());
+  MDB_val val;
+
+  const int rc = mdb_get (*txn, state, &key, &val);
+  if (rc == MDB_NOTFOUND)
+    return 0;
+  CHECK_EQ (rc, MDB_SUCCESS)
+      << "Failed to read from LMDB: " << mdb_strerror (rc);
+
+  return DecodeKey (val);
+}
+
+void
+LmdbBlockStorage::Implementation::SetWarmHeight (const uint64_t h)
+{
+  Transaction txn(env, 0);
+
+  MDB_val key;
+  key.mv_size = WARM_HEIGHT_KEY.size ();
+  key.mv_data = const_cast<char*> (WARM_HEIGHT_KEY.data ());
+
+  unsigned char valData[KEY_SIZE];
+  EncodeKey (h, valData);
+  MDB_val val;
+  val.mv_size = KEY_SIZE;
+  val.mv_data = valData;
+
+  int rc = mdb_put (*txn, state, &key, &val, 0);
+  if (rc == MDB_SUCCESS)
+    rc = txn.Commit ();
+  if (rc != MDB_SUCCESS)
+    LOG (WARNING) << "Failed to store warm-up height: " << mdb_strerror (rc);
+}
+
+/* ************************************************************************** */
+
+LmdbBlockStorage::LmdbBlockStorage () = default;
+LmdbBlockStorage::~LmdbBlockStorage () = default;
+
+bool
+LmdbBlockStorage::Open (const std::string& dir, const uint64_t mapSize)
+{
+  CHECK (impl == nullptr) << "LmdbBlockStorage is already opened";
+
+  auto res = std::make_unique<Implementation> ();
+  if (!res->Open (dir, mapSize))
+    return false;
+
+  impl = std::move (res);
+  return true;
+}
+
+void
+LmdbBlockStorage::Store (const std::vector<BlockData>& blocks)
+{
+  impl->Store (blocks);
+}
+
+std::vector<BlockData>
+LmdbBlockStorage::GetRange (const uint64_t start, const uint64_t count)
+{
+  return impl->GetRange (start, count);
+}
+
+uint64_t
+LmdbBlockStorage::GetWarmHeight ()
+{
+  return impl->GetWarmHeight ();
+}
+
+void
+LmdbBlockStorage::SetWarmHeight (const uint64_t h)
+{
+  impl->SetWarmHeight (h);
+}
+
+/* ************************************************************************** */
+
+} // namespace xayax
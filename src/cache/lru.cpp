@@ -0,0 +1,233 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.hpp"
+
+#include "lrucache.hpp"
+
+#include <glog/logging.h>
+
+#include <memory>
+#include <string>
+
+namespace xayax
+{
+
+namespace
+{
+
+/** Type for serialised blocks as held in memory.  */
+using SerialisedBlock = std::shared_ptr<const std::string>;
+
+/**
+ * Weight function for the LRU cache, counting the bytes of serialised
+ * block data.
+ */
+struct SerialisedSize
+{
+  size_t
+  operator() (const SerialisedBlock& blk) const
+  {
+    return blk->size ();
+  }
+};
+
+/**
+ * Interval (in number of block lookups) at which the cache statistics
+ * are logged.
+ */
+constexpr uint64_t LOG_INTERVAL = 10'000;
+
+} // anonymous namespace
+
+class LruBlockStorage::Implementation
+{
+
+private:
+
+  /** The underlying storage.  */
+  BlockCacheChain::Storage& base;
+
+  /** The in-memory cache, keyed by height.  */
+  LruCache<uint64_t, SerialisedBlock, std::hash<uint64_t>, SerialisedSize>
+      cache;
+
+  /** Lookups at which we logged the statistics last.  */
+  uint64_t lastLogged = 0;
+
+  /**
+   * Puts the given block into the in-memory cache.
+   */
+  void
+  Remember (const BlockData& blk)
+  {
+    cache.Put (blk.height, std::make_shared<const std::string> (
+                               blk.Serialise ()));
+  }
+
+  /**
+   * Logs the statistics if enough lookups happened since the last time.
+   */
+  void
+  MaybeLogStats ()
+  {
+    const uint64_t lookups = cache.GetHits () + cache.GetMisses ();
+    if (lookups < lastLogged + LOG_INTERVAL)
+      return;
+
+    LOG (INFO)
+        << "In-memory block cache: "
+        << cache.GetHits () << " hits, " << cache.GetMisses () << " misses"
+        << " (" << (100 * cache.GetHits () / lookups) << "% hit rate), "
+        << cache.GetSize () << " blocks with " << cache.GetWeight ()
+        << " bytes";
+    lastLogged = lookups;
+  }
+
+public:
+
+  explicit Implementation (BlockCacheChain::Storage& b, const uint64_t maxBytes)
+    : base(b), cache(maxBytes)
+  {}
+
+  void
+  Store (const std::vector<BlockData>& blocks)
+  {
+    base.Store (blocks);
+    for (const auto& blk : blocks)
+      Remember (blk);
+  }
+
+  std::vector<BlockData>
+  GetRange (const uint64_t start, const uint64_t count)
+  {
+    /* Look up all blocks in memory first.  For the ones that are missing,
+       we query the underlying storage (for the range between the first
+       and last missing one).  */
+    std::vector<SerialisedBlock> inMemory(count);
+    uint64_t firstMissing = start + count;
+    uint64_t lastMissing = start;
+    for (uint64_t i = 0; i < count; ++i)
+      if (!cache.Get (start + i, inMemory[i]))
+        {
+          firstMissing = std::min (firstMissing, start + i);
+          lastMissing = start + i;
+        }
+    MaybeLogStats ();
+
+    std::vector<BlockData> fromBase;
+    if (firstMissing <= lastMissing)
+      {
+        fromBase = base.GetRange (firstMissing, lastMissing - firstMissing + 1);
+        for (const auto& blk : fromBase)
+          Remember (blk);
+      }
+
+    /* Merge the blocks from memory with the ones from the underlying
+       storage, in order of height.  */
+    std::vector<BlockData> res;
+    auto baseIt = fromBase.begin ();
+    for (uint64_t i = 0; i < count; ++i)
+      {
+        const uint64_t h = start + i;
+        if (baseIt != fromBase.end () && baseIt->height == h)
+          {
+            res.push_back (std::move (*baseIt));
+            ++baseIt;
+            continue;
+          }
+        if (inMemory[i] != nullptr)
+          {
+            res.emplace_back ();
+            res.back ().Deserialise (*inMemory[i]);
+          }
+      }
+    CHECK (baseIt == fromBase.end ())
+        << "Underlying storage returned unexpected blocks";
+
+    return res;
+  }
+
+  uint64_t
+  GetWarmHeight ()
+  {
+    return base.GetWarmHeight ();
+  }
+
+  void
+  SetWarmHeight (const uint64_t h)
+  {
+    base.SetWarmHeight (h);
+  }
+
+  uint64_t
+  GetHits () const
+  {
+    return cache.GetHits ();
+  }
+
+  uint64_t
+  GetMisses () const
+  {
+    return cache.GetMisses ();
+  }
+
+  uint64_t
+  GetBytes () const
+  {
+    return cache.GetWeight ();
+  }
+
+};
+
+LruBlockStorage::LruBlockStorage (BlockCacheChain::Storage& b,
+                                  const uint64_t maxBytes)
+  : impl(std::make_unique<Implementation> (b, maxBytes))
+{}
+
+LruBlockStorage::~LruBlockStorage () = default;
+
+void
+LruBlockStorage::Store (const std::vector<BlockData>& blocks)
+{
+  impl->Store (blocks);
+}
+
+std::vector<BlockData>
+LruBlockStorage::GetRange (const uint64_t start, const uint64_t count)
+{
+  return impl->GetRange (start, count);
+}
+
+uint64_t
+LruBlockStorage::GetWarmHeight ()
+{
+  return impl->GetWarmHeight ();
+}
+
+void
+LruBlockStorage::SetWarmHeight (const uint64_t h)
+{
+  impl->SetWarmHeight (h);
+}
+
+uint64_t
+LruBlockStorage::GetHits () const
+{
+  return impl->GetHits ();
+}
+
+uint64_t
+LruBlockStorage::GetMisses () const
+{
+  return impl->GetMisses ();
+}
+
+uint64_t
+LruBlockStorage::GetBytes () const
+{
+  return impl->GetBytes ();
+}
+
+} // namespace xayax
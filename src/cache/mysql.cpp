@@ -11,6 +11,11 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <sstream>
+
 /* The MySQL cache stores blocks into a single table inside a given database,
    which should be set up with a schema like this:
 
@@ -18,6 +23,16 @@
       `height` BIGINT UNSIGNED NOT NULL PRIMARY KEY,
       `data` MEDIUMBLOB NOT NULL
    );
+
+   For persisting the progress of the warm-up worker, a second table
+   with the same name plus a "_state" suffix is used:
+
+   CREATE TABLE `cached_blocks_state` (
+      `name` VARCHAR(64) NOT NULL PRIMARY KEY,
+      `value` BIGINT UNSIGNED NOT NULL
+   );
+
+   If this table is not present, the warm-up progress is simply not persisted.
 */
 
 namespace xayax
@@ -36,6 +51,27 @@ private:
   /** The name of the table to use.  */
   std::string table;
 
+  /**
+   * Prepared statements for storing a given number of blocks with one
+   * multi-row insert, keyed by the number of rows.  The number of rows
+   * per statement is limited, so there is only a bounded number of them.
+   */
+  std::map<size_t, std::unique_ptr<mypp::Statement>> storeStmts;
+
+  /** Prepared statement for retrieving a range of blocks.  */
+  std::unique_ptr<mypp::Statement> getRangeStmt;
+
+  /**
+   * Returns the prepared statement for storing the given number of blocks,
+   * preparing it if needed.
+   */
+  mypp::Statement& GetStoreStatement (size_t rows);
+
+  /**
+   * Returns the prepared statement for retrieving a range.
+   */
+  mypp::Statement& GetRangeStatement ();
+
 public:
 
   Implementation () = default;
@@ -64,6 +100,16 @@ public:
    */
   std::vector<BlockData> GetRange (uint64_t start, uint64_t count);
 
+  /**
+   * Retrieves the warm-up height from the state table.
+   */
+  uint64_t GetWarmHeight ();
+
+  /**
+   * Stores the warm-up height into the state table.
+   */
+  void SetWarmHeight (uint64_t h);
+
 };
 
 void
@@ -96,27 +142,104 @@ MySqlBlockStorage::Implementation::Connect (
     }
 }
 
+namespace
+{
+
+/**
+ * Maximum number of rows inserted with one statement when storing blocks.
+ * This keeps the statement size (and thus also the size of each packet
+ * sent to the server) bounded.
+ */
+constexpr size_t MAX_ROWS_PER_STORE = 64;
+
+} // anonymous namespace
+
+mypp::Statement&
+MySqlBlockStorage::Implementation::GetStoreStatement (const size_t rows)
+{
+  CHECK_GT (rows, 0);
+  CHECK_LE (rows, MAX_ROWS_PER_STORE);
+
+  auto& stmt = storeStmts[rows];
+  if (stmt != nullptr)
+    return *stmt;
+
+  std::ostringstream sql;
+  sql << "INSERT INTO `" << table << "` (`height`, `data`) VALUES ";
+  for (size_t i = 0; i < rows; ++i)
+    {
+      if (i > 0)
+        sql << ", ";
+      sql << "(?, ?)";
+    }
+  sql << " ON DUPLICATE KEY UPDATE `data` = VALUES (`data`)";
+
+  stmt = std::make_unique<mypp::Statement> (*connection);
+  try
+    {
+      stmt->Prepare (2 * rows, sql.str ());
+    }
+  catch (const mypp::Error& exc)
+    {
+      LOG (FATAL) << exc.what ();
+    }
+
+  return *stmt;
+}
+
+mypp::Statement&
+MySqlBlockStorage::Implementation::GetRangeStatement ()
+{
+  if (getRangeStmt != nullptr)
+    return *getRangeStmt;
+
+  getRangeStmt = std::make_unique<mypp::Statement> (*connection);
+  try
+    {
+      getRangeStmt->Prepare (2, R"(
+        SELECT `data`
+          FROM `)" + table + R"(`
+          WHERE `height` >= ? AND `height` < ?
+          ORDER BY `height` ASC
+      )");
+    }
+  catch (const mypp::Error& exc)
+    {
+      LOG (FATAL) << exc.what ();
+    }
+
+  return *getRangeStmt;
+}
+
 void
 MySqlBlockStorage::Implementation::Store (const std::vector<BlockData>& blocks)
 {
-  for (const auto& b : blocks)
+  if (blocks.empty ())
+    return;
+
+  /* All blocks are inserted in a single transaction, with multi-row
+     statements of up to MAX_ROWS_PER_STORE blocks each.  */
+  try
     {
-      mypp::Statement stmt(*connection);
-      try
-        {
-          stmt.Prepare (2, R"(
-            REPLACE INTO `)" + table + R"(`
-              (`height`, `data`) VALUES (?, ?)
-          )");
-        }
-      catch (const mypp::Error& exc)
+      connection.Execute ("START TRANSACTION");
+    }
+  catch (const mypp::Error& exc)
+    {
+      LOG (FATAL) << exc.what ();
+    }
+
+  for (size_t begin = 0; begin < blocks.size (); begin += MAX_ROWS_PER_STORE)
+    {
+      const size_t end = std::min (begin + MAX_ROWS_PER_STORE, blocks.size ());
+      auto& stmt = GetStoreStatement (end - begin);
+
+      for (size_t i = begin; i < end; ++i)
         {
-          LOG (FATAL) << exc.what ();
+          const auto& b = blocks[i];
+          stmt.Bind<int64_t> (2 * (i - begin), b.height);
+          stmt.BindBlob (2 * (i - begin) + 1, b.Serialise ());
         }
 
-      stmt.Bind<int64_t> (0, b.height);
-      stmt.BindBlob (1, b.Serialise ());
-
       try
         {
           stmt.Execute ();
@@ -124,31 +247,26 @@ MySqlBlockStorage::Implementation::Store (const std::vector<BlockData>& blocks)
       catch (const mypp::Error& exc)
         {
           LOG (WARNING) << exc.what ();
-          /* We continue here and try the next block.  It is not fatal
-             if one of them failed to insert for whatever reason.  */
+          /* We continue here and try the next batch.  It is not fatal
+             if some of them failed to insert for whatever reason.  */
         }
     }
-}
 
-std::vector<BlockData>
-MySqlBlockStorage::Implementation::GetRange (const uint64_t start,
-                                             const uint64_t count)
-{
-  mypp::Statement stmt(*connection);
   try
     {
-      stmt.Prepare (2, R"(
-        SELECT `data`
-          FROM `)" + table + R"(`
-          WHERE `height` >= ? AND `height` < ?
-          ORDER BY `height` ASC
-      )");
+      connection.Execute ("COMMIT");
     }
   catch (const mypp::Error& exc)
     {
-      LOG (FATAL) << exc.what ();
+      LOG (WARNING) << exc.what ();
     }
+}
 
+std::vector<BlockData>
+MySqlBlockStorage::Implementation::GetRange (const uint64_t start,
+                                             const uint64_t count)
+{
+  auto& stmt = GetRangeStatement ();
   stmt.Bind<int64_t> (0, start);
   stmt.Bind<int64_t> (1, start + count);
 
@@ -172,6 +290,53 @@ MySqlBlockStorage::Implementation::GetRange (const uint64_t start,
     }
 }
 
+uint64_t
+MySqlBlockStorage::Implementation::GetWarmHeight ()
+{
+  mypp::Statement stmt(*connection);
+  try
+    {
+      stmt.Prepare (0, R"(
+        SELECT `value`
+          FROM `)" + table + R"(_state`
+          WHERE `name` = 'warmheight'
+      )");
+      stmt.Query ();
+
+      uint64_t res = 0;
+      if (stmt.Fetch ())
+        res = stmt.Get<int64_t> ("value");
+
+      return res;
+    }
+  catch (const mypp::Error& exc)
+    {
+      LOG (WARNING) << exc.what ();
+      return 0;
+    }
+}
+
+void
+MySqlBlockStorage::Implementation::SetWarmHeight (const uint64_t h)
+{
+  mypp::Statement stmt(*connection);
+  try
+    {
+      stmt.Prepare (1, R"(
+        REPLACE INTO `)" + table + R"(_state`
+          (`name`, `value`) VALUES ('warmheight', ?)
+      )");
+      stmt.Bind<int64_t> (0, h);
+      stmt.Execute ();
+    }
+  catch (const mypp::Error& exc)
+    {
+      /* Failing to persist the progress just means that a future
+         warm-up will have to skip over more already-cached blocks.  */
+      LOG (WARNING) << exc.what ();
+    }
+}
+
 /* ************************************************************************** */
 
 MySqlBlockStorage::MySqlBlockStorage () = default;
@@ -229,6 +394,18 @@ MySqlBlockStorage::GetRange (const uint64_t start, const uint64_t count)
   return impl->GetRange (start, count);
 }
 
+uint64_t
+MySqlBlockStorage::GetWarmHeight ()
+{
+  return impl->GetWarmHeight ();
+}
+
+void
+MySqlBlockStorage::SetWarmHeight (const uint64_t h)
+{
+  impl->SetWarmHeight (h);
+}
+
 /* ************************************************************************** */
 
 } // namespace xayax
@@ -4,29 +4,227 @@
 
 #include "private/chainstate.hpp"
 
+#include "metrics.hpp"
+#include "private/blockdataview.hpp"
 #include "private/jsonutils.hpp"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 namespace xayax
 {
 
+DEFINE_string (xayax_chainstate_durability, "full",
+               "durability profile for the chainstate database: 'full'"
+               " syncs every update to disk, while 'fast' uses WAL with"
+               " synchronous=NORMAL (the chainstate can always be rebuilt"
+               " from the base chain)");
+DEFINE_int64 (xayax_chainstate_mmap_mb, 0,
+              "size of memory-mapped I/O for the chainstate database in MiB");
+DEFINE_int64 (xayax_chainstate_cache_mb, 0,
+              "size of the SQLite page cache for the chainstate in MiB"
+              " (zero to use SQLite's default)");
+DEFINE_int32 (xayax_chainstate_checkpoint_batches, 1'000,
+              "with the 'fast' profile, checkpoint the WAL after this many"
+              " update batches (zero to let SQLite do it automatically)");
+DEFINE_bool (xayax_chainstate_incremental_vacuum, true,
+             "use incremental auto-vacuum for new chainstate databases, so"
+             " that space freed by pruning is returned to the file system");
+DEFINE_bool (xayax_chainstate_convert_vacuum, false,
+             "convert an existing chainstate database to incremental"
+             " auto-vacuum at startup; this is a one-time full VACUUM, which"
+             " blocks until done and needs free disk space of up to twice"
+             " the database size");
+DEFINE_int32 (xayax_chainstate_branch_retention, 10'000,
+              "keep side branches that fork off pruned blocks until they are"
+              " this many blocks below the pruning height");
+DEFINE_int32 (xayax_chainstate_branch_gc_limit, 100,
+              "maximum number of stale side branches removed per pruning");
+
 namespace
 {
 
 /**
- * Sets up the schema we use for storing the chain data in the given database.
- * Does nothing if the schema is already there.
+ * Constructs the database profile to use based on the flags.
+ */
+Database::Profile
+GetProfileFromFlags ()
+{
+  CHECK_GE (FLAGS_xayax_chainstate_mmap_mb, 0);
+  CHECK_GE (FLAGS_xayax_chainstate_cache_mb, 0);
+  CHECK_GE (FLAGS_xayax_chainstate_checkpoint_batches, 0);
+
+  Database::Profile res;
+  res.mmapSize = FLAGS_xayax_chainstate_mmap_mb << 20;
+  res.cacheSize = FLAGS_xayax_chainstate_cache_mb << 10;
+  res.incrementalVacuum = FLAGS_xayax_chainstate_incremental_vacuum;
+
+  if (FLAGS_xayax_chainstate_durability == "fast")
+    {
+      res.wal = true;
+      res.relaxedSync = true;
+      res.autoCheckpoint = (FLAGS_xayax_chainstate_checkpoint_batches == 0);
+    }
+  else
+    CHECK_EQ (FLAGS_xayax_chainstate_durability, "full")
+        << "Invalid --xayax_chainstate_durability";
+
+  return res;
+}
+
+/**
+ * Latency metrics for the main chainstate operations.
+ */
+struct ChainstateMetrics
+{
+
+  MetricsHistogram& importTip;
+  MetricsHistogram& setTip;
+  MetricsHistogram& attachLinear;
+  MetricsHistogram& forkBranch;
+  MetricsHistogram& prune;
+
+  ChainstateMetrics ()
+    : importTip(Get ("import_tip")),
+      setTip(Get ("set_tip")),
+      attachLinear(Get ("attach_linear")),
+      forkBranch(Get ("fork_branch")),
+      prune(Get ("prune"))
+  {}
+
+  static MetricsHistogram&
+  Get (const std::string& op)
+  {
+    return MetricsRegistry::Get ().GetHistogram (
+        "xayax_chainstate_operation_seconds",
+        "Duration of chainstate operations", {{"op", op}});
+  }
+
+};
+
+ChainstateMetrics&
+GetChainstateMetrics ()
+{
+  static ChainstateMetrics metrics;
+  return metrics;
+}
+
+/** Current version of the database schema.  */
+constexpr int SCHEMA_VERSION = 2;
+
+/** Prefix byte for hashes stored in raw form.  */
+constexpr char HASH_RAW = '\0';
+/** Prefix byte for 256-bit hex hashes stored as binary.  */
+constexpr char HASH_BINARY = '\1';
+
+/**
+ * Returns the value of a hex digit, or -1 if the character is not
+ * a lower-case hex digit.
+ */
+int
+HexDigit (const char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/**
+ * Encodes a block hash for storage in the database.  The hashes of our base
+ * chains are 64-character lower-case hex strings, which are stored as the
+ * 32 raw bytes (with a prefix byte).  Any other string (as e.g. used in tests
+ * or for the genesis parent) is stored as-is with another prefix, so that
+ * the encoding is always reversible.
+ */
+std::string
+EncodeHash (const std::string& hash)
+{
+  if (hash.size () == 64)
+    {
+      std::string res(33, HASH_BINARY);
+      bool ok = true;
+      for (size_t i = 0; ok && i < 32; ++i)
+        {
+          const int hi = HexDigit (hash[2 * i]);
+          const int lo = HexDigit (hash[2 * i + 1]);
+          ok = (hi >= 0 && lo >= 0);
+          res[i + 1] = static_cast<char> ((hi << 4) | lo);
+        }
+      if (ok)
+        return res;
+    }
+
+  return HASH_RAW + hash;
+}
+
+/**
+ * Decodes a block hash from its database form.
+ */
+std::string
+DecodeHash (const std::string& data)
+{
+  CHECK (!data.empty ()) << "Invalid hash in the database";
+  switch (data[0])
+    {
+    case HASH_RAW:
+      return data.substr (1);
+
+    case HASH_BINARY:
+      {
+        static const char* digits = "0123456789abcdef";
+        CHECK_EQ (data.size (), 33) << "Invalid binary hash in the database";
+        std::string res;
+        res.reserve (64);
+        for (size_t i = 1; i < data.size (); ++i)
+          {
+            const auto byte = static_cast<unsigned char> (data[i]);
+            res.push_back (digits[byte >> 4]);
+            res.push_back (digits[byte & 0x0f]);
+          }
+        return res;
+      }
+
+    default:
+      LOG (FATAL) << "Invalid hash prefix in the database";
+    }
+}
+
+/**
+ * Binds a block hash (in its database form) to a statement parameter.
  */
 void
-SetupSchema (Database& db)
+BindHash (Database::Statement& stmt, const int ind, const std::string& hash)
+{
+  stmt.BindBlob (ind, EncodeHash (hash));
+}
+
+/**
+ * Extracts a block hash from a result column in its database form.
+ */
+std::string
+GetHash (const Database::Statement& stmt, const int ind)
 {
+  return DecodeHash (stmt.GetBlob (ind));
+}
+
+/**
+ * Creates the blocks table in the current schema version.
+ */
+void
+CreateBlocksTable (Database& db)
+{
+  /* Because the table is clustered on the hash, the index on branch /
+     height includes it as well and is covering for lookups of hashes
+     by branch and height.  */
   db.Execute (R"(
 
-    CREATE TABLE IF NOT EXISTS `blocks` (
+    CREATE TABLE `blocks` (
 
-      `hash` TEXT NOT NULL PRIMARY KEY,
-      `parent` TEXT NOT NULL,
+      -- Block hashes are stored as BLOBs in the form of EncodeHash.
+      `hash` BLOB NOT NULL PRIMARY KEY,
+      `parent` BLOB NOT NULL,
       `height` INTEGER NOT NULL,
 
       -- The branch this block is on.  For the main chain, it is zero;
@@ -35,11 +233,63 @@ SetupSchema (Database& db)
 
       -- All the other block data (including moves), which is just
       -- stored and passed on to GSPs but not needed internally.
-      `data` BLOB NOT NULL,
+      `data` BLOB NOT NULL
 
-      UNIQUE (`branch`, `height`)
+    ) WITHOUT ROWID;
 
-    );
+    CREATE UNIQUE INDEX `blocks_branch_height`
+      ON `blocks` (`branch`, `height`);
+
+  )");
+}
+
+/**
+ * Migrates the blocks table from schema version 1 (with hashes stored
+ * as TEXT and a rowid table) to the current version.
+ */
+void
+MigrateFromVersion1 (Database& db)
+{
+  LOG (WARNING) << "Migrating the chainstate database to the new schema";
+
+  db.Execute ("ALTER TABLE `blocks` RENAME TO `blocks_v1`");
+  CreateBlocksTable (db);
+
+  unsigned cnt = 0;
+  auto stmt = db.PrepareRo (R"(
+    SELECT `hash`, `parent`, `height`, `branch`, `data`
+      FROM `blocks_v1`
+  )");
+  while (stmt.Step ())
+    {
+      auto ins = db.Prepare (R"(
+        INSERT INTO `blocks`
+          (`hash`, `parent`, `height`, `branch`, `data`)
+          VALUES (?1, ?2, ?3, ?4, ?5)
+      )");
+      BindHash (ins, 1, stmt.Get<std::string> (0));
+      BindHash (ins, 2, stmt.Get<std::string> (1));
+      ins.Bind (3, stmt.Get<int64_t> (2));
+      ins.Bind (4, stmt.Get<int64_t> (3));
+      ins.BindBlob (5, stmt.GetBlob (4));
+      ins.Execute ();
+      ++cnt;
+    }
+  stmt = Database::Statement ();
+
+  db.Execute ("DROP TABLE `blocks_v1`");
+  LOG (INFO) << "Migrated " << cnt << " blocks";
+}
+
+/**
+ * Sets up the schema we use for storing the chain data in the given database.
+ * Does nothing if the schema is already there, and migrates it from
+ * older versions if necessary.
+ */
+void
+SetupSchema (Database& db)
+{
+  db.Execute (R"(
 
     -- Base metadata variables as a general key/value store.
     CREATE TABLE IF NOT EXISTS `variables` (
@@ -48,145 +298,298 @@ SetupSchema (Database& db)
     );
 
   )");
+
+  int version = 0;
+  {
+    auto stmt = db.PrepareRo (R"(
+      SELECT `value`
+        FROM `variables`
+        WHERE `name` = 'schemaversion'
+    )");
+    if (stmt.Step ())
+      version = std::stoi (stmt.Get<std::string> (0));
+  }
+
+  if (version == 0)
+    {
+      /* Databases from before the schema was versioned may already
+         have a blocks table, which is then version 1.  */
+      auto stmt = db.PrepareRo (R"(
+        SELECT COUNT(*)
+          FROM `sqlite_master`
+          WHERE `type` = 'table' AND `name` = 'blocks'
+      )");
+      CHECK (stmt.Step ());
+      if (stmt.Get<int64_t> (0) > 0)
+        version = 1;
+    }
+
+  if (version == SCHEMA_VERSION)
+    return;
+  CHECK_LT (version, SCHEMA_VERSION)
+      << "The chainstate database is from a newer version";
+
+  db.Execute ("BEGIN");
+  if (version == 0)
+    CreateBlocksTable (db);
+  else
+    MigrateFromVersion1 (db);
+
+  auto stmt = db.Prepare (R"(
+    INSERT OR REPLACE INTO `variables`
+      (`name`, `value`)
+      VALUES ('schemaversion', ?1)
+  )");
+  stmt.Bind (1, std::to_string (SCHEMA_VERSION));
+  stmt.Execute ();
+  stmt = Database::Statement ();
+  db.Execute ("COMMIT");
+
+  /* Reclaim the space freed up by the old table.  */
+  if (version > 0)
+    db.Execute ("VACUUM");
 }
 
 /**
- * Queries for the lowest or highest mainchain block number.
+ * Returns the lowest branch number that is higher than all branches
+ * currently in the database.  This is used to initialise the persisted
+ * branch counter for databases that do not yet have one.
  */
-int64_t
-GetMainchainHeight (const Database& db, const std::string& order)
+uint64_t
+GetFreeBranchNumber (const Database& db)
 {
   auto stmt = db.PrepareRo (R"(
-    SELECT `height`
+    SELECT MAX(`branch`)
       FROM `blocks`
-      WHERE `branch` = 0
-      ORDER BY `height` )" + order + R"(
-      LIMIT 1
   )");
+  CHECK (stmt.Step ());
 
-  if (!stmt.Step ())
-    return -1;
+  /* We have no blocks, every number is fine.  */
+  if (stmt.IsNull (0))
+    return 1;
 
-  const auto res = stmt.Get<int64_t> (0);
+  const auto highestBranch = stmt.Get<uint64_t> (0);
   CHECK (!stmt.Step ());
 
+  return highestBranch + 1;
+}
+
+} // anonymous namespace
+
+Chainstate::Chainstate (const std::string& file)
+  : Database(file)
+{
+  const auto profile = GetProfileFromFlags ();
+  ApplyProfile (profile);
+  if (IsWal () && !profile.autoCheckpoint)
+    checkpointInterval = FLAGS_xayax_chainstate_checkpoint_batches;
+
+  /* A schema migration runs a VACUUM, which also converts an existing
+     database to incremental auto-vacuum if requested in the profile.  */
+  SetupSchema (*this);
+
+  if (profile.incrementalVacuum && !IsIncrementalVacuum ())
+    {
+      if (FLAGS_xayax_chainstate_convert_vacuum)
+        {
+          LOG (WARNING)
+              << "Converting the chainstate to incremental auto-vacuum,"
+              << " this rewrites the entire database and may take a while...";
+          Execute ("VACUUM");
+          if (!IsIncrementalVacuum ())
+            LOG (WARNING) << "Could not enable incremental auto-vacuum";
+        }
+      else
+        LOG (WARNING)
+            << "The existing chainstate database does not use incremental"
+            << " auto-vacuum, so space freed by pruning is not returned to"
+            << " the file system; use --xayax_chainstate_convert_vacuum"
+            << " to convert it (with a one-time full VACUUM)";
+    }
+
+  RebuildIndex ();
+}
+
+void
+Chainstate::RebuildIndex ()
+{
+  mainchain.clear ();
+  index.clear ();
+
+  auto stmt = PrepareRo (R"(
+    SELECT `hash`, `parent`, `height`, `branch`
+      FROM `blocks`
+  )");
+
+  while (stmt.Step ())
+    {
+      const auto hash = GetHash (stmt, 0);
+
+      IndexEntry entry;
+      entry.parent = GetHash (stmt, 1);
+      entry.height = stmt.Get<uint64_t> (2);
+      entry.branch = stmt.Get<uint64_t> (3);
+
+      if (entry.branch == 0)
+        CHECK (mainchain.emplace (entry.height, hash).second);
+      CHECK (index.emplace (hash, std::move (entry)).second);
+    }
+
+  /* The branch counter is persisted as well, so that rolled-back
+     allocations are reverted here together with the index.  */
+  stmt = PrepareRo (R"(
+    SELECT `value`
+      FROM `variables`
+      WHERE `name` = 'nextbranch'
+  )");
+  if (stmt.Step ())
+    {
+      nextBranch = std::stoull (stmt.Get<std::string> (0));
+      CHECK (!stmt.Step ());
+    }
+  else
+    nextBranch = GetFreeBranchNumber (*this);
+  CHECK_GE (nextBranch, GetFreeBranchNumber (*this));
+
+  VLOG (1)
+      << "Loaded " << index.size () << " blocks into the index, of which "
+      << mainchain.size () << " are on the main chain";
+}
+
+uint64_t
+Chainstate::AllocateBranch ()
+{
+  const uint64_t res = nextBranch++;
+
+  auto stmt = Prepare (R"(
+    INSERT OR REPLACE INTO `variables`
+      (`name`, `value`)
+      VALUES ('nextbranch', ?1)
+  )");
+  stmt.Bind (1, std::to_string (nextBranch));
+  stmt.Execute ();
+
   return res;
 }
 
-/**
- * Inserts a block into the database.
- */
 void
-InsertBlock (Database& db, const BlockData& blk, const uint64_t branch)
+Chainstate::InsertBlock (const BlockData& blk, const uint64_t branch)
 {
-  auto stmt = db.Prepare (R"(
+  auto stmt = Prepare (R"(
     INSERT INTO `blocks`
       (`hash`, `parent`, `height`, `branch`, `data`)
       VALUES (?1, ?2, ?3, ?4, ?5)
   )");
-  stmt.Bind (1, blk.hash);
-  stmt.Bind (2, blk.parent);
+  BindHash (stmt, 1, blk.hash);
+  BindHash (stmt, 2, blk.parent);
   stmt.Bind (3, blk.height);
   stmt.Bind (4, branch);
   stmt.BindBlob (5, blk.Serialise ());
   stmt.Execute ();
+
+  IndexEntry entry;
+  entry.height = blk.height;
+  entry.branch = branch;
+  entry.parent = blk.parent;
+
+  if (branch == 0)
+    CHECK (mainchain.emplace (blk.height, blk.hash).second);
+  CHECK (index.emplace (blk.hash, std::move (entry)).second);
 }
 
-/**
- * Looks for a free branch number to use for a new branch.
- */
-uint64_t
-GetFreeBranchNumber (const Database& db)
+void
+Chainstate::DetachFromMainchain (const uint64_t fromHeight)
 {
-  auto stmt = db.PrepareRo (R"(
-    SELECT `branch`
-      FROM `blocks`
-      ORDER BY `branch` DESC
-      LIMIT 1
+  /* In the common case of extending the main chain, there is nothing
+     to detach.  Skip allocating a branch number then.  */
+  auto mit = mainchain.lower_bound (fromHeight);
+  if (mit == mainchain.end ())
+    return;
+
+  const uint64_t branch = AllocateBranch ();
+  auto upd = Prepare (R"(
+    UPDATE `blocks`
+      SET `branch` = ?1
+      WHERE `branch` = 0 AND `height` >= ?2
   )");
+  upd.Bind (1, branch);
+  upd.Bind (2, fromHeight);
+  upd.Execute ();
 
-  if (!stmt.Step ())
+  while (mit != mainchain.end ())
     {
-      /* We have no blocks, every number is fine.  */
-      return 1;
+      index.at (mit->second).branch = branch;
+      mit = mainchain.erase (mit);
     }
-
-  const auto highestBranch = stmt.Get<uint64_t> (0);
-  CHECK (!stmt.Step ());
-
-  return highestBranch + 1;
 }
 
-/**
- * Marks the given block as current tip, assuming it already exists.
- */
 void
-MarkAsTip (const Chainstate& s, Database& db, const BlockData& blk)
+Chainstate::MarkAsTip (const BlockData& blk)
 {
-  auto stmt = db.PrepareRo (R"(
-    SELECT `branch`
-      FROM `blocks`
-      WHERE `hash` = ?1
-  )");
-  stmt.Bind (1, blk.hash);
-  CHECK (stmt.Step ()) << "Block " << blk.hash << " does not yet exist";
-  const auto oldBranch = stmt.Get<uint64_t> (0);
-  CHECK (!stmt.Step ());
+  const auto mit = index.find (blk.hash);
+  CHECK (mit != index.end ()) << "Block " << blk.hash << " does not yet exist";
 
-  if (oldBranch == 0)
+  if (mit->second.branch == 0)
     {
       /* The new tip is already on the main chain.  Mark all following
          blocks (if there are any) as on a branch, at least for now until
          more of them get set as tip, too.  */
-      auto upd = db.Prepare (R"(
-        UPDATE `blocks`
-          SET `branch` = ?1
-          WHERE `branch` = 0 AND `height` > ?2
-      )");
-      upd.Bind (1, GetFreeBranchNumber (db));
-      upd.Bind (2, blk.height);
-      upd.Execute ();
+      DetachFromMainchain (blk.height + 1);
+      return;
     }
-  else
+
+  /* The new tip is on a branch.  Look for the fork point, mark
+     all blocks on the old main chain beyond the fork point as on
+     a new branch, and all blocks on the new main chain until the
+     current tip as branch zero.  */
+
+  std::vector<std::string> branch;
+  uint64_t forkHeight;
+  for (std::string cur = blk.hash; ; )
     {
-      /* The new tip is on a branch.  Look for the fork point, mark
-         all blocks on the old main chain beyond the fork point as on
-         a new branch, and all blocks on the new main chain until the
-         current tip as branch zero.  */
+      const auto it = index.find (cur);
+      if (it == index.end () || it->second.branch == 0)
+        break;
 
-      std::vector<BlockData> branch;
-      CHECK (s.GetForkBranch (blk.hash, branch))
-          << "Failed to get fork branch for new tip " << blk.hash;
-      CHECK (!branch.empty ());
+      branch.push_back (cur);
+      forkHeight = it->second.height;
+      cur = it->second.parent;
+    }
+  CHECK (!branch.empty ());
 
-      auto upd = db.Prepare (R"(
-        UPDATE `blocks`
-          SET `branch` = ?1
-          WHERE `branch` = 0 AND `height` >= ?2
-      )");
-      upd.Bind (1, GetFreeBranchNumber (db));
-      upd.Bind (2, branch.rbegin ()->height);
-      upd.Execute ();
+  DetachFromMainchain (forkHeight);
+
+  /* The path from the new tip to the fork point consists of segments,
+     each of which is a contiguous height range on some branch.  Move
+     each segment to the main chain with a single update.  The path is
+     ordered by decreasing height.  */
+  for (size_t i = 0; i < branch.size (); )
+    {
+      const uint64_t segmentBranch = index.at (branch[i]).branch;
+      const uint64_t segmentTop = index.at (branch[i]).height;
 
-      for (const auto& d : branch)
+      uint64_t segmentBottom;
+      for (; i < branch.size (); ++i)
         {
-          auto upd2 = db.Prepare (R"(
-            UPDATE `blocks`
-              SET `branch` = 0
-              WHERE `hash` = ?1
-          )");
-          upd2.Bind (1, d.hash);
-          upd2.Execute ();
-        }
-    }
-}
+          auto& entry = index.at (branch[i]);
+          if (entry.branch != segmentBranch)
+            break;
 
-} // anonymous namespace
+          segmentBottom = entry.height;
+          entry.branch = 0;
+          CHECK (mainchain.emplace (entry.height, branch[i]).second);
+        }
 
-Chainstate::Chainstate (const std::string& file)
-  : Database(file)
-{
-  SetupSchema (*this);
+      auto upd = Prepare (R"(
+        UPDATE `blocks`
+          SET `branch` = 0
+          WHERE `branch` = ?1 AND `height` >= ?2 AND `height` <= ?3
+      )");
+      upd.Bind (1, segmentBranch);
+      upd.Bind (2, segmentBottom);
+      upd.Bind (3, segmentTop);
+      upd.Execute ();
+    }
 }
 
 void
@@ -215,59 +618,67 @@ Chainstate::SetChain (const std::string& chain)
   stmt.Execute ();
 }
 
+std::string
+Chainstate::GetChain () const
+{
+  std::lock_guard<std::mutex> lock(mutDbRead);
+  auto stmt = PrepareRo (R"(
+    SELECT `value`
+      FROM `variables`
+      WHERE `name` = 'chain'
+  )");
+
+  if (!stmt.Step ())
+    return "";
+
+  const auto res = stmt.Get<std::string> (0);
+  CHECK (!stmt.Step ());
+  return res;
+}
+
 int64_t
 Chainstate::GetTipHeight () const
 {
-  return GetMainchainHeight (*this, "DESC");
+  if (mainchain.empty ())
+    return -1;
+  return mainchain.rbegin ()->first;
 }
 
 int64_t
 Chainstate::GetLowestUnprunedHeight () const
 {
-  return GetMainchainHeight (*this, "ASC");
+  if (mainchain.empty ())
+    return -1;
+  return mainchain.begin ()->first;
 }
 
 bool
 Chainstate::GetHashForHeight (const uint64_t height, std::string& hash) const
 {
-  auto stmt = PrepareRo (R"(
-    SELECT `hash`
-      FROM `blocks`
-      WHERE `branch` = 0 AND `height` = ?1
-  )");
-  stmt.Bind (1, height);
-
-  if (!stmt.Step ())
+  const auto it = mainchain.find (height);
+  if (it == mainchain.end ())
     return false;
 
-  hash = stmt.Get<std::string> (0);
-  CHECK (!stmt.Step ());
-
+  hash = it->second;
   return true;
 }
 
 bool
 Chainstate::GetHeightForHash (const std::string& hash, uint64_t& height) const
 {
-  auto stmt = PrepareRo (R"(
-    SELECT `height`
-      FROM `blocks`
-      WHERE `hash` = ?1
-  )");
-  stmt.Bind (1, hash);
-
-  if (!stmt.Step ())
+  const auto it = index.find (hash);
+  if (it == index.end ())
     return false;
 
-  height = stmt.Get<uint64_t> (0);
-  CHECK (!stmt.Step ());
-
+  height = it->second.height;
   return true;
 }
 
 void
 Chainstate::ImportTip (const BlockData& tip)
 {
+  MetricsTimer timer(GetChainstateMetrics ().importTip);
+
   const int64_t oldTip = GetTipHeight ();
   if (oldTip != -1)
     CHECK_LT (oldTip, tip.height)
@@ -282,9 +693,9 @@ Chainstate::ImportTip (const BlockData& tip)
      Otherwise insert it as new block.  */
   uint64_t height;
   if (GetHeightForHash (tip.hash, height))
-    MarkAsTip (*this, *this, tip);
+    MarkAsTip (tip);
   else
-    InsertBlock (*this, tip, 0);
+    InsertBlock (tip, 0);
 
   /* Make sure to prune any mainchain blocks before the new one, so that
      GetLowestUnprunedHeight() matches it and there are no gaps between
@@ -301,43 +712,31 @@ Chainstate::ImportTip (const BlockData& tip)
 bool
 Chainstate::SetTip (const BlockData& blk, std::string& oldTip)
 {
+  MetricsTimer timer(GetChainstateMetrics ().setTip);
+
   /* Set the old tip from what is currently the highest branch-zero block.
      If there is none, it means we have no blocks and can't attach our tip.  */
-  auto stmt = PrepareRo (R"(
-    SELECT `hash`
-      FROM `blocks`
-      WHERE `branch` = 0
-      ORDER BY `height` DESC
-      LIMIT 1
-  )");
-  if (!stmt.Step ())
+  if (mainchain.empty ())
     {
       LOG (WARNING) << "We have no blocks, can't attach new tip " << blk.hash;
       return false;
     }
-  oldTip = stmt.Get<std::string> (0);
-  CHECK (!stmt.Step ());
+  oldTip = mainchain.rbegin ()->second;
 
   /* See if we already have the block.  If we do, check that it matches
      the main data we have now, and mark the respective chain as active.  */
-  stmt = PrepareRo (R"(
-    SELECT `parent`, `height`
-      FROM `blocks`
-      WHERE `hash` = ?1
-  )");
-  stmt.Bind (1, blk.hash);
-  if (stmt.Step ())
+  const auto it = index.find (blk.hash);
+  if (it != index.end ())
     {
       LOG (INFO)
           << "We already have block " << blk.hash
           << ", marking as new tip";
 
-      CHECK_EQ (blk.parent, stmt.Get<std::string> (0));
-      CHECK_EQ (blk.height, stmt.Get<uint64_t> (1));
-      CHECK (!stmt.Step ());
+      CHECK_EQ (blk.parent, it->second.parent);
+      CHECK_EQ (blk.height, it->second.height);
 
       UpdateBatch upd(*this);
-      MarkAsTip (*this, *this, blk);
+      MarkAsTip (blk);
       upd.Commit ();
       return true;
     }
@@ -345,33 +744,87 @@ Chainstate::SetTip (const BlockData& blk, std::string& oldTip)
   /* Check the parent block.  If it does not exist, we cannot attach the new
      block to our chainstate.  If it does exist, we can attach the block
      to the parent as a temporary new branch, and then mark it as tip.  */
-  stmt = PrepareRo (R"(
-    SELECT `height`
-      FROM `blocks`
-      WHERE `hash` = ?1
-  )");
-  stmt.Bind (1, blk.parent);
-  if (!stmt.Step ())
+  const auto pit = index.find (blk.parent);
+  if (pit == index.end ())
     {
       LOG (WARNING)
           << "Cannot attach tip " << blk.hash
           << ", parent block " << blk.parent << " is unknown";
       return false;
     }
-  CHECK_EQ (blk.height, stmt.Get<uint64_t> (0) + 1)
+  CHECK_EQ (blk.height, pit->second.height + 1)
       << "Height mismatch for new block " << blk.hash
       << " with parent " << blk.parent;
-  CHECK (!stmt.Step ());
 
   LOG (INFO)
       << "Attaching block " << blk.hash << " to " << blk.parent
       << " as the new tip at height " << blk.height;
 
   UpdateBatch upd(*this);
-  InsertBlock (*this, blk, GetFreeBranchNumber (*this));
-  MarkAsTip (*this, *this, blk);
+  if (blk.parent == oldTip)
+    {
+      /* This is a simple extension of the main chain, so the block
+         can go straight onto it.  */
+      InsertBlock (blk, 0);
+    }
+  else
+    {
+      InsertBlock (blk, AllocateBranch ());
+      MarkAsTip (blk);
+    }
+  upd.Commit ();
+
+  return true;
+}
+
+bool
+Chainstate::AttachLinearRange (const std::vector<BlockData>& blocks)
+{
+  return AttachLinearRange (blocks.begin (), blocks.end ());
+}
+
+bool
+Chainstate::AttachLinearRange (
+    const std::vector<BlockData>::const_iterator begin,
+    const std::vector<BlockData>::const_iterator end)
+{
+  MetricsTimer timer(GetChainstateMetrics ().attachLinear);
+
+  if (begin == end)
+    return true;
+
+  const int64_t tipHeight = GetTipHeight ();
+  if (tipHeight == -1)
+    return false;
+
+  std::string prev;
+  CHECK (GetHashForHeight (tipHeight, prev));
+  uint64_t prevHeight = tipHeight;
+
+  for (auto it = begin; it != end; ++it)
+    {
+      if (it->parent != prev || it->height != prevHeight + 1)
+        return false;
+
+      uint64_t height;
+      if (GetHeightForHash (it->hash, height))
+        return false;
+
+      prev = it->hash;
+      prevHeight = it->height;
+    }
+
+  UpdateBatch upd(*this);
+  for (auto it = begin; it != end; ++it)
+    InsertBlock (*it, 0);
   upd.Commit ();
 
+  const auto& last = *(end - 1);
+  LOG (INFO)
+      << "Attached " << (end - begin) << " blocks linearly to "
+      << begin->parent << ", new tip " << last.hash
+      << " at height " << last.height;
+
   return true;
 }
 
@@ -379,65 +832,82 @@ bool
 Chainstate::GetForkBranch (const std::string& hash,
                            std::vector<BlockData>& branch) const
 {
+  MetricsTimer timer(GetChainstateMetrics ().forkBranch);
   branch.clear ();
 
-  /* Add all blocks on the branch of "hash" below it with decreasing height
-     to the output data.  When we reach the end of the branch, use the parent
-     block as new starting point and continue based on that block as well,
-     until we reach the main chain.  */
-  std::string curHash = hash;
-  while (true)
-    {
-      auto stmt = PrepareRo (R"(
-        SELECT `branch`, `height`
+  /* Use the index to handle the trivial cases (unknown block or a block
+     on the main chain) without going to the database.  */
+  const auto it = index.find (hash);
+  if (it == index.end ())
+    return false;
+  if (it->second.branch == 0)
+    return true;
+
+  /* Follow the parent links from the requested block back until either
+     a main-chain block or a missing (pruned) block is reached, all with
+     a single query.  The recursion only needs the header columns; the
+     block data is joined on in the end.  */
+  auto stmt = PrepareRo (R"(
+    WITH RECURSIVE `path` (`hash`, `parent`, `height`) AS (
+        SELECT `hash`, `parent`, `height`
           FROM `blocks`
           WHERE `hash` = ?1
-      )");
-      stmt.Bind (1, curHash);
+      UNION ALL
+        SELECT `b`.`hash`, `b`.`parent`, `b`.`height`
+          FROM `blocks` AS `b`
+            INNER JOIN `path` AS `p` ON `b`.`hash` = `p`.`parent`
+          WHERE `b`.`branch` > 0
+    )
+    SELECT `p`.`hash`, `p`.`parent`, `p`.`height`, `b`.`data`
+      FROM `path` AS `p`
+        INNER JOIN `blocks` AS `b` ON `b`.`hash` = `p`.`hash`
+      ORDER BY `p`.`height` DESC
+  )");
+  BindHash (stmt, 1, hash);
 
-      if (!stmt.Step ())
-        {
-          /* The block is not known.  This can mean one of two things:
-             First, if this was the initial request, it simply means that
-             we do not know that block and cannot respond.  Second, if this
-             is the parent of a previous branch, it could be that we reached
-             the main chain but those blocks have been pruned already.  */
-          return !branch.empty ();
-        }
+  while (stmt.Step ())
+    {
+      const BlockDataView blk(stmt.GetBlob (3));
+      CHECK_EQ (blk.GetHash (), GetHash (stmt, 0));
+      CHECK_EQ (blk.GetParent (), GetHash (stmt, 1));
+      CHECK_EQ (blk.GetHeight (), stmt.Get<uint64_t> (2));
+      if (!branch.empty ())
+        CHECK_EQ (branch.back ().parent, blk.GetHash ());
+      branch.push_back (blk.ToBlockData ());
+    }
+  CHECK (!branch.empty ());
 
-      const auto curBranch = stmt.Get<uint64_t> (0);
-      const auto curHeight = stmt.Get<uint64_t> (1);
-      CHECK (!stmt.Step ());
+  return true;
+}
 
-      if (curBranch == 0)
-        return true;
+bool
+Chainstate::GetForkBranchHeaders (const std::string& hash,
+                                  std::vector<BlockData>& branch) const
+{
+  branch.clear ();
 
-      stmt = PrepareRo (R"(
-        SELECT `hash`, `parent`, `height`, `data`
-          FROM `blocks`
-          WHERE `branch` = ?1 AND `height` <= ?2
-          ORDER BY `height` DESC
-      )");
-      stmt.Bind (1, curBranch);
-      stmt.Bind (2, curHeight);
+  std::string curHash = hash;
+  while (true)
+    {
+      const auto it = index.find (curHash);
+      if (it == index.end ())
+        return !branch.empty ();
+      if (it->second.branch == 0)
+        return true;
 
-      while (stmt.Step ())
-        {
-          BlockData blk;
-          blk.Deserialise (stmt.GetBlob (3));
-          CHECK_EQ (blk.hash, stmt.Get<std::string> (0));
-          CHECK_EQ (blk.parent, stmt.Get<std::string> (1));
-          CHECK_EQ (blk.height, stmt.Get<uint64_t> (2));
-          branch.emplace_back (std::move (blk));
-        }
+      branch.emplace_back ();
+      branch.back ().hash = curHash;
+      branch.back ().parent = it->second.parent;
+      branch.back ().height = it->second.height;
 
-      curHash = branch.rbegin ()->parent;
+      curHash = it->second.parent;
     }
 }
 
 void
 Chainstate::Prune (const uint64_t untilHeight)
 {
+  MetricsTimer timer(GetChainstateMetrics ().prune);
   UpdateBatch upd(*this);
 
   auto stmt = Prepare (R"(
@@ -447,13 +917,179 @@ Chainstate::Prune (const uint64_t untilHeight)
   stmt.Bind (1, untilHeight);
   stmt.Execute ();
 
+  const unsigned cnt = RowsModified ();
+
+  for (auto it = mainchain.begin ();
+       it != mainchain.end () && it->first <= untilHeight;
+       it = mainchain.erase (it))
+    index.erase (it->second);
+
+  CHECK_GE (FLAGS_xayax_chainstate_branch_retention, 0);
+  const uint64_t retention = FLAGS_xayax_chainstate_branch_retention;
+  if (untilHeight >= retention)
+    CollectStaleBranches (untilHeight - retention);
+
   upd.Commit ();
 
-  const unsigned cnt = RowsModified ();
   LOG_IF (INFO, cnt > 0)
       << "Pruned " << cnt << " blocks until height " << untilHeight;
 }
 
+uint64_t
+Chainstate::Vacuum (const unsigned pages)
+{
+  CHECK_EQ (openBatches, 0) << "Vacuum must not run inside an update batch";
+  return IncrementalVacuum (pages);
+}
+
+void
+Chainstate::CollectStaleBranches (const uint64_t cutoff)
+{
+  CHECK_GT (openBatches, 0) << "Branch GC must run inside an update batch";
+  CHECK_GT (FLAGS_xayax_chainstate_branch_gc_limit, 0);
+
+  /* Find all side branches that are entirely at or below the cutoff.
+     We process them in order of their lowest height, which ensures
+     that a branch forking off another one is only processed after it.
+     That way, chains of stale branches can be removed in one go.
+
+     The candidates are read into memory first, so that we do not
+     modify the table while iterating over it.  */
+  struct Candidate
+  {
+    uint64_t branch;
+    uint64_t minHeight;
+  };
+  std::vector<Candidate> candidates;
+  {
+    auto stmt = PrepareRo (R"(
+      SELECT `branch`, MIN(`height`)
+        FROM `blocks`
+        WHERE `branch` > 0
+        GROUP BY `branch`
+        HAVING MAX(`height`) <= ?1
+        ORDER BY MIN(`height`) ASC
+    )");
+    stmt.Bind (1, cutoff);
+    while (stmt.Step ())
+      candidates.push_back ({stmt.Get<uint64_t> (0), stmt.Get<uint64_t> (1)});
+  }
+
+  const unsigned limit = FLAGS_xayax_chainstate_branch_gc_limit;
+  unsigned removedBranches = 0;
+  unsigned removedBlocks = 0;
+  gcPending = false;
+  for (const auto& c : candidates)
+    {
+      if (removedBranches >= limit)
+        {
+          gcPending = true;
+          break;
+        }
+
+      auto stmt = PrepareRo (R"(
+        SELECT `parent`
+          FROM `blocks`
+          WHERE `branch` = ?1 AND `height` = ?2
+      )");
+      stmt.Bind (1, c.branch);
+      stmt.Bind (2, c.minHeight);
+      CHECK (stmt.Step ());
+      const auto parent = GetHash (stmt, 0);
+      CHECK (!stmt.Step ());
+
+      /* If the branch still connects to a known block, keep it.  */
+      if (index.count (parent) > 0)
+        continue;
+
+      stmt = PrepareRo (R"(
+        SELECT `hash`
+          FROM `blocks`
+          WHERE `branch` = ?1
+      )");
+      stmt.Bind (1, c.branch);
+      while (stmt.Step ())
+        {
+          CHECK_EQ (index.erase (GetHash (stmt, 0)), 1);
+          ++removedBlocks;
+        }
+
+      auto del = Prepare (R"(
+        DELETE FROM `blocks`
+          WHERE `branch` = ?1
+      )");
+      del.Bind (1, c.branch);
+      del.Execute ();
+
+      ++removedBranches;
+    }
+
+  lastGcCutoff = cutoff;
+
+  LOG_IF (INFO, removedBranches > 0)
+      << "Removed " << removedBranches << " stale branches with "
+      << removedBlocks << " blocks up to height " << cutoff;
+  LOG_IF (INFO, gcPending)
+      << "More stale branches are left for the next pruning";
+}
+
+std::vector<std::string>
+Chainstate::GetMainchainData () const
+{
+  std::lock_guard<std::mutex> lock(mutDbRead);
+  auto stmt = PrepareRo (R"(
+    SELECT `hash`, `height`, `data`
+      FROM `blocks`
+      WHERE `branch` = 0
+      ORDER BY `height`
+  )");
+
+  std::vector<std::string> res;
+  auto it = mainchain.begin ();
+  while (stmt.Step ())
+    {
+      CHECK (it != mainchain.end ());
+      CHECK_EQ (stmt.Get<uint64_t> (1), it->first);
+      CHECK_EQ (GetHash (stmt, 0), it->second);
+      res.push_back (stmt.GetBlob (2));
+      ++it;
+    }
+  CHECK (it == mainchain.end ());
+
+  return res;
+}
+
+std::vector<std::string>
+Chainstate::GetMainchainRange (const uint64_t start,
+                               const uint64_t count) const
+{
+  std::vector<std::string> res;
+  if (count == 0)
+    return res;
+
+  std::lock_guard<std::mutex> lock(mutDbRead);
+  auto stmt = PrepareRo (R"(
+    SELECT `hash`, `height`, `data`
+      FROM `blocks`
+      WHERE `branch` = 0 AND `height` >= ?1 AND `height` < ?2
+      ORDER BY `height`
+  )");
+  stmt.Bind (1, start);
+  stmt.Bind (2, start + count);
+
+  auto it = mainchain.lower_bound (start);
+  while (stmt.Step ())
+    {
+      CHECK (it != mainchain.end ());
+      CHECK_EQ (stmt.Get<uint64_t> (1), it->first);
+      CHECK_EQ (GetHash (stmt, 0), it->second);
+      res.push_back (stmt.GetBlob (2));
+      ++it;
+    }
+
+  return res;
+}
+
 void
 Chainstate::SanityCheck () const
 {
@@ -468,6 +1104,8 @@ Chainstate::SanityCheck () const
   CHECK (!stmt.Step ());
   if (numBlocks == 0)
     {
+      CHECK (index.empty ());
+      CHECK (mainchain.empty ());
       LOG (INFO) << "No blocks are in the database, all good";
       return;
     }
@@ -508,15 +1146,16 @@ Chainstate::SanityCheck () const
 
       while (stmt.Step ())
         {
-          const auto hash = stmt.Get<std::string> (0);
-          const auto parent = stmt.Get<std::string> (1);
+          const auto hash = GetHash (stmt, 0);
+          const auto parent = GetHash (stmt, 1);
           const int64_t height = stmt.Get<uint64_t> (2);
 
-          BlockData blk;
-          blk.Deserialise (stmt.GetBlob (3));
-          CHECK_EQ (blk.hash, hash);
-          CHECK_EQ (blk.parent, parent);
-          CHECK_EQ (blk.height, height);
+          /* Only the header data is needed here, so we can use a view
+             and avoid parsing the JSON fields of all moves.  */
+          const BlockDataView blk(stmt.GetBlob (3));
+          CHECK_EQ (blk.GetHash (), hash);
+          CHECK_EQ (blk.GetParent (), parent);
+          CHECK_EQ (blk.GetHeight (), height);
 
           if (lastHeight != -1)
             {
@@ -540,7 +1179,7 @@ Chainstate::SanityCheck () const
           FROM `blocks`
           WHERE `hash` = ?1
       )");
-      stmt.Bind (1, expectedParent);
+      BindHash (stmt, 1, expectedParent);
 
       if (!stmt.Step ())
         {
@@ -561,12 +1200,69 @@ Chainstate::SanityCheck () const
         }
     }
   CHECK (foundMain) << "No main branch found";
+  CHECK_GE (nextBranch, GetFreeBranchNumber (*this))
+      << "Branch counter is behind the branches in the database";
+
+  /* If the last garbage collection removed all stale branches at or
+     below its cutoff, there must not be any left.  */
+  if (lastGcCutoff != -1 && !gcPending)
+    {
+      stmt = PrepareRo (R"(
+        SELECT `branch`, MIN(`height`)
+          FROM `blocks`
+          WHERE `branch` > 0
+          GROUP BY `branch`
+          HAVING MAX(`height`) <= ?1
+      )");
+      stmt.Bind (1, lastGcCutoff);
+      while (stmt.Step ())
+        {
+          const auto branch = stmt.Get<uint64_t> (0);
+          auto root = PrepareRo (R"(
+            SELECT `parent`
+              FROM `blocks`
+              WHERE `branch` = ?1 AND `height` = ?2
+          )");
+          root.Bind (1, branch);
+          root.Bind (2, stmt.Get<uint64_t> (1));
+          CHECK (root.Step ());
+          CHECK (index.count (GetHash (root, 0)) > 0)
+              << "Stale branch " << branch << " has not been collected";
+        }
+    }
+
+  /* The in-memory index should match exactly what is in the database.  */
+  stmt = PrepareRo (R"(
+    SELECT `hash`, `parent`, `height`, `branch`
+      FROM `blocks`
+  )");
+  unsigned numMain = 0;
+  while (stmt.Step ())
+    {
+      const auto hash = GetHash (stmt, 0);
+      const auto it = index.find (hash);
+      CHECK (it != index.end ()) << "Block " << hash << " is not indexed";
+      CHECK_EQ (it->second.parent, GetHash (stmt, 1));
+      CHECK_EQ (it->second.height, stmt.Get<uint64_t> (2));
+      CHECK_EQ (it->second.branch, stmt.Get<uint64_t> (3));
+
+      if (it->second.branch == 0)
+        {
+          ++numMain;
+          const auto mit = mainchain.find (it->second.height);
+          CHECK (mit != mainchain.end () && mit->second == hash)
+              << "Main-chain index mismatch for block " << hash;
+        }
+    }
+  CHECK_EQ (index.size (), numBlocks);
+  CHECK_EQ (mainchain.size (), numMain);
 }
 
 Chainstate::UpdateBatch::UpdateBatch (Chainstate& p)
-  : parent(p)
+  : parent(p), oldGcCutoff(p.lastGcCutoff), oldGcPending(p.gcPending)
 {
   parent.Prepare ("SAVEPOINT `update-batch`").Execute ();
+  ++parent.openBatches;
 }
 
 Chainstate::UpdateBatch::~UpdateBatch ()
@@ -577,6 +1273,14 @@ Chainstate::UpdateBatch::~UpdateBatch ()
   LOG (WARNING) << "Reverting failed update batch";
   parent.Prepare ("ROLLBACK TO `update-batch`").Execute ();
   parent.Prepare ("RELEASE `update-batch`").Execute ();
+  CHECK_GT (parent.openBatches, 0);
+  --parent.openBatches;
+
+  /* The in-memory index and GC state may have been updated as part of
+     the batch, so bring them back in line with the reverted database.  */
+  parent.RebuildIndex ();
+  parent.lastGcCutoff = oldGcCutoff;
+  parent.gcPending = oldGcPending;
 }
 
 void
@@ -585,6 +1289,20 @@ Chainstate::UpdateBatch::Commit ()
   CHECK (!committed) << "Update is already committed";
   committed = true;
   parent.Prepare ("RELEASE `update-batch`").Execute ();
+
+  CHECK_GT (parent.openBatches, 0);
+  --parent.openBatches;
+
+  /* Checkpoint the WAL periodically, but only when no transaction
+     is open anymore.  */
+  if (parent.openBatches > 0 || parent.checkpointInterval == 0)
+    return;
+  ++parent.batchesSinceCheckpoint;
+  if (parent.batchesSinceCheckpoint >= parent.checkpointInterval)
+    {
+      parent.Checkpoint ();
+      parent.batchesSinceCheckpoint = 0;
+    }
 }
 
 } // namespace xayax
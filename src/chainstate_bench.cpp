@@ -0,0 +1,179 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/chainstate.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <glog/logging.h>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * Sets up a chainstate with an in-memory database and a genesis block
+ * imported as tip.  Returns the genesis block.
+ */
+BlockData
+InitChainstate (BlockGenerator& gen, Chainstate& chain)
+{
+  const auto genesis = gen.NewBlock ("pregenesis", 1'000, 0);
+  chain.ImportTip (genesis);
+  return genesis;
+}
+
+/**
+ * Extends the main chain by one block in each iteration (the common
+ * case while following the tip).  The argument is the number of moves
+ * per block.
+ */
+void
+BM_ChainstateSetTipLinear (benchmark::State& state)
+{
+  BlockGenerator gen;
+  Chainstate chain(":memory:");
+  BlockData tip = InitChainstate (gen, chain);
+
+  for (auto _ : state)
+    {
+      state.PauseTiming ();
+      auto blk = gen.NewBlock (tip.hash, tip.height + 1, state.range (0));
+      blk.CacheSerialised ();
+      state.ResumeTiming ();
+
+      std::string oldTip;
+      CHECK (chain.SetTip (blk, oldTip));
+
+      state.PauseTiming ();
+      tip = std::move (blk);
+      state.ResumeTiming ();
+    }
+}
+BENCHMARK (BM_ChainstateSetTipLinear)->Arg (0)->Arg (100);
+
+/**
+ * Sets up two competing branches of the given length from genesis.
+ * The branch ending in a is the active one at the end.
+ */
+void
+SetupCompetingBranches (BlockGenerator& gen, Chainstate& chain,
+                        const unsigned depth, BlockData& a, BlockData& b)
+{
+  const auto genesis = InitChainstate (gen, chain);
+  std::string oldTip;
+
+  const auto branchB = gen.NewChain (genesis, depth, 10);
+  for (const auto& blk : branchB)
+    CHECK (chain.SetTip (blk, oldTip));
+
+  const auto branchA = gen.NewChain (genesis, depth, 10);
+  for (const auto& blk : branchA)
+    CHECK (chain.SetTip (blk, oldTip));
+
+  a = branchA.back ();
+  b = branchB.back ();
+}
+
+/**
+ * Switches back and forth between two branches of the depth given
+ * as argument, which are both already known.
+ */
+void
+BM_ChainstateReorg (benchmark::State& state)
+{
+  BlockGenerator gen;
+  Chainstate chain(":memory:");
+  BlockData a, b;
+  SetupCompetingBranches (gen, chain, state.range (0), a, b);
+
+  bool toB = true;
+  for (auto _ : state)
+    {
+      std::string oldTip;
+      CHECK (chain.SetTip (toB ? b : a, oldTip));
+      toB = !toB;
+    }
+
+  state.SetItemsProcessed (state.iterations () * state.range (0));
+}
+BENCHMARK (BM_ChainstateReorg)->Arg (1)->Arg (10)->Arg (100);
+
+/**
+ * Looks up the fork branch (with full block data) for the tip of
+ * an inactive branch of the given depth.
+ */
+void
+BM_ChainstateGetForkBranch (benchmark::State& state)
+{
+  BlockGenerator gen;
+  Chainstate chain(":memory:");
+  BlockData a, b;
+  SetupCompetingBranches (gen, chain, state.range (0), a, b);
+
+  for (auto _ : state)
+    {
+      std::vector<BlockData> branch;
+      CHECK (chain.GetForkBranch (b.hash, branch));
+      CHECK_EQ (branch.size (), state.range (0));
+      benchmark::DoNotOptimize (branch);
+    }
+
+  state.SetItemsProcessed (state.iterations () * state.range (0));
+}
+BENCHMARK (BM_ChainstateGetForkBranch)->Arg (1)->Arg (10)->Arg (100);
+
+/**
+ * Looks up the fork branch with only headers for an inactive branch.
+ */
+void
+BM_ChainstateGetForkBranchHeaders (benchmark::State& state)
+{
+  BlockGenerator gen;
+  Chainstate chain(":memory:");
+  BlockData a, b;
+  SetupCompetingBranches (gen, chain, state.range (0), a, b);
+
+  for (auto _ : state)
+    {
+      std::vector<BlockData> branch;
+      CHECK (chain.GetForkBranchHeaders (b.hash, branch));
+      benchmark::DoNotOptimize (branch);
+    }
+
+  state.SetItemsProcessed (state.iterations () * state.range (0));
+}
+BENCHMARK (BM_ChainstateGetForkBranchHeaders)->Arg (1)->Arg (100);
+
+/**
+ * Prunes the number of main-chain blocks given as argument.  In each
+ * iteration, that many blocks are attached first (not timed).
+ */
+void
+BM_ChainstatePrune (benchmark::State& state)
+{
+  BlockGenerator gen;
+  Chainstate chain(":memory:");
+  BlockData tip = InitChainstate (gen, chain);
+
+  for (auto _ : state)
+    {
+      state.PauseTiming ();
+      const auto blocks = gen.NewChain (tip, state.range (0), 10);
+      CHECK (chain.AttachLinearRange (blocks));
+      tip = blocks.back ();
+      state.ResumeTiming ();
+
+      chain.Prune (tip.height - 1);
+    }
+
+  state.SetItemsProcessed (state.iterations () * state.range (0));
+}
+BENCHMARK (BM_ChainstatePrune)->Arg (1)->Arg (100);
+
+} // anonymous namespace
+} // namespace xayax
@@ -3,23 +3,46 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blockdata.hpp"
+#include "database.hpp"
 #include "private/chainstate.hpp"
 #include "testutils.hpp"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <cstdio>
 #include <map>
 #include <sstream>
 
 namespace xayax
 {
+
+DECLARE_string (xayax_chainstate_durability);
+DECLARE_int32 (xayax_chainstate_checkpoint_batches);
+DECLARE_bool (xayax_chainstate_incremental_vacuum);
+DECLARE_bool (xayax_chainstate_convert_vacuum);
+DECLARE_int32 (xayax_chainstate_branch_retention);
+DECLARE_int32 (xayax_chainstate_branch_gc_limit);
+
 namespace
 {
 
 using testing::ElementsAre;
 
+/**
+ * Returns the auto_vacuum mode of the database in the given file.
+ */
+int64_t
+GetAutoVacuum (const std::string& file)
+{
+  Database db(file);
+  auto stmt = db.PrepareRo ("PRAGMA `auto_vacuum`");
+  CHECK (stmt.Step ());
+  return stmt.Get<int64_t> (0);
+}
+
 /* ************************************************************************** */
 
 /**
@@ -308,6 +331,61 @@ TEST_F (ChainstateTests, ForkBranch)
   EXPECT_THAT (branch, ElementsAre (GetBlock (e), GetBlock (b), GetBlock (a)));
 }
 
+TEST_F (ChainstateTests, ForkBranchHeaders)
+{
+  const auto genesis = SetGenesis (10);
+  const auto a = AddBlock (genesis);
+  const auto b = AddBlock (a);
+  const auto e = AddBlock (b);
+  const auto c = AddBlock (a);
+  const auto d = AddBlock (genesis);
+
+  std::vector<BlockData> branch;
+  EXPECT_FALSE (state.GetForkBranchHeaders ("invalid", branch));
+  ASSERT_TRUE (state.GetForkBranchHeaders (d, branch));
+  EXPECT_TRUE (branch.empty ());
+
+  std::vector<BlockData> full;
+  ASSERT_TRUE (state.GetForkBranch (e, full));
+  ASSERT_TRUE (state.GetForkBranchHeaders (e, branch));
+  ASSERT_EQ (branch.size (), full.size ());
+  for (unsigned i = 0; i < branch.size (); ++i)
+    {
+      EXPECT_EQ (branch[i].hash, full[i].hash);
+      EXPECT_EQ (branch[i].parent, full[i].parent);
+      EXPECT_EQ (branch[i].height, full[i].height);
+    }
+}
+
+TEST_F (ChainstateTests, MainchainRange)
+{
+  const auto genesis = SetGenesis (10);
+  const auto a = AddBlock (genesis);
+  const auto b = AddBlock (a);
+  AddBlock (a);
+  const auto c = AddBlock (b);
+  state.Prune (10);
+
+  const auto getRange = [this] (const uint64_t start, const uint64_t count)
+    {
+      std::vector<std::string> hashes;
+      for (const auto& data : state.GetMainchainRange (start, count))
+        {
+          BlockData blk;
+          blk.Deserialise (data);
+          hashes.push_back (blk.hash);
+        }
+      return hashes;
+    };
+
+  EXPECT_THAT (getRange (11, 3), ElementsAre (a, b, c));
+  EXPECT_THAT (getRange (12, 1), ElementsAre (b));
+  EXPECT_THAT (getRange (9, 4), ElementsAre (a, b));
+  EXPECT_THAT (getRange (13, 10), ElementsAre (c));
+  EXPECT_THAT (getRange (14, 10), ElementsAre ());
+  EXPECT_THAT (getRange (11, 0), ElementsAre ());
+}
+
 TEST_F (ChainstateTests, ReimportedTip)
 {
   const auto genesis = SetGenesis (10);
@@ -416,6 +494,9 @@ TEST_F (ChainstateTests, ExtraDataAndPruning)
   std::vector<BlockData> branch;
   ASSERT_TRUE (state.GetForkBranch (b, branch));
   EXPECT_THAT (branch, ElementsAre (GetBlock (b), GetBlock (a)));
+  ASSERT_TRUE (state.GetForkBranchHeaders (b, branch));
+  ASSERT_EQ (branch.size (), 2);
+  EXPECT_EQ (branch[1].hash, a);
 
   /* Forking the very last block is fine (we still got the common parent
      not yet pruned).  */
@@ -429,6 +510,401 @@ TEST_F (ChainstateTests, ExtraDataAndPruning)
   EXPECT_EQ (AddBlock (prunedHash), "error");
 }
 
+TEST_F (ChainstateTests, StaleBranchCollection)
+{
+  /* We build up the following situation, where m6 is the tip.  The
+     branch of a1, a2 and c3 forks off genesis, and a3 forks off that
+     branch in turn.
+
+     genesis - m1 - ... - m6
+            \ a1 - a2 - a3
+                    \ c3
+  */
+
+  const auto genesis = SetGenesis (10);
+  const auto a1 = AddBlock (genesis);
+  const auto a2 = AddBlock (a1);
+  const auto a3 = AddBlock (a2);
+  const auto c3 = AddBlock (a2);
+  std::string cur = genesis;
+  for (unsigned i = 0; i < 6; ++i)
+    cur = AddBlock (cur);
+  ASSERT_EQ (state.GetTipHeight (), 16);
+
+  /* The branches are retained while within the retention depth.  */
+  FLAGS_xayax_chainstate_branch_retention = 2;
+  FLAGS_xayax_chainstate_branch_gc_limit = 1;
+  state.Prune (14);
+  state.SanityCheck ();
+  uint64_t height;
+  for (const auto& h : {a1, a2, a3, c3})
+    EXPECT_TRUE (state.GetHeightForHash (h, height));
+
+  /* Once they are old enough, they are removed, but only one per call.  */
+  FLAGS_xayax_chainstate_branch_retention = 0;
+  state.Prune (15);
+  state.SanityCheck ();
+  EXPECT_FALSE (state.GetHeightForHash (a1, height));
+  EXPECT_FALSE (state.GetHeightForHash (a2, height));
+  EXPECT_FALSE (state.GetHeightForHash (c3, height));
+  EXPECT_TRUE (state.GetHeightForHash (a3, height));
+
+  state.Prune (15);
+  state.SanityCheck ();
+  EXPECT_FALSE (state.GetHeightForHash (a3, height));
+  EXPECT_EQ (state.GetLowestUnprunedHeight (), 16);
+  EXPECT_EQ (state.GetTipHeight (), 16);
+
+  FLAGS_xayax_chainstate_branch_retention = 10'000;
+  FLAGS_xayax_chainstate_branch_gc_limit = 100;
+}
+
+TEST_F (ChainstateTests, StaleBranchCollectionReverted)
+{
+  const auto genesis = SetGenesis (10);
+  const auto a1 = AddBlock (genesis);
+  std::string cur = genesis;
+  for (unsigned i = 0; i < 6; ++i)
+    cur = AddBlock (cur);
+
+  /* If the batch in which the GC ran is reverted, the branch is back
+     and the GC state must not claim it has been collected.  */
+  FLAGS_xayax_chainstate_branch_retention = 0;
+  uint64_t height;
+  {
+    Chainstate::UpdateBatch upd(state);
+    state.Prune (15);
+    EXPECT_FALSE (state.GetHeightForHash (a1, height));
+  }
+  EXPECT_TRUE (state.GetHeightForHash (a1, height));
+  state.SanityCheck ();
+
+  state.Prune (15);
+  state.SanityCheck ();
+  EXPECT_FALSE (state.GetHeightForHash (a1, height));
+
+  FLAGS_xayax_chainstate_branch_retention = 10'000;
+}
+
+TEST_F (ChainstateTests, AttachLinearRange)
+{
+  BlockData fake;
+  fake.hash = "fake";
+  fake.parent = "pregenesis";
+  fake.height = 10;
+  EXPECT_FALSE (state.AttachLinearRange ({fake}));
+
+  const auto genesis = SetGenesis (10);
+  EXPECT_TRUE (state.AttachLinearRange ({}));
+
+  std::vector<BlockData> range;
+  range.push_back (NewBlock (genesis));
+  range.push_back (NewBlock (range.back ().hash));
+  range.push_back (NewBlock (range.back ().hash));
+  ASSERT_TRUE (state.AttachLinearRange (range));
+
+  EXPECT_EQ (state.GetTipHeight (), 13);
+  EXPECT_EQ (state.GetLowestUnprunedHeight (), 10);
+  for (const auto& blk : range)
+    {
+      std::string hash;
+      ASSERT_TRUE (state.GetHashForHeight (blk.height, hash));
+      EXPECT_EQ (hash, blk.hash);
+    }
+
+  std::string oldTip;
+  const auto next = AddBlock (range.back ().hash, oldTip);
+  EXPECT_EQ (oldTip, range.back ().hash);
+  EXPECT_EQ (state.GetTipHeight (), 14);
+
+  std::vector<BlockData> branch;
+  ASSERT_TRUE (state.GetForkBranch (next, branch));
+  EXPECT_TRUE (branch.empty ());
+}
+
+TEST_F (ChainstateTests, AttachLinearRangeMismatch)
+{
+  const auto genesis = SetGenesis (10);
+  const auto a = AddBlock (genesis);
+  const auto b = AddBlock (a);
+
+  /* Not building on the current tip.  */
+  const auto& fork = NewBlock (a);
+  EXPECT_FALSE (state.AttachLinearRange ({fork}));
+
+  /* Not contiguous.  */
+  const auto& c = NewBlock (b);
+  const auto& d = NewBlock (c.hash);
+  EXPECT_FALSE (state.AttachLinearRange ({d}));
+  EXPECT_FALSE (state.AttachLinearRange ({c, NewBlock (c.hash), d}));
+
+  /* Already known on a branch.  */
+  std::string oldTip;
+  ASSERT_TRUE (state.SetTip (GetBlock (a), oldTip));
+  EXPECT_FALSE (state.AttachLinearRange ({GetBlock (b), c}));
+
+  EXPECT_EQ (state.GetTipHeight (), 11);
+  uint64_t height;
+  EXPECT_FALSE (state.GetHeightForHash (c.hash, height));
+
+  /* The normal attach still works.  */
+  ASSERT_TRUE (state.SetTip (GetBlock (b), oldTip));
+  ASSERT_TRUE (state.AttachLinearRange ({c, d}));
+  EXPECT_EQ (state.GetTipHeight (), 14);
+}
+
+TEST_F (ChainstateTests, IndexRebuiltOnReopen)
+{
+  const std::string file = std::tmpnam (nullptr);
+  LOG (INFO) << "Using temporary database file: " << file;
+
+  const auto genesis = SetGenesis (10);
+  const auto& a = NewBlock (genesis);
+  const auto& b = NewBlock (a.hash);
+  const auto& fork = NewBlock (genesis);
+  {
+    Chainstate s(file);
+    s.ImportTip (GetBlock (genesis));
+    std::string oldTip;
+    ASSERT_TRUE (s.SetTip (a, oldTip));
+    ASSERT_TRUE (s.SetTip (b, oldTip));
+    ASSERT_TRUE (s.SetTip (fork, oldTip));
+    ASSERT_TRUE (s.SetTip (b, oldTip));
+  }
+
+  {
+    Chainstate s(file);
+    s.SanityCheck ();
+
+    EXPECT_EQ (s.GetTipHeight (), 12);
+    EXPECT_EQ (s.GetLowestUnprunedHeight (), 10);
+
+    std::string hash;
+    ASSERT_TRUE (s.GetHashForHeight (11, hash));
+    EXPECT_EQ (hash, a.hash);
+
+    uint64_t height;
+    ASSERT_TRUE (s.GetHeightForHash (fork.hash, height));
+    EXPECT_EQ (height, 11);
+
+    std::vector<BlockData> branch;
+    ASSERT_TRUE (s.GetForkBranch (fork.hash, branch));
+    EXPECT_THAT (branch, ElementsAre (fork));
+  }
+
+  std::remove (file.c_str ());
+}
+
+TEST_F (ChainstateTests, FastProfile)
+{
+  const std::string file = std::tmpnam (nullptr);
+  LOG (INFO) << "Using temporary database file: " << file;
+
+  FLAGS_xayax_chainstate_durability = "fast";
+  FLAGS_xayax_chainstate_checkpoint_batches = 2;
+
+  const auto genesis = SetGenesis (10);
+  std::vector<BlockData> chain;
+  {
+    Chainstate s(file);
+    s.ImportTip (GetBlock (genesis));
+    std::string parent = genesis;
+    for (unsigned i = 0; i < 5; ++i)
+      {
+        chain.push_back (NewBlock (parent));
+        parent = chain.back ().hash;
+
+        std::string oldTip;
+        ASSERT_TRUE (s.SetTip (chain.back (), oldTip));
+      }
+  }
+
+  FLAGS_xayax_chainstate_durability = "full";
+  FLAGS_xayax_chainstate_checkpoint_batches = 1'000;
+
+  {
+    Chainstate s(file);
+    s.SanityCheck ();
+    EXPECT_EQ (s.GetTipHeight (), 15);
+
+    std::string hash;
+    ASSERT_TRUE (s.GetHashForHeight (15, hash));
+    EXPECT_EQ (hash, chain.back ().hash);
+  }
+
+  std::remove (file.c_str ());
+  std::remove ((file + "-wal").c_str ());
+  std::remove ((file + "-shm").c_str ());
+}
+
+TEST_F (ChainstateTests, MigratesSchemaVersion1)
+{
+  const std::string file = std::tmpnam (nullptr);
+  LOG (INFO) << "Using temporary database file: " << file;
+
+  const std::string hashA(64, 'a');
+  const std::string hashB = "00112233445566778899aabbccddeeff"
+                            "00112233445566778899aabbccddeeff";
+  const std::string hashC(64, 'c');
+
+  BlockData a;
+  a.hash = hashA;
+  a.parent = "pregenesis";
+  a.height = 10;
+  BlockData b;
+  b.hash = hashB;
+  b.parent = hashA;
+  b.height = 11;
+  BlockData c;
+  c.hash = hashC;
+  c.parent = hashA;
+  c.height = 11;
+
+  {
+    /* Set up a database with the old schema.  */
+    Database db(file);
+    db.Execute (R"(
+      CREATE TABLE `blocks` (
+        `hash` TEXT NOT NULL PRIMARY KEY,
+        `parent` TEXT NOT NULL,
+        `height` INTEGER NOT NULL,
+        `branch` INTEGER NOT NULL,
+        `data` BLOB NOT NULL,
+        UNIQUE (`branch`, `height`)
+      );
+      CREATE TABLE `variables` (
+        `name` TEXT NOT NULL PRIMARY KEY,
+        `value` TEXT NOT NULL
+      );
+    )");
+
+    const auto insert = [&db] (const BlockData& blk, const uint64_t branch)
+      {
+        auto stmt = db.Prepare (R"(
+          INSERT INTO `blocks`
+            (`hash`, `parent`, `height`, `branch`, `data`)
+            VALUES (?1, ?2, ?3, ?4, ?5)
+        )");
+        stmt.Bind (1, blk.hash);
+        stmt.Bind (2, blk.parent);
+        stmt.Bind (3, blk.height);
+        stmt.Bind (4, branch);
+        stmt.BindBlob (5, blk.Serialise ());
+        stmt.Execute ();
+      };
+    insert (a, 0);
+    insert (b, 0);
+    insert (c, 1);
+  }
+
+  {
+    Chainstate s(file);
+    s.SanityCheck ();
+    EXPECT_EQ (s.GetTipHeight (), 11);
+
+    std::string hash;
+    ASSERT_TRUE (s.GetHashForHeight (11, hash));
+    EXPECT_EQ (hash, hashB);
+
+    std::vector<BlockData> branch;
+    ASSERT_TRUE (s.GetForkBranch (hashC, branch));
+    EXPECT_THAT (branch, ElementsAre (c));
+
+    std::string oldTip;
+    ASSERT_TRUE (s.SetTip (c, oldTip));
+    EXPECT_EQ (oldTip, hashB);
+  }
+
+  /* The VACUUM after the migration converted the database to incremental
+     auto-vacuum as well.  */
+  EXPECT_EQ (GetAutoVacuum (file), 2);
+
+  {
+    /* Reopening the migrated database works as well.  */
+    Chainstate s(file);
+    s.SanityCheck ();
+    std::string hash;
+    ASSERT_TRUE (s.GetHashForHeight (11, hash));
+    EXPECT_EQ (hash, hashC);
+  }
+
+  std::remove (file.c_str ());
+}
+
+TEST_F (ChainstateTests, ConvertsToIncrementalVacuum)
+{
+  const std::string file = std::tmpnam (nullptr);
+  LOG (INFO) << "Using temporary database file: " << file;
+
+  /* Blocks with enough data (overflow pages), so that pruning them
+     frees pages.  */
+  const auto genesis = SetGenesis (10);
+  std::vector<BlockData> chain;
+  std::string parent = genesis;
+  for (unsigned i = 0; i < 20; ++i)
+    {
+      auto& blk = NewBlock (parent);
+      MoveData mv;
+      mv.txid = "tx";
+      mv.ns = "p";
+      mv.name = "domob";
+      mv.mv = R"({"g":{"x":")" + std::string (10'000, 'x') + R"("}})";
+      blk.moves.push_back (mv);
+      chain.push_back (blk);
+      parent = blk.hash;
+    }
+
+  FLAGS_xayax_chainstate_incremental_vacuum = false;
+  {
+    Chainstate s(file);
+    s.ImportTip (GetBlock (genesis));
+    std::string oldTip;
+    for (unsigned i = 0; i < 10; ++i)
+      ASSERT_TRUE (s.SetTip (chain[i], oldTip));
+
+    /* Without incremental vacuum, the freed pages are not released.  */
+    s.Prune (15);
+    EXPECT_GT (s.Vacuum (1'000), 0);
+  }
+  FLAGS_xayax_chainstate_incremental_vacuum = true;
+  EXPECT_EQ (GetAutoVacuum (file), 0);
+
+  {
+    /* By default, an existing database is not converted.  */
+    Chainstate s(file);
+    s.SanityCheck ();
+    EXPECT_GT (s.Vacuum (1'000), 0);
+  }
+  EXPECT_EQ (GetAutoVacuum (file), 0);
+
+  FLAGS_xayax_chainstate_convert_vacuum = true;
+  {
+    /* With the flag, opening the existing file converts it.  */
+    Chainstate s(file);
+    s.SanityCheck ();
+    EXPECT_EQ (s.GetTipHeight (), 20);
+    EXPECT_EQ (s.GetLowestUnprunedHeight (), 16);
+
+    std::string oldTip;
+    for (unsigned i = 10; i < chain.size (); ++i)
+      ASSERT_TRUE (s.SetTip (chain[i], oldTip));
+
+    s.Prune (25);
+    EXPECT_EQ (s.Vacuum (1'000), 0);
+  }
+  FLAGS_xayax_chainstate_convert_vacuum = false;
+  EXPECT_EQ (GetAutoVacuum (file), 2);
+
+  {
+    Chainstate s(file);
+    s.SanityCheck ();
+    EXPECT_EQ (s.GetTipHeight (), 30);
+    EXPECT_EQ (s.GetLowestUnprunedHeight (), 26);
+  }
+
+  std::remove (file.c_str ());
+}
+
 TEST_F (ChainstateTests, UpdateBatch)
 {
   Chainstate::UpdateBatch outer(state);
@@ -0,0 +1,226 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/compactblock.hpp"
+
+#include "private/jsonutils.hpp"
+
+#include <glog/logging.h>
+
+#include <limits>
+#include <map>
+
+namespace xayax
+{
+
+/**
+ * Helper class for filling in the arena of a CompactBlock while it
+ * is being constructed.
+ */
+class CompactBlock::Builder
+{
+
+private:
+
+  /** The instance being built.  */
+  CompactBlock& blk;
+
+  /**
+   * Interned strings added so far.  The keys point into the source
+   * BlockData, which outlives the builder.
+   */
+  std::map<std::string_view, Span> interned;
+
+public:
+
+  explicit Builder (CompactBlock& b)
+    : blk(b)
+  {}
+
+  /**
+   * Appends a string to the arena and returns its span.
+   */
+  Span
+  Add (const std::string_view str)
+  {
+    CHECK_LE (blk.arena.size () + str.size (),
+              std::numeric_limits<uint32_t>::max ())
+        << "Block data is too large for CompactBlock";
+
+    Span res;
+    res.offset = blk.arena.size ();
+    res.size = str.size ();
+    blk.arena.append (str);
+
+    return res;
+  }
+
+  /**
+   * Adds a string that is likely repeated within the block (namespace or
+   * game ID), reusing the existing copy if there is one.  The string must
+   * stay valid for the lifetime of the builder.
+   */
+  Span
+  Intern (const std::string_view str)
+  {
+    const auto mit = interned.find (str);
+    if (mit != interned.end ())
+      return mit->second;
+
+    const Span res = Add (str);
+    interned.emplace (str, res);
+    return res;
+  }
+
+};
+
+CompactBlock::CompactBlock (const BlockData& blk)
+  : height(blk.height), serialised(blk.serialised)
+{
+  /* Reserve enough for the plain strings upfront, so that the arena
+     is (mostly) allocated once.  */
+  size_t estimate = blk.hash.size () + blk.parent.size ()
+                      + blk.rngseed.size ();
+  size_t numBurns = 0;
+  for (const auto& mv : blk.moves)
+    {
+      estimate += mv.txid.size () + mv.name.size () + mv.mv.size ();
+      numBurns += mv.burns.size ();
+    }
+  arena.reserve (estimate);
+
+  Builder builder(*this);
+  hash = builder.Add (blk.hash);
+  parent = builder.Add (blk.parent);
+  rngseed = builder.Add (blk.rngseed);
+  metadata = builder.Add (StoreJson (blk.metadata));
+
+  moves.reserve (blk.moves.size ());
+  burns.reserve (numBurns);
+  for (const auto& mv : blk.moves)
+    {
+      Move cur;
+      cur.txid = builder.Add (mv.txid);
+      cur.ns = builder.Intern (mv.ns);
+      cur.name = builder.Add (mv.name);
+      cur.mv = builder.Add (mv.mv);
+      cur.metadata = builder.Add (StoreJson (mv.metadata));
+
+      /* The burns are a std::map, so they are already sorted.  */
+      cur.firstBurn = burns.size ();
+      cur.numBurns = mv.burns.size ();
+      for (const auto& entry : mv.burns)
+        {
+          Burn b;
+          b.game = builder.Intern (entry.first);
+          b.value = builder.Add (StoreJson (entry.second));
+          burns.push_back (b);
+        }
+
+      moves.push_back (cur);
+    }
+
+  hasGameIndex = blk.gameIndex.has_value ();
+  if (hasGameIndex)
+    {
+      gameIndex.reserve (blk.gameIndex->size ());
+      for (const auto& entry : *blk.gameIndex)
+        {
+          IndexEntry cur;
+          cur.game = builder.Intern (entry.first);
+          cur.first = indexMoves.size ();
+          cur.num = entry.second.size ();
+          for (const auto i : entry.second)
+            {
+              CHECK_LT (i, moves.size ()) << "Invalid game index";
+              indexMoves.push_back (i);
+            }
+          gameIndex.push_back (cur);
+        }
+    }
+
+  /* The JSON values were not part of the estimate, so the buffer may have
+     grown beyond what is needed.  */
+  arena.shrink_to_fit ();
+}
+
+std::vector<std::pair<std::string_view, std::string_view>>
+CompactBlock::GetBurns (const size_t i) const
+{
+  const auto& mv = moves[i];
+
+  std::vector<std::pair<std::string_view, std::string_view>> res;
+  res.reserve (mv.numBurns);
+  for (uint32_t j = 0; j < mv.numBurns; ++j)
+    {
+      const auto& b = burns[mv.firstBurn + j];
+      res.emplace_back (Get (b.game), Get (b.value));
+    }
+
+  return res;
+}
+
+MoveData
+CompactBlock::GetMove (const size_t i) const
+{
+  const auto& m = moves[i];
+
+  MoveData res;
+  res.txid = Get (m.txid);
+  res.ns = Get (m.ns);
+  res.name = Get (m.name);
+  res.mv = Get (m.mv);
+  for (const auto& entry : GetBurns (i))
+    res.burns.emplace (entry.first, LoadJson (std::string (entry.second)));
+  res.metadata = LoadJson (std::string (Get (m.metadata)));
+
+  return res;
+}
+
+BlockData
+CompactBlock::ToBlockData () const
+{
+  BlockData res;
+  res.hash = GetHash ();
+  res.parent = GetParent ();
+  res.height = height;
+  res.rngseed = Get (rngseed);
+  res.metadata = LoadJson (std::string (Get (metadata)));
+
+  res.moves.reserve (moves.size ());
+  for (size_t i = 0; i < moves.size (); ++i)
+    res.moves.push_back (GetMove (i));
+
+  if (hasGameIndex)
+    {
+      BlockData::GameIndex index;
+      for (const auto& entry : gameIndex)
+        {
+          auto& indices = index[std::string (Get (entry.game))];
+          indices.assign (indexMoves.begin () + entry.first,
+                          indexMoves.begin () + entry.first + entry.num);
+        }
+      res.gameIndex = std::move (index);
+    }
+
+  res.serialised = serialised;
+
+  return res;
+}
+
+size_t
+CompactBlock::GetMemoryUsage () const
+{
+  size_t res = sizeof (*this) + arena.capacity ()
+                + moves.capacity () * sizeof (Move)
+                + burns.capacity () * sizeof (Burn)
+                + gameIndex.capacity () * sizeof (IndexEntry)
+                + indexMoves.capacity () * sizeof (uint32_t);
+  if (serialised != nullptr)
+    res += serialised->capacity ();
+
+  return res;
+}
+
+} // namespace xayax
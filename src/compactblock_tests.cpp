@@ -0,0 +1,189 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/compactblock.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xayax
+{
+namespace
+{
+
+class CompactBlockTests : public testing::Test
+{
+
+protected:
+
+  BlockData blk;
+
+  CompactBlockTests ()
+  {
+    blk.hash = "block hash";
+    blk.parent = "parent hash";
+    blk.height = 42;
+    blk.rngseed = "abcdef";
+    blk.metadata = ParseJson (R"({"foo": "bar"})");
+
+    MoveData m;
+    m.txid = "tx 1";
+    m.ns = "p";
+    m.name = "domob";
+    m.mv = R"({"g": {"x": 123}})";
+    m.metadata = ParseJson (R"([1, 2, 3])");
+    m.burns = {{"y", ParseJson ("1")}, {"x", ParseJson ("5.5")}};
+    blk.moves.push_back (m);
+
+    m.txid = "tx 2";
+    m.ns = "g";
+    m.name = "x";
+    m.mv = R"({"cmd": true})";
+    m.metadata = ParseJson ("null");
+    m.burns = {};
+    blk.moves.push_back (m);
+  }
+
+  /**
+   * Expects that the given BlockData is equal to our test block.
+   */
+  void
+  ExpectSameBlock (const BlockData& actual) const
+  {
+    EXPECT_EQ (actual.hash, blk.hash);
+    EXPECT_EQ (actual.parent, blk.parent);
+    EXPECT_EQ (actual.height, blk.height);
+    EXPECT_EQ (actual.rngseed, blk.rngseed);
+    EXPECT_EQ (actual.metadata, blk.metadata);
+    EXPECT_EQ (actual.Serialise (), blk.Serialise ());
+  }
+
+};
+
+TEST_F (CompactBlockTests, Accessors)
+{
+  const CompactBlock compact(blk);
+
+  EXPECT_EQ (compact.GetHash (), "block hash");
+  EXPECT_EQ (compact.GetParent (), "parent hash");
+  EXPECT_EQ (compact.GetHeight (), 42);
+  ASSERT_EQ (compact.GetNumMoves (), 2);
+  EXPECT_EQ (compact.GetRawMove (0), R"({"g": {"x": 123}})");
+  EXPECT_EQ (compact.GetRawMove (1), R"({"cmd": true})");
+}
+
+TEST_F (CompactBlockTests, Burns)
+{
+  const CompactBlock compact(blk);
+
+  const auto burns = compact.GetBurns (0);
+  ASSERT_EQ (burns.size (), 2);
+  EXPECT_EQ (burns[0].first, "x");
+  EXPECT_EQ (ParseJson (std::string (burns[0].second)), ParseJson ("5.5"));
+  EXPECT_EQ (burns[1].first, "y");
+  EXPECT_EQ (ParseJson (std::string (burns[1].second)), ParseJson ("1"));
+
+  EXPECT_TRUE (compact.GetBurns (1).empty ());
+}
+
+TEST_F (CompactBlockTests, Moves)
+{
+  const CompactBlock compact(blk);
+
+  for (unsigned i = 0; i < blk.moves.size (); ++i)
+    {
+      const MoveData mv = compact.GetMove (i);
+      const auto& expected = blk.moves[i];
+      EXPECT_EQ (mv.txid, expected.txid);
+      EXPECT_EQ (mv.ns, expected.ns);
+      EXPECT_EQ (mv.name, expected.name);
+      EXPECT_EQ (mv.mv, expected.mv);
+      EXPECT_EQ (mv.burns, expected.burns);
+      EXPECT_EQ (mv.metadata, expected.metadata);
+    }
+}
+
+TEST_F (CompactBlockTests, RoundTrip)
+{
+  const CompactBlock compact(blk);
+  ExpectSameBlock (compact.ToBlockData ());
+}
+
+TEST_F (CompactBlockTests, GameIndex)
+{
+  EXPECT_FALSE (CompactBlock (blk).ToBlockData ().gameIndex.has_value ());
+
+  blk.gameIndex = BlockData::GameIndex ();
+  (*blk.gameIndex)["x"] = {0, 1};
+  (*blk.gameIndex)["y"] = {1};
+
+  const auto restored = CompactBlock (blk).ToBlockData ();
+  ASSERT_TRUE (restored.gameIndex.has_value ());
+  EXPECT_EQ (*restored.gameIndex, *blk.gameIndex);
+}
+
+TEST_F (CompactBlockTests, KeepsSerialised)
+{
+  EXPECT_EQ (CompactBlock (blk).ToBlockData ().serialised, nullptr);
+
+  blk.CacheSerialised ();
+  const CompactBlock compact(blk);
+  blk.serialised.reset ();
+
+  const auto restored = compact.ToBlockData ();
+  ASSERT_NE (restored.serialised, nullptr);
+  EXPECT_EQ (*restored.serialised, blk.Serialise ());
+  EXPECT_EQ (compact.ToBlockData ().serialised, restored.serialised);
+}
+
+TEST_F (CompactBlockTests, Empty)
+{
+  BlockData empty;
+  empty.hash = "hash";
+  empty.parent = "parent";
+  empty.height = 10;
+
+  const CompactBlock compact(empty);
+  EXPECT_EQ (compact.GetNumMoves (), 0);
+  EXPECT_EQ (compact.ToBlockData ().Serialise (), empty.Serialise ());
+}
+
+TEST_F (CompactBlockTests, InternsNamespaces)
+{
+  const auto makeBlock = [] (const std::string& ns, const std::string& game)
+    {
+      BlockData res;
+      res.hash = "hash";
+      res.parent = "parent";
+      for (unsigned i = 0; i < 100; ++i)
+        {
+          MoveData m;
+          m.txid = "tx";
+          m.ns = ns;
+          m.name = "name";
+          m.mv = "{}";
+          m.burns = {{game, ParseJson ("1")}};
+          res.moves.push_back (m);
+        }
+      return res;
+    };
+
+  const BlockData shortBlk = makeBlock ("p", "g");
+  const BlockData longBlk = makeBlock (std::string (100, 'p'),
+                                       std::string (100, 'g'));
+
+  const CompactBlock shortCompact(shortBlk);
+  const CompactBlock longCompact(longBlk);
+  EXPECT_EQ (longCompact.ToBlockData ().Serialise (), longBlk.Serialise ());
+
+  /* Each distinct namespace and game ID is stored only once, so the
+     longer strings make just a small difference in total size
+     (rather than 100 times for each move).  */
+  EXPECT_LT (longCompact.GetMemoryUsage (),
+             shortCompact.GetMemoryUsage () + 1'000);
+}
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,286 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/compression.hpp"
+
+#include <zstd.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace xayax
+{
+
+DEFINE_int32 (xayax_block_compression, 0,
+              "zstd compression level for stored blocks, or 0 to store"
+              " them uncompressed");
+DEFINE_string (xayax_block_compression_dict, "",
+               "if set, file with a (trained) zstd dictionary to use when"
+               " compressing stored blocks; it should be specific to the"
+               " chain, and must be kept for reading back blocks stored"
+               " with it");
+
+namespace
+{
+
+/**
+ * Format versions of stored block data.  This is the byte after the
+ * leading zero byte marking compressed data.
+ */
+enum class Format : char
+{
+  /** zstd-compressed without a dictionary.  */
+  ZSTD = 1,
+  /** zstd-compressed with the configured dictionary.  */
+  ZSTD_DICT = 2,
+};
+
+/** Number of header bytes (zero marker and version) of compressed data.  */
+constexpr size_t HEADER_SIZE = 2;
+
+/**
+ * The dictionary loaded from --xayax_block_compression_dict, with the
+ * zstd structures prepared from it.
+ */
+class Dictionary
+{
+
+private:
+
+  /** The compression level the CDict was created for.  */
+  int level = 0;
+
+  ZSTD_CDict* cdict = nullptr;
+  ZSTD_DDict* ddict = nullptr;
+
+public:
+
+  explicit Dictionary (const std::string& file, const int l)
+    : level(l)
+  {
+    std::ifstream in(file, std::ios::binary);
+    CHECK (in) << "Failed to open compression dictionary " << file;
+    std::ostringstream data;
+    data << in.rdbuf ();
+    const std::string dict = data.str ();
+
+    cdict = ZSTD_createCDict (dict.data (), dict.size (), level);
+    ddict = ZSTD_createDDict (dict.data (), dict.size ());
+    CHECK (cdict != nullptr && ddict != nullptr)
+        << "Failed to load compression dictionary " << file;
+
+    LOG (INFO)
+        << "Loaded " << dict.size () << " bytes of compression dictionary"
+        << " from " << file;
+  }
+
+  ~Dictionary ()
+  {
+    ZSTD_freeCDict (cdict);
+    ZSTD_freeDDict (ddict);
+  }
+
+  Dictionary () = delete;
+  Dictionary (const Dictionary&) = delete;
+  void operator= (const Dictionary&) = delete;
+
+  int
+  GetLevel () const
+  {
+    return level;
+  }
+
+  const ZSTD_CDict*
+  GetCDict () const
+  {
+    return cdict;
+  }
+
+  const ZSTD_DDict*
+  GetDDict () const
+  {
+    return ddict;
+  }
+
+};
+
+/** Lock for the loaded dictionary.  */
+std::mutex mutDict;
+
+/** The currently loaded dictionary (if any).  */
+std::shared_ptr<const Dictionary> dict;
+
+/** The file the current dictionary was loaded from.  */
+std::string dictFile;
+
+/**
+ * Returns the dictionary to use as per the flags, loading it if not yet
+ * done (or if the flags changed).  Returns null if no dictionary is set.
+ */
+std::shared_ptr<const Dictionary>
+GetDictionary (const int level)
+{
+  std::lock_guard<std::mutex> lock(mutDict);
+
+  if (FLAGS_xayax_block_compression_dict.empty ())
+    return nullptr;
+
+  if (dict == nullptr || dictFile != FLAGS_xayax_block_compression_dict
+        || (level != 0 && dict->GetLevel () != level))
+    {
+      /* For decompression, the level does not matter.  If we need to load
+         the dictionary just for that, we use the configured level (or some
+         valid level if compression is turned off).  */
+      int loadLevel = level;
+      if (loadLevel == 0)
+        loadLevel = FLAGS_xayax_block_compression;
+      if (loadLevel == 0)
+        loadLevel = 1;
+
+      dict = std::make_shared<Dictionary> (FLAGS_xayax_block_compression_dict,
+                                           loadLevel);
+      dictFile = FLAGS_xayax_block_compression_dict;
+    }
+
+  return dict;
+}
+
+/**
+ * Deleters for the zstd contexts, so we can hold them in unique_ptr's.
+ */
+struct ContextDeleter
+{
+  void
+  operator() (ZSTD_CCtx* ctx) const
+  {
+    ZSTD_freeCCtx (ctx);
+  }
+
+  void
+  operator() (ZSTD_DCtx* ctx) const
+  {
+    ZSTD_freeDCtx (ctx);
+  }
+};
+
+/**
+ * Returns a compression context for the current thread.
+ */
+ZSTD_CCtx*
+GetCompressionContext ()
+{
+  thread_local std::unique_ptr<ZSTD_CCtx, ContextDeleter> ctx(
+      ZSTD_createCCtx ());
+  CHECK (ctx != nullptr);
+  return ctx.get ();
+}
+
+/**
+ * Returns a decompression context for the current thread.
+ */
+ZSTD_DCtx*
+GetDecompressionContext ()
+{
+  thread_local std::unique_ptr<ZSTD_DCtx, ContextDeleter> ctx(
+      ZSTD_createDCtx ());
+  CHECK (ctx != nullptr);
+  return ctx.get ();
+}
+
+} // anonymous namespace
+
+std::string
+CompressBlockData (std::string raw)
+{
+  const int level = FLAGS_xayax_block_compression;
+  if (level == 0)
+    return raw;
+  CHECK_LE (level, ZSTD_maxCLevel ()) << "Invalid --xayax_block_compression";
+
+  const auto d = GetDictionary (level);
+
+  std::string res(HEADER_SIZE + ZSTD_compressBound (raw.size ()), '\0');
+  res[0] = '\0';
+  res[1] = static_cast<char> (d == nullptr ? Format::ZSTD : Format::ZSTD_DICT);
+
+  size_t len;
+  if (d == nullptr)
+    len = ZSTD_compressCCtx (GetCompressionContext (),
+                             &res[HEADER_SIZE], res.size () - HEADER_SIZE,
+                             raw.data (), raw.size (), level);
+  else
+    len = ZSTD_compress_usingCDict (GetCompressionContext (),
+                                    &res[HEADER_SIZE],
+                                    res.size () - HEADER_SIZE,
+                                    raw.data (), raw.size (), d->GetCDict ());
+  CHECK (!ZSTD_isError (len))
+      << "Compression failed: " << ZSTD_getErrorName (len);
+
+  res.resize (HEADER_SIZE + len);
+  return res;
+}
+
+bool
+DecompressBlockData (const std::string_view data, std::string& out)
+{
+  if (data.empty () || data[0] != '\0')
+    return false;
+  CHECK_GE (data.size (), HEADER_SIZE) << "Invalid compressed block data";
+
+  const char* src = data.data () + HEADER_SIZE;
+  const size_t srcSize = data.size () - HEADER_SIZE;
+
+  const auto rawSize = ZSTD_getFrameContentSize (src, srcSize);
+  CHECK (rawSize != ZSTD_CONTENTSIZE_UNKNOWN
+            && rawSize != ZSTD_CONTENTSIZE_ERROR)
+      << "Invalid compressed block data";
+  out.resize (rawSize);
+
+  size_t len;
+  switch (static_cast<Format> (data[1]))
+    {
+    case Format::ZSTD:
+      len = ZSTD_decompressDCtx (GetDecompressionContext (),
+                                 &out[0], out.size (), src, srcSize);
+      break;
+
+    case Format::ZSTD_DICT:
+      {
+        const auto d = GetDictionary (0);
+        CHECK (d != nullptr)
+            << "Block data is compressed with a dictionary, but"
+               " --xayax_block_compression_dict is not set";
+        len = ZSTD_decompress_usingDDict (GetDecompressionContext (),
+                                          &out[0], out.size (), src, srcSize,
+                                          d->GetDDict ());
+        break;
+      }
+
+    default:
+      LOG (FATAL)
+          << "Unknown block data format: " << static_cast<int> (data[1]);
+    }
+
+  CHECK (!ZSTD_isError (len))
+      << "Decompression failed: " << ZSTD_getErrorName (len);
+  CHECK_EQ (len, rawSize) << "Invalid compressed block data";
+
+  return true;
+}
+
+std::string
+GetRawBlockData (std::string data)
+{
+  std::string raw;
+  if (DecompressBlockData (data, raw))
+    return raw;
+  return data;
+}
+
+} // namespace xayax
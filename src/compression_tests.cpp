@@ -0,0 +1,214 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/compression.hpp"
+
+#include "blockdata.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <experimental/filesystem>
+#include <fstream>
+
+namespace xayax
+{
+
+DECLARE_int32 (xayax_block_compression);
+DECLARE_string (xayax_block_compression_dict);
+
+namespace
+{
+
+namespace fs = std::experimental::filesystem;
+
+/**
+ * Returns some block data for testing, which is nicely compressible.
+ */
+BlockData
+GetTestBlock ()
+{
+  BlockData res;
+  res.hash = "block hash";
+  res.parent = "parent hash";
+  res.height = 42;
+  res.rngseed = "rng seed";
+  res.metadata = Json::Value (Json::objectValue);
+  res.metadata["timestamp"] = 1'234;
+
+  for (unsigned i = 0; i < 20; ++i)
+    {
+      MoveData mv;
+      mv.txid = "tx";
+      mv.ns = "p";
+      mv.name = "domob";
+      mv.mv = R"({"g":{"game":{"some":"long move data for the game"}}})";
+      mv.metadata = Json::Value (Json::objectValue);
+      res.moves.push_back (std::move (mv));
+    }
+
+  return res;
+}
+
+class CompressionTests : public testing::Test
+{
+
+protected:
+
+  /** Temporary file for a dictionary.  */
+  const fs::path dictFile;
+
+  CompressionTests ()
+    : dictFile(fs::temp_directory_path () / "xayax-compression-dict")
+  {
+    FLAGS_xayax_block_compression = 0;
+    FLAGS_xayax_block_compression_dict = "";
+  }
+
+  ~CompressionTests ()
+  {
+    FLAGS_xayax_block_compression = 0;
+    FLAGS_xayax_block_compression_dict = "";
+    fs::remove (dictFile);
+  }
+
+  /**
+   * Writes a (raw content) dictionary to our temporary file and
+   * enables it.
+   */
+  void
+  EnableDictionary (const std::string& content)
+  {
+    std::ofstream out(dictFile, std::ios::binary);
+    out << content;
+    out.close ();
+    FLAGS_xayax_block_compression_dict = dictFile.string ();
+  }
+
+};
+
+TEST_F (CompressionTests, Disabled)
+{
+  const std::string raw = GetTestBlock ().Serialise ();
+  EXPECT_EQ (CompressBlockData (raw), raw);
+
+  std::string out;
+  EXPECT_FALSE (DecompressBlockData (raw, out));
+  EXPECT_FALSE (DecompressBlockData ("", out));
+}
+
+TEST_F (CompressionTests, RoundTrip)
+{
+  const std::string raw = GetTestBlock ().Serialise ();
+
+  FLAGS_xayax_block_compression = 3;
+  const std::string compressed = CompressBlockData (raw);
+  ASSERT_GE (compressed.size (), 2);
+  EXPECT_EQ (compressed[0], '\0');
+  EXPECT_EQ (compressed[1], '\x01');
+  EXPECT_LT (compressed.size (), raw.size () / 2);
+
+  std::string out;
+  ASSERT_TRUE (DecompressBlockData (compressed, out));
+  EXPECT_EQ (out, raw);
+}
+
+TEST_F (CompressionTests, WithDictionary)
+{
+  const std::string raw = GetTestBlock ().Serialise ();
+
+  FLAGS_xayax_block_compression = 3;
+  const std::string plain = CompressBlockData (raw);
+
+  EnableDictionary (R"({"g":{"game":{"some":"long move data for the game"}}})"
+                    " block hash parent hash rng seed domob");
+  const std::string compressed = CompressBlockData (raw);
+  ASSERT_GE (compressed.size (), 2);
+  EXPECT_EQ (compressed[0], '\0');
+  EXPECT_EQ (compressed[1], '\x02');
+  EXPECT_LT (compressed.size (), plain.size ());
+
+  std::string out;
+  ASSERT_TRUE (DecompressBlockData (compressed, out));
+  EXPECT_EQ (out, raw);
+
+  /* Data without dictionary can still be read.  */
+  ASSERT_TRUE (DecompressBlockData (plain, out));
+  EXPECT_EQ (out, raw);
+
+  FLAGS_xayax_block_compression_dict = "";
+  EXPECT_DEATH (DecompressBlockData (compressed, out), "dictionary");
+}
+
+TEST_F (CompressionTests, BlockData)
+{
+  const BlockData blk = GetTestBlock ();
+  const std::string uncompressed = blk.Serialise ();
+
+  FLAGS_xayax_block_compression = 3;
+  const std::string compressed = blk.Serialise ();
+  EXPECT_NE (compressed, uncompressed);
+
+  /* Both old uncompressed data and compressed data can be read back,
+     independent of whether compression is enabled now.  */
+  for (const int level : {0, 3})
+    {
+      FLAGS_xayax_block_compression = level;
+      for (const auto& data : {uncompressed, compressed})
+        {
+          BlockData blk2;
+          blk2.Deserialise (data);
+          EXPECT_EQ (blk2, blk);
+        }
+    }
+}
+
+TEST_F (CompressionTests, RawBlockData)
+{
+  const BlockData blk = GetTestBlock ();
+  const std::string raw = blk.Serialise ();
+  EXPECT_EQ (GetRawBlockData (raw), raw);
+
+  FLAGS_xayax_block_compression = 3;
+  const std::string compressed = blk.Serialise ();
+  ASSERT_NE (compressed, raw);
+  EXPECT_EQ (GetRawBlockData (compressed), raw);
+}
+
+TEST_F (CompressionTests, CachedSerialisation)
+{
+  BlockData blk = GetTestBlock ();
+  blk.CacheSerialised ();
+  ASSERT_NE (blk.serialised, nullptr);
+  EXPECT_TRUE (blk.gameIndex.has_value ());
+
+  /* The cached value is returned, even if the compression changed.  */
+  FLAGS_xayax_block_compression = 3;
+  EXPECT_EQ (blk.Serialise (), *blk.serialised);
+
+  /* Deserialised blocks do not keep the input bytes, as they may be
+     modified later on.  */
+  BlockData blk2;
+  blk2.Deserialise (blk.Serialise ());
+  EXPECT_EQ (blk2, blk);
+  EXPECT_EQ (blk2.serialised, nullptr);
+}
+
+TEST_F (CompressionTests, Invalid)
+{
+  std::string out;
+  EXPECT_DEATH (DecompressBlockData (std::string ("\0", 1), out),
+                "Invalid compressed");
+  EXPECT_DEATH (DecompressBlockData (std::string ("\0\x7fxyz", 5), out),
+                "Invalid compressed");
+
+  FLAGS_xayax_block_compression = 3;
+  std::string data = CompressBlockData ("foo bar");
+  data[1] = '\x7f';
+  EXPECT_DEATH (DecompressBlockData (data, out), "Unknown block data format");
+}
+
+} // anonymous namespace
+} // namespace xayax
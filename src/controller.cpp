@@ -4,13 +4,23 @@
 
 #include "controller.hpp"
 
+#include "lrucache.hpp"
+#include "private/blockdataview.hpp"
 #include "private/chainstate.hpp"
+#include "private/compression.hpp"
+#include "private/executor.hpp"
+#include "private/metricsserver.hpp"
 #include "private/pending.hpp"
+#include "private/pruner.hpp"
+#include "private/resync.hpp"
+#include "private/snapshot.hpp"
 #include "private/sync.hpp"
+#include "private/tracing.hpp"
 #include "private/zmqpub.hpp"
 #include "rpc-stubs/xayarpcserverstub.h"
 
 #include <xayautil/base64.hpp>
+#include <xayautil/hash.hpp>
 
 #include <jsonrpccpp/common/errors.h>
 #include <jsonrpccpp/common/exception.h>
@@ -20,14 +30,58 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>
 #include <experimental/filesystem>
 
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
+#include <thread>
+#include <utility>
 
 namespace xayax
 {
 
+DEFINE_bool (xayax_stream_sendupdates, false,
+             "whether game_sendupdates requests without explicit 'to' block"
+             " stream all notifications up to the tip in the background,"
+             " rather than sending at most --xayax_block_range blocks");
+DEFINE_int32 (xayax_stream_pause_ms, 0,
+              "pause in milliseconds between chunks of --xayax_block_range"
+              " blocks when streaming game_sendupdates notifications");
+DEFINE_int32 (xayax_rpc_header_cache, 10'000,
+              "number of pruned (finalised) blocks for which the hash/height"
+              " mapping is cached for getblockhash and getblockheader");
+
+DEFINE_int32 (xayax_prune_interval_blocks, 100,
+              "prune the chainstate in the background once the tip advanced"
+              " by this many blocks (0 to prune on every tip update instead)");
+DEFINE_int32 (xayax_prune_interval_ms, 10'000,
+              "time in ms after which background pruning runs even if fewer"
+              " than --xayax_prune_interval_blocks blocks were attached");
+DEFINE_int32 (xayax_prune_batch_blocks, 1'000,
+              "maximum number of heights pruned in the background while"
+              " holding the chain lock once");
+DEFINE_int32 (xayax_vacuum_pages, 1'000,
+              "maximum number of free database pages released in one"
+              " incremental vacuum step after background pruning");
+DEFINE_int32 (xayax_prune_pause_ms, 5,
+              "pause in ms between background pruning batches and vacuum"
+              " steps, so that waiting users of the chain lock get it");
+DEFINE_int32 (xayax_rpc_threads, 50,
+              "number of threads serving JSON-RPC requests in parallel");
+DEFINE_int32 (xayax_rpc_tip_cache, 10'000,
+              "number of getblockhash and getblockheader results for unpruned"
+              " blocks that are cached until the tip changes");
+DEFINE_int32 (xayax_rpc_signature_cache, 10'000,
+              "number of signature verification results that are cached"
+              " for verifymessage");
+DEFINE_int32 (xayax_verify_threads, 0,
+              "number of threads used to verify signatures in parallel for"
+              " verifymessages (0 to use the number of CPU cores)");
+
 DECLARE_int32 (xayax_block_range);
 
 namespace
@@ -35,6 +89,9 @@ namespace
 
 namespace fs = std::experimental::filesystem;
 
+/** Number of recent spans per stage returned from getperfstats.  */
+constexpr size_t PERF_STATS_RECENT = 10;
+
 } // anonymous namespace
 
 /* ************************************************************************** */
@@ -52,20 +109,40 @@ private:
   /** Associated Controller instance.  */
   Controller& parent;
 
-  /** Mutex for the chainstate.  */
-  std::mutex mutChain;
+  /**
+   * Mutex for the chainstate.  Sync and other updates to the chainstate
+   * (as well as methods that read from its database) lock it exclusively.
+   * Read-only RPC methods that only need the in-memory index of the
+   * chainstate use a shared lock, so they can run in parallel and don't
+   * have to wait for one another.
+   */
+  std::shared_mutex mutChain;
 
   Chainstate chain;
+
+  /**
+   * The background pruner, if enabled.  Otherwise we prune directly
+   * in TipUpdatedFrom.  This is declared before sync, so that the
+   * sync (which notifies it) is destructed first.
+   */
+  std::unique_ptr<Pruner> pruner;
+
   std::unique_ptr<Sync> sync;
   ZmqPub zmq;
   PendingManager pendings;
 
+  /** The streamer for game_sendupdates, if enabled.  */
+  std::unique_ptr<ResyncStreamer> resync;
+
   /** HTTP connector for the RPC server.  */
   jsonrpc::HttpServer http;
 
   /** The RPC server run.  */
   std::unique_ptr<RpcServer> rpc;
 
+  /** The metrics HTTP server, if enabled.  */
+  std::unique_ptr<MetricsServer> metrics;
+
   /* Callbacks from the base chain.  */
   void TipChanged (const std::string& tip) override;
   void PendingMoves (const std::vector<MoveData>& moves) override;
@@ -84,6 +161,9 @@ private:
    * the base chain is queried for up to num blocks starting from the fork
    * point and those are returned.
    *
+   * If gameId is not empty, notifications are only sent for that game
+   * (rather than all tracked games).
+   *
    * The actual detach blocks will be returned in detaches.  If attaches
    * was not filled in and is instead retrieved, then those blocks will be
    * returned in queriedAttach.
@@ -97,9 +177,29 @@ private:
                       const std::string& to,
                       const std::vector<BlockData>& attaches, unsigned num,
                       const std::string& reqtoken,
+                      const std::string& gameId,
                       std::vector<BlockData>& detach,
                       std::vector<BlockData>& queriedAttach);
 
+  /**
+   * Determines the blocks to detach from the given "from" block to get
+   * back to the main chain, and the main-chain fork point (which is from
+   * itself if it is on the main chain already).  Returns false if that
+   * is not possible, e.g. because the block is unknown.  The caller must
+   * hold mutChain (at least shared).
+   */
+  bool FindForkPoint (const std::string& from, std::vector<BlockData>& detach,
+                      uint64_t& forkHeight, std::string& forkPoint);
+
+  /**
+   * Prepares a streamed resync from the given block to the current tip
+   * of the local chain state.  This fills in the detaches, fork point and
+   * target of the job, but does not fetch the attached blocks (which is
+   * left to the streamer).  The caller must hold mutChain (at least
+   * shared).  Returns false on errors in the same way as PushZmqBlocks.
+   */
+  bool PlanResync (const std::string& from, ResyncStreamer::Job& job);
+
   friend class RpcServer;
 
 public:
@@ -144,6 +244,72 @@ private:
   /** The procedure for game_sendupdates with all three arguments set.  */
   const jsonrpc::Procedure procGameSendUpdates3;
 
+  /**
+   * Lock for the caches of finalised block hashes and heights.  These are
+   * used for getblockhash and getblockheader on pruned blocks, which would
+   * otherwise need a base-chain request each time.
+   */
+  std::mutex mutHeaders;
+  /** Hashes of pruned blocks by height.  */
+  LruCache<uint64_t, std::string> finalisedHashes;
+  /** Heights of pruned blocks by hash.  */
+  LruCache<std::string, uint64_t> finalisedHeights;
+
+  /**
+   * Adds a pruned block to the caches of finalised hashes and heights.
+   */
+  void CacheFinalised (uint64_t height, const std::string& hash);
+
+  /**
+   * Lock for the caches of results that depend on the current tip.  They are
+   * cleared in TipChanged, which is called while the sync holds mutChain
+   * exclusively.  Entries are only added while mutChain is held shared,
+   * so that the cached data always matches the current chainstate.
+   * Lookups only need this lock, and not mutChain.
+   */
+  std::mutex mutTipCache;
+  /** The getblockchaininfo result for the current tip, or null.  */
+  Json::Value tipBlockchainInfo;
+  /** Hashes of unpruned main-chain blocks by height.  */
+  LruCache<uint64_t, std::string> tipHashes;
+  /** Heights of unpruned blocks known to the chainstate by hash.  */
+  LruCache<std::string, uint64_t> tipHeights;
+
+  /**
+   * Result of verifying a signature:  Whether or not it is valid, and
+   * the recovered signer address if it is.
+   */
+  using VerifyResult = std::pair<bool, std::string>;
+
+  /**
+   * Lock for the cache of signature verification results.  GSPs verify the
+   * same signatures (e.g. of channel states) again and again, for instance
+   * when replaying blocks after a restart or reorg.
+   */
+  std::mutex mutSignatures;
+  /**
+   * Verification results keyed by the message's SHA-256 hash together
+   * with the raw signature.
+   */
+  LruCache<std::string, VerifyResult> verifiedSignatures;
+
+  /** Executor for verifying the signatures of verifymessages in parallel.  */
+  Executor verifier;
+
+  /**
+   * Verifies a message with the base chain, using and updating the cache
+   * of verification results.  May throw in case of a base-chain error.
+   */
+  VerifyResult VerifyWithCache (const std::string& msg,
+                                const std::string& rawSgn);
+
+  /**
+   * Runs the verification for one verifymessage(s) request and constructs
+   * the RPC result for it.
+   */
+  Json::Value VerifyOne (const std::string& addr, const std::string& msg,
+                         const std::string& sgn);
+
   /**
    * Throws an internal JSON-RPC error to indicate that we had an issue
    * with the base chain given by the passed-in exception.
@@ -158,10 +324,26 @@ private:
                                      msg.str ());
   }
 
+  /**
+   * Handles game_sendupdates (without explicit "to" block) by queuing
+   * a streamed resync to the current tip, and returns the RPC result
+   * right away.
+   */
+  Json::Value StreamUpdates (const std::string& from,
+                             const std::string& gameId,
+                             const std::string& reqtoken);
+
 public:
 
   explicit RpcServer (jsonrpc::AbstractServerConnector& conn, RunData& r);
 
+  /**
+   * Invalidates the cached results that depend on the current tip.
+   * This must be called whenever the chainstate changes, with mutChain
+   * held exclusively.
+   */
+  void TipChanged ();
+
   /**
    * libjson-rpc-cpp does not by itself support optional arguments, which
    * we need for game_sendupdates.  Thus we override the HandleMethodCall
@@ -172,12 +354,14 @@ public:
 
   Json::Value getzmqnotifications () override;
   void trackedgames (const std::string& cmd, const std::string& game) override;
+  Json::Value gettrackedgames () override;
 
   Json::Value getnetworkinfo () override;
   Json::Value getblockchaininfo () override;
 
   std::string getblockhash (int height) override;
   Json::Value getblockheader (const std::string& hash);
+  Json::Value getblockrange (int count, int start) override;
 
   Json::Value game_sendupdates () override;
   Json::Value game_sendupdates2 (const std::string& from,
@@ -188,8 +372,15 @@ public:
 
   Json::Value verifymessage (const std::string& addr, const std::string& msg,
                              const std::string& sgn) override;
+  Json::Value verifymessages (const Json::Value& requests) override;
 
   Json::Value getrawmempool () override;
+
+  Json::Value getperfstats () override;
+  void setperftracing (bool enabled) override;
+
+  Json::Value exportsnapshot (const std::string& file) override;
+
   void stop () override;
 
 };
@@ -202,9 +393,35 @@ Controller::RpcServer::RpcServer (jsonrpc::AbstractServerConnector& conn,
                           "fromblock", jsonrpc::JSON_STRING,
                           "gameid", jsonrpc::JSON_STRING,
                           "toblock", jsonrpc::JSON_STRING,
-                          nullptr)
+                          nullptr),
+    finalisedHashes(std::max (0, FLAGS_xayax_rpc_header_cache)),
+    finalisedHeights(std::max (0, FLAGS_xayax_rpc_header_cache)),
+    tipHashes(std::max (0, FLAGS_xayax_rpc_tip_cache)),
+    tipHeights(std::max (0, FLAGS_xayax_rpc_tip_cache)),
+    verifiedSignatures(std::max (0, FLAGS_xayax_rpc_signature_cache)),
+    verifier(FLAGS_xayax_verify_threads > 0
+                ? FLAGS_xayax_verify_threads
+                : std::max (1u, std::thread::hardware_concurrency ()))
 {}
 
+void
+Controller::RpcServer::CacheFinalised (const uint64_t height,
+                                       const std::string& hash)
+{
+  std::lock_guard<std::mutex> lock(mutHeaders);
+  finalisedHashes.Put (height, hash);
+  finalisedHeights.Put (hash, height);
+}
+
+void
+Controller::RpcServer::TipChanged ()
+{
+  std::lock_guard<std::mutex> lock(mutTipCache);
+  tipBlockchainInfo = Json::Value ();
+  tipHashes.Clear ();
+  tipHeights.Clear ();
+}
+
 void
 Controller::RpcServer::HandleMethodCall (jsonrpc::Procedure& proc,
                                          const Json::Value& input,
@@ -240,6 +457,14 @@ Controller::RpcServer::getzmqnotifications ()
   cur["address"] = run.parent.zmqAddr;
   res.append (cur);
 
+  if (run.zmq.HasBinary ())
+    {
+      cur["type"] = "pubgameblocksbin";
+      res.append (cur);
+      cur["type"] = "pubblocksbin";
+      res.append (cur);
+    }
+
   if (run.parent.pending)
     {
       cur["type"] = "pubgamepending";
@@ -259,6 +484,31 @@ Controller::RpcServer::trackedgames (const std::string& cmd,
     run.zmq.UntrackGame (game);
 }
 
+Json::Value
+Controller::RpcServer::gettrackedgames ()
+{
+  Json::Value res(Json::objectValue);
+  for (const auto& entry : run.zmq.GetTrackedGames ())
+    {
+      const auto& g = entry.second;
+
+      Json::Value subscribers(Json::objectValue);
+      subscribers["game-block-attach"]
+          = static_cast<Json::Int64> (g.attachSubscribers);
+      subscribers["game-block-detach"]
+          = static_cast<Json::Int64> (g.detachSubscribers);
+      subscribers["game-pending-move"]
+          = static_cast<Json::Int64> (g.pendingSubscribers);
+
+      Json::Value cur(Json::objectValue);
+      cur["depth"] = static_cast<Json::Int64> (g.depth);
+      cur["subscribers"] = subscribers;
+      res[entry.first] = cur;
+    }
+
+  return res;
+}
+
 Json::Value
 Controller::RpcServer::getnetworkinfo ()
 {
@@ -283,6 +533,12 @@ Controller::RpcServer::getnetworkinfo ()
 Json::Value
 Controller::RpcServer::getblockchaininfo ()
 {
+  {
+    std::lock_guard<std::mutex> lock(mutTipCache);
+    if (!tipBlockchainInfo.isNull ())
+      return tipBlockchainInfo;
+  }
+
   Json::Value res(Json::objectValue);
 
   {
@@ -300,7 +556,7 @@ Controller::RpcServer::getblockchaininfo ()
     res["chain"] = cachedChain;
   }
 
-  std::lock_guard<std::mutex> lockChain(run.mutChain);
+  std::shared_lock<std::shared_mutex> lockChain(run.mutChain);
   const auto tipHeight = run.chain.GetTipHeight ();
   if (tipHeight == -1)
     {
@@ -317,28 +573,57 @@ Controller::RpcServer::getblockchaininfo ()
       res["bestblockhash"] = tipHash;
     }
 
+  std::lock_guard<std::mutex> lock(mutTipCache);
+  tipBlockchainInfo = res;
+
   return res;
 }
 
 std::string
 Controller::RpcServer::getblockhash (const int height)
 {
-  std::lock_guard<std::mutex> lock(run.mutChain);
+  if (height >= 0)
+    {
+      std::lock_guard<std::mutex> lock(mutTipCache);
+      std::string hash;
+      if (tipHashes.Get (height, hash))
+        return hash;
+    }
 
-  std::string hash;
-  if (run.chain.GetHashForHeight (height, hash))
-    return hash;
+  {
+    std::shared_lock<std::shared_mutex> lock(run.mutChain);
+
+    std::string hash;
+    if (run.chain.GetHashForHeight (height, hash))
+      {
+        std::lock_guard<std::mutex> lockCache(mutTipCache);
+        tipHashes.Put (height, hash);
+        return hash;
+      }
+
+    if (height >= run.chain.GetLowestUnprunedHeight ())
+      throw jsonrpc::JsonRpcException (-8, "block height out of range");
+  }
 
   /* This might be a pruned block.  In this case, we query the main chain
-     for it.  */
+     for it.  This is done without holding the lock, as we do not need
+     the chainstate for it anymore.  Since pruned blocks are final,
+     the result can be cached.  */
 
-  if (height >= run.chain.GetLowestUnprunedHeight ())
+  if (height < 0)
     throw jsonrpc::JsonRpcException (-8, "block height out of range");
 
+  {
+    std::lock_guard<std::mutex> lock(mutHeaders);
+    std::string hash;
+    if (finalisedHashes.Get (height, hash))
+      return hash;
+  }
+
   std::vector<BlockData> blocks;
   try
     {
-      blocks = run.parent.base.GetBlockRange (height, 1);
+      blocks = run.parent.base.GetBlockHeaders (height, 1);
     }
   catch (const std::exception& exc)
     {
@@ -349,31 +634,65 @@ Controller::RpcServer::getblockhash (const int height)
     throw jsonrpc::JsonRpcException (-8, "block height out of range");
 
   CHECK_EQ (blocks.size (), 1);
+  CacheFinalised (height, blocks[0].hash);
   return blocks[0].hash;
 }
 
 Json::Value
 Controller::RpcServer::getblockheader (const std::string& hash)
 {
-  std::lock_guard<std::mutex> lock(run.mutChain);
-
   Json::Value res(Json::objectValue);
   res["hash"] = hash;
 
-  uint64_t height;
-  if (run.chain.GetHeightForHash (hash, height))
-    {
-      res["height"] = static_cast<Json::Int64> (height);
-      return res;
-    }
+  {
+    std::lock_guard<std::mutex> lock(mutTipCache);
+    uint64_t height;
+    if (tipHeights.Get (hash, height))
+      {
+        res["height"] = static_cast<Json::Int64> (height);
+        return res;
+      }
+  }
+
+  int64_t lowestUnpruned;
+  {
+    std::shared_lock<std::shared_mutex> lock(run.mutChain);
+
+    uint64_t height;
+    if (run.chain.GetHeightForHash (hash, height))
+      {
+        std::lock_guard<std::mutex> lockCache(mutTipCache);
+        tipHeights.Put (hash, height);
+        res["height"] = static_cast<Json::Int64> (height);
+        return res;
+      }
 
-  /* Check the base chain to see if this might be a pruned block.  */
+    lowestUnpruned = run.chain.GetLowestUnprunedHeight ();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutHeaders);
+    uint64_t height;
+    if (finalisedHeights.Get (hash, height))
+      {
+        res["height"] = static_cast<Json::Int64> (height);
+        return res;
+      }
+  }
+
+  /* Check the base chain to see if this might be a pruned block.  Only
+     heights that are pruned (and thus final) are cached, as others
+     may still change with a reorg.  */
   try
     {
-      const int64_t baseHeight = run.parent.base.GetMainchainHeight (hash);
+      const auto baseHeights = run.parent.base.GetMainchainHeights ({hash});
+      CHECK_EQ (baseHeights.size (), 1);
+      const int64_t baseHeight = baseHeights[0];
       if (baseHeight != -1)
         {
           CHECK_GE (baseHeight, 0);
+          if (baseHeight < lowestUnpruned)
+            CacheFinalised (baseHeight, hash);
           res["height"] = static_cast<Json::Int64> (baseHeight);
           return res;
         }
@@ -386,6 +705,67 @@ Controller::RpcServer::getblockheader (const std::string& hash)
   throw jsonrpc::JsonRpcException (-5, "block not found");
 }
 
+Json::Value
+Controller::RpcServer::getblockrange (const int count, const int start)
+{
+  if (start < 0 || count < 0)
+    throw jsonrpc::JsonRpcException (-8, "invalid block range");
+
+  /* At most --xayax_block_range blocks are returned at once.  Clients
+     can request the remaining ones afterwards.  */
+  const uint64_t num = std::min (count, FLAGS_xayax_block_range);
+
+  int64_t tipHeight, lowestUnpruned;
+  std::vector<std::string> unpruned;
+  {
+    std::shared_lock<std::shared_mutex> lock(run.mutChain);
+    tipHeight = run.chain.GetTipHeight ();
+    lowestUnpruned = run.chain.GetLowestUnprunedHeight ();
+    if (tipHeight != -1)
+      unpruned = run.chain.GetMainchainRange (start, num);
+  }
+
+  Json::Value res(Json::arrayValue);
+  if (tipHeight == -1)
+    return res;
+  CHECK_GE (lowestUnpruned, 0);
+
+  /* Blocks below the pruning depth are final, so they can be retrieved from
+     the base chain (and its block cache) without holding the lock.  */
+  const uint64_t end = std::min<uint64_t> (start + num, tipHeight + 1);
+  const uint64_t prunedEnd = std::min<uint64_t> (end, lowestUnpruned);
+  std::vector<BlockData> pruned;
+  if (static_cast<uint64_t> (start) < prunedEnd)
+    try
+      {
+        pruned = run.parent.base.GetBlockRange (start, prunedEnd - start);
+      }
+    catch (const std::exception& exc)
+      {
+        PropagateBaseChainError (exc);
+      }
+
+  /* If the base chain returns fewer blocks than requested (or none at all),
+     the result would not be contiguous with the unpruned part (or would
+     look like the end of the chain), so that is an error as well.  */
+  if (static_cast<uint64_t> (start) < prunedEnd
+        && (pruned.size () != prunedEnd - start
+              || (!unpruned.empty ()
+                    && BlockDataView (unpruned.front ()).GetParent ()
+                          != pruned.back ().hash)))
+    throw jsonrpc::JsonRpcException (
+        -1, "base chain does not match the pruned chainstate");
+
+  /* The blocks are returned in raw form, as the receiving side may not
+     use the same compression settings.  */
+  for (const auto& blk : pruned)
+    res.append (xaya::EncodeBase64 (GetRawBlockData (blk.Serialise ())));
+  for (auto& data : unpruned)
+    res.append (xaya::EncodeBase64 (GetRawBlockData (std::move (data))));
+
+  return res;
+}
+
 Json::Value
 Controller::RpcServer::game_sendupdates ()
 {
@@ -404,9 +784,9 @@ Controller::RpcServer::game_sendupdates3 (const std::string& from,
                                           const std::string& gameId,
                                           const std::string& to)
 {
-  /* TODO: Actually use the gameId to filter notifications sent.  For now,
-     we just trigger "default" ones.  This works as GSPs track their games
-     anyway, but it may send too many notifications.  */
+  /* Notifications are only sent for the requested game, so that GSPs of
+     other games sharing this instance do not get (and have to filter out)
+     messages that are not meant for them.  */
 
   std::ostringstream reqtoken;
   {
@@ -415,13 +795,16 @@ Controller::RpcServer::game_sendupdates3 (const std::string& from,
     reqtoken << "request_" << requests;
   }
 
+  if (to.empty () && run.resync != nullptr)
+    return StreamUpdates (from, gameId, reqtoken.str ());
+
   std::vector<BlockData> detaches, attaches;
   bool ok;
   try
     {
-      std::lock_guard<std::mutex> lock(run.mutChain);
+      std::lock_guard<std::shared_mutex> lock(run.mutChain);
       ok = run.PushZmqBlocks (
-              from, to, {}, FLAGS_xayax_block_range, reqtoken.str (),
+              from, to, {}, FLAGS_xayax_block_range, reqtoken.str (), gameId,
               detaches, attaches);
     }
   catch (const std::exception& exc)
@@ -451,9 +834,83 @@ Controller::RpcServer::game_sendupdates3 (const std::string& from,
 }
 
 Json::Value
-Controller::RpcServer::verifymessage (const std::string& addr,
-                                      const std::string& msg,
-                                      const std::string& sgn)
+Controller::RpcServer::StreamUpdates (const std::string& from,
+                                      const std::string& gameId,
+                                      const std::string& reqtoken)
+{
+  ResyncStreamer::Job job;
+  job.reqtoken = reqtoken;
+  job.gameId = gameId;
+
+  /* Only the fork point and detached blocks are determined with the
+     chain lock held.  The attaches are fetched and sent by the streamer.
+     Planning only reads the chainstate, so a shared lock is enough, and
+     the base-chain lookup in FindForkPoint does not block other readers.  */
+  bool ok;
+  try
+    {
+      std::shared_lock<std::shared_mutex> lock(run.mutChain);
+      ok = run.PlanResync (from, job);
+    }
+  catch (const std::exception& exc)
+    {
+      PropagateBaseChainError (exc);
+    }
+
+  Json::Value steps(Json::objectValue);
+  Json::Value res(Json::objectValue);
+  res["reqtoken"] = reqtoken;
+  res["error"] = !ok;
+
+  if (!ok)
+    {
+      steps["detach"] = 0;
+      steps["attach"] = 0;
+      res["toblock"] = from;
+      res["steps"] = steps;
+      return res;
+    }
+
+  steps["detach"] = static_cast<Json::Int64> (job.detach.size ());
+  steps["attach"]
+      = static_cast<Json::Int64> (job.targetHeight - job.forkHeight);
+  res["toblock"] = job.target;
+  res["steps"] = steps;
+
+  run.resync->Enqueue (std::move (job));
+
+  return res;
+}
+
+Controller::RpcServer::VerifyResult
+Controller::RpcServer::VerifyWithCache (const std::string& msg,
+                                        const std::string& rawSgn)
+{
+  const std::string key = xaya::SHA256::Hash (msg).ToHex () + rawSgn;
+
+  VerifyResult res;
+  {
+    std::lock_guard<std::mutex> lock(mutSignatures);
+    if (verifiedSignatures.Get (key, res))
+      return res;
+  }
+
+  /* The actual verification is done without holding the lock, so that
+     multiple requests can be processed in parallel.  */
+  res.first = run.parent.base.VerifyMessage (msg, rawSgn, res.second);
+  if (!res.first)
+    res.second.clear ();
+
+  std::lock_guard<std::mutex> lock(mutSignatures);
+  verifiedSignatures.Put (key, res);
+
+  return res;
+}
+
+Json::Value
+Controller::RpcServer::VerifyOne (const std::string& addr,
+                                  const std::string& msg,
+                                  const std::string& sgn)
 {
   /* The RPC argument for the signature is always base64 encoded (as with
      Xaya Core).  The base chains expect "raw byte" signatures.  */
@@ -472,18 +929,17 @@ Controller::RpcServer::verifymessage (const std::string& addr,
      RPC does in Xaya Core.  */
   const bool addrRecovery = addr.empty ();
 
-  std::string signerAddr;
-  bool ok;
+  VerifyResult verified;
   try
     {
-      ok = run.parent.base.VerifyMessage (msg, rawSgn, signerAddr);
+      verified = VerifyWithCache (msg, rawSgn);
     }
   catch (const std::exception& exc)
     {
       PropagateBaseChainError (exc);
     }
 
-  if (!ok)
+  if (!verified.first)
     {
       if (!addrRecovery)
         return false;
@@ -494,11 +950,66 @@ Controller::RpcServer::verifymessage (const std::string& addr,
     }
 
   if (!addrRecovery)
-    return signerAddr == addr;
+    return verified.second == addr;
 
   Json::Value res(Json::objectValue);
   res["valid"] = true;
-  res["address"] = signerAddr;
+  res["address"] = verified.second;
+  return res;
+}
+
+Json::Value
+Controller::RpcServer::verifymessage (const std::string& addr,
+                                      const std::string& msg,
+                                      const std::string& sgn)
+{
+  return VerifyOne (addr, msg, sgn);
+}
+
+Json::Value
+Controller::RpcServer::verifymessages (const Json::Value& requests)
+{
+  if (!requests.isArray ())
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "requests must be an array");
+
+  /* Each request is an object with "message" and "signature", and optionally
+     "address" (with the same meaning as for verifymessage).  */
+  for (const auto& r : requests)
+    {
+      const bool valid
+          = r.isObject ()
+              && r["message"].isString () && r["signature"].isString ()
+              && (!r.isMember ("address") || r["address"].isString ());
+      if (!valid)
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+            "invalid request for verifymessages");
+    }
+
+  std::vector<std::future<Json::Value>> results;
+  results.reserve (requests.size ());
+  for (const auto& r : requests)
+    {
+      const std::string addr = r.get ("address", "").asString ();
+      const std::string msg = r["message"].asString ();
+      const std::string sgn = r["signature"].asString ();
+      results.push_back (verifier.Submit ([this, addr, msg, sgn] ()
+        {
+          return VerifyOne (addr, msg, sgn);
+        }));
+    }
+
+  /* Wait for all of them before returning (or throwing the first error),
+     so that no task refers to this call anymore afterwards.  */
+  for (auto& f : results)
+    f.wait ();
+
+  Json::Value res(Json::arrayValue);
+  for (auto& f : results)
+    res.append (f.get ());
+
   return res;
 }
 
@@ -522,6 +1033,89 @@ Controller::RpcServer::getrawmempool ()
   return res;
 }
 
+Json::Value
+Controller::RpcServer::getperfstats ()
+{
+  auto& tracer = Tracer::Get ();
+
+  Json::Value stages(Json::objectValue);
+  for (const auto& entry : tracer.GetStats (PERF_STATS_RECENT))
+    {
+      const auto& stats = entry.second;
+
+      Json::Value cur(Json::objectValue);
+      cur["count"] = static_cast<Json::UInt64> (stats.count);
+      cur["mean"] = stats.mean;
+      cur["p50"] = static_cast<Json::Int64> (stats.p50);
+      cur["p90"] = static_cast<Json::Int64> (stats.p90);
+      cur["p99"] = static_cast<Json::Int64> (stats.p99);
+      cur["max"] = static_cast<Json::Int64> (stats.max);
+
+      Json::Value recent(Json::arrayValue);
+      for (const auto& e : stats.recent)
+        {
+          Json::Value span(Json::objectValue);
+          span["thread"] = e.thread;
+          span["start"] = static_cast<Json::Int64> (e.start);
+          span["duration"] = static_cast<Json::Int64> (e.duration);
+          recent.append (span);
+        }
+      cur["recent"] = recent;
+
+      stages[entry.first] = cur;
+    }
+
+  Json::Value res(Json::objectValue);
+  res["enabled"] = tracer.IsEnabled ();
+  res["unit"] = "microseconds";
+  res["stages"] = stages;
+
+  return res;
+}
+
+void
+Controller::RpcServer::setperftracing (const bool enabled)
+{
+  Tracer::Get ().SetEnabled (enabled);
+}
+
+Json::Value
+Controller::RpcServer::exportsnapshot (const std::string& file)
+{
+  /* The block data is read with the chain lock held, so that the snapshot
+     is consistent.  Converting and writing it is done afterwards.  */
+  std::string chain;
+  std::vector<std::string> blocks;
+  int64_t start, tip;
+  std::string tipHash;
+  {
+    std::shared_lock<std::shared_mutex> lock(run.mutChain);
+    chain = run.chain.GetChain ();
+    blocks = run.chain.GetMainchainData ();
+    start = run.chain.GetLowestUnprunedHeight ();
+    tip = run.chain.GetTipHeight ();
+    if (tip != -1)
+      CHECK (run.chain.GetHashForHeight (tip, tipHash));
+  }
+
+  if (blocks.empty ())
+    throw jsonrpc::JsonRpcException (-1, "no blocks to export yet");
+  CHECK_EQ (blocks.size (), tip - start + 1);
+
+  if (!WriteSnapshot (file, chain, blocks))
+    throw jsonrpc::JsonRpcException (-1, "failed to write snapshot file");
+
+  Json::Value res(Json::objectValue);
+  res["file"] = file;
+  res["chain"] = chain;
+  res["blocks"] = static_cast<Json::Int64> (blocks.size ());
+  res["startheight"] = static_cast<Json::Int64> (start);
+  res["tipheight"] = static_cast<Json::Int64> (tip);
+  res["tiphash"] = tipHash;
+
+  return res;
+}
+
 void
 Controller::RpcServer::stop ()
 {
@@ -533,14 +1127,58 @@ Controller::RpcServer::stop ()
 Controller::RunData::RunData (Controller& p, const std::string& dbFile)
   : parent(p), chain(dbFile),
     zmq(parent.zmqAddr), pendings(zmq),
-    http(parent.rpcPort)
+    http(parent.rpcPort, "", "", FLAGS_xayax_rpc_threads)
 {
   CHECK (parent.run == nullptr);
   parent.run = this;
 
+  if (!parent.snapshotFile.empty ())
+    {
+      if (chain.GetTipHeight () != -1)
+        LOG (INFO)
+            << "Not importing snapshot " << parent.snapshotFile
+            << ", we already have local state";
+      else
+        {
+          const std::string baseChain = parent.base.GetChain ();
+          ImportSnapshot (chain, baseChain,
+                          ReadSnapshot (parent.snapshotFile, baseChain));
+        }
+    }
+
+  CHECK_GE (FLAGS_xayax_prune_interval_blocks, 0)
+      << "Invalid --xayax_prune_interval_blocks";
+  if (FLAGS_xayax_prune_interval_blocks > 0)
+    {
+      CHECK_GT (FLAGS_xayax_prune_interval_ms, 0)
+          << "Invalid --xayax_prune_interval_ms";
+      CHECK_GT (FLAGS_xayax_prune_batch_blocks, 0)
+          << "Invalid --xayax_prune_batch_blocks";
+      CHECK_GT (FLAGS_xayax_vacuum_pages, 0) << "Invalid --xayax_vacuum_pages";
+      CHECK_GE (FLAGS_xayax_prune_pause_ms, 0)
+          << "Invalid --xayax_prune_pause_ms";
+      CHECK_GE (parent.maxReorgDepth, 0);
+      pruner = std::make_unique<Pruner> (
+          chain, mutChain, parent.maxReorgDepth,
+          FLAGS_xayax_prune_interval_blocks,
+          std::chrono::milliseconds (FLAGS_xayax_prune_interval_ms),
+          FLAGS_xayax_prune_batch_blocks, FLAGS_xayax_vacuum_pages,
+          std::chrono::milliseconds (FLAGS_xayax_prune_pause_ms));
+    }
+
   sync = std::make_unique<Sync> (parent.base, chain, mutChain,
                                  parent.maxReorgDepth);
 
+  if (FLAGS_xayax_stream_sendupdates)
+    {
+      CHECK_GE (FLAGS_xayax_block_range, 1) << "Invalid --xayax_block_range";
+      CHECK_GE (FLAGS_xayax_stream_pause_ms, 0)
+          << "Invalid --xayax_stream_pause_ms";
+      resync = std::make_unique<ResyncStreamer> (
+          parent.base, zmq, FLAGS_xayax_block_range,
+          std::chrono::milliseconds (FLAGS_xayax_stream_pause_ms));
+    }
+
   for (const auto& g : parent.trackedGames)
     zmq.TrackGame (g);
 
@@ -550,6 +1188,11 @@ Controller::RunData::RunData (Controller& p, const std::string& dbFile)
   rpc = std::make_unique<RpcServer> (http, *this);
   rpc->StartListening ();
 
+  if (parent.metricsPort > 0)
+    metrics = std::make_unique<MetricsServer> (MetricsRegistry::Get (),
+                                               parent.metricsPort,
+                                               parent.rpcListenLocally);
+
   parent.ServersStarted ();
 
   parent.base.SetCallbacks (this);
@@ -574,7 +1217,7 @@ Controller::RunData::TipChanged (const std::string& tip)
 {
   pendings.TipChanged (tip);
   if (sync != nullptr)
-    sync->NewBaseChainTip ();
+    sync->NewBaseChainTip (tip);
 }
 
 void
@@ -588,10 +1231,16 @@ Controller::RunData::TipUpdatedFrom (const std::string& oldTip,
                                      const std::vector<BlockData>& attaches)
 {
   CHECK (!attaches.empty ());
+
+  /* The callback is invoked with mutChain held exclusively right after the
+     chainstate was updated, which is what the RPC caches need.  */
+  if (rpc != nullptr)
+    rpc->TipChanged ();
+
   std::vector<BlockData> detach, queriedAttach;
   try
     {
-      PushZmqBlocks (oldTip, "", attaches, 0, "", detach, queriedAttach);
+      PushZmqBlocks (oldTip, "", attaches, 0, "", "", detach, queriedAttach);
     }
   catch (const std::exception& exc)
     {
@@ -613,8 +1262,16 @@ Controller::RunData::TipUpdatedFrom (const std::string& oldTip,
 
   CHECK_GE (parent.maxReorgDepth, 0);
   const auto tipHeight = chain.GetTipHeight ();
-  if (tipHeight > parent.maxReorgDepth + 1)
-    chain.Prune (tipHeight - parent.maxReorgDepth - 1);
+  if (pruner != nullptr)
+    {
+      CHECK_GE (tipHeight, 0);
+      pruner->TipUpdated (tipHeight);
+    }
+  else if (tipHeight > parent.maxReorgDepth + 1)
+    {
+      TraceSpan span("controller.prune");
+      chain.Prune (tipHeight - parent.maxReorgDepth - 1);
+    }
 }
 
 bool
@@ -623,6 +1280,7 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
                                     const std::vector<BlockData>& attaches,
                                     unsigned num,
                                     const std::string& reqtoken,
+                                    const std::string& gameId,
                                     std::vector<BlockData>& detach,
                                     std::vector<BlockData>& queriedAttach)
 {
@@ -632,6 +1290,8 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
      be called with both set (which simplifies assumptions/logic below).  */
   CHECK (to.empty () || attaches.empty ());
 
+  TraceSpan span("controller.push_zmq");
+
   /* If this is a sequence of the very first blocks / blocks re-imported
      not matching up to the current chain, just push the attach blocks.  */
   if (from.empty ())
@@ -639,75 +1299,19 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
       LOG_IF (WARNING, attaches.empty ())
           << "Requested ZMQ blocks without explicit from and no attaches";
       for (const auto& blk : attaches)
-        zmq.SendBlockAttach (blk, reqtoken);
+        zmq.SendBlockAttach (blk, reqtoken, gameId);
       return true;
     }
 
-  const int64_t pruningDepth = chain.GetLowestUnprunedHeight ();
-  CHECK_GE (pruningDepth, 0);
-
-  detach.clear ();
-  int64_t mainchainHeight = -1;
-  if (!chain.GetForkBranch (from, detach))
-    {
-      /* The block is not known, which most likely means that it is
-         an old main chain block that was pruned.  */
-      mainchainHeight = parent.base.GetMainchainHeight (from);
-      if (mainchainHeight == -1)
-        {
-          /* Usually, the 'from' block is one that was previously a best tip
-             (and thus either the local chainstate is syncing from it due to
-             a tip update, or a GSP requests blocks from what it previously
-             got as best tip from Xaya X).  Thus the current situation should
-             only happen due to a reorg beyond the pruning depth.  */
-          LOG (ERROR)
-              << "Requested 'from' block " << from
-              << " is unknown and also not on the main chain";
-          return false;
-        }
-
-      /* If Xaya X is not in sync, it may happen that the from block
-         requested is retrieved from the base chain, but not actually
-         one we pruned, but a future one (or one in parallel to the blocks
-         we currently store).  In this case, we can't do anything until
-         the sync catches up, but we need to notice this situation and
-         actually exit now.  */
-      if (mainchainHeight >= pruningDepth)
-        {
-          LOG (ERROR)
-              << "Requested 'from' block " << from
-              << " is beyond the current sync state of Xaya X";
-          return false;
-        }
-    }
+  std::string forkPoint;
+  uint64_t forkHeight;
+  if (!FindForkPoint (from, detach, forkHeight, forkPoint))
+    return false;
   for (const auto& blk : detach)
-    zmq.SendBlockDetach (blk, reqtoken);
+    zmq.SendBlockDetach (blk, reqtoken, gameId);
 
-  /* Find the height starting from which we need to send attach blocks from
-     the main chain.  forkPoint will be the main-chain block to which we
-     detach or the from block if we start on the main-chain.  */
-  uint64_t forkHeight;
-  std::string forkPoint;
-  if (mainchainHeight != -1)
-    {
-      /* The fork is going back to a pruned block on main chain.  */
-      forkHeight = mainchainHeight;
-      forkPoint = from;
-    }
-  else if (detach.empty ())
-    {
-      /* The from block was already on the main chain, so we send from
-         the block after it.  */
-      CHECK (chain.GetHeightForHash (from, forkHeight));
-      forkPoint = from;
-    }
-  else
-    {
-      /* We detached some blocks.  We start to send blocks from the main
-         branch starting from the same height as the last detach.  */
-      forkHeight = detach.back ().height - 1;
-      forkPoint = detach.back ().parent;
-    }
+  const int64_t pruningDepth = chain.GetLowestUnprunedHeight ();
+  CHECK_GE (pruningDepth, 0);
 
   /* If we have an explicit "to" block, we assume that it is on the main
      chain (anything else is not supported at least for now).  Then we have
@@ -753,7 +1357,7 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
           for (auto it = toDetach.rbegin (); it != toDetach.rend (); ++it)
             {
               detach.push_back (*it);
-              zmq.SendBlockDetach (*it, reqtoken);
+              zmq.SendBlockDetach (*it, reqtoken, gameId);
             }
           return true;
         }
@@ -785,7 +1389,7 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
               CHECK_EQ (blk.parent, forkPoint);
             }
           if (blk.height > forkHeight)
-            zmq.SendBlockAttach (blk, reqtoken);
+            zmq.SendBlockAttach (blk, reqtoken, gameId);
         }
       CHECK (foundForkPoint);
       return true;
@@ -842,7 +1446,95 @@ Controller::RunData::PushZmqBlocks (const std::string& from,
     }
 
   for (const auto& blk : queriedAttach)
-    zmq.SendBlockAttach (blk, reqtoken);
+    zmq.SendBlockAttach (blk, reqtoken, gameId);
+
+  return true;
+}
+
+bool
+Controller::RunData::FindForkPoint (const std::string& from,
+                                    std::vector<BlockData>& detach,
+                                    uint64_t& forkHeight,
+                                    std::string& forkPoint)
+{
+  const int64_t pruningDepth = chain.GetLowestUnprunedHeight ();
+  CHECK_GE (pruningDepth, 0);
+
+  detach.clear ();
+  int64_t mainchainHeight = -1;
+  if (!chain.GetForkBranch (from, detach))
+    {
+      /* The block is not known, which most likely means that it is
+         an old main chain block that was pruned.  */
+      mainchainHeight = parent.base.GetMainchainHeight (from);
+      if (mainchainHeight == -1)
+        {
+          /* Usually, the 'from' block is one that was previously a best tip
+             (and thus either the local chainstate is syncing from it due to
+             a tip update, or a GSP requests blocks from what it previously
+             got as best tip from Xaya X).  Thus the current situation should
+             only happen due to a reorg beyond the pruning depth.  */
+          LOG (ERROR)
+              << "Requested 'from' block " << from
+              << " is unknown and also not on the main chain";
+          return false;
+        }
+
+      /* If Xaya X is not in sync, it may happen that the from block
+         requested is retrieved from the base chain, but not actually
+         one we pruned, but a future one (or one in parallel to the blocks
+         we currently store).  In this case, we can't do anything until
+         the sync catches up, but we need to notice this situation and
+         actually exit now.  */
+      if (mainchainHeight >= pruningDepth)
+        {
+          LOG (ERROR)
+              << "Requested 'from' block " << from
+              << " is beyond the current sync state of Xaya X";
+          return false;
+        }
+    }
+
+  /* Find the height starting from which we need to send attach blocks from
+     the main chain.  forkPoint will be the main-chain block to which we
+     detach or the from block if we start on the main-chain.  */
+  if (mainchainHeight != -1)
+    {
+      /* The fork is going back to a pruned block on main chain.  */
+      forkHeight = mainchainHeight;
+      forkPoint = from;
+    }
+  else if (detach.empty ())
+    {
+      /* The from block was already on the main chain, so we send from
+         the block after it.  */
+      CHECK (chain.GetHeightForHash (from, forkHeight));
+      forkPoint = from;
+    }
+  else
+    {
+      /* We detached some blocks.  We start to send blocks from the main
+         branch starting from the same height as the last detach.  */
+      forkHeight = detach.back ().height - 1;
+      forkPoint = detach.back ().parent;
+    }
+
+  return true;
+}
+
+bool
+Controller::RunData::PlanResync (const std::string& from,
+                                 ResyncStreamer::Job& job)
+{
+  TraceSpan span("controller.plan_resync");
+
+  if (!FindForkPoint (from, job.detach, job.forkHeight, job.forkPoint))
+    return false;
+
+  const int64_t tipHeight = chain.GetTipHeight ();
+  CHECK_GE (tipHeight, static_cast<int64_t> (job.forkHeight));
+  job.targetHeight = tipHeight;
+  CHECK (chain.GetHashForHeight (job.targetHeight, job.target));
 
   return true;
 }
@@ -876,6 +1568,22 @@ Controller::SetRpcBinding (const int p, const bool local)
   rpcListenLocally = local;
 }
 
+void
+Controller::SetMetricsPort (const int p)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  CHECK (run == nullptr) << "Instance is already running";
+  metricsPort = p;
+}
+
+void
+Controller::SetSnapshot (const std::string& file)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  CHECK (run == nullptr) << "Instance is already running";
+  snapshotFile = file;
+}
+
 void
 Controller::EnablePending ()
 {
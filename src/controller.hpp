@@ -60,6 +60,12 @@ private:
   /** Port for the RPC server.  */
   int rpcPort = -1;
 
+  /** Port for the metrics HTTP server (zero if disabled).  */
+  int metricsPort = 0;
+
+  /** Snapshot file to import on startup (if not empty).  */
+  std::string snapshotFile;
+
   /** Mutex for this instance (for the Run/Stop interaction).  */
   std::mutex mut;
 
@@ -114,6 +120,21 @@ public:
    */
   void SetRpcBinding (int p, bool local);
 
+  /**
+   * Enables the HTTP server for metrics in the Prometheus format on the
+   * given port.  It binds to localhost or all interfaces in the same way
+   * as the RPC server.
+   */
+  void SetMetricsPort (int p);
+
+  /**
+   * Configures a snapshot file (as written by the exportsnapshot RPC method)
+   * to bootstrap from.  If there is no local state yet when the controller
+   * is started, the snapshot's blocks are imported into the chainstate and
+   * syncing resumes from its tip.  Existing local state is kept as is.
+   */
+  void SetSnapshot (const std::string& file);
+
   /**
    * Tries to enable tracking of pending moves.  This will call EnablePending
    * on the base-chain implementation, and if the base chain supports pendings,
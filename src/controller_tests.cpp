@@ -4,6 +4,7 @@
 
 #include "controller.hpp"
 
+#include "metrics.hpp"
 #include "rpc-stubs/xayarpcclient.h"
 #include "testutils.hpp"
 
@@ -11,18 +12,25 @@
 #include <jsonrpccpp/client/connectors/httpclient.h>
 #include <jsonrpccpp/common/exception.h>
 
+#include <xayautil/base64.hpp>
+
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include <experimental/filesystem>
 
+#include <chrono>
 #include <sstream>
+#include <thread>
 
 namespace xayax
 {
 
 DECLARE_int32 (xayax_block_range);
+DECLARE_int32 (xayax_prune_interval_blocks);
+DECLARE_bool (xayax_stream_sendupdates);
+DECLARE_bool (xayax_zmq_binary);
 
 namespace
 {
@@ -94,6 +102,16 @@ protected:
   /** The genesis block we use in the base chain (and controller).  */
   const BlockData genesis;
 
+  /** If set, the snapshot file configured for restarted controllers.  */
+  std::string snapshotFile;
+
+  /**
+   * The --xayax_prune_interval_blocks value used for restarted controllers.
+   * By default the background pruner is disabled, as most tests expect
+   * pruning to take effect right away with the tip update.
+   */
+  int pruneIntervalBlocks = 0;
+
   ControllerTests ()
     : genesis(base.NewGenesis (0))
   {
@@ -122,6 +140,11 @@ protected:
    */
   void StopController ();
 
+  /**
+   * Stops the controller and removes all its local state.
+   */
+  void ClearDataDir ();
+
   /**
    * Recreates the Controller instance, including starting it.  If there is
    * already an instance, it will be stopped and destructed first.
@@ -147,6 +170,11 @@ protected:
    */
   std::vector<Json::Value> AwaitPending (size_t num);
 
+  /**
+   * Awaits n ZMQ messages with the given topic and returns them.
+   */
+  std::vector<Json::Value> AwaitZmq (const std::string& topic, size_t num);
+
   /**
    * Builds up a move-data instance from the given data.  The actual
    * move data is built with our GAME_ID and the given JSON value.
@@ -179,13 +207,19 @@ protected:
     cv.notify_all ();
   }
 
+  /** The --xayax_prune_interval_blocks value before we changed it.  */
+  const int oldPruneIntervalBlocks;
+
 public:
 
   std::unique_ptr<TestZmqSubscriber> sub;
 
   TestController (ControllerTests& tc)
-    : Controller(tc.base, tc.dataDir.string ())
+    : Controller(tc.base, tc.dataDir.string ()),
+      oldPruneIntervalBlocks(FLAGS_xayax_prune_interval_blocks)
   {
+    FLAGS_xayax_prune_interval_blocks = tc.pruneIntervalBlocks;
+
     SetZmqEndpoint (ZMQ_ADDR);
     SetRpcBinding (RPC_PORT, true);
     EnableSanityChecks ();
@@ -197,6 +231,8 @@ public:
     /* Sleep some time before destructing the ZMQ subscriber to make
        sure it would receive any unexpected extra messages.  */
     SleepSome ();
+
+    FLAGS_xayax_prune_interval_blocks = oldPruneIntervalBlocks;
   }
 
   /**
@@ -227,6 +263,8 @@ ControllerTests::Restart (const unsigned maxReorgDepth, const bool pending)
   controller->SetMaxReorgDepth (maxReorgDepth);
   if (pending)
     controller->EnablePending ();
+  if (!snapshotFile.empty ())
+    controller->SetSnapshot (snapshotFile);
 
   runner = std::make_unique<std::thread> ([this] ()
     {
@@ -248,6 +286,13 @@ ControllerTests::StopController ()
   controller.reset ();
 }
 
+void
+ControllerTests::ClearDataDir ()
+{
+  StopController ();
+  fs::remove_all (dataDir);
+}
+
 void
 ControllerTests::ExpectZmq (const std::vector<BlockData>& detach,
                             const std::vector<BlockData>& attach,
@@ -296,7 +341,12 @@ ControllerTests::WaitForZmqTip (const BlockData& tip)
 std::vector<Json::Value>
 ControllerTests::AwaitPending (const size_t num)
 {
-  const std::string topic = "game-pending-move json " + GAME_ID;
+  return AwaitZmq ("game-pending-move json " + GAME_ID, num);
+}
+
+std::vector<Json::Value>
+ControllerTests::AwaitZmq (const std::string& topic, const size_t num)
+{
   return controller->sub->AwaitMessages (topic, num);
 }
 
@@ -444,6 +494,27 @@ TEST_F (ControllerRpcTests, GetZmqNotifications)
   Restart (1'000'000, true);
   EXPECT_EQ (rpc.getzmqnotifications (), expected);
 
+  /* With binary notifications, the per-game and full-block binary
+     notifiers are listed as well.  */
+  expected = ParseJson (R"([
+    {
+      "type": "pubgameblocks"
+    },
+    {
+      "type": "pubgameblocksbin"
+    },
+    {
+      "type": "pubblocksbin"
+    }
+  ])");
+  for (auto& e : expected)
+    e["address"] = ZMQ_ADDR;
+
+  FLAGS_xayax_zmq_binary = true;
+  Restart (1'000'000, false);
+  EXPECT_EQ (rpc.getzmqnotifications (), expected);
+  FLAGS_xayax_zmq_binary = false;
+
   expected.resize (1);
   Restart (1'000'000, false);
   EXPECT_EQ (rpc.getzmqnotifications (), expected);
@@ -462,6 +533,36 @@ TEST_F (ControllerRpcTests, TrackedGames)
   ExpectZmq ({}, {b});
 }
 
+TEST_F (ControllerRpcTests, GetTrackedGames)
+{
+  rpc.trackedgames ("add", GAME_ID);
+  rpc.trackedgames ("add", "other");
+
+  /* The test subscriber listens to all topics.  */
+  EXPECT_EQ (rpc.gettrackedgames (), ParseJson (R"({
+    "game":
+      {
+        "depth": 2,
+        "subscribers":
+          {
+            "game-block-attach": 1,
+            "game-block-detach": 1,
+            "game-pending-move": 1
+          }
+      },
+    "other":
+      {
+        "depth": 1,
+        "subscribers":
+          {
+            "game-block-attach": 1,
+            "game-block-detach": 1,
+            "game-pending-move": 1
+          }
+      }
+  })"));
+}
+
 TEST_F (ControllerRpcTests, GetNetworkInfo)
 {
   /* The first call to getnetworkinfo will cache the version.  */
@@ -507,6 +608,26 @@ TEST_F (ControllerRpcTests, GetBlockHashAndHeader)
   EXPECT_THROW (rpc.getblockheader ("invalid"), jsonrpc::JsonRpcException);
 }
 
+TEST_F (ControllerRpcTests, TipCacheInvalidation)
+{
+  const auto a = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (a);
+
+  /* Query the results once, so that they are cached for the current tip.  */
+  EXPECT_EQ (rpc.getblockchaininfo ()["bestblockhash"], a.hash);
+  EXPECT_EQ (rpc.getblockhash (a.height), a.hash);
+
+  /* After a reorg, the cached results must be updated.  */
+  const auto b = base.SetTip (base.NewBlock (genesis.hash));
+  WaitForZmqTip (b);
+
+  const auto info = rpc.getblockchaininfo ();
+  EXPECT_EQ (info["blocks"].asInt (), b.height);
+  EXPECT_EQ (info["bestblockhash"], b.hash);
+  EXPECT_EQ (rpc.getblockhash (a.height), b.hash);
+  EXPECT_EQ (rpc.getblockheader (b.hash)["height"].asInt (), b.height);
+}
+
 TEST_F (ControllerRpcTests, Pending)
 {
   /* We need to add a first block to get the PendingManager into synced
@@ -555,6 +676,29 @@ TEST_F (ControllerRpcTests, Pending)
   ));
 }
 
+TEST_F (ControllerRpcTests, PerfStats)
+{
+  rpc.setperftracing (true);
+  const auto blk = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (blk);
+
+  auto res = rpc.getperfstats ();
+  EXPECT_TRUE (res["enabled"].asBool ());
+  EXPECT_EQ (res["unit"], "microseconds");
+  for (const std::string stage : {"sync.fetch", "sync.set_tip",
+                                  "controller.push_zmq", "zmq.send"})
+    {
+      const auto& stats = res["stages"][stage];
+      ASSERT_TRUE (stats.isObject ()) << stage;
+      EXPECT_GE (stats["count"].asInt (), 1);
+      EXPECT_LE (stats["p50"].asInt64 (), stats["max"].asInt64 ());
+      EXPECT_GE (stats["recent"].size (), 1);
+    }
+
+  rpc.setperftracing (false);
+  EXPECT_FALSE (rpc.getperfstats ()["enabled"].asBool ());
+}
+
 TEST_F (ControllerRpcTests, BaseChainErrors)
 {
   /* We want to prune up to the last block (so we can test the handling
@@ -591,6 +735,124 @@ TEST_F (ControllerRpcTests, BaseChainErrors)
   EXPECT_THROW (rpc.getblockheader (genesis.hash), jsonrpc::JsonRpcException);
 }
 
+TEST_F (ControllerRpcTests, CachesPrunedHeaders)
+{
+  Restart (0);
+
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto b = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (b);
+
+  /* Query pruned blocks once, so they get cached.  Afterwards, the
+     calls work even if the base chain fails.  */
+  EXPECT_EQ (rpc.getblockhash (genesis.height), genesis.hash);
+  EXPECT_EQ (rpc.getblockheader (a.hash)["height"].asInt (), a.height);
+
+  base.SetShouldThrow (true);
+
+  EXPECT_EQ (rpc.getblockhash (genesis.height), genesis.hash);
+  EXPECT_EQ (rpc.getblockheader (genesis.hash)["height"].asInt (),
+             genesis.height);
+  EXPECT_EQ (rpc.getblockhash (a.height), a.hash);
+  EXPECT_EQ (rpc.getblockheader (a.hash)["height"].asInt (), a.height);
+}
+
+TEST_F (ControllerRpcTests, Snapshot)
+{
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto b = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (b);
+
+  const fs::path file = std::tmpnam (nullptr);
+  const auto res = rpc.exportsnapshot (file.string ());
+  EXPECT_EQ (res["blocks"].asInt (), 3);
+  EXPECT_EQ (res["startheight"].asInt (), genesis.height);
+  EXPECT_EQ (res["tipheight"].asInt (), b.height);
+  EXPECT_EQ (res["tiphash"], b.hash);
+
+  /* A fresh instance bootstrapped from the snapshot has the full state
+     right away, before the sync has done anything.  */
+  ClearDataDir ();
+  snapshotFile = file.string ();
+  Restart ();
+
+  const auto info = rpc.getblockchaininfo ();
+  EXPECT_EQ (info["blocks"].asInt (), b.height);
+  EXPECT_EQ (info["bestblockhash"], b.hash);
+  EXPECT_EQ (rpc.getblockhash (a.height), a.hash);
+
+  /* Syncing resumes from the snapshot tip.  */
+  const auto c = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (c);
+
+  /* With existing state, the snapshot is ignored.  */
+  Restart ();
+  EXPECT_EQ (rpc.getblockchaininfo ()["bestblockhash"], c.hash);
+
+  fs::remove (file);
+}
+
+TEST_F (ControllerRpcTests, BlockRange)
+{
+  Restart (1);
+
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto b = base.SetTip (base.NewBlock ());
+  const auto c = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (c);
+
+  const auto getRange = [this] (const int start, const int count)
+    {
+      std::vector<BlockData> res;
+      for (const auto& entry : rpc.getblockrange (count, start))
+        {
+          std::string data;
+          CHECK (xaya::DecodeBase64 (entry.asString (), data));
+          BlockData blk;
+          blk.Deserialise (data);
+          res.push_back (std::move (blk));
+        }
+      return res;
+    };
+
+  /* Genesis and a are pruned and come from the base chain, while b and c
+     are read from the chainstate.  */
+  EXPECT_THAT (getRange (genesis.height, 10), ElementsAre (genesis, a, b, c));
+  EXPECT_THAT (getRange (a.height, 2), ElementsAre (a, b));
+  EXPECT_THAT (getRange (c.height, 5), ElementsAre (c));
+  EXPECT_THAT (getRange (c.height + 1, 5), ElementsAre ());
+  EXPECT_THAT (getRange (a.height, 0), ElementsAre ());
+
+  EXPECT_THROW (rpc.getblockrange (1, -1), jsonrpc::JsonRpcException);
+  EXPECT_THROW (rpc.getblockrange (-1, 0), jsonrpc::JsonRpcException);
+}
+
+TEST_F (ControllerRpcTests, BackgroundPruning)
+{
+  auto& batches = MetricsRegistry::Get ().GetCounter (
+      "xayax_pruner_batches_total", "");
+
+  pruneIntervalBlocks = 2;
+  Restart (1);
+  const uint64_t batchesBefore = batches.Get ();
+
+  base.SetTip (base.NewBlock ());
+  base.SetTip (base.NewBlock ());
+  const auto c = base.SetTip (base.NewBlock ());
+  WaitForZmqTip (c);
+
+  /* The pruner runs in the background, so wait for it.  */
+  for (unsigned i = 0; i < 10'000 && batches.Get () == batchesBefore; ++i)
+    std::this_thread::sleep_for (std::chrono::milliseconds (1));
+  ASSERT_GT (batches.Get (), batchesBefore) << "Pruner did not run";
+
+  /* The genesis block is pruned now, so its header can only be looked up
+     from the base chain, while the tip is still in the chainstate.  */
+  base.SetShouldThrow (true);
+  EXPECT_EQ (rpc.getblockheader (c.hash)["height"].asInt (), c.height);
+  EXPECT_THROW (rpc.getblockheader (genesis.hash), jsonrpc::JsonRpcException);
+}
+
 /* ************************************************************************** */
 
 class ControllerSendUpdatesTests : public ControllerRpcTests
@@ -649,6 +911,33 @@ TEST_F (ControllerSendUpdatesTests, DetachOnly)
   ExpectZmq ({c}, {}, upd["reqtoken"].asString ());
 }
 
+TEST_F (ControllerSendUpdatesTests, OnlyRequestedGame)
+{
+  rpc.trackedgames ("add", "other");
+
+  auto upd = rpc.game_sendupdates2 (a.hash, GAME_ID);
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 2,
+    "detach": 1
+  })"));
+  ExpectZmq ({a}, {b, c}, upd["reqtoken"].asString ());
+
+  upd = rpc.game_sendupdates2 (genesis.hash, "other");
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 2,
+    "detach": 0
+  })"));
+  const auto attaches = AwaitZmq ("game-block-attach json other", 2);
+  ASSERT_EQ (attaches.size (), 2);
+  EXPECT_EQ (attaches[0]["block"]["hash"], b.hash);
+  EXPECT_EQ (attaches[1]["block"]["hash"], c.hash);
+  EXPECT_EQ (attaches[1]["reqtoken"], upd["reqtoken"]);
+
+  /* Untracked games do not get any notifications.  */
+  upd = rpc.game_sendupdates2 (genesis.hash, "untracked");
+  EXPECT_EQ (upd["steps"]["attach"], 2);
+}
+
 TEST_F (ControllerSendUpdatesTests, DetachAndAttach)
 {
   const auto upd = rpc.game_sendupdates2 (a.hash, GAME_ID);
@@ -857,5 +1146,90 @@ TEST_F (ControllerSendUpdatesTests, BlockRange)
 
 /* ************************************************************************** */
 
+class ControllerStreamedUpdatesTests : public ControllerSendUpdatesTests
+{
+
+private:
+
+  const int oldBlockRange;
+
+protected:
+
+  ControllerStreamedUpdatesTests ()
+    : oldBlockRange(FLAGS_xayax_block_range)
+  {
+    FLAGS_xayax_stream_sendupdates = true;
+    FLAGS_xayax_block_range = 2;
+    Restart ();
+  }
+
+  ~ControllerStreamedUpdatesTests ()
+  {
+    FLAGS_xayax_stream_sendupdates = false;
+    FLAGS_xayax_block_range = oldBlockRange;
+  }
+
+};
+
+TEST_F (ControllerStreamedUpdatesTests, LongRange)
+{
+  const auto chain = base.AttachBranch (c.hash, 7);
+  WaitForZmqTip (chain.back ());
+
+  /* All blocks up to the tip are sent, even though there are many more
+     than the block range.  */
+  const auto upd = rpc.game_sendupdates2 (a.hash, GAME_ID);
+  EXPECT_FALSE (upd["error"].asBool ());
+  EXPECT_EQ (upd["toblock"], chain.back ().hash);
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 9,
+    "detach": 1
+  })"));
+
+  std::vector<BlockData> attaches = {b, c};
+  attaches.insert (attaches.end (), chain.begin (), chain.end ());
+  ExpectZmq ({a}, attaches, upd["reqtoken"].asString ());
+}
+
+TEST_F (ControllerStreamedUpdatesTests, NoUpdates)
+{
+  const auto upd = rpc.game_sendupdates2 (c.hash, GAME_ID);
+  EXPECT_EQ (upd["toblock"], c.hash);
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 0,
+    "detach": 0
+  })"));
+}
+
+TEST_F (ControllerStreamedUpdatesTests, UnknownFromBlock)
+{
+  const std::string invalidBlock("some unknown block");
+  const auto upd = rpc.game_sendupdates2 (invalidBlock, GAME_ID);
+  EXPECT_EQ (upd["toblock"], invalidBlock);
+  EXPECT_TRUE (upd["error"].asBool ());
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 0,
+    "detach": 0
+  })"));
+  ExpectZmq ({}, {}, upd["reqtoken"].asString ());
+}
+
+TEST_F (ControllerStreamedUpdatesTests, ExplicitToBlock)
+{
+  /* With an explicit "to" block, the legacy behaviour is used.  */
+  const auto chain = base.AttachBranch (c.hash, 5);
+  WaitForZmqTip (chain.back ());
+
+  const auto upd = rpc.game_sendupdates3 (c.hash, GAME_ID, chain[3].hash);
+  EXPECT_EQ (upd["toblock"], chain[1].hash);
+  EXPECT_EQ (upd["steps"], ParseJson (R"({
+    "attach": 2,
+    "detach": 0
+  })"));
+  ExpectZmq ({}, {chain[0], chain[1]}, upd["reqtoken"].asString ());
+}
+
+/* ************************************************************************** */
+
 } // anonymous namespace
 } // namespace xayax
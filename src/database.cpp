@@ -2,11 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "private/database.hpp"
+#include "database.hpp"
 
 #include <glog/logging.h>
 
 #include <limits>
+#include <sstream>
 
 namespace xayax
 {
@@ -92,6 +93,134 @@ Database::Execute (const std::string& sql)
             SQLITE_OK);
 }
 
+namespace
+{
+
+/**
+ * Callback for sqlite3_exec that stores the first column of the (last)
+ * result row into the std::string passed as data.
+ */
+int
+StoreResult (void* data, int columns, char** strs, char** names)
+{
+  CHECK_GE (columns, 1);
+  auto* res = static_cast<std::string*> (data);
+  *res = (strs[0] == nullptr ? "" : strs[0]);
+  return 0;
+}
+
+} // anonymous namespace
+
+void
+Database::ApplyProfile (const Profile& p)
+{
+  const auto pragma = [this] (const std::string& sql)
+    {
+      std::string res;
+      CHECK_EQ (sqlite3_exec (db, sql.c_str (), &StoreResult, &res, nullptr),
+                SQLITE_OK)
+          << "Failed to execute: " << sql;
+      return res;
+    };
+
+  /* This has to come before enabling WAL, as the auto-vacuum mode can
+     only be changed (without VACUUM) while the database is empty.  For an
+     existing database, the mode is just recorded and applied with the
+     next VACUUM.  */
+  if (p.incrementalVacuum)
+    pragma ("PRAGMA `auto_vacuum` = INCREMENTAL");
+
+  if (p.wal)
+    {
+      const std::string mode = pragma ("PRAGMA `journal_mode` = WAL");
+      wal = (mode == "wal");
+      if (!wal)
+        LOG (WARNING) << "Could not enable WAL mode, using: " << mode;
+    }
+
+  if (p.relaxedSync)
+    pragma ("PRAGMA `synchronous` = NORMAL");
+
+  if (p.mmapSize > 0)
+    {
+      std::ostringstream sql;
+      sql << "PRAGMA `mmap_size` = " << p.mmapSize;
+      pragma (sql.str ());
+    }
+
+  if (p.cacheSize > 0)
+    {
+      /* Negative values for cache_size are interpreted in KiB rather
+         than pages by SQLite.  */
+      std::ostringstream sql;
+      sql << "PRAGMA `cache_size` = -" << p.cacheSize;
+      pragma (sql.str ());
+    }
+
+  if (!p.autoCheckpoint)
+    pragma ("PRAGMA `wal_autocheckpoint` = 0");
+
+  VLOG (1)
+      << "Applied SQLite profile: WAL " << (wal ? "on" : "off")
+      << ", synchronous=" << (p.relaxedSync ? "NORMAL" : "default")
+      << ", mmap " << p.mmapSize << " bytes"
+      << ", cache " << p.cacheSize << " KiB"
+      << ", incremental vacuum " << (p.incrementalVacuum ? "on" : "off");
+}
+
+void
+Database::Checkpoint ()
+{
+  CHECK (wal) << "Checkpoint requires WAL mode";
+
+  int logFrames, checkpointed;
+  const int rc = sqlite3_wal_checkpoint_v2 (db, nullptr,
+                                            SQLITE_CHECKPOINT_PASSIVE,
+                                            &logFrames, &checkpointed);
+  CHECK_EQ (rc, SQLITE_OK) << "Failed to checkpoint the WAL";
+  VLOG (1)
+      << "Checkpointed " << checkpointed << " of " << logFrames
+      << " WAL frames";
+}
+
+uint64_t
+Database::IncrementalVacuum (const unsigned pages)
+{
+  std::ostringstream sql;
+  sql << "PRAGMA `incremental_vacuum` (" << pages << ")";
+
+  /* The pragma does its work while stepping through it, and returns
+     no data.  */
+  sqlite3_stmt* stmt = nullptr;
+  CHECK_EQ (sqlite3_prepare_v2 (db, sql.str ().c_str (), -1, &stmt, nullptr),
+            SQLITE_OK)
+      << "Failed to prepare incremental vacuum";
+  int rc;
+  do
+    rc = sqlite3_step (stmt);
+  while (rc == SQLITE_ROW);
+  sqlite3_finalize (stmt);
+  CHECK_EQ (rc, SQLITE_DONE) << "Incremental vacuum failed";
+
+  std::string count;
+  CHECK_EQ (sqlite3_exec (db, "PRAGMA `freelist_count`", &StoreResult,
+                          &count, nullptr),
+            SQLITE_OK);
+
+  return std::stoull (count);
+}
+
+bool
+Database::IsIncrementalVacuum ()
+{
+  std::string mode;
+  CHECK_EQ (sqlite3_exec (db, "PRAGMA `auto_vacuum`", &StoreResult,
+                          &mode, nullptr),
+            SQLITE_OK);
+
+  return mode == "2";
+}
+
 Database::Statement
 Database::Prepare (const std::string& sql)
 {
@@ -7,6 +7,7 @@
 
 #include <sqlite3.h>
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
@@ -19,6 +20,10 @@ namespace xayax
  * like a cache of prepared statements.  The database is opened in
  * multi-thread mode, which means that calls are not automatically thread-safe
  * and external synchronisation must be used with this instance.
+ *
+ * Base-chain implementations should use this class as well for local
+ * databases of their own, since SQLite's global configuration is done here
+ * when the first instance is opened.
  */
 class Database
 {
@@ -33,9 +38,13 @@ private:
   /** Cache of prepared statements.  */
   mutable std::map<std::string, std::unique_ptr<CachedStatement>> statements;
 
+  /** Whether or not the database is in WAL journal mode.  */
+  bool wal = false;
+
 public:
 
   class Statement;
+  struct Profile;
 
   /**
    * Opens the database at the given filename into this instance.
@@ -76,6 +85,85 @@ public:
    */
   unsigned RowsModified () const;
 
+  /**
+   * Configures the database connection according to the given profile.
+   * This should be done right after opening it.
+   */
+  void ApplyProfile (const Profile& p);
+
+  /**
+   * Returns true if the database is in WAL journal mode.  This may be
+   * false even if requested by the profile, e.g. for in-memory databases.
+   */
+  bool
+  IsWal () const
+  {
+    return wal;
+  }
+
+  /**
+   * Checkpoints the WAL (in passive mode, i.e. without blocking on readers).
+   * Must not be called while a transaction is open.
+   */
+  void Checkpoint ();
+
+  /**
+   * Releases up to the given number of free pages back to the file system,
+   * if the database is in incremental auto-vacuum mode.  Returns the number
+   * of free pages remaining afterwards.  Must not be called while
+   * a transaction is open.
+   */
+  uint64_t IncrementalVacuum (unsigned pages);
+
+  /**
+   * Returns true if the database is in incremental auto-vacuum mode.
+   * If it was requested by the profile for an existing database in a
+   * different mode, this only becomes true after the next full VACUUM.
+   */
+  bool IsIncrementalVacuum ();
+
+};
+
+/**
+ * Settings for the database connection, which trade durability for
+ * performance.  The defaults are the ones of SQLite itself (i.e. fully
+ * durable), and correspond to what is used if no profile is applied.
+ */
+struct Database::Profile
+{
+
+  /** Whether to use WAL instead of a rollback journal.  */
+  bool wal = false;
+
+  /**
+   * Whether to only sync at critical moments (synchronous=NORMAL)
+   * rather than on every commit.  With WAL, this can lose the most recent
+   * transactions on power loss, but never corrupts the database.
+   */
+  bool relaxedSync = false;
+
+  /** Size of memory-mapped I/O in bytes, zero to disable it.  */
+  uint64_t mmapSize = 0;
+
+  /** Size of the page cache in KiB, zero to keep SQLite's default.  */
+  uint64_t cacheSize = 0;
+
+  /**
+   * Whether SQLite should checkpoint the WAL automatically.  This can be
+   * turned off if the caller triggers checkpoints itself at a good time,
+   * using Checkpoint.
+   */
+  bool autoCheckpoint = true;
+
+  /**
+   * Whether to use incremental auto-vacuum, so that the space of deleted
+   * data can be released with IncrementalVacuum.  This takes effect right
+   * away for new databases.  Existing databases in a different mode are
+   * only converted by the next full VACUUM (e.g. one done by the caller
+   * for a schema migration anyway), see IsIncrementalVacuum.
+   */
+  bool incrementalVacuum = false;
+
 };
 
 /**
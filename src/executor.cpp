@@ -0,0 +1,82 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/executor.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+namespace xayax
+{
+
+DEFINE_int32 (xayax_async_threads, 8,
+              "number of worker threads for asynchronous base-chain requests"
+              " that are not handled natively by the base chain");
+
+Executor::Executor (const size_t numThreads)
+{
+  CHECK_GT (numThreads, 0);
+  for (size_t i = 0; i < numThreads; ++i)
+    workers.emplace_back ([this] ()
+      {
+        Run ();
+      });
+}
+
+Executor::~Executor ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shouldStop = true;
+    cv.notify_all ();
+  }
+
+  for (auto& w : workers)
+    w.join ();
+}
+
+void
+Executor::Push (std::function<void ()> task)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  CHECK (!shouldStop) << "Executor is shutting down";
+  tasks.push_back (std::move (task));
+  cv.notify_one ();
+}
+
+void
+Executor::Run ()
+{
+  while (true)
+    {
+      std::function<void ()> task;
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        cv.wait (lock, [this] ()
+          {
+            return shouldStop || !tasks.empty ();
+          });
+
+        /* We finish all queued tasks before stopping, so that no future
+           returned from Submit is left without a result.  */
+        if (tasks.empty ())
+          return;
+
+        task = std::move (tasks.front ());
+        tasks.pop_front ();
+      }
+
+      task ();
+    }
+}
+
+Executor&
+Executor::Shared ()
+{
+  CHECK_GT (FLAGS_xayax_async_threads, 0) << "Invalid --xayax_async_threads";
+  static Executor instance(FLAGS_xayax_async_threads);
+  return instance;
+}
+
+} // namespace xayax
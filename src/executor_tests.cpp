@@ -0,0 +1,89 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/executor.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+namespace
+{
+
+using ExecutorTests = testing::Test;
+
+TEST_F (ExecutorTests, Results)
+{
+  Executor exec(2);
+
+  auto a = exec.Submit ([] () { return 42; });
+  auto b = exec.Submit ([] () { return std::string ("foo"); });
+
+  EXPECT_EQ (a.get (), 42);
+  EXPECT_EQ (b.get (), "foo");
+}
+
+TEST_F (ExecutorTests, Exceptions)
+{
+  Executor exec(1);
+
+  auto fut = exec.Submit ([] () -> int
+    {
+      throw std::runtime_error ("failed");
+    });
+  EXPECT_THROW (fut.get (), std::runtime_error);
+
+  EXPECT_EQ (exec.Submit ([] () { return 5; }).get (), 5);
+}
+
+TEST_F (ExecutorTests, RunsInParallel)
+{
+  constexpr unsigned num = 4;
+  Executor exec(num);
+
+  /* Each task waits until all of them have started, which only works
+     if they really run concurrently.  */
+  std::mutex mut;
+  std::condition_variable cv;
+  unsigned started = 0;
+
+  std::vector<std::future<void>> futures;
+  for (unsigned i = 0; i < num; ++i)
+    futures.push_back (exec.Submit ([&] ()
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        ++started;
+        cv.notify_all ();
+        cv.wait (lock, [&] () { return started == num; });
+      }));
+
+  for (auto& f : futures)
+    f.get ();
+  EXPECT_EQ (started, num);
+}
+
+TEST_F (ExecutorTests, FinishesQueuedTasks)
+{
+  std::atomic<unsigned> done(0);
+  std::vector<std::future<void>> futures;
+  {
+    Executor exec(1);
+    for (unsigned i = 0; i < 10; ++i)
+      futures.push_back (exec.Submit ([&done] () { ++done; }));
+  }
+
+  EXPECT_EQ (done, 10);
+  for (auto& f : futures)
+    f.get ();
+}
+
+} // anonymous namespace
+} // namespace xayax
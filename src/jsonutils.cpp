@@ -6,7 +6,7 @@
 
 #include <glog/logging.h>
 
-#include <sstream>
+#include <memory>
 
 namespace xayax
 {
@@ -27,16 +27,27 @@ StoreJson (const Json::Value& val)
 Json::Value
 LoadJson (const std::string& str)
 {
-  Json::CharReaderBuilder rbuilder;
-  rbuilder["allowComments"] = false;
-  rbuilder["strictRoot"] = false;
-  rbuilder["failIfExtra"] = true;
-  rbuilder["rejectDupKeys"] = true;
+  /* This is called for all JSON fields of blocks read from storage, so it
+     should be fast.  Thus we reuse the reader instance per thread, and handle
+     the frequent case of null values (e.g. for missing metadata) directly.  */
+  if (str == "null")
+    return Json::Value ();
+
+  thread_local std::unique_ptr<Json::CharReader> reader;
+  if (reader == nullptr)
+    {
+      Json::CharReaderBuilder rbuilder;
+      rbuilder["allowComments"] = false;
+      rbuilder["strictRoot"] = false;
+      rbuilder["failIfExtra"] = true;
+      rbuilder["rejectDupKeys"] = true;
+      reader.reset (rbuilder.newCharReader ());
+    }
 
   Json::Value res;
   std::string parseErrs;
-  std::istringstream in(str);
-  CHECK (Json::parseFromStream (rbuilder, in, &res, &parseErrs))
+  CHECK (reader->parse (str.data (), str.data () + str.size (),
+                        &res, &parseErrs))
       << "Invalid JSON stored: " << parseErrs << "\n" << str;
 
   return res;
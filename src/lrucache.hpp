@@ -0,0 +1,204 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_LRUCACHE_HPP
+#define XAYAX_LRUCACHE_HPP
+
+#include <glog/logging.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace xayax
+{
+
+/**
+ * Default weight function for LruCache, which counts every entry as one.
+ * With it, the cache's maximum weight is just the number of entries.
+ */
+template <typename V>
+  struct UnitWeight
+{
+  size_t
+  operator() (const V& value) const
+  {
+    return 1;
+  }
+};
+
+/**
+ * Simple cache of key/value pairs with a maximum total weight of the
+ * entries (by default their number), which evicts the least-recently used
+ * entries when full.  It also keeps track of the number of hits and misses
+ * for lookups.
+ *
+ * The weight of a value must not change while it is in the cache.
+ *
+ * This class is not thread-safe, and must be synchronised externally.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename Weight = UnitWeight<V>>
+  class LruCache
+{
+
+private:
+
+  /** Type of the list of entries, with the most-recently used first.  */
+  using EntryList = std::list<std::pair<K, V>>;
+
+  /** Maximum total weight of the entries to keep.  */
+  size_t maxSize;
+
+  /** Total weight of all current entries.  */
+  size_t weight = 0;
+
+  /** The weight function.  */
+  Weight weightOf;
+
+  /** The actual entries in order of usage.  */
+  EntryList entries;
+
+  /** Index of list entries by key.  */
+  std::unordered_map<K, typename EntryList::iterator, Hash> byKey;
+
+  /** Number of lookups that found an entry.  */
+  uint64_t hits = 0;
+
+  /** Number of lookups that did not find an entry.  */
+  uint64_t misses = 0;
+
+public:
+
+  /**
+   * Constructs an empty cache with the given maximum size (total weight).
+   * If the size is zero, nothing will be cached.
+   */
+  explicit LruCache (const size_t s)
+    : maxSize(s)
+  {}
+
+  LruCache () = delete;
+  LruCache (const LruCache&) = delete;
+  void operator= (const LruCache&) = delete;
+
+  /**
+   * Looks up the entry for a given key.  If it exists, it is marked as
+   * most-recently used, copied to the output and true is returned.
+   */
+  bool
+  Get (const K& key, V& value)
+  {
+    const auto mit = byKey.find (key);
+    if (mit == byKey.end ())
+      {
+        ++misses;
+        return false;
+      }
+
+    ++hits;
+    entries.splice (entries.begin (), entries, mit->second);
+    value = mit->second->second;
+
+    return true;
+  }
+
+  /**
+   * Inserts or replaces the entry for the given key, marking it as
+   * most-recently used.  Evicts the least-recently used entries if
+   * the cache is full.  Values that are heavier than the maximum size
+   * on their own are not cached at all.
+   */
+  void
+  Put (const K& key, V value)
+  {
+    const size_t w = weightOf (value);
+    if (w > maxSize)
+      {
+        Erase (key);
+        return;
+      }
+
+    const auto mit = byKey.find (key);
+    if (mit != byKey.end ())
+      {
+        weight -= weightOf (mit->second->second);
+        mit->second->second = std::move (value);
+        entries.splice (entries.begin (), entries, mit->second);
+      }
+    else
+      {
+        entries.emplace_front (key, std::move (value));
+        byKey.emplace (key, entries.begin ());
+      }
+    weight += w;
+
+    while (weight > maxSize)
+      {
+        weight -= weightOf (entries.back ().second);
+        byKey.erase (entries.back ().first);
+        entries.pop_back ();
+      }
+    CHECK_EQ (byKey.size (), entries.size ());
+  }
+
+  /**
+   * Removes the entry with the given key, if there is one.
+   */
+  void
+  Erase (const K& key)
+  {
+    const auto mit = byKey.find (key);
+    if (mit == byKey.end ())
+      return;
+
+    weight -= weightOf (mit->second->second);
+    entries.erase (mit->second);
+    byKey.erase (mit);
+  }
+
+  /**
+   * Removes all entries from the cache.  Does not reset the hit and
+   * miss counters.
+   */
+  void
+  Clear ()
+  {
+    byKey.clear ();
+    entries.clear ();
+    weight = 0;
+  }
+
+  size_t
+  GetSize () const
+  {
+    return entries.size ();
+  }
+
+  size_t
+  GetWeight () const
+  {
+    return weight;
+  }
+
+  uint64_t
+  GetHits () const
+  {
+    return hits;
+  }
+
+  uint64_t
+  GetMisses () const
+  {
+    return misses;
+  }
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_LRUCACHE_HPP
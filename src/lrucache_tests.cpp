@@ -0,0 +1,137 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "lrucache.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace xayax
+{
+namespace
+{
+
+using LruCacheTests = testing::Test;
+
+TEST_F (LruCacheTests, BasicLookup)
+{
+  LruCache<std::string, int> cache(10);
+
+  int val;
+  EXPECT_FALSE (cache.Get ("foo", val));
+
+  cache.Put ("foo", 42);
+  cache.Put ("bar", 5);
+  ASSERT_TRUE (cache.Get ("foo", val));
+  EXPECT_EQ (val, 42);
+  ASSERT_TRUE (cache.Get ("bar", val));
+  EXPECT_EQ (val, 5);
+
+  cache.Put ("foo", 10);
+  ASSERT_TRUE (cache.Get ("foo", val));
+  EXPECT_EQ (val, 10);
+
+  EXPECT_EQ (cache.GetSize (), 2);
+  EXPECT_EQ (cache.GetHits (), 3);
+  EXPECT_EQ (cache.GetMisses (), 1);
+}
+
+TEST_F (LruCacheTests, Eviction)
+{
+  LruCache<int, int> cache(2);
+
+  cache.Put (1, 1);
+  cache.Put (2, 2);
+
+  /* Use 1, so that 2 is evicted next.  */
+  int val;
+  ASSERT_TRUE (cache.Get (1, val));
+  cache.Put (3, 3);
+
+  EXPECT_EQ (cache.GetSize (), 2);
+  EXPECT_TRUE (cache.Get (1, val));
+  EXPECT_FALSE (cache.Get (2, val));
+  EXPECT_TRUE (cache.Get (3, val));
+
+  /* Replacing an entry marks it as used as well.  */
+  cache.Put (1, 10);
+  cache.Put (4, 4);
+  EXPECT_TRUE (cache.Get (1, val));
+  EXPECT_EQ (val, 10);
+  EXPECT_FALSE (cache.Get (3, val));
+  EXPECT_TRUE (cache.Get (4, val));
+}
+
+TEST_F (LruCacheTests, ZeroSize)
+{
+  LruCache<int, int> cache(0);
+  cache.Put (1, 1);
+
+  int val;
+  EXPECT_FALSE (cache.Get (1, val));
+  EXPECT_EQ (cache.GetSize (), 0);
+}
+
+TEST_F (LruCacheTests, Clear)
+{
+  LruCache<int, int> cache(5);
+  cache.Put (1, 1);
+  cache.Put (2, 2);
+  cache.Clear ();
+
+  int val;
+  EXPECT_FALSE (cache.Get (1, val));
+  EXPECT_EQ (cache.GetSize (), 0);
+
+  cache.Put (1, 1);
+  EXPECT_TRUE (cache.Get (1, val));
+}
+
+/**
+ * Weight for string values by their length.
+ */
+struct StringLength
+{
+  size_t
+  operator() (const std::string& str) const
+  {
+    return str.size ();
+  }
+};
+
+TEST_F (LruCacheTests, Weighted)
+{
+  LruCache<int, std::string, std::hash<int>, StringLength> cache(10);
+  cache.Put (1, "abc");
+  cache.Put (2, "defg");
+  EXPECT_EQ (cache.GetWeight (), 7);
+
+  /* This evicts the first entry, but not the second.  */
+  cache.Put (3, "hijk");
+  EXPECT_EQ (cache.GetSize (), 2);
+  EXPECT_EQ (cache.GetWeight (), 8);
+
+  std::string val;
+  EXPECT_FALSE (cache.Get (1, val));
+  EXPECT_TRUE (cache.Get (2, val));
+  EXPECT_EQ (val, "defg");
+
+  /* Replacing updates the weight.  */
+  cache.Put (3, "x");
+  EXPECT_EQ (cache.GetWeight (), 5);
+
+  /* Too heavy values are not cached, and replace an existing entry.  */
+  cache.Put (2, "this is too long");
+  EXPECT_FALSE (cache.Get (2, val));
+  EXPECT_EQ (cache.GetSize (), 1);
+  EXPECT_EQ (cache.GetWeight (), 1);
+
+  cache.Erase (3);
+  EXPECT_EQ (cache.GetSize (), 0);
+  EXPECT_EQ (cache.GetWeight (), 0);
+}
+
+} // anonymous namespace
+} // namespace xayax
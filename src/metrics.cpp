@@ -0,0 +1,455 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace xayax
+{
+
+namespace
+{
+
+/**
+ * Escapes a label value for the Prometheus text format.
+ */
+std::string
+EscapeLabelValue (const std::string& val)
+{
+  std::string res;
+  for (const char c : val)
+    switch (c)
+      {
+      case '\\':
+        res += "\\\\";
+        break;
+      case '"':
+        res += "\\\"";
+        break;
+      case '\n':
+        res += "\\n";
+        break;
+      default:
+        res += c;
+        break;
+      }
+
+  return res;
+}
+
+/**
+ * Formats labels for the Prometheus text format, i.e. as the comma-separated
+ * list of name="value" pairs without the braces.
+ */
+std::string
+FormatLabels (const MetricLabels& labels)
+{
+  std::ostringstream out;
+  bool first = true;
+  for (const auto& entry : labels)
+    {
+      if (!first)
+        out << ',';
+      first = false;
+      out << entry.first << "=\"" << EscapeLabelValue (entry.second) << '"';
+    }
+
+  return out.str ();
+}
+
+/**
+ * Returns the full label string (including braces) from formatted labels
+ * and an optional extra label (e.g. "le" for histogram buckets).
+ */
+std::string
+WrapLabels (const std::string& formatted, const std::string& extra = "")
+{
+  std::string inner = formatted;
+  if (!extra.empty ())
+    {
+      if (!inner.empty ())
+        inner += ',';
+      inner += extra;
+    }
+
+  if (inner.empty ())
+    return "";
+
+  return "{" + inner + "}";
+}
+
+/**
+ * Formats a floating-point value for the Prometheus text format.  We use
+ * a fixed precision that is enough for all practical purposes, but keeps
+ * bucket bounds like 0.0001 readable.
+ */
+std::string
+FormatDouble (const double val)
+{
+  std::ostringstream out;
+  out << std::setprecision (12) << val;
+  return out.str ();
+}
+
+} // anonymous namespace
+
+/* ************************************************************************** */
+
+MetricsHistogram::MetricsHistogram (const std::vector<double>& b)
+  : bounds(b), buckets(new std::atomic<uint64_t>[b.size () + 1]), sum(0.0)
+{
+  CHECK (std::is_sorted (bounds.begin (), bounds.end ()));
+  for (size_t i = 0; i <= bounds.size (); ++i)
+    buckets[i].store (0, std::memory_order_relaxed);
+}
+
+void
+MetricsHistogram::Observe (const double val)
+{
+  size_t ind = 0;
+  while (ind < bounds.size () && val > bounds[ind])
+    ++ind;
+  buckets[ind].fetch_add (1, std::memory_order_relaxed);
+
+  double cur = sum.load (std::memory_order_relaxed);
+  while (!sum.compare_exchange_weak (cur, cur + val,
+                                     std::memory_order_relaxed))
+    ;
+}
+
+std::vector<uint64_t>
+MetricsHistogram::GetCumulativeCounts () const
+{
+  std::vector<uint64_t> res;
+  uint64_t total = 0;
+  for (size_t i = 0; i <= bounds.size (); ++i)
+    {
+      total += buckets[i].load (std::memory_order_relaxed);
+      res.push_back (total);
+    }
+
+  return res;
+}
+
+MetricsTimer::~MetricsTimer ()
+{
+  const auto elapsed = std::chrono::steady_clock::now () - start;
+  hist.Observe (std::chrono::duration<double> (elapsed).count ());
+}
+
+/* ************************************************************************** */
+
+/**
+ * A family of metrics with the same name, type and help text, that
+ * only differ in their labels.
+ */
+struct MetricsRegistry::Family
+{
+
+  std::string help;
+  std::string type;
+
+  /**
+   * The actual metrics by their formatted labels.  Only the map
+   * corresponding to the type is used.
+   */
+  std::map<std::string, std::unique_ptr<MetricsCounter>> counters;
+  std::map<std::string, std::unique_ptr<MetricsGauge>> gauges;
+  std::map<std::string, std::unique_ptr<MetricsHistogram>> histograms;
+
+};
+
+MetricsRegistry::MetricsRegistry () = default;
+MetricsRegistry::~MetricsRegistry () = default;
+
+MetricsRegistry&
+MetricsRegistry::Get ()
+{
+  static MetricsRegistry instance;
+  return instance;
+}
+
+const std::vector<double>&
+MetricsRegistry::LatencyBuckets ()
+{
+  static const std::vector<double> buckets = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+  };
+  return buckets;
+}
+
+const std::vector<double>&
+MetricsRegistry::SizeBuckets ()
+{
+  static const std::vector<double> buckets = {
+    0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1'024,
+  };
+  return buckets;
+}
+
+MetricsRegistry::Family&
+MetricsRegistry::GetFamily (const std::string& name, const std::string& help,
+                            const std::string& type)
+{
+  auto mit = families.find (name);
+  if (mit == families.end ())
+    {
+      auto f = std::make_unique<Family> ();
+      f->help = help;
+      f->type = type;
+      mit = families.emplace (name, std::move (f)).first;
+    }
+
+  CHECK_EQ (mit->second->type, type) << "Type mismatch for metric " << name;
+  return *mit->second;
+}
+
+MetricsCounter&
+MetricsRegistry::GetCounter (const std::string& name, const std::string& help,
+                             const MetricLabels& labels)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  auto& entry = GetFamily (name, help, "counter")
+                  .counters[FormatLabels (labels)];
+  if (entry == nullptr)
+    entry = std::make_unique<MetricsCounter> ();
+  return *entry;
+}
+
+MetricsGauge&
+MetricsRegistry::GetGauge (const std::string& name, const std::string& help,
+                           const MetricLabels& labels)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  auto& entry = GetFamily (name, help, "gauge").gauges[FormatLabels (labels)];
+  if (entry == nullptr)
+    entry = std::make_unique<MetricsGauge> ();
+  return *entry;
+}
+
+MetricsHistogram&
+MetricsRegistry::GetHistogram (const std::string& name,
+                               const std::string& help,
+                               const MetricLabels& labels,
+                               const std::vector<double>& bounds)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  auto& entry = GetFamily (name, help, "histogram")
+                  .histograms[FormatLabels (labels)];
+  if (entry == nullptr)
+    entry = std::make_unique<MetricsHistogram> (bounds);
+  CHECK (entry->GetBounds () == bounds)
+      << "Bucket mismatch for metric " << name;
+  return *entry;
+}
+
+std::string
+MetricsRegistry::Render () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  std::ostringstream out;
+  for (const auto& entry : families)
+    {
+      const std::string& name = entry.first;
+      const Family& f = *entry.second;
+
+      out << "# HELP " << name << ' ' << f.help << '\n';
+      out << "# TYPE " << name << ' ' << f.type << '\n';
+
+      for (const auto& c : f.counters)
+        out << name << WrapLabels (c.first) << ' ' << c.second->Get () << '\n';
+      for (const auto& g : f.gauges)
+        out << name << WrapLabels (g.first) << ' ' << g.second->Get () << '\n';
+
+      for (const auto& h : f.histograms)
+        {
+          const auto& bounds = h.second->GetBounds ();
+          const auto counts = h.second->GetCumulativeCounts ();
+          CHECK_EQ (counts.size (), bounds.size () + 1);
+
+          for (size_t i = 0; i < bounds.size (); ++i)
+            out << name << "_bucket"
+                << WrapLabels (h.first,
+                               "le=\"" + FormatDouble (bounds[i]) + "\"")
+                << ' ' << counts[i] << '\n';
+          out << name << "_bucket" << WrapLabels (h.first, "le=\"+Inf\"")
+              << ' ' << counts.back () << '\n';
+
+          out << name << "_sum" << WrapLabels (h.first)
+              << ' ' << FormatDouble (h.second->GetSum ()) << '\n';
+          out << name << "_count" << WrapLabels (h.first)
+              << ' ' << counts.back () << '\n';
+        }
+    }
+
+  return out.str ();
+}
+
+/* ************************************************************************** */
+
+InstrumentedChain::MethodMetrics::MethodMetrics (MetricsRegistry& reg,
+                                                 const std::string& method)
+  : errors(reg.GetCounter ("xayax_basechain_errors_total",
+                           "Number of base-chain calls that failed",
+                           {{"method", method}})),
+    latency(reg.GetHistogram ("xayax_basechain_call_seconds",
+                              "Latency of base-chain calls",
+                              {{"method", method}}))
+{}
+
+InstrumentedChain::InstrumentedChain (BaseChain& b)
+  : InstrumentedChain(b, MetricsRegistry::Get ())
+{}
+
+InstrumentedChain::InstrumentedChain (BaseChain& b, MetricsRegistry& reg)
+  : base(b),
+    tipHeight(reg, "GetTipHeight"),
+    blockRange(reg, "GetBlockRange"),
+    blockByHash(reg, "GetBlockByHash"),
+    mainchainHeight(reg, "GetMainchainHeight"),
+    blockHeaders(reg, "GetBlockHeaders"),
+    mainchainHeights(reg, "GetMainchainHeights"),
+    mempool(reg, "GetMempool"),
+    verifyMessage(reg, "VerifyMessage"),
+    blocks(reg.GetCounter ("xayax_basechain_blocks_total",
+                           "Number of blocks returned from the base chain"))
+{}
+
+template <typename Fcn>
+  auto
+  InstrumentedChain::Measure (MethodMetrics& m, const Fcn& fcn)
+{
+  MetricsTimer timer(m.latency);
+  try
+    {
+      return fcn ();
+    }
+  catch (...)
+    {
+      m.errors.Inc ();
+      throw;
+    }
+}
+
+void
+InstrumentedChain::SetCallbacks (Callbacks* c)
+{
+  /* Just as with BlockCacheChain, the base chain will invoke the
+     callbacks directly.  */
+  base.SetCallbacks (c);
+}
+
+void
+InstrumentedChain::Start ()
+{
+  base.Start ();
+}
+
+bool
+InstrumentedChain::EnablePending ()
+{
+  return base.EnablePending ();
+}
+
+uint64_t
+InstrumentedChain::GetTipHeight ()
+{
+  return Measure (tipHeight, [this] ()
+    {
+      return base.GetTipHeight ();
+    });
+}
+
+std::vector<BlockData>
+InstrumentedChain::GetBlockRange (const uint64_t start, const uint64_t count)
+{
+  auto res = Measure (blockRange, [&] ()
+    {
+      return base.GetBlockRange (start, count);
+    });
+  blocks.Inc (res.size ());
+  return res;
+}
+
+bool
+InstrumentedChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  const bool res = Measure (blockByHash, [&] ()
+    {
+      return base.GetBlockByHash (hash, blk);
+    });
+  if (res)
+    blocks.Inc ();
+  return res;
+}
+
+int64_t
+InstrumentedChain::GetMainchainHeight (const std::string& hash)
+{
+  return Measure (mainchainHeight, [&] ()
+    {
+      return base.GetMainchainHeight (hash);
+    });
+}
+
+std::vector<BlockData>
+InstrumentedChain::GetBlockHeaders (const uint64_t start, const uint64_t count)
+{
+  return Measure (blockHeaders, [&] ()
+    {
+      return base.GetBlockHeaders (start, count);
+    });
+}
+
+std::vector<int64_t>
+InstrumentedChain::GetMainchainHeights (const std::vector<std::string>& hashes)
+{
+  return Measure (mainchainHeights, [&] ()
+    {
+      return base.GetMainchainHeights (hashes);
+    });
+}
+
+std::vector<std::string>
+InstrumentedChain::GetMempool ()
+{
+  return Measure (mempool, [this] ()
+    {
+      return base.GetMempool ();
+    });
+}
+
+bool
+InstrumentedChain::VerifyMessage (const std::string& msg,
+                                  const std::string& signature,
+                                  std::string& addr)
+{
+  return Measure (verifyMessage, [&] ()
+    {
+      return base.VerifyMessage (msg, signature, addr);
+    });
+}
+
+std::string
+InstrumentedChain::GetChain ()
+{
+  return base.GetChain ();
+}
+
+uint64_t
+InstrumentedChain::GetVersion ()
+{
+  return base.GetVersion ();
+}
+
+/* ************************************************************************** */
+
+} // namespace xayax
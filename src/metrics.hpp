@@ -0,0 +1,326 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_METRICS_HPP
+#define XAYAX_METRICS_HPP
+
+#include "basechain.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Labels of a metric, as name/value pairs.
+ */
+using MetricLabels = std::map<std::string, std::string>;
+
+/**
+ * A monotonically increasing counter.  Updating it is a single relaxed
+ * atomic operation, so that it can be used on hot paths.
+ */
+class MetricsCounter
+{
+
+private:
+
+  std::atomic<uint64_t> value;
+
+public:
+
+  MetricsCounter ()
+    : value(0)
+  {}
+
+  MetricsCounter (const MetricsCounter&) = delete;
+  void operator= (const MetricsCounter&) = delete;
+
+  void
+  Inc (const uint64_t n = 1)
+  {
+    value.fetch_add (n, std::memory_order_relaxed);
+  }
+
+  uint64_t
+  Get () const
+  {
+    return value.load (std::memory_order_relaxed);
+  }
+
+};
+
+/**
+ * A gauge, i.e. a value that can go up and down (like the current
+ * tip height).
+ */
+class MetricsGauge
+{
+
+private:
+
+  std::atomic<int64_t> value;
+
+public:
+
+  MetricsGauge ()
+    : value(0)
+  {}
+
+  MetricsGauge (const MetricsGauge&) = delete;
+  void operator= (const MetricsGauge&) = delete;
+
+  void
+  Set (const int64_t v)
+  {
+    value.store (v, std::memory_order_relaxed);
+  }
+
+  int64_t
+  Get () const
+  {
+    return value.load (std::memory_order_relaxed);
+  }
+
+};
+
+/**
+ * A histogram of observed values (e.g. latencies in seconds) with fixed
+ * bucket bounds.  Observing a value does a short linear scan over the
+ * bounds and a few relaxed atomic updates, without any locking.
+ */
+class MetricsHistogram
+{
+
+private:
+
+  /** The upper bounds (inclusive) of the buckets, in increasing order.  */
+  const std::vector<double> bounds;
+
+  /**
+   * Number of observations per bucket (not cumulative).  The last entry
+   * is for values above the largest bound.
+   */
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+
+  /** Sum of all observed values.  */
+  std::atomic<double> sum;
+
+public:
+
+  explicit MetricsHistogram (const std::vector<double>& b);
+
+  MetricsHistogram () = delete;
+  MetricsHistogram (const MetricsHistogram&) = delete;
+  void operator= (const MetricsHistogram&) = delete;
+
+  /**
+   * Records an observed value.
+   */
+  void Observe (double val);
+
+  const std::vector<double>&
+  GetBounds () const
+  {
+    return bounds;
+  }
+
+  /**
+   * Returns the cumulative counts for each bound (i.e. the number of
+   * observations less or equal to the bound), with a final entry for
+   * the total count.
+   */
+  std::vector<uint64_t> GetCumulativeCounts () const;
+
+  double
+  GetSum () const
+  {
+    return sum.load (std::memory_order_relaxed);
+  }
+
+};
+
+/**
+ * RAII helper that observes the time between its construction and
+ * destruction (in seconds) in a histogram.
+ */
+class MetricsTimer
+{
+
+private:
+
+  MetricsHistogram& hist;
+  const std::chrono::steady_clock::time_point start;
+
+public:
+
+  explicit MetricsTimer (MetricsHistogram& h)
+    : hist(h), start(std::chrono::steady_clock::now ())
+  {}
+
+  ~MetricsTimer ();
+
+  MetricsTimer () = delete;
+  MetricsTimer (const MetricsTimer&) = delete;
+  void operator= (const MetricsTimer&) = delete;
+
+};
+
+/**
+ * Registry of all metrics, which can render them in the Prometheus
+ * text exposition format.  Metrics are looked up (or created) by name and
+ * labels once, and the returned references stay valid for the lifetime
+ * of the registry.  Code instrumenting hot paths should keep these
+ * references around instead of looking them up each time.
+ *
+ * This class is thread-safe.
+ */
+class MetricsRegistry
+{
+
+private:
+
+  struct Family;
+
+  /** Lock for the families map.  */
+  mutable std::mutex mut;
+
+  /** All metric families by name.  */
+  std::map<std::string, std::unique_ptr<Family>> families;
+
+  /**
+   * Returns the family with the given name, creating it if needed.
+   * The type must match for existing families.  The caller must hold
+   * the lock.
+   */
+  Family& GetFamily (const std::string& name, const std::string& help,
+                     const std::string& type);
+
+public:
+
+  MetricsRegistry ();
+  ~MetricsRegistry ();
+
+  MetricsRegistry (const MetricsRegistry&) = delete;
+  void operator= (const MetricsRegistry&) = delete;
+
+  /**
+   * Returns the process-wide default registry, which is used by the
+   * instrumentation inside Xaya X.
+   */
+  static MetricsRegistry& Get ();
+
+  /**
+   * Default bucket bounds for latencies in seconds.
+   */
+  static const std::vector<double>& LatencyBuckets ();
+
+  /**
+   * Default bucket bounds for sizes (e.g. the number of blocks in a batch).
+   */
+  static const std::vector<double>& SizeBuckets ();
+
+  MetricsCounter& GetCounter (const std::string& name, const std::string& help,
+                              const MetricLabels& labels = {});
+  MetricsGauge& GetGauge (const std::string& name, const std::string& help,
+                          const MetricLabels& labels = {});
+  MetricsHistogram& GetHistogram (const std::string& name,
+                                  const std::string& help,
+                                  const MetricLabels& labels = {},
+                                  const std::vector<double>& bounds
+                                      = LatencyBuckets ());
+
+  /**
+   * Renders all metrics in the Prometheus text format.
+   */
+  std::string Render () const;
+
+};
+
+/**
+ * An implementation of BaseChain that wraps another one and records
+ * metrics (number of calls, errors and latency) for each method called
+ * on it, as well as the number of blocks returned from GetBlockRange
+ * and GetBlockByHash.  Asynchronous calls use the default implementation,
+ * so they are recorded like the corresponding synchronous calls.
+ */
+class InstrumentedChain : public BaseChain
+{
+
+private:
+
+  /** Metrics for one of the wrapped methods.  */
+  struct MethodMetrics
+  {
+
+    MetricsCounter& errors;
+    MetricsHistogram& latency;
+
+    explicit MethodMetrics (MetricsRegistry& reg, const std::string& method);
+
+  };
+
+  /** The underlying chain.  */
+  BaseChain& base;
+
+  MethodMetrics tipHeight;
+  MethodMetrics blockRange;
+  MethodMetrics blockByHash;
+  MethodMetrics mainchainHeight;
+  MethodMetrics blockHeaders;
+  MethodMetrics mainchainHeights;
+  MethodMetrics mempool;
+  MethodMetrics verifyMessage;
+
+  /** Number of blocks returned from GetBlockRange and GetBlockByHash.  */
+  MetricsCounter& blocks;
+
+  /**
+   * Runs the given call, recording its latency and whether it threw
+   * in the method's metrics.
+   */
+  template <typename Fcn>
+    static auto Measure (MethodMetrics& m, const Fcn& fcn);
+
+public:
+
+  /**
+   * Constructs the instance, using the given registry (or by default
+   * the process-wide one).
+   */
+  explicit InstrumentedChain (BaseChain& b);
+  explicit InstrumentedChain (BaseChain& b, MetricsRegistry& reg);
+
+  void SetCallbacks (Callbacks* c) override;
+
+  void Start () override;
+  bool EnablePending () override;
+  uint64_t GetTipHeight () override;
+  std::vector<BlockData> GetBlockRange (uint64_t start,
+                                        uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
+  int64_t GetMainchainHeight (const std::string& hash) override;
+  std::vector<BlockData> GetBlockHeaders (uint64_t start,
+                                          uint64_t count) override;
+  std::vector<int64_t> GetMainchainHeights (
+      const std::vector<std::string>& hashes) override;
+  std::vector<std::string> GetMempool () override;
+  bool VerifyMessage (const std::string& msg,
+                      const std::string& signature,
+                      std::string& addr) override;
+  std::string GetChain () override;
+  uint64_t GetVersion () override;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_METRICS_HPP
@@ -0,0 +1,215 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.hpp"
+
+#include "private/metricsserver.hpp"
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xayax
+{
+namespace
+{
+
+/* ************************************************************************** */
+
+using MetricsTests = testing::Test;
+
+TEST_F (MetricsTests, CounterAndGauge)
+{
+  MetricsRegistry reg;
+
+  auto& c = reg.GetCounter ("counter", "help");
+  c.Inc ();
+  c.Inc (41);
+  EXPECT_EQ (c.Get (), 42);
+  EXPECT_EQ (&reg.GetCounter ("counter", "help"), &c);
+  EXPECT_NE (&reg.GetCounter ("counter", "help", {{"a", "b"}}), &c);
+
+  auto& g = reg.GetGauge ("gauge", "help");
+  g.Set (10);
+  g.Set (-5);
+  EXPECT_EQ (g.Get (), -5);
+}
+
+TEST_F (MetricsTests, Histogram)
+{
+  MetricsHistogram h({1, 2, 5});
+  for (const double v : {0.5, 1.0, 1.5, 3.0, 10.0, 20.0})
+    h.Observe (v);
+
+  EXPECT_EQ (h.GetCumulativeCounts (), std::vector<uint64_t> ({2, 3, 4, 6}));
+  EXPECT_DOUBLE_EQ (h.GetSum (), 36.0);
+}
+
+TEST_F (MetricsTests, ConcurrentUpdates)
+{
+  MetricsRegistry reg;
+  auto& c = reg.GetCounter ("counter", "help");
+  auto& h = reg.GetHistogram ("hist", "help", {}, {1});
+
+  constexpr unsigned threads = 4;
+  constexpr unsigned perThread = 10'000;
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; ++i)
+    workers.emplace_back ([&] ()
+      {
+        for (unsigned j = 0; j < perThread; ++j)
+          {
+            c.Inc ();
+            h.Observe (0.5);
+          }
+      });
+  for (auto& w : workers)
+    w.join ();
+
+  EXPECT_EQ (c.Get (), threads * perThread);
+  EXPECT_EQ (h.GetCumulativeCounts ().back (), threads * perThread);
+  EXPECT_DOUBLE_EQ (h.GetSum (), threads * perThread * 0.5);
+}
+
+TEST_F (MetricsTests, Render)
+{
+  MetricsRegistry reg;
+  reg.GetCounter ("requests_total", "Number of requests",
+                  {{"method", "foo"}}).Inc (3);
+  reg.GetCounter ("requests_total", "Number of requests",
+                  {{"method", "b\"a\\r"}}).Inc ();
+  reg.GetGauge ("height", "Current height").Set (100);
+  auto& h = reg.GetHistogram ("latency_seconds", "Latency", {}, {0.001, 0.5});
+  h.Observe (0.25);
+  h.Observe (1);
+
+  EXPECT_EQ (reg.Render (), R"(# HELP height Current height
+# TYPE height gauge
+height 100
+# HELP latency_seconds Latency
+# TYPE latency_seconds histogram
+latency_seconds_bucket{le="0.001"} 0
+latency_seconds_bucket{le="0.5"} 1
+latency_seconds_bucket{le="+Inf"} 2
+latency_seconds_sum 1.25
+latency_seconds_count 2
+# HELP requests_total Number of requests
+# TYPE requests_total counter
+requests_total{method="b\"a\\r"} 1
+requests_total{method="foo"} 3
+)");
+}
+
+TEST_F (MetricsTests, ServerHandler)
+{
+  MetricsRegistry reg;
+  reg.GetGauge ("height", "Current height").Set (5);
+
+  std::string body;
+  EXPECT_EQ (MetricsServer::Handle (reg, "GET", "/metrics", body), 200);
+  EXPECT_EQ (body, reg.Render ());
+
+  EXPECT_EQ (MetricsServer::Handle (reg, "GET", "/other", body), 404);
+  EXPECT_EQ (MetricsServer::Handle (reg, "POST", "/metrics", body), 405);
+}
+
+/* ************************************************************************** */
+
+class InstrumentedChainTests : public testing::Test
+{
+
+protected:
+
+  TestBaseChain base;
+  MetricsRegistry reg;
+  InstrumentedChain chain;
+
+  InstrumentedChainTests ()
+    : chain(base, reg)
+  {
+    base.Start ();
+  }
+
+  /**
+   * Returns the number of recorded calls for a given method.
+   */
+  uint64_t
+  GetCalls (const std::string& method)
+  {
+    return reg.GetHistogram ("xayax_basechain_call_seconds", "",
+                             {{"method", method}})
+              .GetCumulativeCounts ().back ();
+  }
+
+  /**
+   * Returns the number of recorded errors for a given method.
+   */
+  uint64_t
+  GetErrors (const std::string& method)
+  {
+    return reg.GetCounter ("xayax_basechain_errors_total", "",
+                           {{"method", method}}).Get ();
+  }
+
+};
+
+TEST_F (InstrumentedChainTests, ForwardsAndCounts)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (10));
+  const auto branch = base.AttachBranch (genesis.hash, 5);
+
+  EXPECT_EQ (chain.GetTipHeight (), 15);
+  EXPECT_EQ (chain.GetBlockRange (10, 3).size (), 3);
+  EXPECT_EQ (chain.GetBlockRange (14, 10).size (), 2);
+  EXPECT_EQ (chain.GetMainchainHeight (branch[0].hash), 11);
+
+  EXPECT_EQ (GetCalls ("GetTipHeight"), 1);
+  EXPECT_EQ (GetCalls ("GetBlockRange"), 2);
+  EXPECT_EQ (GetCalls ("GetMainchainHeight"), 1);
+  EXPECT_EQ (GetCalls ("GetMempool"), 0);
+  EXPECT_EQ (reg.GetCounter ("xayax_basechain_blocks_total", "").Get (), 5);
+}
+
+TEST_F (InstrumentedChainTests, HeaderLookups)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (10));
+  const auto branch = base.AttachBranch (genesis.hash, 2);
+
+  EXPECT_EQ (chain.GetBlockHeaders (10, 5).size (), 3);
+  const std::vector<int64_t> expected = {12, -1};
+  EXPECT_EQ (chain.GetMainchainHeights ({branch[1].hash, "foo"}), expected);
+
+  EXPECT_EQ (GetCalls ("GetBlockHeaders"), 1);
+  EXPECT_EQ (GetCalls ("GetMainchainHeights"), 1);
+  EXPECT_EQ (GetCalls ("GetBlockRange"), 0);
+  EXPECT_EQ (reg.GetCounter ("xayax_basechain_blocks_total", "").Get (), 0);
+}
+
+TEST_F (InstrumentedChainTests, Errors)
+{
+  base.SetGenesis (base.NewGenesis (0));
+  base.SetShouldThrow (true);
+
+  EXPECT_THROW (chain.GetTipHeight (), std::exception);
+  EXPECT_THROW (chain.GetBlockRange (0, 1), std::exception);
+  EXPECT_EQ (GetCalls ("GetTipHeight"), 1);
+  EXPECT_EQ (GetErrors ("GetTipHeight"), 1);
+  EXPECT_EQ (GetErrors ("GetBlockRange"), 1);
+
+  base.SetShouldThrow (false);
+  chain.GetTipHeight ();
+  EXPECT_EQ (GetCalls ("GetTipHeight"), 2);
+  EXPECT_EQ (GetErrors ("GetTipHeight"), 1);
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,106 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/metricsserver.hpp"
+
+#include <microhttpd.h>
+
+#include <glog/logging.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstring>
+
+namespace xayax
+{
+
+namespace
+{
+
+/* Older versions of libmicrohttpd use int as the return type of
+   the request handler.  */
+#if MHD_VERSION < 0x00097002
+using MHD_Result = int;
+#endif
+
+/** Content type of the Prometheus text format.  */
+constexpr const char* CONTENT_TYPE = "text/plain; version=0.0.4";
+
+/**
+ * The request handler callback for libmicrohttpd.
+ */
+MHD_Result
+HandleRequest (void* cls, MHD_Connection* conn, const char* url,
+               const char* method, const char* version,
+               const char* upload, size_t* uploadSize, void** state)
+{
+  const auto& reg = *static_cast<const MetricsRegistry*> (cls);
+
+  std::string body;
+  const unsigned status = MetricsServer::Handle (reg, method, url, body);
+
+  MHD_Response* resp = MHD_create_response_from_buffer (
+      body.size (), const_cast<char*> (body.data ()), MHD_RESPMEM_MUST_COPY);
+  CHECK (resp != nullptr);
+  MHD_add_response_header (resp, MHD_HTTP_HEADER_CONTENT_TYPE, CONTENT_TYPE);
+  const auto res = MHD_queue_response (conn, status, resp);
+  MHD_destroy_response (resp);
+
+  return res;
+}
+
+} // anonymous namespace
+
+MetricsServer::MetricsServer (const MetricsRegistry& reg, const int port,
+                              const bool local)
+  : registry(reg)
+{
+  CHECK_GT (port, 0);
+  CHECK_LT (port, 1 << 16);
+
+  sockaddr_in addr;
+  std::memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons (port);
+  addr.sin_addr.s_addr = htonl (local ? INADDR_LOOPBACK : INADDR_ANY);
+
+  daemon = MHD_start_daemon (MHD_USE_INTERNAL_POLLING_THREAD, port,
+                             nullptr, nullptr,
+                             &HandleRequest,
+                             const_cast<MetricsRegistry*> (&registry),
+                             MHD_OPTION_SOCK_ADDR, &addr,
+                             MHD_OPTION_END);
+  CHECK (daemon != nullptr)
+      << "Failed to start metrics server on port " << port;
+
+  LOG (INFO) << "Serving metrics on port " << port;
+}
+
+MetricsServer::~MetricsServer ()
+{
+  MHD_stop_daemon (daemon);
+}
+
+unsigned
+MetricsServer::Handle (const MetricsRegistry& reg, const std::string& method,
+                       const std::string& url, std::string& body)
+{
+  if (url != "/metrics")
+    {
+      body = "not found\n";
+      return MHD_HTTP_NOT_FOUND;
+    }
+
+  if (method != MHD_HTTP_METHOD_GET)
+    {
+      body = "only GET is supported\n";
+      return MHD_HTTP_METHOD_NOT_ALLOWED;
+    }
+
+  body = reg.Render ();
+  return MHD_HTTP_OK;
+}
+
+} // namespace xayax
@@ -0,0 +1,604 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/movejson.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace xayax
+{
+
+namespace
+{
+
+/**
+ * Maximum nesting depth of arrays and objects that Univalue accepts.
+ */
+constexpr unsigned MAX_DEPTH = 512;
+
+/**
+ * Decodes UTF-8 and \u escapes in a string exactly like Univalue's
+ * JSONUTF8StringFilter does, producing the string that Univalue would
+ * hold for it.  In particular, this re-encodes all code points, and
+ * combines surrogate pairs (given as escapes or encoded in UTF-8).
+ */
+class Utf8Filter
+{
+
+private:
+
+  /** The output string.  */
+  std::string& out;
+
+  /** Set to false if we encountered an error.  */
+  bool valid = true;
+
+  /** Remaining bits of the current multi-byte sequence (if any).  */
+  unsigned state = 0;
+
+  /** The code point being decoded from a multi-byte sequence.  */
+  unsigned codepoint = 0;
+
+  /** An opened (and not yet closed) surrogate pair.  */
+  unsigned surpair = 0;
+
+  void
+  AppendCodepoint (const unsigned cp)
+  {
+    if (cp <= 0x7F)
+      out.push_back (static_cast<char> (cp));
+    else if (cp <= 0x7FF)
+      {
+        out.push_back (static_cast<char> (0xC0 | (cp >> 6)));
+        out.push_back (static_cast<char> (0x80 | (cp & 0x3F)));
+      }
+    else if (cp <= 0xFFFF)
+      {
+        out.push_back (static_cast<char> (0xE0 | (cp >> 12)));
+        out.push_back (static_cast<char> (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back (static_cast<char> (0x80 | (cp & 0x3F)));
+      }
+    else
+      {
+        CHECK_LE (cp, 0x1FFFFF);
+        out.push_back (static_cast<char> (0xF0 | (cp >> 18)));
+        out.push_back (static_cast<char> (0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back (static_cast<char> (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back (static_cast<char> (0x80 | (cp & 0x3F)));
+      }
+  }
+
+public:
+
+  explicit Utf8Filter (std::string& o)
+    : out(o)
+  {}
+
+  /**
+   * Processes a raw byte of the string.
+   */
+  void
+  PushByte (const unsigned char ch)
+  {
+    if (state == 0)
+      {
+        /* Note that plain ASCII characters are passed through directly,
+           even if a surrogate pair is open.  This matches Univalue.  */
+        if (ch < 0x80)
+          out.push_back (static_cast<char> (ch));
+        else if (ch < 0xC0)
+          valid = false;
+        else if (ch < 0xE0)
+          {
+            codepoint = (ch & 0x1F) << 6;
+            state = 6;
+          }
+        else if (ch < 0xF0)
+          {
+            codepoint = (ch & 0x0F) << 12;
+            state = 12;
+          }
+        else if (ch < 0xF8)
+          {
+            codepoint = (ch & 0x07) << 18;
+            state = 18;
+          }
+        else
+          valid = false;
+        return;
+      }
+
+    if ((ch & 0xC0) != 0x80)
+      valid = false;
+    state -= 6;
+    codepoint |= (ch & 0x3F) << state;
+    if (state == 0)
+      PushCodepoint (codepoint);
+  }
+
+  /**
+   * Processes a full code point, either decoded from UTF-8 or given
+   * as \u escape.
+   */
+  void
+  PushCodepoint (const unsigned cp)
+  {
+    if (state != 0)
+      valid = false;
+
+    if (cp >= 0xD800 && cp < 0xDC00)
+      {
+        if (surpair != 0)
+          valid = false;
+        else
+          surpair = cp;
+      }
+    else if (cp >= 0xDC00 && cp < 0xE000)
+      {
+        if (surpair != 0)
+          {
+            AppendCodepoint (0x10000
+                              | ((surpair - 0xD800) << 10)
+                              | (cp - 0xDC00));
+            surpair = 0;
+          }
+        else
+          valid = false;
+      }
+    else if (surpair != 0)
+      valid = false;
+    else
+      AppendCodepoint (cp);
+  }
+
+  /**
+   * Checks that the string can end in the current state, and returns
+   * whether or not the string was valid.
+   */
+  bool
+  Finalise ()
+  {
+    if (state != 0 || surpair != 0)
+      valid = false;
+    return valid;
+  }
+
+};
+
+/**
+ * The actual parser, which holds the current input position.
+ */
+class MoveJsonParser
+{
+
+private:
+
+  /** The current position in the input.  */
+  const char* pos;
+
+  /** The end of the input.  */
+  const char* const end;
+
+  /**
+   * Reader used to decode floating-point numbers (and integers that
+   * are too large).  We create it lazily, as it is not needed for most
+   * moves.  Using jsoncpp itself for this ensures that we get the exact
+   * same results for those edge cases.
+   */
+  std::unique_ptr<Json::CharReader> numberReader;
+
+  static bool
+  IsSpace (const char c)
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  static bool
+  IsDigit (const char c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  void
+  SkipSpace ()
+  {
+    while (pos < end && IsSpace (*pos))
+      ++pos;
+  }
+
+  /**
+   * Checks if the input continues with the given literal, and consumes
+   * it if it does.
+   */
+  bool
+  ConsumeLiteral (const char* lit)
+  {
+    const size_t len = std::strlen (lit);
+    if (static_cast<size_t> (end - pos) < len
+          || std::strncmp (pos, lit, len) != 0)
+      return false;
+
+    pos += len;
+    return true;
+  }
+
+  bool
+  ParseString (std::string& res)
+  {
+    CHECK (pos < end && *pos == '"');
+    ++pos;
+
+    res.clear ();
+    Utf8Filter filter(res);
+
+    while (true)
+      {
+        if (pos >= end || static_cast<unsigned char> (*pos) < 0x20)
+          return false;
+
+        if (*pos == '"')
+          {
+            ++pos;
+            break;
+          }
+
+        if (*pos != '\\')
+          {
+            filter.PushByte (*pos);
+            ++pos;
+            continue;
+          }
+
+        ++pos;
+        if (pos >= end)
+          return false;
+
+        switch (*pos)
+          {
+          case '"':
+            filter.PushByte ('"');
+            break;
+          case '\\':
+            filter.PushByte ('\\');
+            break;
+          case '/':
+            filter.PushByte ('/');
+            break;
+          case 'b':
+            filter.PushByte ('\b');
+            break;
+          case 'f':
+            filter.PushByte ('\f');
+            break;
+          case 'n':
+            filter.PushByte ('\n');
+            break;
+          case 'r':
+            filter.PushByte ('\r');
+            break;
+          case 't':
+            filter.PushByte ('\t');
+            break;
+
+          case 'u':
+            {
+              if (end - pos <= 5)
+                return false;
+
+              unsigned cp = 0;
+              for (unsigned i = 1; i <= 4; ++i)
+                {
+                  const char c = pos[i];
+                  cp <<= 4;
+                  if (c >= '0' && c <= '9')
+                    cp |= c - '0';
+                  else if (c >= 'a' && c <= 'f')
+                    cp |= c - 'a' + 10;
+                  else if (c >= 'A' && c <= 'F')
+                    cp |= c - 'A' + 10;
+                  else
+                    return false;
+                }
+
+              filter.PushCodepoint (cp);
+              pos += 4;
+              break;
+            }
+
+          default:
+            return false;
+          }
+        ++pos;
+      }
+
+    return filter.Finalise ();
+  }
+
+  /**
+   * Decodes a syntactically valid number token into a JSON value,
+   * the same way as jsoncpp would do it.
+   */
+  bool
+  DecodeNumber (const char* start, const char* tokenEnd, Json::Value& res)
+  {
+    /* This follows the logic of jsoncpp's decodeNumber:  Integers are
+       decoded directly if they fit into 64 bits, and everything else
+       is passed on as double.  */
+    const char* cur = start;
+    const bool negative = (*cur == '-');
+    if (negative)
+      ++cur;
+
+    constexpr auto posThreshold = Json::Value::maxLargestUInt / 10;
+    constexpr auto posLastDigit = Json::Value::maxLargestUInt % 10;
+    constexpr auto negThreshold
+        = Json::Value::LargestUInt (Json::Value::minLargestInt) / 10;
+    constexpr auto negLastDigit
+        = Json::Value::LargestUInt (Json::Value::minLargestInt) % 10;
+    const auto threshold = negative ? negThreshold : posThreshold;
+    const auto maxLastDigit = negative ? negLastDigit : posLastDigit;
+
+    bool isInteger = true;
+    Json::Value::LargestUInt value = 0;
+    while (cur < tokenEnd)
+      {
+        const char c = *cur++;
+        if (!IsDigit (c))
+          {
+            isInteger = false;
+            break;
+          }
+
+        const Json::Value::LargestUInt digit = c - '0';
+        if (value >= threshold
+              && (value > threshold || cur != tokenEnd
+                    || digit > maxLastDigit))
+          {
+            isInteger = false;
+            break;
+          }
+
+        value = value * 10 + digit;
+      }
+
+    if (isInteger)
+      {
+        if (negative)
+          {
+            const auto lastDigit = value % 10;
+            res = -Json::Value::LargestInt (value / 10) * 10
+                    - Json::Value::LargestInt (lastDigit);
+          }
+        else if (value <= Json::Value::LargestUInt (Json::Value::maxLargestInt))
+          res = Json::Value::LargestInt (value);
+        else
+          res = value;
+        return true;
+      }
+
+    if (numberReader == nullptr)
+      {
+        Json::CharReaderBuilder rbuilder;
+        numberReader.reset (rbuilder.newCharReader ());
+      }
+
+    std::string errs;
+    return numberReader->parse (start, tokenEnd, &res, &errs);
+  }
+
+  bool
+  ParseNumber (Json::Value& res)
+  {
+    const char* start = pos;
+
+    if (*pos == '-')
+      {
+        ++pos;
+        if (pos >= end || !IsDigit (*pos))
+          return false;
+      }
+
+    if (*pos == '0' && pos + 1 < end && IsDigit (pos[1]))
+      return false;
+    while (pos < end && IsDigit (*pos))
+      ++pos;
+
+    if (pos < end && *pos == '.')
+      {
+        ++pos;
+        if (pos >= end || !IsDigit (*pos))
+          return false;
+        while (pos < end && IsDigit (*pos))
+          ++pos;
+      }
+
+    if (pos < end && (*pos == 'e' || *pos == 'E'))
+      {
+        ++pos;
+        if (pos < end && (*pos == '-' || *pos == '+'))
+          ++pos;
+        if (pos >= end || !IsDigit (*pos))
+          return false;
+        while (pos < end && IsDigit (*pos))
+          ++pos;
+      }
+
+    return DecodeNumber (start, pos, res);
+  }
+
+  bool
+  ParseObject (Json::Value& res, const unsigned depth)
+  {
+    CHECK (pos < end && *pos == '{');
+    ++pos;
+
+    if (depth > MAX_DEPTH)
+      return false;
+
+    res = Json::Value (Json::objectValue);
+
+    SkipSpace ();
+    if (pos < end && *pos == '}')
+      {
+        ++pos;
+        return true;
+      }
+
+    std::string key;
+    while (true)
+      {
+        SkipSpace ();
+        if (pos >= end || *pos != '"' || !ParseString (key))
+          return false;
+
+        SkipSpace ();
+        if (pos >= end || *pos != ':')
+          return false;
+        ++pos;
+
+        /* Univalue itself allows duplicate keys, but when they are passed
+           on to jsoncpp, we reject them.  */
+        if (res.isMember (key))
+          return false;
+
+        if (!ParseValue (res[key], depth))
+          return false;
+
+        SkipSpace ();
+        if (pos >= end)
+          return false;
+        if (*pos == '}')
+          {
+            ++pos;
+            return true;
+          }
+        if (*pos != ',')
+          return false;
+        ++pos;
+      }
+  }
+
+  bool
+  ParseArray (Json::Value& res, const unsigned depth)
+  {
+    CHECK (pos < end && *pos == '[');
+    ++pos;
+
+    if (depth > MAX_DEPTH)
+      return false;
+
+    res = Json::Value (Json::arrayValue);
+
+    SkipSpace ();
+    if (pos < end && *pos == ']')
+      {
+        ++pos;
+        return true;
+      }
+
+    while (true)
+      {
+        if (!ParseValue (res.append (Json::Value ()), depth))
+          return false;
+
+        SkipSpace ();
+        if (pos >= end)
+          return false;
+        if (*pos == ']')
+          {
+            ++pos;
+            return true;
+          }
+        if (*pos != ',')
+          return false;
+        ++pos;
+      }
+  }
+
+public:
+
+  explicit MoveJsonParser (const std::string& str)
+    : pos(str.data ()), end(str.data () + str.size ())
+  {}
+
+  MoveJsonParser () = delete;
+  MoveJsonParser (const MoveJsonParser&) = delete;
+  void operator= (const MoveJsonParser&) = delete;
+
+  /**
+   * Parses a value at the current position.  The depth is the number
+   * of arrays and objects the value is nested in.
+   */
+  bool
+  ParseValue (Json::Value& res, const unsigned depth)
+  {
+    SkipSpace ();
+    if (pos >= end)
+      return false;
+
+    switch (*pos)
+      {
+      case '{':
+        return ParseObject (res, depth + 1);
+      case '[':
+        return ParseArray (res, depth + 1);
+
+      case '"':
+        {
+          std::string str;
+          if (!ParseString (str))
+            return false;
+          res = str;
+          return true;
+        }
+
+      case 'n':
+        res = Json::Value ();
+        return ConsumeLiteral ("null");
+      case 't':
+        res = true;
+        return ConsumeLiteral ("true");
+      case 'f':
+        res = false;
+        return ConsumeLiteral ("false");
+
+      default:
+        if (*pos == '-' || IsDigit (*pos))
+          return ParseNumber (res);
+        return false;
+      }
+  }
+
+  /**
+   * Returns true if there is only whitespace left in the input.
+   */
+  bool
+  AtEnd ()
+  {
+    SkipSpace ();
+    return pos == end;
+  }
+
+};
+
+} // anonymous namespace
+
+bool
+ReadMoveJson (const std::string& str, Json::Value& val)
+{
+  MoveJsonParser parser(str);
+
+  Json::Value res;
+  if (!parser.ParseValue (res, 0) || !parser.AtEnd () || !res.isObject ())
+    return false;
+
+  val = std::move (res);
+  return true;
+}
+
+} // namespace xayax
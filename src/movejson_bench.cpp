@@ -0,0 +1,95 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/movejson.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <glog/logging.h>
+
+#include <string>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * Parses typical player moves.
+ */
+void
+BM_ReadMoveJsonTypical (benchmark::State& state)
+{
+  BlockGenerator gen;
+  std::vector<std::string> moves;
+  for (unsigned i = 0; i < 100; ++i)
+    moves.push_back (gen.NewMove ().mv);
+
+  size_t bytes = 0;
+  for (auto _ : state)
+    for (const auto& mv : moves)
+      {
+        Json::Value val;
+        CHECK (ReadMoveJson (mv, val));
+        benchmark::DoNotOptimize (val);
+        bytes += mv.size ();
+      }
+
+  state.SetBytesProcessed (bytes);
+  state.SetItemsProcessed (state.iterations () * moves.size ());
+}
+BENCHMARK (BM_ReadMoveJsonTypical);
+
+/**
+ * Parses a large move, which has an array with the number of elements
+ * given as argument (e.g. a big admin command or batched move).
+ */
+void
+BM_ReadMoveJsonLarge (benchmark::State& state)
+{
+  std::string mv = R"({"g":{"game":{"data":[)";
+  for (int64_t i = 0; i < state.range (0); ++i)
+    {
+      if (i > 0)
+        mv += ",";
+      mv += R"({"id":)" + std::to_string (i) + R"(,"name":"item ä"})";
+    }
+  mv += "]}}}";
+
+  for (auto _ : state)
+    {
+      Json::Value val;
+      CHECK (ReadMoveJson (mv, val));
+      benchmark::DoNotOptimize (val);
+    }
+
+  state.SetBytesProcessed (state.iterations () * mv.size ());
+}
+BENCHMARK (BM_ReadMoveJsonLarge)->Arg (10)->Arg (1'000)->Arg (100'000);
+
+/**
+ * Rejects an invalid move (with a duplicate key at the very end),
+ * which requires scanning all of it.
+ */
+void
+BM_ReadMoveJsonInvalid (benchmark::State& state)
+{
+  BlockGenerator gen;
+  std::string mv = gen.NewMove ().mv;
+  mv.pop_back ();
+  mv += R"(,"g":{}})";
+
+  for (auto _ : state)
+    {
+      Json::Value val;
+      CHECK (!ReadMoveJson (mv, val));
+      benchmark::DoNotOptimize (val);
+    }
+}
+BENCHMARK (BM_ReadMoveJsonInvalid);
+
+} // anonymous namespace
+} // namespace xayax
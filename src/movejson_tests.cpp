@@ -0,0 +1,242 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/movejson.hpp"
+
+#include <univalue.h>
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * The original implementation of move parsing, which filters the data
+ * through Univalue, serialises it again and then parses it with jsoncpp.
+ * The new parser must give the exact same results.
+ */
+bool
+LegacyReadMoveJson (const std::string& str, Json::Value& val)
+{
+  UniValue value;
+  if (!value.read (str) || !value.isObject ())
+    return false;
+  const std::string filtered = value.write ();
+
+  Json::CharReaderBuilder rbuilder;
+  rbuilder["allowComments"] = false;
+  rbuilder["strictRoot"] = true;
+  rbuilder["failIfExtra"] = true;
+  rbuilder["rejectDupKeys"] = true;
+
+  std::string parseErrs;
+  std::istringstream in(filtered);
+  return Json::parseFromStream (rbuilder, in, &val, &parseErrs);
+}
+
+/**
+ * Checks that the new and legacy implementation agree on the given input.
+ * Returns whether or not the input is valid.
+ */
+bool
+ExpectSameResult (const std::string& str)
+{
+  Json::Value expected;
+  const bool expectedValid = LegacyReadMoveJson (str, expected);
+
+  Json::Value actual;
+  const bool actualValid = ReadMoveJson (str, actual);
+
+  EXPECT_EQ (actualValid, expectedValid) << "Mismatch for input:\n" << str;
+  if (expectedValid && actualValid)
+    {
+      EXPECT_EQ (actual, expected) << "Mismatch for input:\n" << str;
+    }
+
+  return actualValid;
+}
+
+/* ************************************************************************** */
+
+using MoveJsonTests = testing::Test;
+
+TEST_F (MoveJsonTests, Valid)
+{
+  for (const std::string& str : std::vector<std::string> {
+    "{}",
+    "  {}\n\t\r ",
+    R"({"foo": 42, "bar": [1, 2.5, -3e2, true, false, null, "x"]})",
+    R"({"g": {"game": {"x": {"y": [{}, []]}}}})",
+    R"({"": 0, "a": "", "b": "ä😀\"\\\/\b\f\n\r\t"})",
+    R"({"num": -0, "big": 18446744073709551615, "neg": -9223372036854775808})",
+    "{\"raw\": \"\xc3\xa4\xf0\x9f\x98\x80\x7f\"}",
+  })
+    EXPECT_TRUE (ExpectSameResult (str)) << str;
+}
+
+TEST_F (MoveJsonTests, Invalid)
+{
+  for (const std::string& str : std::vector<std::string> {
+    "",
+    "   ",
+    "[]",
+    "42",
+    "\"foo\"",
+    "null",
+    "{} {}",
+    "{},",
+    "{",
+    "}",
+    R"({"a": 1,})",
+    R"({"a"})",
+    R"({"a": })",
+    R"({"a" 1})",
+    R"({a: 1})",
+    R"({'a': 1})",
+    R"({"a": 1 /* comment */})",
+    R"({"a": [1, 2,]})",
+    R"({"a": [,]})",
+    R"({"a": 01})",
+    R"({"a": -})",
+    R"({"a": 1.})",
+    R"({"a": .5})",
+    R"({"a": 1e})",
+    R"({"a": +1})",
+    R"({"a": NaN})",
+    R"({"a": nul})",
+    R"({"a": True})",
+    R"({"a": "\x"})",
+    R"({"a": "\u12"})",
+    R"({"a": "\ud800"})",
+    R"({"a": "\udc00"})",
+    R"({"a": "\ud800\ud800"})",
+    R"({"a": 1, "a": 2})",
+    R"({"x": {"a": 1, "b": 2, "a": 3}})",
+    "{\"a\": \"\n\"}",
+    "{\"a\": \"\xc3\"}",
+    "{\"a\": \"\x80\"}",
+    "{\"a\": \"\xff\"}",
+    std::string ("{\"a\": 1}\0", 9),
+  })
+    EXPECT_FALSE (ExpectSameResult (str)) << str;
+}
+
+TEST_F (MoveJsonTests, Quirks)
+{
+  /* These are special cases where Univalue's behaviour is not necessarily
+     what one would expect.  We still need to match it exactly.  */
+  for (const std::string& str : std::vector<std::string> {
+    R"({"a": "\ud800x\udc00"})",
+    "{\"a\": \"\xed\xa0\xbd\xed\xb8\x80\"}",
+    "{\"a\": \"\xc0\x80\"}",
+    "{\"a\": \"\xf7\xbf\xbf\xbf\"}",
+    R"({"a": "\u0000", "a\u0000": 1})",
+    R"({"overflow": 18446744073709551616})",
+    R"({"tiny": 1e-400})",
+    R"({"huge": 1E+400, "negative": -1e400})",
+  })
+    ExpectSameResult (str);
+}
+
+TEST_F (MoveJsonTests, NestingDepth)
+{
+  const auto nested = [] (const unsigned depth)
+    {
+      std::string res;
+      for (unsigned i = 1; i < depth; ++i)
+        res += "{\"a\":";
+      res += "[]";
+      for (unsigned i = 1; i < depth; ++i)
+        res += "}";
+      return res;
+    };
+
+  EXPECT_TRUE (ExpectSameResult (nested (512)));
+  EXPECT_FALSE (ExpectSameResult (nested (513)));
+  EXPECT_FALSE (ExpectSameResult (nested (10'000)));
+}
+
+/**
+ * Randomly mutates a given string.
+ */
+std::string
+Mutate (std::mt19937& rnd, std::string str)
+{
+  static const std::string fragments[] = {
+    "{", "}", "[", "]", ":", ",", "\"", "\\", " ", "\n",
+    "0", "1", "-", ".", "e", "E", "+",
+    "null", "true", "false", "nul",
+    "\\u", "\\ud800", "\\udc00", "\\u0000", "\\n", "\\\"", "\\/",
+    "\xc3", "\xa4", "\xed\xa0\x80", "\xf0\x9f\x98\x80", "\xff", "\x7f",
+    "\"a\":1,", "\"a\"", "[[", "]]", "9223372036854775808", "1e400",
+  };
+  constexpr size_t numFragments = sizeof (fragments) / sizeof (fragments[0]);
+
+  const unsigned numMutations = 1 + rnd () % 4;
+  for (unsigned i = 0; i < numMutations; ++i)
+    {
+      const size_t pos = str.empty () ? 0 : rnd () % (str.size () + 1);
+      switch (rnd () % 4)
+        {
+        case 0:
+          str.insert (pos, fragments[rnd () % numFragments]);
+          break;
+        case 1:
+          if (pos < str.size ())
+            str.erase (pos, 1 + rnd () % 3);
+          break;
+        case 2:
+          if (pos < str.size ())
+            str[pos] = static_cast<char> (rnd () % 256);
+          break;
+        case 3:
+          str.insert (pos, 1, static_cast<char> (rnd () % 256));
+          break;
+        }
+    }
+
+  return str;
+}
+
+TEST_F (MoveJsonTests, Fuzzed)
+{
+  const std::vector<std::string> seeds = {
+    "{}",
+    R"({"g": {"game": {"foo": 42, "bar": [1, 2, 3]}}})",
+    R"({"cmd": {"x": null, "y": true, "z": false}, "g": {}})",
+    R"({"a": "ä😀 text", "b": -1.5e10, "c": 0})",
+    R"({"n": [18446744073709551615, -9223372036854775808, 1e400]})",
+    "{\"s\": \"\xc3\xa4\xf0\x9f\x98\x80\"}",
+  };
+
+  std::mt19937 rnd(42);
+  unsigned numValid = 0;
+  constexpr unsigned trials = 50'000;
+  for (unsigned i = 0; i < trials; ++i)
+    {
+      const auto& seed = seeds[rnd () % seeds.size ()];
+      if (ExpectSameResult (Mutate (rnd, seed)))
+        ++numValid;
+    }
+
+  /* Make sure that the fuzzing actually produces a mix of valid
+     and invalid inputs.  */
+  LOG (INFO) << "Valid fuzzed inputs: " << numValid << " / " << trials;
+  EXPECT_GT (numValid, trials / 50);
+  EXPECT_LT (numValid, trials - trials / 50);
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,118 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_BLOCKDATAVIEW_HPP
+#define XAYAX_BLOCKDATAVIEW_HPP
+
+#include "blockdata.hpp"
+#include "proto/blockdata.pb.h"
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace xayax
+{
+
+/**
+ * A read-only view of a serialised BlockData instance.  Parsing the
+ * serialised bytes only decodes the protocol buffer, while the JSON fields
+ * (block metadata, and per-move metadata and burns) are only parsed when
+ * actually accessed.  This is useful when reading blocks from storage
+ * but only needing some of their data, e.g. the block header.
+ *
+ * Instances are not thread-safe (even for reading, as accessing the
+ * JSON fields may parse them).
+ */
+class BlockDataView
+{
+
+private:
+
+  /** The underlying protocol buffer data.  */
+  proto::Block pb;
+
+  /** The block metadata, once parsed.  */
+  mutable std::optional<Json::Value> metadata;
+
+public:
+
+  /**
+   * Constructs the view by parsing the given serialised data.  CHECK fails
+   * if it is invalid.  The data is not referenced after construction,
+   * so it can e.g. point into memory owned by a database transaction.
+   */
+  explicit BlockDataView (std::string_view data);
+
+  BlockDataView () = delete;
+  BlockDataView (const BlockDataView&) = delete;
+  void operator= (const BlockDataView&) = delete;
+
+  const std::string&
+  GetHash () const
+  {
+    return pb.hash ();
+  }
+
+  const std::string&
+  GetParent () const
+  {
+    return pb.parent ();
+  }
+
+  uint64_t
+  GetHeight () const
+  {
+    return pb.height ();
+  }
+
+  const std::string&
+  GetRngSeed () const
+  {
+    return pb.rngseed ();
+  }
+
+  /**
+   * Returns the block metadata, parsing it on first access.
+   */
+  const Json::Value& GetMetadata () const;
+
+  size_t
+  GetNumMoves () const
+  {
+    return pb.moves_size ();
+  }
+
+  /**
+   * Returns the raw (unparsed) move data of the i-th move.
+   */
+  const std::string&
+  GetRawMove (const size_t i) const
+  {
+    return pb.moves (i).mv ();
+  }
+
+  /**
+   * Materialises the i-th move, including its JSON fields.
+   */
+  MoveData GetMove (size_t i) const;
+
+  /**
+   * Returns the game index stored with the block, if any.
+   */
+  std::optional<BlockData::GameIndex> GetGameIndex () const;
+
+  /**
+   * Materialises the full BlockData instance.
+   */
+  BlockData ToBlockData () const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_BLOCKDATAVIEW_HPP
@@ -6,10 +6,14 @@
 #define XAYAX_CHAINSTATE_HPP
 
 #include "blockdata.hpp"
-#include "private/database.hpp"
+#include "database.hpp"
 
 #include <cstdint>
+#include <map>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace xayax
 {
@@ -38,8 +42,18 @@ namespace xayax
  * chain following some fork point as on a branch, detect the fork point
  * for a given block to the main chain) with simple database queries.
  *
+ * The header data of all blocks in the database (heights, branches and
+ * parents) is also kept in an in-memory index, so that the frequent
+ * lookups done during syncing and by RPC methods do not need to
+ * query the database.
+ *
  * As with the database, this class is not thread-safe and must be externally
- * synchronised as needed.
+ * synchronised as needed.  The exception are GetTipHeight,
+ * GetLowestUnprunedHeight, GetHashForHeight and GetHeightForHash, which
+ * only read from the in-memory index, as well as GetChain, GetMainchainData
+ * and GetMainchainRange, which serialise their database reads internally.
+ * They may be called in parallel with each other (e.g. under a shared lock),
+ * just not concurrently to any modification.
  */
 class Chainstate : private Database
 {
@@ -48,10 +62,126 @@ public:
 
   class UpdateBatch;
 
+private:
+
+  /**
+   * Header data about a block we have in the database, which is kept in
+   * our in-memory index.
+   */
+  struct IndexEntry
+  {
+
+    /** The block's height.  */
+    uint64_t height;
+
+    /** The branch the block is on.  */
+    uint64_t branch;
+
+    /** The block's parent hash.  */
+    std::string parent;
+
+  };
+
+  /**
+   * Height to hash of all blocks on the main chain (branch zero) that we
+   * have in the database.  This is a write-through cache of what is in
+   * the database, so that many common queries can be answered without
+   * going to SQLite at all.
+   */
+  std::map<uint64_t, std::string> mainchain;
+
+  /**
+   * Header data for all blocks (on all branches) that are in the database,
+   * keyed by hash.  Like mainchain, this mirrors the database state.
+   */
+  std::unordered_map<std::string, IndexEntry> index;
+
+  /**
+   * The next free branch number.  This mirrors the value persisted
+   * in the variables table.
+   */
+  uint64_t nextBranch;
+
+  /**
+   * Lock for the database reads done by the read-only methods that may be
+   * called concurrently (see the class comment).  They share the SQLite
+   * connection and its statement cache.
+   */
+  mutable std::mutex mutDbRead;
+
+  /** Number of currently open (nested) update batches.  */
+  unsigned openBatches = 0;
+
+  /**
+   * Number of committed outermost update batches since the WAL was
+   * last checkpointed by us.
+   */
+  unsigned batchesSinceCheckpoint = 0;
+
+  /**
+   * Interval (in committed update batches) at which we checkpoint the WAL.
+   * Zero if we leave that to SQLite.
+   */
+  unsigned checkpointInterval = 0;
+
+  /**
+   * Cutoff height used by the last garbage collection of stale branches,
+   * or -1 if none has run since opening the database.
+   */
+  int64_t lastGcCutoff = -1;
+
+  /**
+   * Set to true if the last garbage collection hit its work limit,
+   * i.e. there may still be stale branches below the cutoff.
+   */
+  bool gcPending = false;
+
+  /**
+   * Reconstructs the in-memory index from the database.  This is done
+   * at startup, and also if a batch update is rolled back.
+   */
+  void RebuildIndex ();
+
+  /**
+   * Inserts a block into the database and the index.
+   */
+  void InsertBlock (const BlockData& blk, uint64_t branch);
+
+  /**
+   * Returns a fresh branch number to use, and updates the persisted
+   * branch counter accordingly.
+   */
+  uint64_t AllocateBranch ();
+
+  /**
+   * Moves all main-chain blocks at or above the given height onto
+   * a new branch, in the database and the index.
+   */
+  void DetachFromMainchain (uint64_t fromHeight);
+
+  /**
+   * Marks the given block as current tip, assuming it already exists.
+   */
+  void MarkAsTip (const BlockData& blk);
+
+  /**
+   * Removes side branches that can no longer be reconnected to the
+   * unpruned main chain (because the block they fork off has been pruned
+   * or removed itself), and whose highest block is at or below the
+   * given cutoff height.  At most the number of branches given by
+   * --xayax_chainstate_branch_gc_limit are removed per call.
+   */
+  void CollectStaleBranches (uint64_t cutoff);
+
+public:
+
   /**
    * Constructs the instance, using the given file as underlying SQLite
    * database for state storage.  The file is created as a new database
    * if it does not yet exist.
+   *
+   * The durability / performance profile of the database is configured
+   * through the --xayax_chainstate_* flags.
    */
   explicit Chainstate (const std::string& file);
 
@@ -63,6 +193,12 @@ public:
    */
   void SetChain (const std::string& chain);
 
+  /**
+   * Returns the chain string recorded in the local database, or the empty
+   * string if none is set yet.
+   */
+  std::string GetChain () const;
+
   /**
    * Returns the block height of the best chain.  If there is no block
    * set yet at all, returns -1.
@@ -110,6 +246,27 @@ public:
    */
   bool SetTip (const BlockData& blk, std::string& oldTip);
 
+  /**
+   * Attaches a range of new blocks that extend the current tip linearly,
+   * i.e. the first block's parent is the current tip, and each following
+   * block builds on the previous one.  This is equivalent to calling SetTip
+   * for each block in turn, but much more efficient (e.g. during catch-up),
+   * as the blocks are inserted directly onto the main chain in a single
+   * batch, without any branch bookkeeping.
+   *
+   * If the blocks are not a linear extension of the current tip
+   * (or if any of them is already known), false is returned and
+   * nothing is changed.  The caller should then fall back to SetTip.
+   */
+  bool AttachLinearRange (const std::vector<BlockData>& blocks);
+
+  /**
+   * Attaches a linear range of blocks given as a pair of iterators.
+   * This avoids copying out a sub-range of a vector just for the call.
+   */
+  bool AttachLinearRange (std::vector<BlockData>::const_iterator begin,
+                          std::vector<BlockData>::const_iterator end);
+
   /**
    * Determines the fork point and branch that connects a given block (by hash)
    * to the current main chain.  Returns false if the given block hash is
@@ -124,13 +281,52 @@ public:
   bool GetForkBranch (const std::string& hash,
                       std::vector<BlockData>& branch) const;
 
+  /**
+   * Returns the fork branch like GetForkBranch, but only with the header
+   * data (hash, parent and height) filled in for the blocks.  This is
+   * answered from the in-memory index, without reading the block data
+   * from the database.
+   */
+  bool GetForkBranchHeaders (const std::string& hash,
+                             std::vector<BlockData>& branch) const;
+
   /**
    * Prunes all data of blocks on the main chain at or below the given height.
    * This in essence asserts that those blocks will certainly not end up on a
    * reorg in the future.
+   *
+   * Side branches forking off pruned blocks are still kept for a while
+   * (--xayax_chainstate_branch_retention blocks), so that GSPs on them
+   * can be detached.  After that, they are garbage collected incrementally
+   * as part of pruning.
    */
   void Prune (uint64_t untilHeight);
 
+  /**
+   * Releases up to the given number of free database pages (e.g. from
+   * pruned blocks) back to the file system, and returns the number of free
+   * pages remaining.  This has no effect if incremental auto-vacuum is not
+   * enabled.  It is done in bounded steps, so that callers can release the
+   * chain lock in between.
+   */
+  uint64_t Vacuum (unsigned pages);
+
+  /**
+   * Returns the serialised data (as stored, see BlockData::Serialise) of all
+   * unpruned blocks on the main chain, in order of increasing height.
+   * This is used to export snapshots of the state.
+   */
+  std::vector<std::string> GetMainchainData () const;
+
+  /**
+   * Returns the serialised data (as stored) of the unpruned main-chain
+   * blocks with heights in [start, start + count), in order of increasing
+   * height.  Heights that are pruned or above the tip are skipped, so the
+   * result may be shorter than count.
+   */
+  std::vector<std::string> GetMainchainRange (uint64_t start,
+                                              uint64_t count) const;
+
   /**
    * Runs a sanity check on the stored state, verifying some assumed conditions.
    * Aborts if anything is wrong.  This method can take a long time, and is
@@ -157,6 +353,13 @@ private:
   /** Set to true if the update has been committed.  */
   bool committed = false;
 
+  /**
+   * The branch GC state of the chainstate when the batch was opened,
+   * which is restored if the batch is rolled back.
+   */
+  int64_t oldGcCutoff;
+  bool oldGcPending;
+
 public:
 
   explicit UpdateBatch (Chainstate& p);
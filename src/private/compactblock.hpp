@@ -0,0 +1,202 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_COMPACTBLOCK_HPP
+#define XAYAX_COMPACTBLOCK_HPP
+
+#include "blockdata.hpp"
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Compact, flattened representation of a BlockData instance for blocks that
+ * are held in memory for a longer time (e.g. in a cache).  A BlockData needs
+ * several small heap allocations per move (strings, the burns map and the
+ * metadata JSON trees).  Here, all string data of the block is instead kept
+ * in a single arena buffer, which is referenced by offsets:
+ *
+ *  - Namespaces and game IDs are interned within the block, so that each
+ *    distinct value is only stored once.
+ *  - Burns are a sorted vector per move rather than a map.
+ *  - JSON values (block and move metadata, burns) are kept in their
+ *    serialised form (as with StoreJson), and only parsed when needed.
+ *
+ * If the block's serialised form is cached (BlockData::serialised), it is
+ * kept as well and passed on by ToBlockData.  That way, blocks retrieved
+ * from the compact form need not be serialised (and compressed) again
+ * e.g. when they are stored in the chainstate.
+ *
+ * Instances are immutable after construction and can be read from multiple
+ * threads at the same time.
+ */
+class CompactBlock
+{
+
+private:
+
+  /** Reference to a string inside the arena.  */
+  struct Span
+  {
+    uint32_t offset = 0;
+    uint32_t size = 0;
+  };
+
+  /** Data about a move.  */
+  struct Move
+  {
+    Span txid;
+    Span ns;
+    Span name;
+    Span mv;
+    Span metadata;
+
+    /** Index of the first burn of this move in burns.  */
+    uint32_t firstBurn = 0;
+    /** Number of burns of this move.  */
+    uint32_t numBurns = 0;
+  };
+
+  /** A burn of some move for a game.  */
+  struct Burn
+  {
+    Span game;
+    Span value;
+  };
+
+  /** The moves of a game in the game index.  */
+  struct IndexEntry
+  {
+    Span game;
+
+    /** Index of the first move index in indexMoves.  */
+    uint32_t first = 0;
+    /** Number of the game's moves.  */
+    uint32_t num = 0;
+  };
+
+  class Builder;
+
+  /** Buffer holding all the string data.  */
+  std::string arena;
+
+  uint64_t height = 0;
+  Span hash;
+  Span parent;
+  Span rngseed;
+  Span metadata;
+
+  std::vector<Move> moves;
+
+  /** The burns of all moves, sorted by game within each move.  */
+  std::vector<Burn> burns;
+
+  /** Whether the block has a game index.  */
+  bool hasGameIndex = false;
+
+  /** The game index entries, sorted by game.  */
+  std::vector<IndexEntry> gameIndex;
+
+  /** The move indices referenced by gameIndex.  */
+  std::vector<uint32_t> indexMoves;
+
+  /** The cached serialised form of the block, if any.  */
+  std::shared_ptr<const std::string> serialised;
+
+  /**
+   * Returns the string referenced by a span.
+   */
+  std::string_view
+  Get (const Span& s) const
+  {
+    return std::string_view (arena.data () + s.offset, s.size);
+  }
+
+public:
+
+  /**
+   * Constructs the compact form of a given block.
+   */
+  explicit CompactBlock (const BlockData& blk);
+
+  CompactBlock (CompactBlock&&) = default;
+  CompactBlock& operator= (CompactBlock&&) = default;
+
+  CompactBlock () = delete;
+  CompactBlock (const CompactBlock&) = delete;
+  void operator= (const CompactBlock&) = delete;
+
+  std::string_view
+  GetHash () const
+  {
+    return Get (hash);
+  }
+
+  std::string_view
+  GetParent () const
+  {
+    return Get (parent);
+  }
+
+  uint64_t
+  GetHeight () const
+  {
+    return height;
+  }
+
+  size_t
+  GetNumMoves () const
+  {
+    return moves.size ();
+  }
+
+  /**
+   * Returns the raw (unparsed) move data of the i-th move.
+   */
+  std::string_view
+  GetRawMove (const size_t i) const
+  {
+    return Get (moves[i].mv);
+  }
+
+  /**
+   * Returns the burns of the i-th move as pairs of game ID and the
+   * serialised JSON value, sorted by game ID.
+   */
+  std::vector<std::pair<std::string_view, std::string_view>> GetBurns (
+      size_t i) const;
+
+  /**
+   * Materialises the i-th move, including its JSON fields.
+   */
+  MoveData GetMove (size_t i) const;
+
+  /**
+   * Materialises the full BlockData instance.  This parses the JSON fields,
+   * but shares the cached serialised form (if any) instead of computing
+   * it again later.
+   */
+  BlockData ToBlockData () const;
+
+  /**
+   * Returns the approximate number of bytes of memory used by
+   * this instance.
+   */
+  size_t GetMemoryUsage () const;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_COMPACTBLOCK_HPP
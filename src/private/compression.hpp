@@ -0,0 +1,42 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_COMPRESSION_HPP
+#define XAYAX_COMPRESSION_HPP
+
+#include <string>
+#include <string_view>
+
+namespace xayax
+{
+
+/**
+ * Applies the configured compression (if any) to the raw serialised data
+ * of a block.  If compression is enabled, the result is a zero byte
+ * (which can never start a valid protocol buffer) followed by a format
+ * version byte and the compressed payload.  If it is disabled, the
+ * data is returned as is; this is also the format of blocks stored before
+ * compression was supported.
+ */
+std::string CompressBlockData (std::string raw);
+
+/**
+ * Undoes CompressBlockData for stored data.  If the data is compressed,
+ * the raw data is put into out and true is returned.  If the data
+ * is not compressed, false is returned and the input data can be used
+ * directly.  CHECK fails if the data is invalid, or if it was compressed
+ * with a dictionary and that dictionary is not configured.
+ */
+bool DecompressBlockData (std::string_view data, std::string& out);
+
+/**
+ * Returns the raw form of serialised block data, decompressing it if
+ * necessary.  This is the form in which block data is exchanged with other
+ * instances, as they may not use the same compression settings.
+ */
+std::string GetRawBlockData (std::string data);
+
+} // namespace xayax
+
+#endif // XAYAX_COMPRESSION_HPP
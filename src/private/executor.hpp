@@ -0,0 +1,108 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_EXECUTOR_HPP
+#define XAYAX_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Fixed pool of worker threads that run submitted tasks in the order
+ * they were queued.  This is used for the default implementations of the
+ * asynchronous BaseChain methods, so that we do not spawn an unbounded number
+ * of threads for concurrent requests.
+ *
+ * Tasks must not block on the results of other tasks submitted to the
+ * same executor, as that may deadlock if all workers are busy.
+ *
+ * This class is thread-safe.
+ */
+class Executor
+{
+
+private:
+
+  /** Lock for the task queue.  */
+  std::mutex mut;
+
+  /** Notified when tasks are queued or the workers should stop.  */
+  std::condition_variable cv;
+
+  /** The queued tasks.  */
+  std::deque<std::function<void ()>> tasks;
+
+  /** Set to true when the workers should exit.  */
+  bool shouldStop = false;
+
+  /** The worker threads.  */
+  std::vector<std::thread> workers;
+
+  /**
+   * Main loop of a worker thread.
+   */
+  void Run ();
+
+  /**
+   * Adds a task to the queue.
+   */
+  void Push (std::function<void ()> task);
+
+public:
+
+  /**
+   * Constructs the executor and starts the given number of workers.
+   */
+  explicit Executor (size_t numThreads);
+
+  /**
+   * Stops the workers after all queued tasks have been run.
+   */
+  ~Executor ();
+
+  Executor () = delete;
+  Executor (const Executor&) = delete;
+  void operator= (const Executor&) = delete;
+
+  /**
+   * Queues a function to be run on one of the workers, and returns
+   * a future for its result (or exception).
+   */
+  template <typename Fcn>
+    auto
+    Submit (Fcn fcn) -> std::future<decltype (fcn ())>
+  {
+    using Result = decltype (fcn ());
+    auto task = std::make_shared<std::packaged_task<Result ()>> (
+        std::move (fcn));
+    auto res = task->get_future ();
+    Push ([task] ()
+      {
+        (*task) ();
+      });
+    return res;
+  }
+
+  /**
+   * Returns the process-wide shared executor, which is created on first use
+   * with --xayax_async_threads workers.
+   */
+  static Executor& Shared ();
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_EXECUTOR_HPP
@@ -0,0 +1,60 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_METRICSSERVER_HPP
+#define XAYAX_METRICSSERVER_HPP
+
+#include "metrics.hpp"
+
+#include <string>
+
+struct MHD_Daemon;
+
+namespace xayax
+{
+
+/**
+ * Simple HTTP server that exposes the metrics of a registry at /metrics
+ * in the Prometheus text format.  The server runs on its own thread from
+ * construction until the instance is destroyed.
+ */
+class MetricsServer
+{
+
+private:
+
+  /** The registry whose metrics we serve.  */
+  const MetricsRegistry& registry;
+
+  /** The underlying libmicrohttpd daemon.  */
+  MHD_Daemon* daemon = nullptr;
+
+public:
+
+  /**
+   * Starts the server on the given port.  If local is true, it only
+   * binds on localhost.
+   */
+  explicit MetricsServer (const MetricsRegistry& reg, int port, bool local);
+
+  ~MetricsServer ();
+
+  MetricsServer () = delete;
+  MetricsServer (const MetricsServer&) = delete;
+  void operator= (const MetricsServer&) = delete;
+
+  /**
+   * Handles a single request for the given registry, returning the
+   * HTTP status code and setting the response body.  This is called by
+   * the HTTP server, and exposed so that the logic can be tested directly.
+   */
+  static unsigned Handle (const MetricsRegistry& reg,
+                          const std::string& method, const std::string& url,
+                          std::string& body);
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_METRICSSERVER_HPP
@@ -0,0 +1,33 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_MOVEJSON_HPP
+#define XAYAX_MOVEJSON_HPP
+
+#include <json/json.h>
+
+#include <string>
+
+namespace xayax
+{
+
+/**
+ * Parses the data of a move (as taken from a transaction on the base chain)
+ * as JSON.  This accepts exactly the moves that Xaya Core would accept,
+ * i.e. the ones that are valid JSON per Univalue's parser, have an object
+ * as root value, and do not contain duplicate keys in any object.
+ *
+ * Historically, this was done by running the data through Univalue,
+ * serialising it again and parsing the result with jsoncpp (rejecting
+ * duplicate keys).  This function does all of that in a single pass,
+ * building up the jsoncpp value directly, while returning exactly
+ * the same results.
+ *
+ * Returns true if the move is valid, and false otherwise.
+ */
+bool ReadMoveJson (const std::string& str, Json::Value& val);
+
+} // namespace xayax
+
+#endif // XAYAX_MOVEJSON_HPP
@@ -0,0 +1,138 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_PRUNER_HPP
+#define XAYAX_PRUNER_HPP
+
+#include "private/chainstate.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+namespace xayax
+{
+
+/**
+ * Background worker that prunes the chainstate and releases the freed space
+ * of the database, so that this is not done on every tip update while
+ * the sync holds the chain lock.
+ *
+ * Pruning is triggered once the tip has advanced by some number of blocks
+ * since the last run, or after some time has passed.  The blocks are then
+ * pruned in batches of bounded size, each holding the chain lock only
+ * briefly, followed by bounded incremental vacuum steps.
+ */
+class Pruner
+{
+
+private:
+
+  /** The chainstate to prune.  */
+  Chainstate& chain;
+
+  /** Mutex for the chainstate, which we lock exclusively to update it.  */
+  std::shared_mutex& mutChain;
+
+  /** Number of main-chain blocks to keep behind the tip.  */
+  const uint64_t depth;
+
+  /** Number of new blocks after which to prune.  */
+  const uint64_t intervalBlocks;
+
+  /** Time after which to prune even if not enough blocks were added.  */
+  const std::chrono::milliseconds interval;
+
+  /** Maximum number of heights to prune while holding the lock once.  */
+  const uint64_t batchBlocks;
+
+  /** Maximum number of pages to release in one vacuum step.  */
+  const unsigned vacuumPages;
+
+  /**
+   * Pause between batches and vacuum steps.  Merely yielding is not
+   * enough, as a shared_mutex does not guarantee that waiting threads
+   * get the lock before we take it again.
+   */
+  const std::chrono::milliseconds pause;
+
+  /** Lock for the state of the worker.  */
+  std::mutex mut;
+
+  /** Notified when the tip changes or the worker should stop.  */
+  std::condition_variable cv;
+
+  /** The most recent tip height we have been notified about.  */
+  int64_t notifiedHeight = -1;
+
+  /** The tip height at which we pruned last.  */
+  int64_t prunedHeight = -1;
+
+  /** Set to true when the worker should exit.  */
+  bool shouldStop = false;
+
+  /** The worker thread.  */
+  std::thread worker;
+
+  /**
+   * Main loop of the worker thread.
+   */
+  void Run ();
+
+  /**
+   * Returns true if the worker should stop.
+   */
+  bool IsStopping ();
+
+  /**
+   * Waits for the pause between batches (without holding the chain lock).
+   * Returns false if the worker should stop instead.
+   */
+  bool Pause ();
+
+  /**
+   * Prunes all blocks beyond the pruning depth, in batches.
+   */
+  void PruneBatches ();
+
+  /**
+   * Releases free pages of the database, in bounded steps.
+   */
+  void VacuumSteps ();
+
+public:
+
+  /**
+   * Constructs the pruner and starts its worker thread.
+   */
+  explicit Pruner (Chainstate& c, std::shared_mutex& mutC, uint64_t d,
+                   uint64_t blocks, std::chrono::milliseconds i,
+                   uint64_t batch, unsigned pages,
+                   std::chrono::milliseconds p);
+
+  /**
+   * Stops the worker.  A run in progress is aborted after its current
+   * batch or vacuum step.
+   */
+  ~Pruner ();
+
+  Pruner () = delete;
+  Pruner (const Pruner&) = delete;
+  void operator= (const Pruner&) = delete;
+
+  /**
+   * Notifies the pruner about a new tip height of the chainstate.  This
+   * is cheap and does not block, so it can be called with the chain
+   * lock held.
+   */
+  void TipUpdated (uint64_t height);
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_PRUNER_HPP
@@ -0,0 +1,144 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_RESYNC_HPP
+#define XAYAX_RESYNC_HPP
+
+#include "basechain.hpp"
+#include "blockdata.hpp"
+#include "private/zmqpub.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Background worker that streams the ZMQ notifications requested through
+ * game_sendupdates over a potentially long range of blocks.  The fork point
+ * and detached blocks are determined by the caller (with the chain lock
+ * held), and the worker then sends the detaches and fetches and sends the
+ * attaches from the base chain in chunks, without holding any lock
+ * on the chain state.
+ *
+ * Jobs are processed one at a time in the order they were queued, so that
+ * many GSPs resyncing at once do not multiply the load on the base chain.
+ */
+class ResyncStreamer
+{
+
+public:
+
+  /**
+   * A single requested resync.
+   */
+  struct Job
+  {
+
+    /** The reqtoken to set in the notifications.  */
+    std::string reqtoken;
+
+    /** The game to send notifications for (or empty for all).  */
+    std::string gameId;
+
+    /** The blocks to detach, in the order of detaching them.  */
+    std::vector<BlockData> detach;
+
+    /** The main-chain block from which on we attach.  */
+    std::string forkPoint;
+
+    /** The height of the fork point.  */
+    uint64_t forkHeight = 0;
+
+    /** The height of the last block to attach.  */
+    uint64_t targetHeight = 0;
+
+    /** The expected hash of the last block to attach.  */
+    std::string target;
+
+  };
+
+private:
+
+  /** The base chain to fetch attached blocks from.  */
+  BaseChain& base;
+
+  /** The publisher to send notifications with.  */
+  ZmqPub& zmq;
+
+  /** Number of blocks to request from the base chain at once.  */
+  const unsigned chunkSize;
+
+  /** Pause between sending two chunks of attaches.  */
+  const std::chrono::milliseconds pause;
+
+  /** Lock for the job queue.  */
+  std::mutex mut;
+
+  /** Notified when jobs are queued or the worker should stop.  */
+  std::condition_variable cv;
+
+  /** Queued jobs, oldest first.  */
+  std::deque<Job> jobs;
+
+  /** Set to true when the worker should exit.  */
+  bool shouldStop = false;
+
+  /** The worker thread.  */
+  std::thread worker;
+
+  /**
+   * Main loop of the worker thread.
+   */
+  void Run ();
+
+  /**
+   * Sends out the notifications for one job.  Returns false if it was
+   * aborted, either due to a mismatch in the blocks returned by the base
+   * chain (e.g. a reorg in the mean time) or because we are stopping.
+   * Throws if the base chain does.
+   */
+  bool Process (const Job& job);
+
+  /**
+   * Waits for the pause between chunks.  Returns false if the worker
+   * should stop instead.
+   */
+  bool WaitPause ();
+
+public:
+
+  /**
+   * Constructs the streamer and starts its worker thread.
+   */
+  explicit ResyncStreamer (BaseChain& b, ZmqPub& z, unsigned chunk,
+                           std::chrono::milliseconds p);
+
+  /**
+   * Stops the worker.  A job in progress is aborted after its current
+   * chunk, and queued jobs are discarded.
+   */
+  ~ResyncStreamer ();
+
+  ResyncStreamer () = delete;
+  ResyncStreamer (const ResyncStreamer&) = delete;
+  void operator= (const ResyncStreamer&) = delete;
+
+  /**
+   * Queues a new job for processing.
+   */
+  void Enqueue (Job job);
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_RESYNC_HPP
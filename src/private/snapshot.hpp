@@ -0,0 +1,47 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_SNAPSHOT_HPP
+#define XAYAX_SNAPSHOT_HPP
+
+#include "blockdata.hpp"
+#include "private/chainstate.hpp"
+
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * Writes a snapshot file for the given chain string and serialised main-chain
+ * blocks (as returned by Chainstate::GetMainchainData).  The file holds
+ * a proto::Snapshot with the blocks in their uncompressed protocol-buffer
+ * format.  It is written to a temporary file first and then renamed,
+ * so that readers never see a partial snapshot.  Returns false if the
+ * file could not be written.
+ */
+bool WriteSnapshot (const std::string& file, const std::string& chain,
+                    const std::vector<std::string>& blocks);
+
+/**
+ * Reads a snapshot file and returns its blocks.  This verifies that the
+ * snapshot is for the given chain, and that the blocks are non-empty and
+ * form a linear chain.  CHECK fails if the file cannot be read or is
+ * invalid in any of these ways.
+ */
+std::vector<BlockData> ReadSnapshot (const std::string& file,
+                                     const std::string& chain);
+
+/**
+ * Imports the blocks from a snapshot (as returned by ReadSnapshot) into
+ * an empty chainstate, with the first block as lowest unpruned block
+ * and the last one as tip.  The chainstate's chain string is set as well.
+ */
+void ImportSnapshot (Chainstate& state, const std::string& chain,
+                     const std::vector<BlockData>& blocks);
+
+} // namespace xayax
+
+#endif // XAYAX_SNAPSHOT_HPP
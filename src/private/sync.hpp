@@ -8,9 +8,14 @@
 #include "basechain.hpp"
 #include "private/chainstate.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -37,14 +42,36 @@ public:
 
 private:
 
+  /**
+   * A block-range request to the base chain that has been started ahead
+   * of time on the shared executor, while we are catching up.  The blocks
+   * are serialised as part of the background task as well.
+   */
+  struct PrefetchedRange
+  {
+
+    /** The start height of the range.  */
+    uint64_t start;
+
+    /** The number of blocks requested.  */
+    unsigned count;
+
+    /** The future that will hold the result.  */
+    std::future<std::vector<BlockData>> blocks;
+
+  };
+
   /** The base chain we use for updates.  */
   BaseChain& base;
 
   /** The chainstate that we update.  */
   Chainstate& chain;
 
-  /** Mutex for the chainstate.  */
-  std::mutex& mutChain;
+  /**
+   * Mutex for the chainstate.  We lock it exclusively whenever we modify
+   * the chainstate, which is also when the callbacks are invoked.
+   */
+  std::shared_mutex& mutChain;
 
   /**
    * The pruning depth the sync should ensure.  This is used when the initial
@@ -77,6 +104,12 @@ private:
   /** If we have a running background thread, the thread instance.  */
   std::unique_ptr<std::thread> updater;
 
+  /**
+   * Hash of the most recent tip the base chain notified us about, which
+   * has not been processed yet (or empty if there is none).
+   */
+  std::string tipHint;
+
   /**
    * Number of blocks to request from the base chain during sync.  During
    * normal operation, this is two (so we may get one new block and then detect
@@ -94,23 +127,141 @@ private:
    */
   int64_t nextStartHeight;
 
+  /**
+   * If the first block returned in an update step did not attach to our
+   * chain, this is set to the height it was requested from.  The next step
+   * then locates the fork point with the base chain (see LocateForkPoint)
+   * before fetching full blocks again.  It is -1 otherwise.
+   */
+  int64_t forkSearchHeight;
+
+  /**
+   * Block ranges that have been requested in advance from the base chain
+   * during catch-up, in order of their start height.  Each range starts
+   * at the last block of the previous one, so that it can be processed just
+   * like the next request we would otherwise make.
+   */
+  std::deque<PrefetchedRange> prefetched;
+
+  /** Total number of blocks attached to the chainstate by this instance.  */
+  std::atomic<uint64_t> blocksAttached;
+
+  /**
+   * Total time (in microseconds) for which this instance has held the
+   * chain mutex exclusively.
+   */
+  std::atomic<uint64_t> lockHeldMicros;
+
+  /**
+   * Set while a run of multiple update steps (i.e. a catch-up) is
+   * in progress.  The remaining fields record the starting state of it,
+   * so that we can log a throughput summary once we are caught up.
+   */
+  bool catchingUp;
+  unsigned catchUpSteps;
+  std::chrono::steady_clock::time_point catchUpStart;
+  uint64_t catchUpBlocksStart;
+  uint64_t catchUpLockMicrosStart;
+
+  /**
+   * Records the start of an update step for the catch-up statistics.
+   */
+  void StartCatchUpStep ();
+
+  /**
+   * Called when we are caught up with the base chain.  If this ends a
+   * catch-up of multiple steps, it logs a summary of the throughput.
+   */
+  void FinishCatchUp (uint64_t tipHeight);
+
   /**
    * Increases the numBlocks number to the next level.
    */
   void IncreaseNumBlocks ();
 
+  /**
+   * Retrieves a range of blocks from the base chain, and serialises them
+   * right away (see BlockData::CacheSerialised).  That way, the work for
+   * that (including compression) is done before the chain mutex is taken
+   * to store the blocks.
+   */
+  std::vector<BlockData> GetSerialisedRange (uint64_t start, unsigned count);
+
+  /**
+   * Drops all prefetched ranges, waiting for those still in flight.
+   */
+  void DropPrefetched ();
+
+  /**
+   * Retrieves a range of blocks from the base chain.  If the range has been
+   * prefetched already, the prefetched result is used.  If we are catching
+   * up (i.e. the range is full-size and the base chain has more blocks
+   * following it), further ranges are prefetched in the background.
+   *
+   * This method must not be called with the chain mutex held.
+   */
+  std::vector<BlockData> FetchBlockRange (uint64_t start, unsigned count,
+                                          uint64_t baseTip,
+                                          uint64_t genesisHeight);
+
+  /**
+   * Checks whether the block at the given height on our main chain
+   * matches the base chain, using only a header lookup on the base chain.
+   *
+   * The caller must hold the chain mutex (at least shared).
+   */
+  bool MatchesBaseChain (uint64_t height);
+
+  /**
+   * Finds the highest height at which our main chain still agrees with the
+   * base chain, given a height where it is known not to.  This steps back
+   * exponentially from that height until a match is found, and then does
+   * a binary search in between.  As it only compares hashes, this is much
+   * cheaper than walking back with full block requests after a deep reorg
+   * or when restarting with a stale chainstate.
+   *
+   * CHECK fails if there is no match above the lowest unpruned height,
+   * i.e. for a reorg beyond the pruning depth.
+   *
+   * This method holds the chain mutex shared for the whole search (so that
+   * the pruner cannot interfere), and must not be called with it held.
+   */
+  uint64_t LocateForkPoint (uint64_t mismatch);
+
   /**
    * Tries to retrieve the block at given height from the base chain and import
    * it as new tip in the chain state.  Returns true on success and false if
    * we failed to get the block.
+   *
+   * The chain mutex is locked by this method for the import itself,
+   * and must not be held by the caller.
    */
   bool ImportNewTip (uint64_t height);
 
+  /**
+   * Tries to attach the given block hash, which the base chain notified us
+   * about as new tip, directly if it builds on our current tip.  This is the
+   * fast path for the common case of a single new block, which just needs
+   * to retrieve that block by hash.  Returns true if the block is now our
+   * tip, and sets height to its height.  Returns false if the fast path
+   * does not apply, and the normal update logic should be run instead.
+   *
+   * The chain mutex is locked by this method as needed, and must not be held
+   * by the caller.
+   */
+  bool AttachNotifiedTip (const std::string& hash, uint64_t& height);
+
   /**
    * Runs a single update step.  This checks the state of our chain vs
    * the base chain, and tries to update (at least partially) towards
    * the base chain.
    *
+   * Requests to the base chain are mostly made without holding the chain
+   * mutex; it is only locked while the chainstate is read and updated.
+   * This is fine since the sync worker is the only one changing the tip
+   * (the pruner just removes old blocks).  The fork-point search is the
+   * exception, see LocateForkPoint.
+   *
    * Returns true if another step should be done right now, i.e. if we
    * were not able to fully update to the latest state.
    */
@@ -118,7 +269,8 @@ private:
 
 public:
 
-  explicit Sync (BaseChain& b, Chainstate& c, std::mutex& mutC, uint64_t pd);
+  explicit Sync (BaseChain& b, Chainstate& c, std::shared_mutex& mutC,
+                 uint64_t pd);
   ~Sync ();
 
   /**
@@ -132,11 +284,25 @@ public:
    */
   void NewBaseChainTip ();
 
+  /**
+   * Notify the sync worker about a new tip on the base chain with the
+   * given hash.  If it builds on the current tip, it can be attached
+   * without a full update step.
+   */
+  void NewBaseChainTip (const std::string& tip);
+
   /**
    * Sets the callbacks that this instance should invoke.
    */
   void SetCallbacks (Callbacks* c);
 
+  /**
+   * Returns the total number of blocks attached so far, and the total time
+   * the chain mutex has been held exclusively for that (in microseconds).
+   * This is meant for benchmarking and monitoring.
+   */
+  void GetStats (uint64_t& blocks, uint64_t& lockMicros) const;
+
 };
 
 /**
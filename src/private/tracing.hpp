@@ -0,0 +1,198 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_TRACING_HPP
+#define XAYAX_TRACING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xayax
+{
+
+/**
+ * A single recorded span, i.e. the execution of one stage of the block
+ * pipeline (like fetching blocks from the base chain or sending a ZMQ
+ * message).  Times are in microseconds on the monotonic clock, relative
+ * to when the tracer was created.
+ */
+struct TraceEntry
+{
+
+  /** The stage name.  This must be a string literal.  */
+  const char* stage;
+
+  /** Index of the thread that recorded the span.  */
+  unsigned thread;
+
+  /** Start time of the span.  */
+  int64_t start;
+  /** Duration of the span.  */
+  int64_t duration;
+
+};
+
+/**
+ * Statistics about the recorded spans of one stage.  All durations
+ * are in microseconds.
+ */
+struct TraceStageStats
+{
+
+  /** Number of spans in the recorded window.  */
+  uint64_t count = 0;
+
+  double mean = 0.0;
+  int64_t p50 = 0;
+  int64_t p90 = 0;
+  int64_t p99 = 0;
+  int64_t max = 0;
+
+  /** The most recent spans, oldest first.  */
+  std::vector<TraceEntry> recent;
+
+};
+
+/**
+ * Lightweight tracer for the stages of the block pipeline.  Spans are
+ * recorded into a fixed-size ring buffer per thread, so that recording
+ * only takes two reads of the monotonic clock and a lock that is only ever
+ * contended while the statistics are being collected.  Tracing can be
+ * switched on and off at runtime; when off, a span costs a single relaxed
+ * atomic load.
+ *
+ * This class is thread-safe.
+ */
+class Tracer
+{
+
+private:
+
+  class ThreadBuffer;
+  class ThreadHolder;
+
+  /** Whether or not tracing is enabled.  */
+  std::atomic<bool> enabled;
+
+  /** Reference point for the recorded times.  */
+  const std::chrono::steady_clock::time_point epoch;
+
+  /** Lock for the list of buffers.  */
+  mutable std::mutex mut;
+
+  /** Buffers of all threads that are alive and have recorded spans.  */
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+  /**
+   * Buffer into which the spans of threads that exited are merged, so
+   * that short-lived threads do not accumulate buffers.
+   */
+  std::unique_ptr<ThreadBuffer> retired;
+
+  /** Counter for assigning thread indices.  */
+  unsigned nextThread = 0;
+
+  Tracer ();
+
+  /**
+   * Returns the buffer of the calling thread, creating and registering
+   * it if necessary.
+   */
+  ThreadBuffer& GetThreadBuffer ();
+
+  /**
+   * Merges the spans of a thread's buffer into the retired buffer and
+   * unregisters it.  This is called when a thread exits.
+   */
+  void Retire (const std::shared_ptr<ThreadBuffer>& buf);
+
+public:
+
+  ~Tracer ();
+
+  Tracer (const Tracer&) = delete;
+  void operator= (const Tracer&) = delete;
+
+  /**
+   * Returns the process-wide tracer instance.  It is initially enabled
+   * or disabled according to --xayax_perf_tracing.
+   */
+  static Tracer& Get ();
+
+  bool
+  IsEnabled () const
+  {
+    return enabled.load (std::memory_order_relaxed);
+  }
+
+  void SetEnabled (bool val);
+
+  /**
+   * Records a span directly.  This is mostly used by TraceSpan, but
+   * exposed so that it can be tested with deterministic values.
+   */
+  void Record (const char* stage, std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end);
+
+  /**
+   * Returns statistics for all stages with spans in the current window,
+   * including up to numRecent of the most recent spans per stage.
+   */
+  std::map<std::string, TraceStageStats> GetStats (size_t numRecent) const;
+
+  /**
+   * Clears all recorded spans.
+   */
+  void Reset ();
+
+};
+
+/**
+ * RAII helper that records a span for the given stage from its construction
+ * to its destruction, if tracing is enabled.
+ */
+class TraceSpan
+{
+
+private:
+
+  /** The stage name, which must be a string literal.  */
+  const char* const stage;
+
+  /** Whether tracing was enabled when the span started.  */
+  const bool active;
+
+  /** Start time of the span (only set if active).  */
+  std::chrono::steady_clock::time_point start;
+
+public:
+
+  explicit TraceSpan (const char* s)
+    : stage(s), active(Tracer::Get ().IsEnabled ())
+  {
+    if (active)
+      start = std::chrono::steady_clock::now ();
+  }
+
+  ~TraceSpan ()
+  {
+    if (active)
+      Tracer::Get ().Record (stage, start, std::chrono::steady_clock::now ());
+  }
+
+  TraceSpan () = delete;
+  TraceSpan (const TraceSpan&) = delete;
+  void operator= (const TraceSpan&) = delete;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_TRACING_HPP
@@ -6,12 +6,22 @@
 #define XAYAX_ZMQPUB_HPP
 
 #include "blockdata.hpp"
+#include "lrucache.hpp"
+#include "private/executor.hpp"
 
 #include <json/json.h>
 #include <zmq.hpp>
 
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 
 namespace xayax
@@ -20,21 +30,119 @@ namespace xayax
 /**
  * ZMQ publisher that can push block and move data per the Xaya ZMQ spec:
  * https://github.com/xaya/xaya/blob/master/doc/xaya/interface.md
+ *
+ * The publisher uses an XPUB socket to keep track of which topics are
+ * actually subscribed to, so that no notifications are prepared for
+ * tracked games that nobody is listening to.
+ *
+ * Messages are not written to the socket directly by the callers, but put
+ * onto an outbound queue (bounded in bytes).  A dedicated sender thread
+ * drains it, so that a burst of notifications (e.g. from game_sendupdates)
+ * does not block the callers.  Subscribers that do not keep up with the
+ * data lose messages once their high-water mark is reached, without
+ * affecting the others.
+ *
+ * Optionally, block notifications are also published in a compact binary
+ * form (a serialised proto::BlockNotification) on "bin" topics next to
+ * the JSON ones, e.g. "game-block-attach bin <game>".  In that case, live
+ * tip updates (but not resyncs requested by a GSP) are also published with
+ * the full block including all moves on "block-attach bin" and
+ * "block-detach bin", independent of the tracked games.
  */
 class ZmqPub
 {
 
+public:
+
+  /**
+   * Information about one tracked game.
+   */
+  struct TrackedGame
+  {
+
+    /** How many times the game has been tracked.  */
+    uint64_t depth = 0;
+
+    /** Number of subscriptions matching the block-attach topic.  */
+    uint64_t attachSubscribers = 0;
+    /** Number of subscriptions matching the block-detach topic.  */
+    uint64_t detachSubscribers = 0;
+    /** Number of subscriptions matching the pending-move topic.  */
+    uint64_t pendingSubscribers = 0;
+
+  };
+
 private:
 
+  /** A fully prepared message waiting in the outbound queue.  */
+  struct QueuedMessage
+  {
+
+    /** The command string (topic).  */
+    std::string cmd;
+
+    /** The serialised JSON payload.  */
+    std::string data;
+
+    /** The sequence number for the message.  */
+    uint32_t seq;
+
+    /**
+     * Returns the number of bytes this message accounts for in the queue.
+     */
+    size_t
+    GetBytes () const
+    {
+      return cmd.size () + data.size () + sizeof (seq);
+    }
+
+  };
+
   zmq::context_t ctx;
   zmq::socket_t sock;
 
   /**
-   * Lock for this instance, mainly for the ZMQ socket and the in-memory map
-   * of sequence numbers).
+   * Lock for this instance, mainly for the in-memory map of sequence numbers,
+   * the subscriptions and the tracked games.  Processing of moves is
+   * done without holding it, so that it is only held for queueing up
+   * the notifications.
    */
   std::mutex mut;
 
+  /**
+   * Lock for the ZMQ socket itself, which is used both by the sender
+   * thread and for reading subscription messages.  If both are needed,
+   * mut must be locked first.
+   */
+  std::mutex sockMut;
+
+  /** Lock for the outbound queue.  */
+  std::mutex queueMut;
+
+  /** Notified when messages are queued or the sender should stop.  */
+  std::condition_variable queueCv;
+
+  /** Messages waiting to be sent, oldest first.  */
+  std::deque<QueuedMessage> queue;
+
+  /** Total size (as per QueuedMessage::GetBytes) of the queued messages.  */
+  size_t queueBytes = 0;
+
+  /** Maximum total size of the messages in the outbound queue.  */
+  size_t maxQueueBytes;
+
+  /** Set to true when the sender thread should exit.  */
+  bool stopSender = false;
+
+  /** The thread sending out queued messages.  */
+  std::thread sender;
+
+  /** Whether binary block notifications are published.  */
+  const bool binary;
+
+  /** Lock for the payload cache.  */
+  std::mutex cacheMut;
+
   /** Next sequence number per command string.  */
   std::unordered_map<std::string, uint32_t> nextSeq;
 
@@ -48,32 +156,154 @@ private:
   std::unordered_map<std::string, uint64_t> games;
 
   /**
-   * Sends a multipart message consisting of command, JSON data and the right
-   * sequence number.  The caller must ensure that all locks are held
-   * as required.
+   * The topic prefixes subscribed to on the socket, with the number of
+   * subscriptions for each.  This is updated from the subscription messages
+   * received on the XPUB socket.
+   */
+  std::map<std::string, uint64_t> subscriptions;
+
+  /**
+   * The serialised notification payloads for a block, for (some of) the games
+   * that the block has moves or admin commands for.  This is cached and
+   * reused for all detach and attach notifications.
+   *
+   * For blocks without a game index, it is computed once for all games,
+   * which involves parsing and validating all moves.  If the block has a
+   * game index, only the moves relevant for the tracked games are processed,
+   * and the payload is extended if other games are needed later on.
+   */
+  struct BlockPayload;
+
+  /** Cache of block payloads by block hash.  */
+  LruCache<std::string, std::shared_ptr<const BlockPayload>> payloadCache;
+
+  /**
+   * Number of threads (including the calling one) across which the moves
+   * of a large block are processed when computing its payload.
+   */
+  size_t prepareThreads;
+
+  /**
+   * Long-lived workers for processing the moves of a block, with one
+   * thread less than prepareThreads (as the calling thread processes one
+   * shard itself).  This is null if prepareThreads is one.
+   */
+  std::unique_ptr<Executor> prepareExecutor;
+
+  /**
+   * Reads all pending subscription messages from the socket and updates
+   * the subscriptions map.  The caller must hold mut (but not sockMut).
+   */
+  void ProcessSubscriptions ();
+
+  /**
+   * Returns the number of subscriptions that match the given command string
+   * (i.e. are a prefix of it).  The caller must hold mut and should have
+   * called ProcessSubscriptions before.
+   */
+  uint64_t CountSubscribers (const std::string& cmd) const;
+
+  /**
+   * Queues a multipart message consisting of command, JSON data and the right
+   * sequence number for sending.  The caller must hold mut.  If the
+   * outbound queue is full, the message is dropped (but its sequence
+   * number is still used up, so that subscribers notice the gap).
    */
   void SendMessage (const std::string& cmd, const Json::Value& data);
 
+  /**
+   * Queues a multipart message with already serialised JSON data.
+   */
+  void SendMessage (const std::string& cmd, const std::string& dataStr);
+
+  /**
+   * Writes a queued message to the socket.
+   */
+  void SendQueued (const QueuedMessage& msg);
+
+  /**
+   * Main loop of the sender thread.
+   */
+  void RunSender ();
+
+  /**
+   * Returns the payload for the given block, either from the cache
+   * or by computing it (and adding to the cache).  The returned payload
+   * covers at least the given games.  This must be called without
+   * holding mut.
+   */
+  std::shared_ptr<const BlockPayload> GetBlockPayload (
+      const BlockData& blk, const std::set<std::string>& forGames);
+
   /**
    * Sends notifications for all tracked games for the given block, which is
    * either being detached or attached (and the "cmdPrefix" must be set
-   * accordingly).
+   * accordingly).  If gameId is not empty, notifications are only sent
+   * for that game (if it is tracked).  Games without subscribers for the
+   * notification are skipped.  If binary notifications are enabled and
+   * this is a plain (not requested) notification, the full block is also
+   * sent on fullTopic.
+   */
+  void SendBlock (const std::string& cmdPrefix, const std::string& fullTopic,
+                  const BlockData& blk,
+                  const std::string& reqtoken, const std::string& gameId);
+
+  /**
+   * Sends the JSON notifications for a block as per SendBlock.
+   */
+  void SendBlockJson (const std::string& cmdPrefix, const BlockData& blk,
+                      const std::string& reqtoken, const std::string& gameId);
+
+  /**
+   * Sends the binary notifications for a block as per SendBlock.  They are
+   * built directly from the BlockData and its game index, without parsing
+   * the moves into JSON.  If the block has no game index, it is computed
+   * into computedIndex (unless already set there).
    */
-  void SendBlock (const std::string& cmdPrefix, const BlockData& blk,
-                  const std::string& reqtoken);
+  void SendBlockBinary (const std::string& cmdPrefix, const BlockData& blk,
+                        std::optional<BlockData::GameIndex>& computedIndex,
+                        const std::string& reqtoken,
+                        const std::string& gameId);
+
+  /**
+   * Sends a full-block notification with all moves of the block on the
+   * given topic, if anyone is subscribed to it.  The game index is
+   * handled as with SendBlockBinary.
+   */
+  void SendFullBlock (const std::string& topic, const BlockData& blk,
+                      std::optional<BlockData::GameIndex>& computedIndex);
 
 public:
 
   /**
-   * Constructs the publisher, binding to the given address.
+   * Constructs the publisher, binding to the given address.  The size of
+   * the payload cache is taken from the --xayax_zmq_payload_cache flag.
+   * The socket and queue settings as well as whether binary notifications
+   * are enabled are always taken from the corresponding --xayax_zmq_* flags.
    */
   explicit ZmqPub (const std::string& addr);
 
   /**
-   * Stops the publisher and cleans up the connection.
+   * Constructs the publisher with an explicit (maximum) number of blocks
+   * whose payloads will be cached.
+   */
+  explicit ZmqPub (const std::string& addr, size_t payloadCacheSize);
+
+  /**
+   * Stops the publisher and cleans up the connection.  Messages that
+   * are still queued are discarded.
    */
   ~ZmqPub ();
 
+  /**
+   * Returns true if binary block notifications are published.
+   */
+  bool
+  HasBinary () const
+  {
+    return binary;
+  }
+
   /**
    * Adds a game to the list of tracked games (incrementing its depth).
    */
@@ -91,12 +321,26 @@ public:
    */
   void SendBlockAttach (const BlockData& blk, const std::string& reqtoken);
 
+  /**
+   * Pushes notifications for the given block being attached only for the
+   * given game, if it is tracked.  An empty gameId means all tracked games.
+   */
+  void SendBlockAttach (const BlockData& blk, const std::string& reqtoken,
+                        const std::string& gameId);
+
   /**
    * Pushes notifications for all tracked games and the given block
    * being detached.
    */
   void SendBlockDetach (const BlockData& blk, const std::string& reqtoken);
 
+  /**
+   * Pushes notifications for the given block being detached only for the
+   * given game, if it is tracked.  An empty gameId means all tracked games.
+   */
+  void SendBlockDetach (const BlockData& blk, const std::string& reqtoken,
+                        const std::string& gameId);
+
   /**
    * Pushes notifications for all tracked games for one or more moves
    * created by a pending transaction.  All MoveData entries in the list
@@ -104,6 +348,18 @@ public:
    */
   void SendPendingMoves (const std::vector<MoveData>& moves);
 
+  /**
+   * Returns all tracked games together with their depth and the number
+   * of subscribers to their notifications.
+   */
+  std::map<std::string, TrackedGame> GetTrackedGames ();
+
+  /**
+   * Returns the number of hits and misses of the block payload cache
+   * so far.
+   */
+  void GetPayloadCacheStats (uint64_t& hits, uint64_t& misses);
+
 };
 
 } // namespace xayax
@@ -0,0 +1,201 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/pruner.hpp"
+
+#include "metrics.hpp"
+#include "private/tracing.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace xayax
+{
+
+namespace
+{
+
+/**
+ * The metrics exported by the pruner.
+ */
+struct PrunerMetrics
+{
+
+  MetricsCounter& batches;
+  MetricsCounter& vacuumSteps;
+  MetricsGauge& freePages;
+
+  PrunerMetrics ()
+    : batches(MetricsRegistry::Get ().GetCounter (
+          "xayax_pruner_batches_total",
+          "Number of pruning batches done in the background")),
+      vacuumSteps(MetricsRegistry::Get ().GetCounter (
+          "xayax_pruner_vacuum_steps_total",
+          "Number of incremental vacuum steps done in the background")),
+      freePages(MetricsRegistry::Get ().GetGauge (
+          "xayax_pruner_free_pages",
+          "Free pages in the chainstate database after the last vacuum"))
+  {}
+
+  static PrunerMetrics&
+  Get ()
+  {
+    static PrunerMetrics instance;
+    return instance;
+  }
+
+};
+
+} // anonymous namespace
+
+Pruner::Pruner (Chainstate& c, std::shared_mutex& mutC, const uint64_t d,
+                const uint64_t blocks, const std::chrono::milliseconds i,
+                const uint64_t batch, const unsigned pages,
+                const std::chrono::milliseconds p)
+  : chain(c), mutChain(mutC), depth(d),
+    intervalBlocks(blocks), interval(i),
+    batchBlocks(batch), vacuumPages(pages), pause(p)
+{
+  CHECK_GT (intervalBlocks, 0);
+  CHECK_GT (batchBlocks, 0);
+  CHECK_GT (vacuumPages, 0);
+
+  worker = std::thread ([this] ()
+    {
+      Run ();
+    });
+}
+
+Pruner::~Pruner ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shouldStop = true;
+    cv.notify_all ();
+  }
+
+  worker.join ();
+}
+
+void
+Pruner::TipUpdated (const uint64_t height)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  notifiedHeight = height;
+  if (notifiedHeight >= prunedHeight + static_cast<int64_t> (intervalBlocks))
+    cv.notify_all ();
+}
+
+bool
+Pruner::IsStopping ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return shouldStop;
+}
+
+bool
+Pruner::Pause ()
+{
+  std::unique_lock<std::mutex> lock(mut);
+  cv.wait_for (lock, pause, [this] ()
+    {
+      return shouldStop;
+    });
+  return !shouldStop;
+}
+
+void
+Pruner::Run ()
+{
+  while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        /* We prune either when enough new blocks have been attached,
+           or when the interval has passed (whichever comes first).  */
+        cv.wait_for (lock, interval, [this] ()
+          {
+            return shouldStop
+                || notifiedHeight
+                      >= prunedHeight + static_cast<int64_t> (intervalBlocks);
+          });
+        if (shouldStop)
+          return;
+        if (notifiedHeight == prunedHeight)
+          continue;
+        prunedHeight = notifiedHeight;
+      }
+
+      PruneBatches ();
+      VacuumSteps ();
+    }
+}
+
+void
+Pruner::PruneBatches ()
+{
+  auto& metrics = PrunerMetrics::Get ();
+
+  while (!IsStopping ())
+    {
+      {
+        std::lock_guard<std::shared_mutex> lock(mutChain);
+        TraceSpan span("pruner.prune");
+
+        /* The target is determined from the actual tip, which may
+           differ from the notified one by now.  */
+        const int64_t tipHeight = chain.GetTipHeight ();
+        const int64_t lowest = chain.GetLowestUnprunedHeight ();
+        if (tipHeight <= static_cast<int64_t> (depth) + 1 || lowest == -1)
+          return;
+        const uint64_t target = tipHeight - depth - 1;
+        if (static_cast<uint64_t> (lowest) > target)
+          return;
+
+        const uint64_t until = std::min (target, lowest + batchBlocks - 1);
+        chain.Prune (until);
+        metrics.batches.Inc ();
+        if (until == target)
+          return;
+      }
+
+      /* Give the sync and RPC methods a chance to take the lock
+         between batches.  */
+      if (!Pause ())
+        return;
+    }
+}
+
+void
+Pruner::VacuumSteps ()
+{
+  auto& metrics = PrunerMetrics::Get ();
+
+  uint64_t lastFree = 0;
+  bool first = true;
+  while (!IsStopping ())
+    {
+      uint64_t free;
+      {
+        std::lock_guard<std::shared_mutex> lock(mutChain);
+        TraceSpan span("pruner.vacuum");
+        free = chain.Vacuum (vacuumPages);
+      }
+      metrics.vacuumSteps.Inc ();
+      metrics.freePages.Set (free);
+
+      /* If incremental vacuum is not enabled for the database, the free
+         pages will not go down, so we have to stop in that case.  */
+      if (free == 0 || (!first && free >= lastFree))
+        return;
+      lastFree = free;
+      first = false;
+
+      if (!Pause ())
+        return;
+    }
+}
+
+} // namespace xayax
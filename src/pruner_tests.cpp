@@ -0,0 +1,168 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/pruner.hpp"
+
+#include "metrics.hpp"
+#include "testutils.hpp"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+namespace xayax
+{
+namespace
+{
+
+using std::chrono::milliseconds;
+
+class PrunerTests : public testing::Test
+{
+
+protected:
+
+  TestBaseChain base;
+  Chainstate chain;
+  std::shared_mutex mutChain;
+
+  PrunerTests ()
+    : chain(":memory:")
+  {
+    chain.ImportTip (base.SetGenesis (base.NewGenesis (0)));
+  }
+
+  /**
+   * Attaches n new blocks to the chainstate, and notifies the pruner
+   * about each new tip if one is given.
+   */
+  void
+  Attach (const unsigned n, Pruner* pruner)
+  {
+    for (unsigned i = 0; i < n; ++i)
+      {
+        const auto blk = base.SetTip (base.NewBlock ());
+
+        std::lock_guard<std::shared_mutex> lock(mutChain);
+        std::string oldTip;
+        CHECK (chain.SetTip (blk, oldTip));
+        if (pruner != nullptr)
+          pruner->TipUpdated (blk.height);
+      }
+  }
+
+  /**
+   * Returns the lowest unpruned height of the chainstate.
+   */
+  int64_t
+  GetLowestUnpruned ()
+  {
+    std::lock_guard<std::shared_mutex> lock(mutChain);
+    return chain.GetLowestUnprunedHeight ();
+  }
+
+  /**
+   * Waits until the lowest unpruned height of the chainstate is the
+   * expected one.
+   */
+  void
+  WaitForLowestUnpruned (const int64_t expected)
+  {
+    for (unsigned i = 0; i < 10'000; ++i)
+      {
+        if (GetLowestUnpruned () == expected)
+          return;
+        std::this_thread::sleep_for (milliseconds (1));
+      }
+
+    FAIL () << "Timed out waiting for pruning to " << expected;
+  }
+
+};
+
+TEST_F (PrunerTests, PrunesAfterBlocks)
+{
+  Pruner pruner(chain, mutChain, 2, 5, milliseconds (3'600'000), 3, 10,
+                milliseconds (1));
+
+  /* Fewer blocks than the interval do not trigger pruning.  */
+  Attach (4, &pruner);
+  SleepSome ();
+  EXPECT_EQ (GetLowestUnpruned (), 0);
+
+  /* Once the interval is reached, we prune (in multiple batches) down to
+     the pruning depth.  */
+  Attach (16, &pruner);
+  WaitForLowestUnpruned (20 - 2);
+}
+
+TEST_F (PrunerTests, PrunesAfterTime)
+{
+  Pruner pruner(chain, mutChain, 2, 1'000, milliseconds (10), 100, 10,
+                milliseconds (1));
+
+  Attach (10, &pruner);
+  WaitForLowestUnpruned (10 - 2);
+}
+
+TEST_F (PrunerTests, ShortChain)
+{
+  Pruner pruner(chain, mutChain, 10, 1, milliseconds (10), 100, 10,
+                milliseconds (1));
+
+  Attach (5, &pruner);
+  SleepSome ();
+  EXPECT_EQ (GetLowestUnpruned (), 0);
+}
+
+TEST_F (PrunerTests, ReleasesFreePages)
+{
+  /* Attach blocks with some data (so that pruning them frees pages),
+     and then prune them all in one go.  */
+  for (unsigned i = 0; i < 100; ++i)
+    {
+      auto blk = base.NewBlock ();
+      MoveData mv;
+      mv.txid = "tx";
+      mv.ns = "p";
+      mv.name = "domob";
+      mv.mv = R"({"g":{"x":")" + std::string (1'000, 'x') + R"("}})";
+      blk.moves.push_back (mv);
+      blk = base.SetTip (blk);
+
+      std::string oldTip;
+      CHECK (chain.SetTip (blk, oldTip));
+    }
+
+  /* The pruner reports the free pages remaining after each vacuum step
+     in a gauge.  Reset it, so that we can tell when it has been set.  */
+  auto& metrics = MetricsRegistry::Get ();
+  auto& steps = metrics.GetCounter ("xayax_pruner_vacuum_steps_total", "");
+  auto& freePages = metrics.GetGauge ("xayax_pruner_free_pages", "");
+  const uint64_t stepsBefore = steps.Get ();
+  freePages.Set (-1);
+
+  Pruner pruner(chain, mutChain, 1, 1, milliseconds (10), 1'000, 1,
+                milliseconds (1));
+  pruner.TipUpdated (100);
+  WaitForLowestUnpruned (99);
+
+  /* The vacuum runs after pruning, in steps of a single page, until
+     all free pages are released.  */
+  for (unsigned i = 0; i < 10'000; ++i)
+    {
+      if (freePages.Get () == 0)
+        break;
+      std::this_thread::sleep_for (milliseconds (1));
+    }
+  ASSERT_EQ (freePages.Get (), 0) << "Free pages were not released";
+
+  /* There were pages to release, so it took more than one step.  */
+  EXPECT_GT (steps.Get (), stepsBefore + 1);
+}
+
+} // anonymous namespace
+} // namespace xayax
@@ -0,0 +1,204 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/resync.hpp"
+
+#include "metrics.hpp"
+#include "private/tracing.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <utility>
+
+namespace xayax
+{
+
+namespace
+{
+
+/**
+ * The metrics exported by the resync streamer.
+ */
+struct ResyncMetrics
+{
+
+  MetricsCounter& jobs;
+  MetricsCounter& aborted;
+  MetricsCounter& blocks;
+  MetricsGauge& queued;
+
+  ResyncMetrics ()
+    : jobs(MetricsRegistry::Get ().GetCounter (
+          "xayax_resync_jobs_total", "Number of streamed resyncs started")),
+      aborted(MetricsRegistry::Get ().GetCounter (
+          "xayax_resync_aborted_total",
+          "Number of streamed resyncs that were aborted")),
+      blocks(MetricsRegistry::Get ().GetCounter (
+          "xayax_resync_blocks_total",
+          "Number of blocks sent by streamed resyncs")),
+      queued(MetricsRegistry::Get ().GetGauge (
+          "xayax_resync_queued", "Number of streamed resyncs waiting"))
+  {}
+
+  static ResyncMetrics&
+  Get ()
+  {
+    static ResyncMetrics instance;
+    return instance;
+  }
+
+};
+
+} // anonymous namespace
+
+ResyncStreamer::ResyncStreamer (BaseChain& b, ZmqPub& z, const unsigned chunk,
+                                const std::chrono::milliseconds p)
+  : base(b), zmq(z), chunkSize(chunk), pause(p)
+{
+  CHECK_GT (chunkSize, 0);
+
+  worker = std::thread ([this] ()
+    {
+      Run ();
+    });
+}
+
+ResyncStreamer::~ResyncStreamer ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shouldStop = true;
+    cv.notify_all ();
+  }
+
+  worker.join ();
+}
+
+void
+ResyncStreamer::Enqueue (Job job)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  VLOG (1)
+      << "Queuing resync " << job.reqtoken << " from " << job.forkPoint
+      << " to " << job.target;
+  jobs.push_back (std::move (job));
+  ResyncMetrics::Get ().queued.Set (jobs.size ());
+  cv.notify_all ();
+}
+
+bool
+ResyncStreamer::WaitPause ()
+{
+  std::unique_lock<std::mutex> lock(mut);
+  return !cv.wait_for (lock, pause, [this] () { return shouldStop; });
+}
+
+void
+ResyncStreamer::Run ()
+{
+  auto& metrics = ResyncMetrics::Get ();
+
+  while (true)
+    {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mut);
+        cv.wait (lock, [this] ()
+          {
+            return shouldStop || !jobs.empty ();
+          });
+        if (shouldStop)
+          return;
+
+        job = std::move (jobs.front ());
+        jobs.pop_front ();
+        metrics.queued.Set (jobs.size ());
+      }
+
+      metrics.jobs.Inc ();
+      bool ok;
+      try
+        {
+          ok = Process (job);
+        }
+      catch (const std::exception& exc)
+        {
+          LOG (WARNING)
+              << "Base-chain error during resync " << job.reqtoken
+              << ": " << exc.what ();
+          ok = false;
+        }
+
+      /* GSPs recover from an aborted resync by requesting updates
+         again after they time out waiting for the target block.  */
+      if (!ok)
+        metrics.aborted.Inc ();
+    }
+}
+
+bool
+ResyncStreamer::Process (const Job& job)
+{
+  auto& metrics = ResyncMetrics::Get ();
+
+  LOG (INFO)
+      << "Streaming resync " << job.reqtoken << ": "
+      << job.detach.size () << " detaches and "
+      << (job.targetHeight - job.forkHeight) << " attaches";
+
+  for (const auto& blk : job.detach)
+    zmq.SendBlockDetach (blk, job.reqtoken, job.gameId);
+  metrics.blocks.Inc (job.detach.size ());
+
+  /* The next chunk is always requested from the base chain while the
+     current one is being sent, so that the two overlap.  */
+  const auto requestChunk = [this, &job] (const uint64_t from)
+    {
+      const auto num
+          = std::min<uint64_t> (chunkSize, job.targetHeight - from + 1);
+      return base.GetBlockRangeAsync (from, num);
+    };
+
+  std::string prev = job.forkPoint;
+  uint64_t h = job.forkHeight + 1;
+  std::future<std::vector<BlockData>> next;
+  if (h <= job.targetHeight)
+    next = requestChunk (h);
+  while (h <= job.targetHeight)
+    {
+      if (h > job.forkHeight + 1 && !WaitPause ())
+        return false;
+
+      TraceSpan span("resync.chunk");
+
+      const auto blocks = next.get ();
+      if (blocks.empty () || blocks.front ().parent != prev)
+        {
+          LOG (WARNING)
+              << "Mismatch for attach blocks at height " << h
+              << " in resync " << job.reqtoken << ", race condition?";
+          return false;
+        }
+
+      prev = blocks.back ().hash;
+      h += blocks.size ();
+      if (h <= job.targetHeight)
+        next = requestChunk (h);
+
+      for (const auto& blk : blocks)
+        zmq.SendBlockAttach (blk, job.reqtoken, job.gameId);
+      metrics.blocks.Inc (blocks.size ());
+    }
+
+  LOG_IF (WARNING, prev != job.target)
+      << "Resync " << job.reqtoken << " ended at " << prev
+      << " instead of " << job.target << ", race condition?";
+
+  return true;
+}
+
+} // namespace xayax
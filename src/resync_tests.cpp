@@ -0,0 +1,166 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/resync.hpp"
+
+#include "private/zmqpub.hpp"
+#include "testutils.hpp"
+
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+namespace xayax
+{
+namespace
+{
+
+/**
+ * Address for the ZMQ socket in tests.  While we could use some non-TCP
+ * method here for testing, using TCP is closer to what will be used in
+ * production (and doesn't really hurt us much).
+ */
+constexpr const char* ZMQ_ADDR = "tcp://127.0.0.1:49837";
+
+/** Game ID we use for testing.  */
+const std::string GAME_ID = "game";
+
+class ResyncStreamerTests : public testing::Test
+{
+
+private:
+
+  ZmqPub pub;
+
+protected:
+
+  TestBaseChain base;
+  TestZmqSubscriber sub;
+
+  /** The streamer, with a chunk size of three blocks.  */
+  ResyncStreamer streamer;
+
+  /** The genesis block of the test chain.  */
+  BlockData genesis;
+
+  ResyncStreamerTests ()
+    : pub(ZMQ_ADDR, 0), sub(ZMQ_ADDR),
+      streamer(base, pub, 3, std::chrono::milliseconds (1))
+  {
+    pub.TrackGame (GAME_ID);
+    genesis = base.SetGenesis (base.NewGenesis (0));
+
+    /* Give the ZMQ publisher and subscriber some time to get connected
+       before continuing with the test.  */
+    SleepSome ();
+  }
+
+  ~ResyncStreamerTests ()
+  {
+    /* Sleep some time before destructing the ZMQ subscriber to make
+       sure it would receive any unexpected extra messages.  */
+    SleepSome ();
+  }
+
+  /**
+   * Expects to receive notifications for the given blocks on the given
+   * topic, all with the given reqtoken.
+   */
+  void
+  ExpectBlocks (const std::string& cmd, const std::vector<BlockData>& blocks,
+                const std::string& reqtoken)
+  {
+    const auto msg = sub.AwaitMessages (cmd + " json " + GAME_ID,
+                                        blocks.size ());
+    ASSERT_EQ (msg.size (), blocks.size ());
+    for (unsigned i = 0; i < blocks.size (); ++i)
+      {
+        EXPECT_EQ (msg[i]["block"]["hash"], blocks[i].hash);
+        EXPECT_EQ (msg[i]["reqtoken"], reqtoken);
+      }
+  }
+
+};
+
+TEST_F (ResyncStreamerTests, AttachesInChunks)
+{
+  const auto branch = base.AttachBranch (genesis.hash, 10);
+  const unsigned callsBefore = base.GetBlockRangeCalls ();
+
+  ResyncStreamer::Job job;
+  job.reqtoken = "token";
+  job.gameId = GAME_ID;
+  job.forkPoint = genesis.hash;
+  job.forkHeight = genesis.height;
+  job.targetHeight = branch.back ().height;
+  job.target = branch.back ().hash;
+  streamer.Enqueue (job);
+
+  ExpectBlocks ("game-block-attach", branch, "token");
+  EXPECT_EQ (base.GetBlockRangeCalls () - callsBefore, 4);
+}
+
+TEST_F (ResyncStreamerTests, DetachesAndAttaches)
+{
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto branch = base.AttachBranch (genesis.hash, 2);
+
+  ResyncStreamer::Job job;
+  job.reqtoken = "token";
+  job.gameId = GAME_ID;
+  job.detach = {a};
+  job.forkPoint = genesis.hash;
+  job.forkHeight = genesis.height;
+  job.targetHeight = branch.back ().height;
+  job.target = branch.back ().hash;
+  streamer.Enqueue (job);
+
+  ExpectBlocks ("game-block-detach", {a}, "token");
+  ExpectBlocks ("game-block-attach", branch, "token");
+}
+
+TEST_F (ResyncStreamerTests, MultipleJobs)
+{
+  const auto branch = base.AttachBranch (genesis.hash, 2);
+
+  ResyncStreamer::Job job;
+  job.gameId = GAME_ID;
+  job.forkPoint = genesis.hash;
+  job.forkHeight = genesis.height;
+  job.targetHeight = branch.back ().height;
+  job.target = branch.back ().hash;
+
+  job.reqtoken = "first";
+  streamer.Enqueue (job);
+  job.reqtoken = "second";
+  streamer.Enqueue (job);
+
+  ExpectBlocks ("game-block-attach", branch, "first");
+  ExpectBlocks ("game-block-attach", branch, "second");
+}
+
+TEST_F (ResyncStreamerTests, AbortsOnMismatch)
+{
+  /* The base chain has reorged away from the fork point that the job
+     would attach from, so no attaches are sent at all.  */
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto branch = base.AttachBranch (genesis.hash, 5);
+
+  ResyncStreamer::Job job;
+  job.reqtoken = "token";
+  job.gameId = GAME_ID;
+  job.forkPoint = a.hash;
+  job.forkHeight = a.height;
+  job.targetHeight = branch.back ().height;
+  job.target = branch.back ().hash;
+  streamer.Enqueue (job);
+
+  SleepSome ();
+}
+
+} // anonymous namespace
+} // namespace xayax
@@ -9,8 +9,13 @@
 #include <jsonrpccpp/client/connectors/httpclient.h>
 
 #include <chrono>
+#include <exception>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace xayax
 {
@@ -26,8 +31,9 @@ RpcHeaders ParseRpcHeaders (const std::string& str);
 
 /**
  * Simple wrapper around a JSON-RPC connection to some HTTP endpoint.
- * We use a fresh instance of this every time we need one, just for simplicity
- * and to ensure thread safety.
+ * An instance must not be used by multiple threads at the same time.
+ * It keeps its HTTP connection alive between calls, so reusing instances
+ * (e.g. through a RpcClientPool) avoids reconnecting for every request.
  */
 template <typename T, jsonrpc::clientVersion_t V>
   class RpcClient
@@ -82,6 +88,163 @@ public:
 
 };
 
+/**
+ * Thread-safe pool of RpcClient instances for a given endpoint.  Clients
+ * are checked out for the duration of some work (through a Handle), and
+ * returned to the pool afterwards, so that their keep-alive connections
+ * can be reused by later requests.
+ *
+ * Checking out never blocks:  If no idle client is available, a new one
+ * is created.  At most a given number of idle clients is kept in the pool,
+ * and further ones are just destructed when returned.
+ */
+template <typename T, jsonrpc::clientVersion_t V>
+  class RpcClientPool
+{
+
+public:
+
+  using Client = RpcClient<T, V>;
+
+  /**
+   * Function that is called to configure each newly created client
+   * (e.g. to set timeouts or headers).
+   */
+  using SetupFcn = std::function<void (Client&)>;
+
+  class Handle;
+
+private:
+
+  /** The endpoint we connect to.  */
+  const std::string endpoint;
+
+  /** Maximum number of idle clients kept around.  */
+  const size_t maxIdle;
+
+  /** Setup function for new clients.  */
+  const SetupFcn setup;
+
+  /** Lock for the list of idle clients.  */
+  std::mutex mut;
+
+  /** The currently idle clients.  */
+  std::vector<std::unique_ptr<Client>> idle;
+
+  /**
+   * Takes out an idle client, or creates a new one if there is none.
+   */
+  std::unique_ptr<Client>
+  Checkout ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      if (!idle.empty ())
+        {
+          auto res = std::move (idle.back ());
+          idle.pop_back ();
+          return res;
+        }
+    }
+
+    auto res = std::make_unique<Client> (endpoint);
+    if (setup)
+      setup (*res);
+    return res;
+  }
+
+  /**
+   * Returns a client to the pool after it has been used.
+   */
+  void
+  Return (std::unique_ptr<Client> c)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    if (idle.size () < maxIdle)
+      idle.push_back (std::move (c));
+  }
+
+public:
+
+  explicit RpcClientPool (const std::string& ep, const size_t m,
+                          const SetupFcn& s)
+    : endpoint(ep), maxIdle(m), setup(s)
+  {}
+
+  RpcClientPool () = delete;
+  RpcClientPool (const RpcClientPool&) = delete;
+  void operator= (const RpcClientPool&) = delete;
+
+  const std::string&
+  GetEndpoint () const
+  {
+    return endpoint;
+  }
+
+  /**
+   * Returns the number of idle clients currently in the pool.
+   */
+  size_t
+  GetNumIdle ()
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return idle.size ();
+  }
+
+};
+
+/**
+ * A client checked out from a RpcClientPool, which is returned to the pool
+ * when the handle is destructed.  If the handle is destructed due to an
+ * exception (e.g. an RPC error), then the client is discarded instead, so
+ * that later requests use a fresh connection.
+ */
+template <typename T, jsonrpc::clientVersion_t V>
+  class RpcClientPool<T, V>::Handle
+{
+
+private:
+
+  /** The pool this belongs to.  */
+  RpcClientPool& pool;
+
+  /** The checked-out client.  */
+  std::unique_ptr<Client> client;
+
+  /** Number of uncaught exceptions when this was constructed.  */
+  const int uncaught;
+
+public:
+
+  explicit Handle (RpcClientPool& p)
+    : pool(p), client(pool.Checkout ()),
+      uncaught(std::uncaught_exceptions ())
+  {}
+
+  ~Handle ()
+  {
+    if (client != nullptr && std::uncaught_exceptions () <= uncaught)
+      pool.Return (std::move (client));
+  }
+
+  Handle () = delete;
+  Handle (const Handle&) = delete;
+  void operator= (const Handle&) = delete;
+
+  T&
+  operator* ()
+  {
+    return **client;
+  }
+
+  T*
+  operator-> ()
+  {
+    return &**client;
+  }
+
+};
+
 } // namespace xayax
 
 #endif // XAYAX_RPCUTILS_HPP
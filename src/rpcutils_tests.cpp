@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 
+#include <stdexcept>
+
 namespace xayax
 {
 namespace
@@ -55,5 +57,106 @@ TEST_F (ParseRpcHeadersTests, InvalidTailIgnored)
   Expect ("abc=xyz;foo;1=2", {{"abc", "xyz"}});
 }
 
+/* ************************************************************************** */
+
+/**
+ * Dummy "RPC client" type that we use to test the pool.  It never
+ * actually does any calls, but records an ID per instance.
+ */
+class DummyClient
+{
+
+private:
+
+  /** Counter for assigning IDs.  */
+  static unsigned nextId;
+
+public:
+
+  /** This instance's ID.  */
+  const unsigned id;
+
+  explicit DummyClient (jsonrpc::IClientConnector& conn,
+                        const jsonrpc::clientVersion_t v)
+    : id(nextId++)
+  {}
+
+};
+
+unsigned DummyClient::nextId = 0;
+
+using DummyPool = RpcClientPool<DummyClient, jsonrpc::JSONRPC_CLIENT_V2>;
+
+class RpcClientPoolTests : public testing::Test
+{
+
+protected:
+
+  /** Number of times the setup function was called.  */
+  unsigned numSetup = 0;
+
+  DummyPool pool;
+
+  RpcClientPoolTests ()
+    : pool("http://localhost:1", 2, [this] (DummyPool::Client& c)
+        {
+          ++numSetup;
+        })
+  {}
+
+};
+
+TEST_F (RpcClientPoolTests, ReusesClients)
+{
+  unsigned id;
+  {
+    DummyPool::Handle h(pool);
+    id = h->id;
+  }
+  EXPECT_EQ (pool.GetNumIdle (), 1);
+
+  {
+    DummyPool::Handle h(pool);
+    EXPECT_EQ (h->id, id);
+    EXPECT_EQ (pool.GetNumIdle (), 0);
+  }
+
+  EXPECT_EQ (numSetup, 1);
+}
+
+TEST_F (RpcClientPoolTests, ConcurrentCheckouts)
+{
+  {
+    DummyPool::Handle h1(pool);
+    DummyPool::Handle h2(pool);
+    DummyPool::Handle h3(pool);
+    EXPECT_NE (h1->id, h2->id);
+    EXPECT_NE (h1->id, h3->id);
+    EXPECT_NE (h2->id, h3->id);
+  }
+  EXPECT_EQ (numSetup, 3);
+
+  /* At most two idle clients are kept.  */
+  EXPECT_EQ (pool.GetNumIdle (), 2);
+}
+
+TEST_F (RpcClientPoolTests, DiscardedOnException)
+{
+  try
+    {
+      DummyPool::Handle h(pool);
+      throw std::runtime_error ("RPC error");
+    }
+  catch (const std::runtime_error& exc)
+    {}
+  EXPECT_EQ (pool.GetNumIdle (), 0);
+
+  {
+    DummyPool::Handle h(pool);
+  }
+  EXPECT_EQ (pool.GetNumIdle (), 1);
+  EXPECT_EQ (numSetup, 2);
+}
+
 } // anonymous namespace
 } // namespace xayax
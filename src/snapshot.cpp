@@ -0,0 +1,125 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/snapshot.hpp"
+
+#include "private/compression.hpp"
+#include "proto/blockdata.pb.h"
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace xayax
+{
+
+bool
+WriteSnapshot (const std::string& file, const std::string& chain,
+               const std::vector<std::string>& blocks)
+{
+  proto::Snapshot snapshot;
+  snapshot.set_chain (chain);
+
+  /* The stored data may be compressed with a local dictionary, which
+     the importing instance does not necessarily have.  Thus we always
+     put the raw blocks into the snapshot.  */
+  for (const auto& data : blocks)
+    {
+      std::string raw;
+      const std::string* pb = &data;
+      if (DecompressBlockData (data, raw))
+        pb = &raw;
+      CHECK (snapshot.add_blocks ()->ParseFromString (*pb))
+          << "Failed to parse stored block data";
+    }
+
+  const std::string tmpFile = file + ".tmp";
+  {
+    std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+    if (!out || !snapshot.SerializeToOstream (&out) || !out.flush ())
+      {
+        LOG (WARNING) << "Failed to write snapshot to " << tmpFile;
+        std::remove (tmpFile.c_str ());
+        return false;
+      }
+  }
+  if (std::rename (tmpFile.c_str (), file.c_str ()) != 0)
+    {
+      LOG (WARNING) << "Failed to rename snapshot file to " << file;
+      std::remove (tmpFile.c_str ());
+      return false;
+    }
+
+  LOG (INFO)
+      << "Wrote snapshot with " << blocks.size () << " blocks to " << file;
+  return true;
+}
+
+std::vector<BlockData>
+ReadSnapshot (const std::string& file, const std::string& chain)
+{
+  proto::Snapshot snapshot;
+  {
+    std::ifstream in(file, std::ios::binary);
+    CHECK (in) << "Failed to open snapshot file " << file;
+    CHECK (snapshot.ParseFromIstream (&in))
+        << "Failed to parse snapshot file " << file;
+  }
+
+  CHECK_EQ (snapshot.chain (), chain)
+      << "Chain mismatch between connected base chain and the snapshot";
+  CHECK_GT (snapshot.blocks_size (), 0) << "Snapshot " << file << " is empty";
+
+  std::vector<BlockData> res;
+  for (const auto& pb : snapshot.blocks ())
+    {
+      std::string data;
+      CHECK (pb.SerializeToString (&data));
+
+      BlockData blk;
+      blk.Deserialise (data);
+
+      if (!res.empty ())
+        {
+          const auto& prev = res.back ();
+          CHECK_EQ (blk.parent, prev.hash)
+              << "Block " << blk.hash << " in the snapshot does not build"
+              << " on the previous block";
+          CHECK_EQ (blk.height, prev.height + 1)
+              << "Height mismatch for block " << blk.hash
+              << " in the snapshot";
+        }
+
+      res.push_back (std::move (blk));
+    }
+
+  LOG (INFO)
+      << "Read snapshot with " << res.size () << " blocks from height "
+      << res.front ().height << " to " << res.back ().height;
+
+  return res;
+}
+
+void
+ImportSnapshot (Chainstate& state, const std::string& chain,
+                const std::vector<BlockData>& blocks)
+{
+  CHECK (!blocks.empty ());
+  CHECK_EQ (state.GetTipHeight (), -1)
+      << "Snapshots can only be imported into an empty chainstate";
+
+  Chainstate::UpdateBatch upd(state);
+  state.SetChain (chain);
+  state.ImportTip (blocks.front ());
+  CHECK (state.AttachLinearRange (blocks.begin () + 1, blocks.end ()))
+      << "Failed to attach the snapshot blocks";
+  upd.Commit ();
+
+  LOG (INFO)
+      << "Imported snapshot up to tip " << blocks.back ().hash
+      << " at height " << blocks.back ().height;
+}
+
+} // namespace xayax
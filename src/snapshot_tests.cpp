@@ -0,0 +1,180 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/snapshot.hpp"
+
+#include "private/chainstate.hpp"
+#include "proto/blockdata.pb.h"
+#include "testutils.hpp"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <experimental/filesystem>
+#include <fstream>
+
+namespace xayax
+{
+namespace
+{
+
+namespace fs = std::experimental::filesystem;
+
+/* ************************************************************************** */
+
+class SnapshotTests : public testing::Test
+{
+
+protected:
+
+  /** Source of blocks for the test.  */
+  TestBaseChain base;
+
+  /** The chainstate from which snapshots are exported.  */
+  Chainstate source;
+
+  /** Temporary file for the snapshot.  */
+  const fs::path file;
+
+  SnapshotTests ()
+    : source(":memory:"), file(std::tmpnam (nullptr))
+  {
+    source.SetChain ("test");
+  }
+
+  ~SnapshotTests ()
+  {
+    fs::remove (file);
+  }
+
+  /**
+   * Attaches a new block onto the base chain and the source chainstate.
+   */
+  BlockData
+  Attach (BlockData blk)
+  {
+    blk = base.SetTip (blk);
+    std::string oldTip;
+    CHECK (source.SetTip (blk, oldTip));
+    return blk;
+  }
+
+  /**
+   * Writes a snapshot from the source chainstate.
+   */
+  void
+  Export ()
+  {
+    ASSERT_TRUE (WriteSnapshot (file.string (), source.GetChain (),
+                                source.GetMainchainData ()));
+  }
+
+};
+
+TEST_F (SnapshotTests, RoundTrip)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (10));
+  source.ImportTip (genesis);
+
+  auto blk = base.NewBlock ();
+  MoveData mv;
+  mv.txid = "tx";
+  mv.ns = "p";
+  mv.name = "domob";
+  mv.mv = R"({"g":{"x":42}})";
+  blk.moves.push_back (mv);
+  const auto a = Attach (blk);
+  const auto b = Attach (base.NewBlock ());
+  source.Prune (10);
+
+  Export ();
+  const auto blocks = ReadSnapshot (file.string (), "test");
+  ASSERT_EQ (blocks.size (), 2);
+  EXPECT_EQ (blocks[0], a);
+  EXPECT_EQ (blocks[1], b);
+
+  Chainstate target(":memory:");
+  ImportSnapshot (target, "test", blocks);
+  target.SanityCheck ();
+
+  EXPECT_EQ (target.GetChain (), "test");
+  EXPECT_EQ (target.GetLowestUnprunedHeight (), 11);
+  EXPECT_EQ (target.GetTipHeight (), 12);
+  std::string hash;
+  ASSERT_TRUE (target.GetHashForHeight (11, hash));
+  EXPECT_EQ (hash, a.hash);
+  ASSERT_TRUE (target.GetHashForHeight (12, hash));
+  EXPECT_EQ (hash, b.hash);
+
+  /* The target can be extended as usual.  */
+  const auto c = base.SetTip (base.NewBlock ());
+  std::string oldTip;
+  ASSERT_TRUE (target.SetTip (c, oldTip));
+  EXPECT_EQ (oldTip, b.hash);
+}
+
+TEST_F (SnapshotTests, OnlyMainchain)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  source.ImportTip (genesis);
+  const auto a = Attach (base.NewBlock ());
+  Attach (base.NewBlock ());
+  const auto c = Attach (base.NewBlock (a.hash));
+
+  Export ();
+  const auto blocks = ReadSnapshot (file.string (), "test");
+  ASSERT_EQ (blocks.size (), 3);
+  EXPECT_EQ (blocks[0], genesis);
+  EXPECT_EQ (blocks[1], a);
+  EXPECT_EQ (blocks[2], c);
+}
+
+TEST_F (SnapshotTests, WriteFailure)
+{
+  source.ImportTip (base.SetGenesis (base.NewGenesis (0)));
+  EXPECT_FALSE (WriteSnapshot ("/does/not/exist/snapshot", "test",
+                               source.GetMainchainData ()));
+}
+
+TEST_F (SnapshotTests, ChainMismatch)
+{
+  source.ImportTip (base.SetGenesis (base.NewGenesis (0)));
+  Export ();
+  EXPECT_DEATH (ReadSnapshot (file.string (), "other"), "Chain mismatch");
+}
+
+TEST_F (SnapshotTests, NotLinked)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  const auto a = base.SetTip (base.NewBlock ());
+  const auto b = base.SetTip (base.NewBlock ());
+
+  /* Write a snapshot with the middle block missing.  */
+  proto::Snapshot snapshot;
+  snapshot.set_chain ("test");
+  for (const auto& blk : {genesis, b})
+    CHECK (snapshot.add_blocks ()->ParseFromString (blk.Serialise ()));
+  {
+    std::ofstream out(file.string (), std::ios::binary);
+    CHECK (snapshot.SerializeToOstream (&out));
+  }
+
+  EXPECT_DEATH (ReadSnapshot (file.string (), "test"), "does not build");
+}
+
+TEST_F (SnapshotTests, ImportIntoExistingState)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  source.ImportTip (genesis);
+  Export ();
+  const auto blocks = ReadSnapshot (file.string (), "test");
+
+  EXPECT_DEATH (ImportSnapshot (source, "test", blocks), "empty chainstate");
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xayax
@@ -4,11 +4,18 @@
 
 #include "private/sync.hpp"
 
+#include "metrics.hpp"
+#include "private/executor.hpp"
+#include "private/tracing.hpp"
+
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <iterator>
+#include <utility>
 
 namespace xayax
 {
@@ -17,6 +24,9 @@ DEFINE_int32 (xayax_block_range, 128,
               "maximum number of blocks to process at once");
 DEFINE_int32 (xayax_update_timeout_ms, 5'000,
               "time in ms between forced sync updates");
+DEFINE_int32 (xayax_sync_prefetch, 4,
+              "number of block ranges to request in parallel from the"
+              " base chain while catching up (0 to disable)");
 
 namespace
 {
@@ -28,10 +38,100 @@ namespace
  */
 constexpr auto WAIT_BETWEEN_STEPS = std::chrono::milliseconds (1);
 
+/**
+ * The metrics exported by the sync worker.
+ */
+struct SyncMetrics
+{
+
+  MetricsHistogram& stepTime;
+  MetricsHistogram& stepBlocks;
+  MetricsCounter& blocksAttached;
+  MetricsCounter& lockHeldMicros;
+  MetricsCounter& forkProbes;
+  MetricsGauge& tipHeight;
+  MetricsGauge& baseTipHeight;
+
+  SyncMetrics ()
+    : SyncMetrics(MetricsRegistry::Get ())
+  {}
+
+  explicit SyncMetrics (MetricsRegistry& reg)
+    : stepTime(reg.GetHistogram ("xayax_sync_step_seconds",
+                                 "Duration of sync update steps")),
+      stepBlocks(reg.GetHistogram ("xayax_sync_step_blocks",
+                                   "Number of blocks received per sync step",
+                                   {}, MetricsRegistry::SizeBuckets ())),
+      blocksAttached(reg.GetCounter ("xayax_sync_blocks_attached_total",
+                                     "Number of blocks attached by the sync")),
+      lockHeldMicros(reg.GetCounter (
+          "xayax_sync_lock_held_microseconds_total",
+          "Time the sync held the chain lock exclusively")),
+      forkProbes(reg.GetCounter (
+          "xayax_sync_fork_probes_total",
+          "Number of header lookups made to locate fork points")),
+      tipHeight(reg.GetGauge ("xayax_sync_tip_height",
+                              "Height of the synced chainstate tip")),
+      baseTipHeight(reg.GetGauge ("xayax_sync_base_tip_height",
+                                  "Tip height of the base chain as seen"
+                                  " by the sync"))
+  {}
+
+};
+
+SyncMetrics&
+GetSyncMetrics ()
+{
+  static SyncMetrics metrics;
+  return metrics;
+}
+
+/**
+ * RAII helper that measures the time between its construction and
+ * destruction and adds it (in microseconds) to a counter and the
+ * corresponding metric.  It is used to track how long we hold the chain
+ * mutex; for that, it must be declared after the lock so that it is
+ * destructed before the unlock.
+ */
+class LockTimer
+{
+
+private:
+
+  /** The counter to add the time to.  */
+  std::atomic<uint64_t>& total;
+
+  /** The time when this instance was created.  */
+  const std::chrono::steady_clock::time_point start;
+
+public:
+
+  explicit LockTimer (std::atomic<uint64_t>& t)
+    : total(t), start(std::chrono::steady_clock::now ())
+  {}
+
+  ~LockTimer ()
+  {
+    const auto elapsed = std::chrono::steady_clock::now () - start;
+    const uint64_t micros
+        = std::chrono::duration_cast<std::chrono::microseconds> (
+            elapsed).count ();
+    total += micros;
+    GetSyncMetrics ().lockHeldMicros.Inc (micros);
+  }
+
+  LockTimer () = delete;
+  LockTimer (const LockTimer&) = delete;
+  void operator= (const LockTimer&) = delete;
+
+};
+
 } // anonymous namespace
 
-Sync::Sync (BaseChain& b, Chainstate& c, std::mutex& mutC, const uint64_t pd)
-  : base(b), chain(c), mutChain(mutC), pruningDepth(pd)
+Sync::Sync (BaseChain& b, Chainstate& c, std::shared_mutex& mutC,
+            const uint64_t pd)
+  : base(b), chain(c), mutChain(mutC), pruningDepth(pd),
+    blocksAttached(0), lockHeldMicros(0), catchingUp(false)
 {}
 
 Sync::~Sync ()
@@ -47,6 +147,9 @@ Sync::~Sync ()
       updater.reset ();
     }
   mut.unlock ();
+
+  /* Background fetches may still reference this instance.  */
+  DropPrefetched ();
 }
 
 void
@@ -58,10 +161,13 @@ Sync::Start ()
   shouldStop = false;
   numBlocks = 1;
   nextStartHeight = -1;
+  forkSearchHeight = -1;
+  catchingUp = false;
+  tipHint.clear ();
 
   try
     {
-      std::lock_guard<std::mutex> lockChain(mutChain);
+      std::lock_guard<std::shared_mutex> lockChain(mutChain);
       chain.SetChain (base.GetChain ());
     }
   catch (const std::exception& exc)
@@ -111,6 +217,14 @@ Sync::NewBaseChainTip ()
   cv.notify_all ();
 }
 
+void
+Sync::NewBaseChainTip (const std::string& tip)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  tipHint = tip;
+  cv.notify_all ();
+}
+
 void
 Sync::SetCallbacks (Callbacks* c)
 {
@@ -118,6 +232,53 @@ Sync::SetCallbacks (Callbacks* c)
   cb = c;
 }
 
+void
+Sync::GetStats (uint64_t& blocks, uint64_t& lockMicros) const
+{
+  blocks = blocksAttached;
+  lockMicros = lockHeldMicros;
+}
+
+void
+Sync::StartCatchUpStep ()
+{
+  if (!catchingUp)
+    {
+      catchingUp = true;
+      catchUpSteps = 0;
+      catchUpStart = std::chrono::steady_clock::now ();
+      catchUpBlocksStart = blocksAttached;
+      catchUpLockMicrosStart = lockHeldMicros;
+    }
+
+  ++catchUpSteps;
+}
+
+void
+Sync::FinishCatchUp (const uint64_t tipHeight)
+{
+  CHECK (catchingUp);
+  catchingUp = false;
+
+  /* A single step is just the normal processing of a new tip, which we do
+     not want to log about every time.  */
+  if (catchUpSteps <= 1)
+    return;
+
+  const auto elapsed = std::chrono::steady_clock::now () - catchUpStart;
+  const double seconds
+      = std::chrono::duration_cast<std::chrono::microseconds> (
+          elapsed).count () / 1e6;
+  const uint64_t blocks = blocksAttached - catchUpBlocksStart;
+  const uint64_t lockMicros = lockHeldMicros - catchUpLockMicrosStart;
+
+  LOG (INFO)
+      << "Caught up to height " << tipHeight << ": "
+      << blocks << " blocks in " << catchUpSteps << " steps and "
+      << seconds << " s (" << (seconds > 0 ? blocks / seconds : 0.0)
+      << " blocks/s), chain lock held for " << lockMicros / 1e3 << " ms";
+}
+
 void
 Sync::IncreaseNumBlocks ()
 {
@@ -125,10 +286,148 @@ Sync::IncreaseNumBlocks ()
   numBlocks = std::min<unsigned> (FLAGS_xayax_block_range, numBlocks << 1);
 }
 
+std::vector<BlockData>
+Sync::GetSerialisedRange (const uint64_t start, const unsigned count)
+{
+  auto res = base.GetBlockRange (start, count);
+  for (auto& blk : res)
+    blk.CacheSerialised ();
+  return res;
+}
+
+void
+Sync::DropPrefetched ()
+{
+  /* The futures from the executor do not block on destruction, so we wait
+     explicitly for requests still in flight to finish.  */
+  for (auto& p : prefetched)
+    p.blocks.wait ();
+  prefetched.clear ();
+}
+
+std::vector<BlockData>
+Sync::FetchBlockRange (const uint64_t start, const unsigned count,
+                       const uint64_t baseTip, const uint64_t genesisHeight)
+{
+  std::vector<BlockData> res;
+  if (!prefetched.empty () && prefetched.front ().start == start
+        && prefetched.front ().count == count)
+    {
+      VLOG (1) << "Using prefetched block range from " << start;
+      PrefetchedRange cur = std::move (prefetched.front ());
+      prefetched.pop_front ();
+      res = cur.blocks.get ();
+    }
+  else
+    {
+      /* If we have prefetched ranges that do not match what we need now
+         (e.g. because of a reorg or fast catch-up), drop them.  */
+      LOG_IF (INFO, !prefetched.empty ())
+          << "Dropping " << prefetched.size () << " prefetched block ranges";
+      DropPrefetched ();
+      res = GetSerialisedRange (start, count);
+    }
+
+  /* We only prefetch while catching up in full-size steps, and not if we
+     will just reimport a new tip anyway after the current range.  */
+  CHECK_GE (FLAGS_xayax_sync_prefetch, 0) << "Invalid --xayax_sync_prefetch";
+  if (res.size () < count
+        || count < static_cast<unsigned> (FLAGS_xayax_block_range)
+        || start + count - 1 < genesisHeight)
+    return res;
+
+  /* Each prefetched range starts at the last block of the previous one.
+     That way, the fork check in UpdateStep works for it as usual.  We only
+     request ranges that are fully available on the base chain; the last one
+     touching the tip is always requested directly.  */
+  uint64_t next = start + count - 1;
+  if (!prefetched.empty ())
+    next = prefetched.back ().start + count - 1;
+  while (prefetched.size () < static_cast<unsigned> (FLAGS_xayax_sync_prefetch)
+            && next + count <= baseTip + 1)
+    {
+      VLOG (1)
+          << "Prefetching " << count << " blocks from " << next
+          << " from the base chain";
+
+      PrefetchedRange cur;
+      cur.start = next;
+      cur.count = count;
+      cur.blocks = Executor::Shared ().Submit ([this, next, count] ()
+        {
+          return GetSerialisedRange (next, count);
+        });
+      prefetched.push_back (std::move (cur));
+
+      next += count - 1;
+    }
+
+  return res;
+}
+
+bool
+Sync::MatchesBaseChain (const uint64_t height)
+{
+  std::string ours;
+  if (!chain.GetHashForHeight (height, ours))
+    return false;
+
+  GetSyncMetrics ().forkProbes.Inc ();
+  const auto headers = base.GetBlockHeaders (height, 1);
+  return !headers.empty () && headers.front ().hash == ours;
+}
+
+uint64_t
+Sync::LocateForkPoint (const uint64_t mismatch)
+{
+  TraceSpan span("sync.fork_point");
+
+  /* We hold a shared lock for the entire search, so that the chainstate
+     (in particular the lowest unpruned height) stays consistent between
+     the probes.  Otherwise the background pruner could prune a height we
+     are about to check, which would then look like a mismatch.  This only
+     blocks other writers (i.e. the pruner), not readers.  */
+  std::shared_lock<std::shared_mutex> lock(mutChain);
+
+  const int64_t lowest = chain.GetLowestUnprunedHeight ();
+  CHECK_GE (lowest, 0);
+  const uint64_t lowestHeight = lowest;
+
+  /* hi is always a height at which our chain does not match the base chain,
+     and lo (once found) one where it does.  */
+  uint64_t hi = mismatch;
+  uint64_t lo;
+  uint64_t step = 1;
+  while (true)
+    {
+      CHECK_GT (hi, lowestHeight) << "Reorg beyond pruning depth";
+      lo = (hi - lowestHeight > step ? hi - step : lowestHeight);
+      if (MatchesBaseChain (lo))
+        break;
+      hi = lo;
+      step <<= 1;
+    }
+
+  while (hi - lo > 1)
+    {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (MatchesBaseChain (mid))
+        lo = mid;
+      else
+        hi = mid;
+    }
+
+  LOG (INFO)
+      << "Found fork point with the base chain at height " << lo
+      << " (mismatch at " << mismatch << ")";
+  return lo;
+}
+
 bool
 Sync::ImportNewTip (const uint64_t height)
 {
-  const auto blocks = base.GetBlockRange (height, 1);
+  TraceSpan span("sync.import_tip");
+  const auto blocks = GetSerialisedRange (height, 1);
   if (blocks.empty ())
     {
       LOG (WARNING)
@@ -140,7 +439,12 @@ Sync::ImportNewTip (const uint64_t height)
   CHECK_EQ (blocks.size (), 1);
   const auto& blk = blocks.front ();
 
+  std::lock_guard<std::shared_mutex> lock(mutChain);
+  LockTimer timer(lockHeldMicros);
   chain.ImportTip (blk);
+  ++blocksAttached;
+  GetSyncMetrics ().blocksAttached.Inc ();
+  GetSyncMetrics ().tipHeight.Set (blk.height);
   LOG (INFO) << "Imported new tip " << blk.hash << " from the base chain";
 
   if (cb != nullptr)
@@ -149,21 +453,113 @@ Sync::ImportNewTip (const uint64_t height)
   return true;
 }
 
+bool
+Sync::AttachNotifiedTip (const std::string& hash, uint64_t& height)
+{
+  TraceSpan span("sync.notified_tip");
+
+  std::string tip;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutChain);
+    const int64_t tipHeight = chain.GetTipHeight ();
+    if (tipHeight == -1)
+      return false;
+    CHECK (chain.GetHashForHeight (tipHeight, tip));
+    height = tipHeight;
+  }
+
+  if (hash == tip)
+    {
+      VLOG (1) << "Notified tip " << hash << " is already our tip";
+      return true;
+    }
+
+  BlockData blk;
+  try
+    {
+      if (!base.GetBlockByHash (hash, blk))
+        return false;
+    }
+  catch (const std::exception& exc)
+    {
+      LOG (WARNING) << "Error retrieving notified tip " << hash << ": "
+                    << exc.what ();
+      return false;
+    }
+  if (blk.parent != tip)
+    return false;
+  blk.CacheSerialised ();
+
+  auto& metrics = GetSyncMetrics ();
+  metrics.baseTipHeight.Set (blk.height);
+
+  std::lock_guard<std::shared_mutex> lock(mutChain);
+  LockTimer timer(lockHeldMicros);
+
+  std::string oldTip;
+  CHECK (chain.SetTip (blk, oldTip));
+  CHECK_EQ (oldTip, tip);
+  ++blocksAttached;
+  metrics.blocksAttached.Inc ();
+  metrics.tipHeight.Set (blk.height);
+  height = blk.height;
+  VLOG (1) << "Attached notified tip " << hash << " directly";
+
+  if (cb != nullptr)
+    cb->TipUpdatedFrom (oldTip, {blk});
+
+  return true;
+}
+
 bool
 Sync::UpdateStep ()
 {
-  std::lock_guard<std::mutex> lock(mutChain);
+  StartCatchUpStep ();
+  auto& metrics = GetSyncMetrics ();
+  MetricsTimer timer(metrics.stepTime);
+
+  /* If the base chain notified us about a new tip, and we are not in the
+     middle of catching up or looking for a fork point, try the fast path
+     of just attaching that block.  */
+  const std::string hint = std::move (tipHint);
+  tipHint.clear ();
+  uint64_t hintHeight;
+  if (!hint.empty () && nextStartHeight == -1 && forkSearchHeight == -1
+        && prefetched.empty () && AttachNotifiedTip (hint, hintHeight))
+    {
+      numBlocks = 1;
+      FinishCatchUp (hintHeight);
+      return false;
+    }
 
   /* Check the current height of the base chain, and what height we
      want to quick-sync to / initialise at based on the pruning depth.  */
-  const uint64_t baseTip = base.GetTipHeight ();
+  uint64_t baseTip;
+  {
+    TraceSpan span("sync.base_tip");
+    baseTip = base.GetTipHeight ();
+  }
+  metrics.baseTipHeight.Set (baseTip);
   const uint64_t genesisHeight
       = (baseTip < pruningDepth ? 0 : baseTip - pruningDepth);
 
+  /* If the previous step found that we are not on the base chain anymore,
+     find the exact fork point now, so that we can fetch the full blocks
+     right from there.  */
+  if (forkSearchHeight != -1)
+    {
+      nextStartHeight = LocateForkPoint (forkSearchHeight);
+      forkSearchHeight = -1;
+    }
+
   int64_t startHeight = nextStartHeight;
   if (nextStartHeight == -1)
     {
-      const int64_t tipHeight = chain.GetTipHeight ();
+      int64_t tipHeight;
+      {
+        std::shared_lock<std::shared_mutex> lock(mutChain);
+        tipHeight = chain.GetTipHeight ();
+      }
       if (tipHeight == -1)
         return ImportNewTip (genesisHeight);
       startHeight = tipHeight;
@@ -181,80 +577,106 @@ Sync::UpdateStep ()
   VLOG (1)
       << "Requesting " << num << " blocks from " << startHeight
       << " from the base chain";
-  const auto blocks = base.GetBlockRange (startHeight, num);
-
-  /* If we are reactivating a chain that we already have locally by
-     attaching one of the blocks in that current fork, we need to query
-     the corresponding fork branch to get the attach blocks for the
-     call to TipUpdatedFrom that precede the blocks we have queried now
-     from the base chain.  */
-  std::vector<BlockData> oldForkBranch;
-  if (!blocks.empty ())
-    chain.GetForkBranch (blocks.front ().parent, oldForkBranch);
-
-  std::string oldTip;
-  if (blocks.empty () || !chain.SetTip (blocks.front (), oldTip))
-    {
-      /* The first block does not fit to our existing chain.  We need to
-         go back and request blocks prior until we find the fork point.
-
-         Make sure that the first block can (by height) fit to our pruned chain.
-         Note that usually we would need the next block to be one *above* the
-         lowest unpruned height to fit (so we know the parent as well), but
-         there is no harm in requesting that block itself as well.  If it
-         matches the one we have, then the attach will be fine.  This also
-         covers the case of just detaches back to the lowest unpruned block.  */
-      IncreaseNumBlocks ();
-      nextStartHeight = std::max<int64_t> (chain.GetLowestUnprunedHeight (),
-                                           startHeight - num);
-      /* If this did not decrease the start height at all, it means that we are
-         already at the lowest unpruned height but that is not good enough.
-         In other words, a reorg beyond the pruning depth.  */
-      CHECK_LT (nextStartHeight, startHeight) << "Reorg beyond pruning depth";
-      return true;
-    }
-
-  /* If we managed to attach the first block, we are done looking for
-     a reorg fork point.  */
-  nextStartHeight = -1;
-
-  /* Attach the actual blocks.  We batch this update in the database,
-     so that we avoid many unnecessary disk writes while we are still
-     catching up in large chunks.  */
-  Chainstate::UpdateBatch upd(chain);
-  for (unsigned i = 1; i < blocks.size (); ++i)
-    {
-      std::string prev;
-      CHECK (chain.SetTip (blocks[i], prev));
-      CHECK_EQ (prev, blocks[i].parent);
-      CHECK_EQ (prev, blocks[i - 1].hash);
-    }
-  upd.Commit ();
-
-  /* Only notify about a new tip if we actually have a new tip.  This makes
-     sure we are not notifying for the case that only the current tip was
-     returned in our query.  */
-  if (cb != nullptr && oldTip != blocks.back ().hash)
-    {
-      std::reverse (oldForkBranch.begin (), oldForkBranch.end ());
-      for (const auto& b : blocks)
-        oldForkBranch.push_back (b);
-      cb->TipUpdatedFrom (oldTip, oldForkBranch);
-    }
-
-  /* If we received fewer blocks than requested, we are caught up.  */
-  if (blocks.size () < num)
-    {
-      numBlocks = 1;
-      return false;
-    }
+  std::vector<BlockData> blocks;
+  {
+    TraceSpan span("sync.fetch");
+    blocks = FetchBlockRange (startHeight, num, baseTip, genesisHeight);
+  }
+  metrics.stepBlocks.Observe (blocks.size ());
+
+  /* Height of the last block received, which is (if any) our new tip.  */
+  uint64_t lastHeight = 0;
+  {
+    std::lock_guard<std::shared_mutex> lock(mutChain);
+    LockTimer timer(lockHeldMicros);
+    /* This includes the TipUpdatedFrom callback and thus the spans
+       recorded by it (e.g. for pushing the ZMQ notifications).  */
+    TraceSpan span("sync.set_tip");
+
+    /* If we are reactivating a chain that we already have locally by
+       attaching one of the blocks in that current fork, we need to query
+       the corresponding fork branch to get the attach blocks for the
+       call to TipUpdatedFrom that precede the blocks we have queried now
+       from the base chain.  The full block data is only needed for
+       that call, so skip reading it if there is no callback.  */
+    std::vector<BlockData> oldForkBranch;
+    if (!blocks.empty () && cb != nullptr)
+      chain.GetForkBranch (blocks.front ().parent, oldForkBranch);
+
+    std::string oldTip;
+    if (blocks.empty () || !chain.SetTip (blocks.front (), oldTip))
+      {
+        /* The first block does not fit to our existing chain.  We need to
+           find the fork point, which is done in the next step (without
+           holding the lock, as it queries the base chain).  From there,
+           we request the blocks to attach.
+
+           The fork point can be the lowest unpruned block itself.  If it
+           matches the one we have, then the attach will be fine.  This
+           also covers the case of just detaches back to that block.  */
+        IncreaseNumBlocks ();
+        forkSearchHeight = startHeight;
+        return true;
+      }
+
+    /* If we managed to attach the first block, we are done looking for
+       a reorg fork point.  */
+    nextStartHeight = -1;
+
+    /* Attach the actual blocks.  In the common case, they just extend the
+       current tip linearly (which is now the first block), and can be
+       inserted in one go.  If not (e.g. because we are reactivating blocks
+       that we already know on a branch), attach them one by one.  We batch
+       this update in the database, so that we avoid many unnecessary disk
+       writes while we are still catching up in large chunks.  */
+    if (!chain.AttachLinearRange (blocks.begin () + 1, blocks.end ()))
+      {
+        Chainstate::UpdateBatch upd(chain);
+        for (unsigned i = 1; i < blocks.size (); ++i)
+          {
+            std::string prev;
+            CHECK (chain.SetTip (blocks[i], prev));
+            CHECK_EQ (prev, blocks[i].parent);
+            CHECK_EQ (prev, blocks[i - 1].hash);
+          }
+        upd.Commit ();
+      }
+    blocksAttached += blocks.size () - 1;
+    metrics.blocksAttached.Inc (blocks.size () - 1);
+    metrics.tipHeight.Set (blocks.back ().height);
+
+    /* Only notify about a new tip if we actually have a new tip.  This makes
+       sure we are not notifying for the case that only the current tip was
+       returned in our query.  The blocks are not needed anymore after
+       this (except for their count and the tip height), so they can be
+       moved over into the list of attaches instead of copied.  */
+    const size_t numReceived = blocks.size ();
+    lastHeight = blocks.back ().height;
+    if (cb != nullptr && oldTip != blocks.back ().hash)
+      {
+        std::reverse (oldForkBranch.begin (), oldForkBranch.end ());
+        oldForkBranch.reserve (oldForkBranch.size () + blocks.size ());
+        std::move (blocks.begin (), blocks.end (),
+                   std::back_inserter (oldForkBranch));
+        blocks.clear ();
+        cb->TipUpdatedFrom (oldTip, oldForkBranch);
+      }
+
+    /* If we received fewer blocks than requested, we are caught up.  */
+    if (numReceived < num)
+      {
+        numBlocks = 1;
+        FinishCatchUp (lastHeight);
+        return false;
+      }
+  }
 
   /* We are now guaranteed to be on the main chain per the base-chain query.
      If we are far behind the base-chain tip (more than the pruning height),
      quick-sync forward by just reimporting the new tip.  Assuming that no
      reorgs happen beyond the pruning depth, this is safe to do and will still
      ensure that all branches a GSP might be attached to are kept.  */
-  if (blocks.back ().height < genesisHeight && ImportNewTip (genesisHeight))
+  if (lastHeight < genesisHeight && ImportNewTip (genesisHeight))
     return true;
 
   /* Otherwise, we continue retrieving blocks.  */
@@ -15,10 +15,13 @@
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <shared_mutex>
 
 namespace xayax
 {
 
+DECLARE_int32 (xayax_block_range);
+DECLARE_int32 (xayax_sync_prefetch);
 DECLARE_int32 (xayax_update_timeout_ms);
 
 namespace
@@ -61,13 +64,13 @@ private:
    * Lock for the chain state, which we also use for this instance
    * and the condition variable.
    */
-  std::mutex& mutChain;
+  std::shared_mutex& mutChain;
 
   /** Current tip as of the last update notification.  */
   std::string currentTip;
 
   /** Condition variable that gets notified if the tip is updated.  */
-  std::condition_variable cv;
+  std::condition_variable_any cv;
 
   /**
    * Counter for tip-updated calls, so we can make sure there are not any
@@ -77,7 +80,7 @@ private:
 
 public:
 
-  explicit TestCallbacks (Chainstate& c, std::mutex& mC)
+  explicit TestCallbacks (Chainstate& c, std::shared_mutex& mC)
     : chain(c), mutChain(mC)
   {}
 
@@ -87,7 +90,7 @@ public:
   void
   WaitForTip (const std::string& expected)
   {
-    std::unique_lock<std::mutex> lock(mutChain);
+    std::unique_lock<std::shared_mutex> lock(mutChain);
     while (expected != GetCurrentTip (chain))
       cv.wait (lock);
   }
@@ -98,7 +101,7 @@ public:
   unsigned
   GetNumUpdateCalls () const
   {
-    std::lock_guard<std::mutex> lock(mutChain);
+    std::lock_guard<std::shared_mutex> lock(mutChain);
     return updates;
   }
 
@@ -146,7 +149,7 @@ class SyncTests : public testing::Test
 private:
 
   Chainstate chain;
-  std::mutex mutChain;
+  std::shared_mutex mutChain;
 
 protected:
 
@@ -194,7 +197,7 @@ protected:
   void
   ReadChainstate (const std::function<void (const Chainstate& c)>& fcn)
   {
-    std::lock_guard<std::mutex> lock(mutChain);
+    std::lock_guard<std::shared_mutex> lock(mutChain);
     fcn (chain);
   }
 
@@ -281,6 +284,109 @@ TEST_F (SyncTests, FastCatchup)
     });
 }
 
+TEST_F (SyncTests, PrefetchedCatchup)
+{
+  const auto oldBlockRange = FLAGS_xayax_block_range;
+  const auto oldPrefetch = FLAGS_xayax_sync_prefetch;
+  FLAGS_xayax_block_range = 8;
+  FLAGS_xayax_sync_prefetch = 3;
+
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  const auto branch1 = base.AttachBranch (genesis.hash, 10);
+  StartSync (1'000);
+  cb.WaitForTip (branch1.back ().hash);
+  StopSync ();
+
+  /* Reorg to a longer chain, such that the catch-up consists of many
+     ranges that get prefetched.  The first one will not attach, but later
+     ones need to be ignored and refetched after the reorg.  */
+  const auto branch2 = base.AttachBranch (genesis.hash, 200);
+  StartSync (1'000);
+  cb.WaitForTip (branch2.back ().hash);
+
+  ReadChainstate ([&] (const Chainstate& chain)
+    {
+      EXPECT_EQ (chain.GetLowestUnprunedHeight (), 0);
+      EXPECT_EQ (chain.GetTipHeight (), 200);
+
+      std::string hash;
+      for (unsigned i = 0; i < branch2.size (); ++i)
+        {
+          ASSERT_TRUE (chain.GetHashForHeight (i + 1, hash));
+          EXPECT_EQ (hash, branch2[i].hash);
+        }
+    });
+
+  StopSync ();
+  FLAGS_xayax_block_range = oldBlockRange;
+  FLAGS_xayax_sync_prefetch = oldPrefetch;
+}
+
+TEST_F (SyncTests, Stats)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  const auto branch = base.AttachBranch (genesis.hash, 50);
+  StartSync (1'000);
+  cb.WaitForTip (branch.back ().hash);
+
+  /* The initial import counts as one block, followed by all the
+     blocks attached on top of it.  */
+  uint64_t blocks, lockMicros;
+  sync->GetStats (blocks, lockMicros);
+  EXPECT_EQ (blocks, 51);
+  EXPECT_GT (lockMicros, 0);
+}
+
+TEST_F (SyncTests, NotifiedTip)
+{
+  /* Make sure that no updates are triggered by the timeout.  */
+  FLAGS_xayax_update_timeout_ms = 10'000;
+
+  base.SetGenesis (base.NewGenesis (0));
+  StartSync (0);
+  const auto a = base.SetTip (base.NewBlock ());
+  sync->NewBaseChainTip ();
+  cb.WaitForTip (a.hash);
+
+  /* New tips that build on the current one should be attached just by
+     retrieving them by hash.  */
+  const unsigned rangeCalls = base.GetBlockRangeCalls ();
+  BlockData blk;
+  for (unsigned i = 0; i < 5; ++i)
+    {
+      blk = base.SetTip (base.NewBlock ());
+      sync->NewBaseChainTip (blk.hash);
+      cb.WaitForTip (blk.hash);
+    }
+  EXPECT_EQ (base.GetBlockRangeCalls (), rangeCalls);
+  EXPECT_EQ (base.GetBlockByHashCalls (), 5);
+
+  /* Notifications for our current tip do not trigger anything.  */
+  const unsigned updates = cb.GetNumUpdateCalls ();
+  sync->NewBaseChainTip (blk.hash);
+  SleepSome ();
+  EXPECT_EQ (cb.GetNumUpdateCalls (), updates);
+  EXPECT_EQ (base.GetBlockRangeCalls (), rangeCalls);
+}
+
+TEST_F (SyncTests, NotifiedTipFallback)
+{
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  const auto branch = base.AttachBranch (genesis.hash, 3);
+  StartSync (10);
+  cb.WaitForTip (branch.back ().hash);
+
+  /* A reorg does not build on our tip, so the normal update is used.  */
+  const auto reorg = base.SetTip (base.NewBlock (genesis.hash));
+  sync->NewBaseChainTip (reorg.hash);
+  cb.WaitForTip (reorg.hash);
+
+  /* The same applies if the notified block is not known.  */
+  const auto blk = base.SetTip (base.NewBlock ());
+  sync->NewBaseChainTip ("unknown");
+  cb.WaitForTip (blk.hash);
+}
+
 TEST_F (SyncTests, DiscoversNewBlocks)
 {
   /* Use a smaller update timeout to speed up the test.  */
@@ -322,6 +428,33 @@ TEST_F (SyncTests, LongReorg)
   cb.WaitForTip (longBranch.back ().hash);
 }
 
+TEST_F (SyncTests, DeepReorgForkPoint)
+{
+  /* Reorg deep enough so that the fork point is found through exponential
+     step-back and a binary search that does not land exactly on one
+     of the step-back heights.  */
+  const auto genesis = base.SetGenesis (base.NewGenesis (0));
+  const auto common = base.AttachBranch (genesis.hash, 37);
+  const auto oldBranch = base.AttachBranch (common.back ().hash, 50);
+
+  StartSync (1'000);
+  cb.WaitForTip (oldBranch.back ().hash);
+  StopSync ();
+
+  const auto newBranch = base.AttachBranch (common.back ().hash, 60);
+  StartSync (1'000);
+  cb.WaitForTip (newBranch.back ().hash);
+
+  ReadChainstate ([&] (const Chainstate& c)
+    {
+      std::string hash;
+      ASSERT_TRUE (c.GetHashForHeight (common.back ().height, hash));
+      EXPECT_EQ (hash, common.back ().hash);
+      ASSERT_TRUE (c.GetHashForHeight (common.back ().height + 1, hash));
+      EXPECT_EQ (hash, newBranch.front ().hash);
+    });
+}
+
 TEST_F (SyncTests, ShortReorg)
 {
   /* Even though that is not what happens in practice typically, the
@@ -188,6 +188,13 @@ TestBaseChain::GetBlockRangeCalls () const
   return getBlockRangeCalls;
 }
 
+unsigned
+TestBaseChain::GetBlockByHashCalls () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return getBlockByHashCalls;
+}
+
 void
 TestBaseChain::Start ()
 {
@@ -257,6 +264,22 @@ TestBaseChain::GetBlockRange (const uint64_t start, const uint64_t count)
   return res;
 }
 
+bool
+TestBaseChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  MaybeThrow ();
+  std::lock_guard<std::mutex> lock(mut);
+
+  ++getBlockByHashCalls;
+
+  const auto mit = blocks.find (hash);
+  if (mit == blocks.end ())
+    return false;
+
+  blk = mit->second;
+  return true;
+}
+
 int64_t
 TestBaseChain::GetMainchainHeight (const std::string& hash)
 {
@@ -311,13 +334,14 @@ TestBaseChain::GetVersion ()
 
 /* ************************************************************************** */
 
-TestZmqSubscriber::TestZmqSubscriber (const std::string& addr)
+TestZmqSubscriber::TestZmqSubscriber (const std::string& addr,
+                                      const std::string& topic)
   : sock(ctx, ZMQ_SUB)
 {
   std::lock_guard<std::mutex> lock(mut);
 
   sock.connect (addr);
-  sock.set (zmq::sockopt::subscribe, "");
+  sock.set (zmq::sockopt::subscribe, topic);
   LOG (INFO) << "Connected ZMQ subscriber to " << addr;
 
   shouldStop = false;
@@ -381,18 +405,29 @@ TestZmqSubscriber::ReceiveLoop ()
       ASSERT_EQ (seq, nextSeq[topic]);
       ++nextSeq[topic];
 
-      /* Parse and enqueue the message.  */
-      messages[topic].push (ParseJson (data));
+      /* Enqueue the message.  It is parsed only when expected, as it
+         may be binary data.  */
+      messages[topic].push (data);
       cv.notify_all ();
     }
 }
 
 std::vector<Json::Value>
 TestZmqSubscriber::AwaitMessages (const std::string& cmd, const size_t num)
+{
+  std::vector<Json::Value> res;
+  for (const auto& data : AwaitRawMessages (cmd, num))
+    res.push_back (ParseJson (data));
+
+  return res;
+}
+
+std::vector<std::string>
+TestZmqSubscriber::AwaitRawMessages (const std::string& cmd, const size_t num)
 {
   std::unique_lock<std::mutex> lock(mut);
 
-  std::vector<Json::Value> res;
+  std::vector<std::string> res;
   while (res.size () < num)
     {
       while (messages[cmd].empty ())
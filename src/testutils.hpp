@@ -85,6 +85,8 @@ private:
 
   /** How many times GetBlockRange has been called.  */
   unsigned getBlockRangeCalls = 0;
+  /** How many times GetBlockByHash has been called.  */
+  unsigned getBlockByHashCalls = 0;
 
   /**
    * Constructs a new block hash based on our counter.
@@ -160,11 +162,17 @@ public:
    */
   unsigned GetBlockRangeCalls () const;
 
+  /**
+   * Returns how many times GetBlockByHash has been called.
+   */
+  unsigned GetBlockByHashCalls () const;
+
   void Start () override;
   bool EnablePending () override;
   uint64_t GetTipHeight () override;
   std::vector<BlockData> GetBlockRange (uint64_t start,
                                         uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
   int64_t GetMainchainHeight (const std::string& hash) override;
   std::vector<std::string> GetMempool () override;
   bool VerifyMessage (const std::string& msg, const std::string& signature,
@@ -196,8 +204,8 @@ private:
   /** Expected next sequence number for each command.  */
   std::map<std::string, unsigned> nextSeq;
 
-  /** For each command, the queue of not-yet-expected messages.  */
-  std::map<std::string, std::queue<Json::Value>> messages;
+  /** For each command, the queue of not-yet-expected raw payloads.  */
+  std::map<std::string, std::queue<std::string>> messages;
 
   /** Background thread that polls the ZMQ socket and notifies waiters.  */
   std::unique_ptr<std::thread> receiver;
@@ -213,9 +221,11 @@ private:
 public:
 
   /**
-   * Constructs the subscriber and connects it to a socket at the given address.
+   * Constructs the subscriber and connects it to a socket at the given address,
+   * subscribing to the given topic prefix (by default everything).
    */
-  explicit TestZmqSubscriber (const std::string& addr);
+  explicit TestZmqSubscriber (const std::string& addr,
+                              const std::string& topic = "");
 
   /**
    * Cleans up everything, expecting that no unexpected messages have been
@@ -229,6 +239,13 @@ public:
    */
   std::vector<Json::Value> AwaitMessages (const std::string& cmd, size_t num);
 
+  /**
+   * Expects num messages with the given topic like AwaitMessages, but
+   * returns their raw payloads instead of parsing them as JSON.
+   */
+  std::vector<std::string> AwaitRawMessages (const std::string& cmd,
+                                             size_t num);
+
   /**
    * Forgets / ignores all unexpected messages.
    */
@@ -145,6 +145,54 @@ TEST_F (TestBaseChainTests, GetMainchainHeight)
   EXPECT_EQ (bc.GetMainchainHeight (d.hash), 12);
 }
 
+TEST_F (TestBaseChainTests, DefaultHeaderLookups)
+{
+  const auto genesis = bc.SetGenesis (bc.NewGenesis (10));
+  auto a = bc.NewBlock ();
+  a.moves.emplace_back ();
+  a.moves.back ().ns = "g";
+  a.moves.back ().name = "domob";
+  bc.SetTip (a);
+  const auto b = bc.SetTip (bc.NewBlock (genesis.hash));
+
+  const auto headers = bc.GetBlockHeaders (10, 5);
+  ASSERT_EQ (headers.size (), 2);
+  EXPECT_EQ (headers[0].hash, genesis.hash);
+  EXPECT_EQ (headers[1].hash, b.hash);
+  EXPECT_EQ (headers[1].parent, genesis.hash);
+
+  bc.SetTip (a);
+  const auto withMoves = bc.GetBlockRange (11, 1);
+  ASSERT_EQ (withMoves.size (), 1);
+  EXPECT_EQ (withMoves[0].moves.size (), 1);
+  const auto noMoves = bc.GetBlockHeaders (11, 1);
+  ASSERT_EQ (noMoves.size (), 1);
+  EXPECT_EQ (noMoves[0].hash, a.hash);
+  EXPECT_TRUE (noMoves[0].moves.empty ());
+
+  EXPECT_THAT (bc.GetMainchainHeights ({b.hash, "foo", a.hash, genesis.hash}),
+               ElementsAre (-1, -1, 11, 10));
+  EXPECT_THAT (bc.GetMainchainHeights ({}), ElementsAre ());
+}
+
+TEST_F (TestBaseChainTests, DefaultAsync)
+{
+  const auto genesis = bc.SetGenesis (bc.NewGenesis (10));
+  const auto a = bc.SetTip (bc.NewBlock ());
+  const auto b = bc.SetTip (bc.NewBlock ());
+
+  auto range = bc.GetBlockRangeAsync (10, 5);
+  auto heightA = bc.GetMainchainHeightAsync (a.hash);
+  auto heightFoo = bc.GetMainchainHeightAsync ("foo");
+  EXPECT_THAT (range.get (), ElementsAre (genesis, a, b));
+  EXPECT_EQ (heightA.get (), 11);
+  EXPECT_EQ (heightFoo.get (), -1);
+
+  bc.SetShouldThrow (true);
+  auto failed = bc.GetBlockRangeAsync (10, 1);
+  EXPECT_THROW (failed.get (), std::exception);
+}
+
 /* ************************************************************************** */
 
 } // anonymous namespace
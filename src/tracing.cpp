@@ -0,0 +1,288 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/tracing.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace xayax
+{
+
+DEFINE_bool (xayax_perf_tracing, false,
+             "whether to record tracing spans for the block pipeline on"
+             " startup (can be changed at runtime with setperftracing)");
+DEFINE_int32 (xayax_perf_tracing_buffer, 1'024,
+              "number of tracing spans kept per thread");
+
+/* ************************************************************************** */
+
+/**
+ * Ring buffer holding the most recent spans recorded by one thread.
+ * Its lock is only taken by the owning thread when recording, and by
+ * the tracer while collecting spans.
+ */
+class Tracer::ThreadBuffer
+{
+
+private:
+
+  /** Lock for the entries.  */
+  mutable std::mutex mut;
+
+  /** Maximum number of entries.  */
+  const size_t capacity;
+
+  /**
+   * The stored entries.  This grows up to the capacity, and then is
+   * overwritten in a circular fashion.
+   */
+  std::vector<TraceEntry> entries;
+
+  /** Index at which the next entry is written once the buffer is full.  */
+  size_t next = 0;
+
+public:
+
+  /** The index of the associated thread.  */
+  const unsigned thread;
+
+  explicit ThreadBuffer (const size_t c, const unsigned t)
+    : capacity(c), thread(t)
+  {
+    CHECK_GT (capacity, 0);
+  }
+
+  ThreadBuffer () = delete;
+  ThreadBuffer (const ThreadBuffer&) = delete;
+  void operator= (const ThreadBuffer&) = delete;
+
+  void
+  Add (const TraceEntry& e)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    if (entries.size () < capacity)
+      {
+        entries.push_back (e);
+        return;
+      }
+
+    entries[next] = e;
+    next = (next + 1) % capacity;
+  }
+
+  /**
+   * Appends all entries (oldest first) to the given vector.
+   */
+  void
+  Collect (std::vector<TraceEntry>& out) const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    out.insert (out.end (), entries.begin () + next, entries.end ());
+    out.insert (out.end (), entries.begin (), entries.begin () + next);
+  }
+
+  void
+  Clear ()
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    entries.clear ();
+    next = 0;
+  }
+
+};
+
+/**
+ * Thread-local holder of a thread's buffer, which retires it when the
+ * thread exits.
+ */
+class Tracer::ThreadHolder
+{
+
+public:
+
+  std::shared_ptr<ThreadBuffer> buffer;
+
+  ThreadHolder () = default;
+
+  ~ThreadHolder ()
+  {
+    if (buffer != nullptr)
+      Tracer::Get ().Retire (buffer);
+  }
+
+  ThreadHolder (const ThreadHolder&) = delete;
+  void operator= (const ThreadHolder&) = delete;
+
+};
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/**
+ * Returns the configured capacity of the per-thread buffers.
+ */
+size_t
+GetBufferCapacity ()
+{
+  CHECK_GT (FLAGS_xayax_perf_tracing_buffer, 0)
+      << "Invalid --xayax_perf_tracing_buffer";
+  return FLAGS_xayax_perf_tracing_buffer;
+}
+
+/**
+ * Returns the value at a given percentile (between 0 and 1) of the
+ * sorted list of values, using the nearest-rank method.
+ */
+int64_t
+Percentile (const std::vector<int64_t>& sorted, const double p)
+{
+  CHECK (!sorted.empty ());
+  const auto rank = static_cast<size_t> (std::ceil (p * sorted.size ()));
+  return sorted[std::max<size_t> (rank, 1) - 1];
+}
+
+} // anonymous namespace
+
+Tracer::Tracer ()
+  : enabled(FLAGS_xayax_perf_tracing),
+    epoch(std::chrono::steady_clock::now ()),
+    retired(std::make_unique<ThreadBuffer> (GetBufferCapacity (), 0))
+{}
+
+Tracer::~Tracer () = default;
+
+Tracer&
+Tracer::Get ()
+{
+  static Tracer instance;
+  return instance;
+}
+
+void
+Tracer::SetEnabled (const bool val)
+{
+  enabled.store (val, std::memory_order_relaxed);
+  LOG (INFO) << "Performance tracing " << (val ? "enabled" : "disabled");
+}
+
+Tracer::ThreadBuffer&
+Tracer::GetThreadBuffer ()
+{
+  thread_local ThreadHolder holder;
+
+  if (holder.buffer == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      holder.buffer = std::make_shared<ThreadBuffer> (GetBufferCapacity (),
+                                                      nextThread++);
+      buffers.push_back (holder.buffer);
+    }
+
+  return *holder.buffer;
+}
+
+void
+Tracer::Retire (const std::shared_ptr<ThreadBuffer>& buf)
+{
+  std::vector<TraceEntry> entries;
+  buf->Collect (entries);
+
+  std::lock_guard<std::mutex> lock(mut);
+  for (const auto& e : entries)
+    retired->Add (e);
+
+  buffers.erase (std::remove (buffers.begin (), buffers.end (), buf),
+                 buffers.end ());
+}
+
+void
+Tracer::Record (const char* stage,
+                const std::chrono::steady_clock::time_point start,
+                const std::chrono::steady_clock::time_point end)
+{
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+
+  auto& buf = GetThreadBuffer ();
+
+  TraceEntry e;
+  e.stage = stage;
+  e.thread = buf.thread;
+  e.start = duration_cast<microseconds> (start - epoch).count ();
+  e.duration = duration_cast<microseconds> (end - start).count ();
+  buf.Add (e);
+}
+
+std::map<std::string, TraceStageStats>
+Tracer::GetStats (const size_t numRecent) const
+{
+  std::vector<TraceEntry> entries;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    retired->Collect (entries);
+    for (const auto& buf : buffers)
+      buf->Collect (entries);
+  }
+
+  std::stable_sort (entries.begin (), entries.end (),
+                    [] (const TraceEntry& a, const TraceEntry& b)
+                      {
+                        return a.start < b.start;
+                      });
+
+  std::map<std::string, std::vector<const TraceEntry*>> perStage;
+  for (const auto& e : entries)
+    perStage[e.stage].push_back (&e);
+
+  std::map<std::string, TraceStageStats> res;
+  for (const auto& entry : perStage)
+    {
+      const auto& spans = entry.second;
+      auto& stats = res[entry.first];
+
+      std::vector<int64_t> durations;
+      durations.reserve (spans.size ());
+      for (const auto* e : spans)
+        durations.push_back (e->duration);
+      std::sort (durations.begin (), durations.end ());
+
+      int64_t total = 0;
+      for (const auto d : durations)
+        total += d;
+
+      stats.count = durations.size ();
+      stats.mean = static_cast<double> (total) / durations.size ();
+      stats.p50 = Percentile (durations, 0.5);
+      stats.p90 = Percentile (durations, 0.9);
+      stats.p99 = Percentile (durations, 0.99);
+      stats.max = durations.back ();
+
+      const size_t first
+          = spans.size () > numRecent ? spans.size () - numRecent : 0;
+      for (size_t i = first; i < spans.size (); ++i)
+        stats.recent.push_back (*spans[i]);
+    }
+
+  return res;
+}
+
+void
+Tracer::Reset ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  retired->Clear ();
+  for (const auto& buf : buffers)
+    buf->Clear ();
+}
+
+/* ************************************************************************** */
+
+} // namespace xayax
@@ -0,0 +1,151 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/tracing.hpp"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <chrono>
+#include <thread>
+
+namespace xayax
+{
+
+DECLARE_int32 (xayax_perf_tracing_buffer);
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+using std::chrono::microseconds;
+
+class TracingTests : public testing::Test
+{
+
+protected:
+
+  Tracer& tracer;
+
+  /** A fixed reference time for recording spans.  */
+  const Clock::time_point base;
+
+  TracingTests ()
+    : tracer(Tracer::Get ()), base(Clock::now ())
+  {
+    tracer.Reset ();
+    tracer.SetEnabled (true);
+  }
+
+  ~TracingTests ()
+  {
+    tracer.SetEnabled (false);
+    tracer.Reset ();
+  }
+
+  /**
+   * Records a span for the given stage starting at the given offset
+   * (in microseconds) from the base time and with the given duration.
+   */
+  void
+  Record (const char* stage, const int64_t start, const int64_t duration)
+  {
+    const auto s = base + microseconds (start);
+    tracer.Record (stage, s, s + microseconds (duration));
+  }
+
+};
+
+TEST_F (TracingTests, Disabled)
+{
+  tracer.SetEnabled (false);
+  {
+    TraceSpan span("foo");
+  }
+  EXPECT_TRUE (tracer.GetStats (10).empty ());
+
+  tracer.SetEnabled (true);
+  {
+    TraceSpan span("foo");
+  }
+  EXPECT_EQ (tracer.GetStats (10).at ("foo").count, 1);
+}
+
+TEST_F (TracingTests, Percentiles)
+{
+  for (int i = 1; i <= 100; ++i)
+    Record ("foo", i, 101 - i);
+  Record ("bar", 0, 42);
+
+  const auto stats = tracer.GetStats (3);
+  ASSERT_EQ (stats.size (), 2);
+
+  const auto& foo = stats.at ("foo");
+  EXPECT_EQ (foo.count, 100);
+  EXPECT_DOUBLE_EQ (foo.mean, 50.5);
+  EXPECT_EQ (foo.p50, 50);
+  EXPECT_EQ (foo.p90, 90);
+  EXPECT_EQ (foo.p99, 99);
+  EXPECT_EQ (foo.max, 100);
+
+  ASSERT_EQ (foo.recent.size (), 3);
+  EXPECT_EQ (foo.recent[0].duration, 3);
+  EXPECT_EQ (foo.recent[2].duration, 1);
+  EXPECT_LT (foo.recent[0].start, foo.recent[1].start);
+
+  const auto& bar = stats.at ("bar");
+  EXPECT_EQ (bar.count, 1);
+  EXPECT_EQ (bar.p50, 42);
+  EXPECT_EQ (bar.p99, 42);
+  ASSERT_EQ (bar.recent.size (), 1);
+  EXPECT_EQ (std::string (bar.recent[0].stage), "bar");
+}
+
+TEST_F (TracingTests, RingBuffer)
+{
+  /* The buffer size is read when a thread's buffer is created, so we
+     record from a fresh thread.  */
+  FLAGS_xayax_perf_tracing_buffer = 5;
+  std::thread ([this] ()
+    {
+      for (int i = 0; i < 20; ++i)
+        Record ("foo", i, i);
+    }).join ();
+  FLAGS_xayax_perf_tracing_buffer = 1'024;
+
+  const auto stats = tracer.GetStats (10);
+  const auto& foo = stats.at ("foo");
+  EXPECT_EQ (foo.count, 5);
+  EXPECT_EQ (foo.max, 19);
+  ASSERT_EQ (foo.recent.size (), 5);
+  EXPECT_EQ (foo.recent.front ().duration, 15);
+}
+
+TEST_F (TracingTests, MultipleThreads)
+{
+  Record ("foo", 0, 1);
+  std::thread ([this] ()
+    {
+      Record ("foo", 1, 2);
+    }).join ();
+  std::thread ([this] ()
+    {
+      Record ("foo", 2, 3);
+    }).join ();
+
+  const auto stats = tracer.GetStats (10);
+  const auto& foo = stats.at ("foo");
+  EXPECT_EQ (foo.count, 3);
+  ASSERT_EQ (foo.recent.size (), 3);
+  EXPECT_NE (foo.recent[0].thread, foo.recent[1].thread);
+  EXPECT_NE (foo.recent[1].thread, foo.recent[2].thread);
+
+  tracer.Reset ();
+  EXPECT_TRUE (tracer.GetStats (10).empty ());
+}
+
+} // anonymous namespace
+} // namespace xayax
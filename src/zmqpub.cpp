@@ -4,30 +4,162 @@
 
 #include "private/zmqpub.hpp"
 
-#include <univalue.h>
-
+#include "metrics.hpp"
+#include "private/compression.hpp"
+#include "private/jsonutils.hpp"
+#include "private/movejson.hpp"
+#include "private/tracing.hpp"
+#include "proto/blockdata.pb.h"
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cstring>
+#include <future>
 #include <map>
-#include <sstream>
+#include <set>
+#include <thread>
+#include <vector>
 
 namespace xayax
 {
 
+DEFINE_int32 (xayax_zmq_payload_cache, 1'000,
+              "number of blocks for which the serialised ZMQ notifications"
+              " are cached");
+DEFINE_int32 (xayax_zmq_prepare_threads, 0,
+              "number of threads used to process the moves of a block for"
+              " ZMQ notifications (zero to use all CPU cores)");
+DEFINE_int32 (xayax_zmq_send_hwm, 1'000,
+              "high-water mark (in messages) of the ZMQ publisher socket"
+              " per subscriber, beyond which messages are dropped for that"
+              " subscriber (zero for no limit)");
+DEFINE_int32 (xayax_zmq_io_threads, 1,
+              "number of I/O threads used by the ZMQ context");
+DEFINE_int32 (xayax_zmq_queue_mb, 256,
+              "maximum size (in MiB) of the ZMQ messages queued for sending"
+              " before further ones are dropped");
+DEFINE_bool (xayax_zmq_binary, false,
+             "whether to publish block notifications also in binary form"
+             " on the 'bin' ZMQ topics");
+
 namespace
 {
 
-/** High-water mark used for sending.  */
-constexpr int SEND_HWM = 1'000;
-
 /** Topic prefix for block-attach messages.  */
 constexpr const char* PREFIX_ATTACH = "game-block-attach";
 /** Topic prefix for block-detach messages.  */
 constexpr const char* PREFIX_DETACH = "game-block-detach";
 
+/**
+ * Topic for full-block attach notifications.  They are not specific to any
+ * game but carry all moves, so that e.g. other Xaya X instances can follow
+ * this one instead of the base chain.
+ */
+constexpr const char* TOPIC_FULL_ATTACH = "block-attach bin";
+/** Topic for full-block detach notifications.  */
+constexpr const char* TOPIC_FULL_DETACH = "block-detach bin";
+
 /** Topic prefix for pending moves.  */
 constexpr const char* PREFIX_MOVE = "game-pending-move";
 
+/**
+ * Metrics for the messages sent on one topic (i.e. command prefix, not
+ * including the game ID, to keep the number of label values bounded).
+ */
+struct TopicMetrics
+{
+
+  MetricsCounter& messages;
+  MetricsCounter& bytes;
+  MetricsCounter& failures;
+  MetricsCounter& dropped;
+
+  explicit TopicMetrics (const std::string& topic)
+    : messages(MetricsRegistry::Get ().GetCounter (
+          "xayax_zmq_messages_total", "Number of ZMQ messages sent",
+          {{"topic", topic}})),
+      bytes(MetricsRegistry::Get ().GetCounter (
+          "xayax_zmq_bytes_total", "Number of bytes sent through ZMQ",
+          {{"topic", topic}})),
+      failures(MetricsRegistry::Get ().GetCounter (
+          "xayax_zmq_send_failures_total", "Number of failed ZMQ sends",
+          {{"topic", topic}})),
+      dropped(MetricsRegistry::Get ().GetCounter (
+          "xayax_zmq_dropped_total",
+          "Number of ZMQ messages dropped because the outbound queue"
+          " was full",
+          {{"topic", topic}}))
+  {}
+
+};
+
+/**
+ * Metrics about the outbound queue of the publisher.
+ */
+struct QueueMetrics
+{
+
+  MetricsGauge& length;
+  MetricsGauge& bytes;
+
+  QueueMetrics ()
+    : length(MetricsRegistry::Get ().GetGauge (
+          "xayax_zmq_queue_length",
+          "Number of ZMQ messages waiting to be sent")),
+      bytes(MetricsRegistry::Get ().GetGauge (
+          "xayax_zmq_queue_bytes",
+          "Size of the ZMQ messages waiting to be sent"))
+  {}
+
+  static QueueMetrics&
+  Get ()
+  {
+    static QueueMetrics instance;
+    return instance;
+  }
+
+};
+
+/**
+ * Returns the metrics for the topic a given command string belongs to.
+ */
+TopicMetrics&
+GetTopicMetrics (const std::string& cmd)
+{
+  static TopicMetrics attach(PREFIX_ATTACH);
+  static TopicMetrics detach(PREFIX_DETACH);
+  static TopicMetrics move(PREFIX_MOVE);
+  static TopicMetrics fullAttach(TOPIC_FULL_ATTACH);
+  static TopicMetrics fullDetach(TOPIC_FULL_DETACH);
+  static TopicMetrics other("other");
+
+  const auto hasPrefix = [&cmd] (const char* prefix)
+    {
+      return cmd.compare (0, std::strlen (prefix), prefix) == 0;
+    };
+
+  if (hasPrefix (PREFIX_ATTACH))
+    return attach;
+  if (hasPrefix (PREFIX_DETACH))
+    return detach;
+  if (hasPrefix (PREFIX_MOVE))
+    return move;
+  if (hasPrefix (TOPIC_FULL_ATTACH))
+    return fullAttach;
+  if (hasPrefix (TOPIC_FULL_DETACH))
+    return fullDetach;
+  return other;
+}
+
+/**
+ * Minimum number of moves per shard when processing the moves of a block
+ * in parallel.  Blocks with fewer moves are just processed on the
+ * calling thread, as spawning threads is not worth it for them.
+ */
+constexpr size_t MIN_MOVES_PER_SHARD = 256;
+
 /**
  * Tries to parse a given string of move data as JSON.  Returns true
  * if parsing was successful and the move is considered valid.
@@ -37,41 +169,55 @@ ParseMoveJson (const std::string& txid, const std::string& str,
                Json::Value& val)
 {
   /* Moves are the main user-provided input that we have to be very careful
-     in processing.  Univalue is used as the first line of defence in parsing
-     JSON from moves in Xaya Core as well, and it seems like a robust and
-     stable library for this task.  Thus we filter the move data through
-     Univalue first, before passing it on to jsoncpp.  */
-  UniValue value;
-  if (!value.read (str) || !value.isObject ())
+     in processing.  ReadMoveJson accepts exactly what Univalue (as the
+     first line of defence in Xaya Core) accepts, except that moves with
+     duplicate keys are rejected gracefully (just ignoring the move).  */
+  if (!ReadMoveJson (str, val))
     {
       LOG (WARNING) << "Move data for " << txid << " is invalid JSON:\n" << str;
       return false;
     }
-  const std::string filtered = value.write ();
-
-  Json::CharReaderBuilder rbuilder;
-  rbuilder["allowComments"] = false;
-  rbuilder["strictRoot"] = true;
-  rbuilder["failIfExtra"] = true;
-  /* Univalue accepts duplicate keys, so it may forward moves to
-     us that contain duplicate keys.  We need to handle them gracefully when
-     parsing.  Specifically, we reject them, but just fail (instead of
-     aborting) and ignore this move.  */
-  rbuilder["rejectDupKeys"] = true;
-
-  std::string parseErrs;
-  std::istringstream in(filtered);
-  if (!Json::parseFromStream (rbuilder, in, &val, &parseErrs))
-    {
-      LOG (WARNING)
-          << "Invalid JSON produced by Univalue (dup keys?): "
-          << parseErrs << "\n" << filtered;
-      return false;
-    }
 
   return true;
 }
 
+/**
+ * Serialises JSON for sending in a ZMQ message.
+ */
+std::string
+WriteJson (const Json::Value& data)
+{
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["commentStyle"] = "None";
+  wbuilder["indentation"] = "";
+  wbuilder["enableYAMLCompatibility"] = false;
+  wbuilder["dropNullPlaceholders"] = false;
+  wbuilder["useSpecialFloats"] = false;
+
+  return Json::writeString (wbuilder, data);
+}
+
+/**
+ * Adds the "reqtoken" field to a serialised block notification.  Since
+ * the JSON writer orders object keys and "reqtoken" comes last, this gives
+ * exactly the same result as setting it in the JSON value before
+ * serialising, but it allows us to reuse a cached payload.
+ */
+std::string
+AddReqToken (const std::string& payload, const std::string& reqtoken)
+{
+  if (reqtoken.empty ())
+    return payload;
+
+  CHECK (!payload.empty () && payload.back () == '}');
+  std::string res = payload.substr (0, payload.size () - 1);
+  res += ",\"reqtoken\":";
+  res += WriteJson (reqtoken);
+  res += '}';
+
+  return res;
+}
+
 /**
  * Extracts the metadata field of a block or move (that we got from the
  * base-chain connector directly).  If the field is set to an object, we
@@ -220,20 +366,166 @@ PerTxData::PerTxData (const MoveData& mv)
     }
 }
 
+/**
+ * Analyses all the given moves, returning the PerTxData instances for them
+ * in the same order.  For a large number of moves, the work is sharded
+ * by move index across up to maxThreads threads:  The calling one, and
+ * the workers of the given executor (which may be null if maxThreads
+ * is one).
+ */
+std::vector<std::unique_ptr<PerTxData>>
+ParseMoves (const std::vector<const MoveData*>& moves,
+            Executor* exec, const size_t maxThreads)
+{
+  size_t numThreads = std::min (maxThreads,
+                                moves.size () / MIN_MOVES_PER_SHARD);
+  numThreads = std::max<size_t> (numThreads, 1);
+
+  std::vector<std::unique_ptr<PerTxData>> res(moves.size ());
+  const auto processShard = [&moves, &res] (const size_t begin,
+                                             const size_t end)
+    {
+      for (size_t i = begin; i < end; ++i)
+        res[i] = std::make_unique<PerTxData> (*moves[i]);
+    };
+
+  /* The first shard is processed on the calling thread, the others
+     on the executor while we wait.  */
+  const size_t shardSize = (moves.size () + numThreads - 1) / numThreads;
+  std::vector<std::future<void>> shards;
+  for (size_t begin = shardSize; begin < moves.size (); begin += shardSize)
+    {
+      const size_t end = std::min (begin + shardSize, moves.size ());
+      CHECK (exec != nullptr);
+      shards.push_back (exec->Submit ([&processShard, begin, end] ()
+        {
+          processShard (begin, end);
+        }));
+    }
+  processShard (0, std::min (shardSize, moves.size ()));
+  for (auto& s : shards)
+    s.get ();
+
+  if (numThreads > 1)
+    VLOG (1)
+        << "Processed " << moves.size () << " moves on "
+        << numThreads << " threads";
+
+  return res;
+}
+
+/**
+ * Returns the game index of a block.  If the block does not have one, it is
+ * computed into the given optional (or taken from there, if it has been
+ * computed already before).
+ */
+const BlockData::GameIndex&
+GetGameIndex (const BlockData& blk,
+              std::optional<BlockData::GameIndex>& computed)
+{
+  if (blk.gameIndex.has_value ())
+    return *blk.gameIndex;
+
+  if (!computed.has_value ())
+    computed = blk.GetGameIndex ();
+  return *computed;
+}
+
 } // anonymous namespace
 
+struct ZmqPub::BlockPayload
+{
+
+  /**
+   * Serialised notification for each game with data in the block (out of
+   * the games covered by this payload).
+   */
+  std::map<std::string, std::string> perGame;
+
+  /** Serialised notification for games without data in the block.  */
+  std::string empty;
+
+  /**
+   * Set to true if this payload has been computed for all games.  This is
+   * the case for blocks without a game index, where all moves have to be
+   * processed anyway.
+   */
+  bool complete = false;
+
+  /**
+   * If the payload is not complete, the games for which it has been
+   * computed (whether or not they have data in the block).
+   */
+  std::set<std::string> covered;
+
+  /**
+   * Returns true if the payload is known for the given game.
+   */
+  bool
+  Covers (const std::string& g) const
+  {
+    return complete || covered.count (g) > 0;
+  }
+
+};
+
 ZmqPub::ZmqPub (const std::string& addr)
-  : sock(ctx, zmq::socket_type::pub)
+  : ZmqPub(addr, FLAGS_xayax_zmq_payload_cache)
 {
+  CHECK_GE (FLAGS_xayax_zmq_payload_cache, 0)
+      << "Invalid --xayax_zmq_payload_cache";
+}
+
+ZmqPub::ZmqPub (const std::string& addr, const size_t payloadCacheSize)
+  : ctx(FLAGS_xayax_zmq_io_threads),
+    sock(ctx, zmq::socket_type::xpub),
+    maxQueueBytes(static_cast<size_t> (FLAGS_xayax_zmq_queue_mb) << 20),
+    binary(FLAGS_xayax_zmq_binary),
+    payloadCache(payloadCacheSize)
+{
+  CHECK_GT (FLAGS_xayax_zmq_io_threads, 0) << "Invalid --xayax_zmq_io_threads";
+  CHECK_GE (FLAGS_xayax_zmq_send_hwm, 0) << "Invalid --xayax_zmq_send_hwm";
+  CHECK_GT (FLAGS_xayax_zmq_queue_mb, 0) << "Invalid --xayax_zmq_queue_mb";
+  CHECK_GE (FLAGS_xayax_zmq_prepare_threads, 0)
+      << "Invalid --xayax_zmq_prepare_threads";
+
+  prepareThreads = FLAGS_xayax_zmq_prepare_threads;
+  if (prepareThreads == 0)
+    prepareThreads = std::max (1u, std::thread::hardware_concurrency ());
+  if (prepareThreads > 1)
+    prepareExecutor = std::make_unique<Executor> (prepareThreads - 1);
+
   LOG (INFO) << "Binding ZMQ publisher to " << addr;
-  sock.set (zmq::sockopt::sndhwm, SEND_HWM);
+  /* When the high-water mark is reached for a subscriber, further messages
+     are dropped just for that one (the default XPUB behaviour), so that
+     a stalled subscriber does not hold up delivery to the others.
+     Subscribers detect dropped messages from the gap in sequence
+     numbers.  */
+  sock.set (zmq::sockopt::sndhwm, FLAGS_xayax_zmq_send_hwm);
+  /* We want to see all subscribe and unsubscribe messages (not just the
+     first and last for a topic), so that we can count subscribers.  */
+  sock.set (zmq::sockopt::xpub_verboser, true);
+  /* Detect dead subscriber connections, so that their queued messages
+     are freed and they no longer count as subscribers.  */
   sock.set (zmq::sockopt::tcp_keepalive, 1);
   sock.bind (addr);
+
+  sender = std::thread ([this] ()
+    {
+      RunSender ();
+    });
 }
 
 ZmqPub::~ZmqPub ()
 {
-  std::lock_guard<std::mutex> lock(mut);
+  {
+    std::lock_guard<std::mutex> lock(queueMut);
+    stopSender = true;
+    queueCv.notify_all ();
+  }
+  sender.join ();
+
+  std::lock_guard<std::mutex> lock(sockMut);
 
   /* Make sure we close the socket right away.  */
   sock.set (zmq::sockopt::linger, 0);
@@ -284,14 +576,100 @@ ZmqPub::UntrackGame (const std::string& g)
   LOG (INFO) << "Untracking game '" << g << "', new depth: " << newDepth;
 }
 
+void
+ZmqPub::ProcessSubscriptions ()
+{
+  std::lock_guard<std::mutex> lock(sockMut);
+  while (true)
+    {
+      zmq::message_t msg;
+      if (!sock.recv (msg, zmq::recv_flags::dontwait))
+        return;
+
+      /* Subscription messages consist of a single byte (one for subscribing
+         and zero for unsubscribing) followed by the topic prefix.  */
+      const std::string data = msg.to_string ();
+      if (data.empty () || (data[0] != 0 && data[0] != 1))
+        {
+          LOG (WARNING) << "Unexpected message received on the ZMQ socket";
+          continue;
+        }
+      const std::string topic = data.substr (1);
+
+      if (data[0] == 1)
+        {
+          const uint64_t num = ++subscriptions[topic];
+          VLOG (1)
+              << "New ZMQ subscription to '" << topic << "', now " << num;
+          continue;
+        }
+
+      auto mit = subscriptions.find (topic);
+      if (mit == subscriptions.end ())
+        continue;
+      CHECK_GT (mit->second, 0);
+      --mit->second;
+      VLOG (1)
+          << "ZMQ unsubscription from '" << topic << "', now " << mit->second;
+      if (mit->second == 0)
+        subscriptions.erase (mit);
+    }
+}
+
+uint64_t
+ZmqPub::CountSubscribers (const std::string& cmd) const
+{
+  uint64_t res = 0;
+  for (const auto& entry : subscriptions)
+    if (cmd.compare (0, entry.first.size (), entry.first) == 0)
+      res += entry.second;
+  return res;
+}
+
 void
 ZmqPub::SendMessage (const std::string& cmd, const Json::Value& data)
+{
+  SendMessage (cmd, WriteJson (data));
+}
+
+void
+ZmqPub::SendMessage (const std::string& cmd, const std::string& dataStr)
 {
   auto mitSeq = nextSeq.find (cmd);
   if (mitSeq == nextSeq.end ())
     mitSeq = nextSeq.emplace (cmd, 0).first;
 
-  uint32_t seq = mitSeq->second;
+  /* The sequence number is used up even if the message is dropped, so that
+     subscribers can detect the missed message from the gap and resync.  */
+  const uint32_t seq = mitSeq->second++;
+
+  QueuedMessage msg{cmd, dataStr, seq};
+  const size_t msgBytes = msg.GetBytes ();
+
+  std::lock_guard<std::mutex> lock(queueMut);
+  if (queueBytes + msgBytes > maxQueueBytes)
+    {
+      LOG_EVERY_N (WARNING, 1'000)
+          << "ZMQ outbound queue is full, dropping message: " << cmd;
+      GetTopicMetrics (cmd).dropped.Inc ();
+      return;
+    }
+
+  queue.push_back (std::move (msg));
+  queueBytes += msgBytes;
+  auto& metrics = QueueMetrics::Get ();
+  metrics.length.Set (queue.size ());
+  metrics.bytes.Set (queueBytes);
+  queueCv.notify_one ();
+
+  VLOG (1) << "Queued ZMQ message: " << cmd;
+  VLOG (2) << "Payload data:\n" << dataStr;
+}
+
+void
+ZmqPub::SendQueued (const QueuedMessage& msg)
+{
+  uint32_t seq = msg.seq;
   uint8_t seqBytes[sizeof (seq)];
   for (unsigned i = 0; i < sizeof (seq); ++i)
     {
@@ -300,40 +678,96 @@ ZmqPub::SendMessage (const std::string& cmd, const Json::Value& data)
     }
   CHECK_EQ (seq, 0);
 
-  Json::StreamWriterBuilder wbuilder;
-  wbuilder["commentStyle"] = "None";
-  wbuilder["indentation"] = "";
-  wbuilder["enableYAMLCompatibility"] = false;
-  wbuilder["dropNullPlaceholders"] = false;
-  wbuilder["useSpecialFloats"] = false;
-  const std::string dataStr = Json::writeString (wbuilder, data);
+  auto& metrics = GetTopicMetrics (msg.cmd);
+  TraceSpan span("zmq.send");
 
-  /* We want to handle EAGAIN in the same way as other errors.  */
-  if (!sock.send (zmq::message_t (cmd), zmq::send_flags::sndmore))
-    throw zmq::error_t ();
+  std::lock_guard<std::mutex> lock(sockMut);
 
-  VLOG (1) << "Sent ZMQ message: " << cmd;
-  VLOG (2) << "Payload data:\n" << data;
+  /* The XPUB socket never blocks on sending, as messages are dropped
+     for subscribers at their high-water mark.  Errors are logged and
+     the message is given up.  */
+  try
+    {
+      CHECK (sock.send (zmq::message_t (msg.cmd), zmq::send_flags::sndmore));
+    }
+  catch (const zmq::error_t& exc)
+    {
+      LOG (ERROR) << "Failed to send ZMQ message " << msg.cmd
+                  << ": " << exc.what ();
+      metrics.failures.Inc ();
+      return;
+    }
+
+  VLOG (1) << "Sent ZMQ message: " << msg.cmd;
 
   /* Once the first send succeeded, ZMQ guarantees atomic delivery of
      the further parts.  */
-  CHECK (sock.send (zmq::message_t (dataStr), zmq::send_flags::sndmore));
-  CHECK (sock.send (zmq::message_t (seqBytes, sizeof (seq)),
+  CHECK (sock.send (zmq::message_t (msg.data), zmq::send_flags::sndmore));
+  CHECK (sock.send (zmq::message_t (seqBytes, sizeof (seqBytes)),
                     zmq::send_flags::none));
 
-  /* Increase the sequence number at the end.  If the sending fails and
-     throws, we want to keep the previous one.  */
-  ++mitSeq->second;
+  metrics.messages.Inc ();
+  metrics.bytes.Inc (msg.cmd.size () + msg.data.size () + sizeof (seqBytes));
 }
 
 void
-ZmqPub::SendBlock (const std::string& cmdPrefix, const BlockData& blk,
-                   const std::string& reqtoken)
+ZmqPub::RunSender ()
 {
-  std::lock_guard<std::mutex> lock(mut);
+  auto& metrics = QueueMetrics::Get ();
+
+  while (true)
+    {
+      QueuedMessage msg;
+      {
+        std::unique_lock<std::mutex> lock(queueMut);
+        queueCv.wait (lock, [this] ()
+          {
+            return stopSender || !queue.empty ();
+          });
+        if (stopSender)
+          return;
+
+        msg = std::move (queue.front ());
+        queue.pop_front ();
+        CHECK_GE (queueBytes, msg.GetBytes ());
+        queueBytes -= msg.GetBytes ();
+        metrics.length.Set (queue.size ());
+        metrics.bytes.Set (queueBytes);
+      }
 
-  /* Prepare the template object for this block that is the same for each game
-     we track.  */
+      SendQueued (msg);
+    }
+}
+
+std::shared_ptr<const ZmqPub::BlockPayload>
+ZmqPub::GetBlockPayload (const BlockData& blk,
+                         const std::set<std::string>& forGames)
+{
+  std::shared_ptr<const BlockPayload> cached;
+  {
+    std::lock_guard<std::mutex> lock(cacheMut);
+    if (payloadCache.Get (blk.hash, cached))
+      {
+        bool coversAll = true;
+        for (const auto& g : forGames)
+          if (!cached->Covers (g))
+            {
+              coversAll = false;
+              break;
+            }
+
+        if (coversAll)
+          {
+            VLOG (2) << "Using cached ZMQ payload for block " << blk.hash;
+            return cached;
+          }
+      }
+  }
+
+  TraceSpan span("zmq.build_payload");
+
+  /* Prepare the template object for this block that is the same for each
+     game.  */
   Json::Value blkJson = InitFromMetadata (blk);
   blkJson["hash"] = blk.hash;
   blkJson["parent"] = blk.parent;
@@ -341,84 +775,327 @@ ZmqPub::SendBlock (const std::string& cmdPrefix, const BlockData& blk,
   blkJson["rngseed"] = blk.rngseed;
   Json::Value blkTemplate(Json::objectValue);
   blkTemplate["block"] = blkJson;
-  if (!reqtoken.empty ())
-    blkTemplate["reqtoken"] = reqtoken;
-
-  /* Start with an empty array of moves and commands for every game
-     that we track.  */
-  std::map<std::string, Json::Value> perGameMoves;
-  std::map<std::string, Json::Value> perGameAdmin;
-  for (const auto& entry : games)
+  blkTemplate["moves"] = Json::Value (Json::arrayValue);
+  blkTemplate["admin"] = Json::Value (Json::arrayValue);
+
+  /* Determine the moves that we need to process.  Without a game index,
+     we have to process all of them, and then compute the payload for all
+     games (not just the requested ones), so that it can be cached
+     independently of them.  With an index, we only process the moves
+     relevant for the requested games not yet in the cached payload.  */
+  std::set<std::string> newGames;
+  std::map<uint32_t, std::set<std::string>> gamesForMove;
+  std::vector<const MoveData*> toProcess;
+  std::vector<const std::set<std::string>*> selectedGames;
+  if (blk.gameIndex.has_value ())
     {
-      CHECK_GT (entry.second, 0);
-      perGameMoves.emplace (entry.first, Json::Value (Json::arrayValue));
-      perGameAdmin.emplace (entry.first, Json::Value (Json::arrayValue));
-    }
+      for (const auto& g : forGames)
+        {
+          if (cached != nullptr && cached->Covers (g))
+            continue;
+          newGames.insert (g);
 
-  /* Process all moves in the block and add relevant data to the per-game
-     arrays.  */
-  for (const auto& mv : blk.moves)
+          const auto mit = blk.gameIndex->find (g);
+          if (mit == blk.gameIndex->end ())
+            continue;
+          for (const auto i : mit->second)
+            {
+              CHECK_LT (i, blk.moves.size ()) << "Invalid game index";
+              gamesForMove[i].insert (g);
+            }
+        }
+
+      for (const auto& entry : gamesForMove)
+        {
+          toProcess.push_back (&blk.moves[entry.first]);
+          selectedGames.push_back (&entry.second);
+        }
+      VLOG (2)
+          << "Processing " << toProcess.size () << " of " << blk.moves.size ()
+          << " moves in block " << blk.hash << " based on the game index";
+    }
+  else
+    for (const auto& mv : blk.moves)
+      toProcess.push_back (&mv);
+
+  /* Process the selected moves and add relevant data to the per-game
+     arrays.  When using the index, each move is only taken into account
+     for the games it has been selected for.  */
+  std::map<std::string, Json::Value> perGame;
+  const auto getGame = [&] (const size_t i, const std::string& gameId)
+      -> Json::Value*
     {
-      const PerTxData data(mv);
+      if (blk.gameIndex.has_value () && selectedGames[i]->count (gameId) == 0)
+        return nullptr;
+
+      auto mit = perGame.find (gameId);
+      if (mit == perGame.end ())
+        mit = perGame.emplace (gameId, blkTemplate).first;
+      return &mit->second;
+    };
+  const auto parsed = ParseMoves (toProcess, prepareExecutor.get (),
+                                  prepareThreads);
+  for (size_t i = 0; i < parsed.size (); ++i)
+    {
+      const PerTxData& data = *parsed[i];
 
       for (const auto& entry : data.GetMovesPerGame ())
         {
-          const auto mit = perGameMoves.find (entry.first);
-          if (mit == perGameMoves.end ())
+          auto* game = getGame (i, entry.first);
+          if (game == nullptr)
             continue;
 
-          CHECK_EQ (games.count (entry.first), 1);
-          CHECK (mit->second.isArray ());
-          mit->second.append (entry.second);
+          auto& moves = (*game)["moves"];
+          CHECK (moves.isArray ());
+          moves.append (entry.second);
         }
 
       std::string adminGame;
       Json::Value adminCmd;
       if (data.GetAdminCommand (adminGame, adminCmd))
         {
-          const auto mit = perGameAdmin.find (adminGame);
-          if (mit == perGameAdmin.end ())
+          auto* game = getGame (i, adminGame);
+          if (game == nullptr)
             continue;
 
-          CHECK_EQ (games.count (adminGame), 1);
-          CHECK (mit->second.isArray ());
-          mit->second.append (adminCmd);
+          auto& admin = (*game)["admin"];
+          CHECK (admin.isArray ());
+          admin.append (adminCmd);
         }
     }
 
-  /* Send out notifications for all tracked games.  */
-  for (const auto& entry : games)
+  /* Build up the new payload, extending the data from a previously cached
+     payload (for other games) if there is one.  */
+  auto res = std::make_shared<BlockPayload> ();
+  if (cached != nullptr && blk.gameIndex.has_value ())
+    *res = *cached;
+  res->empty = WriteJson (blkTemplate);
+  if (blk.gameIndex.has_value ())
+    res->covered.insert (newGames.begin (), newGames.end ());
+  else
+    res->complete = true;
+  for (const auto& entry : perGame)
+    res->perGame[entry.first] = WriteJson (entry.second);
+
+  std::lock_guard<std::mutex> lock(cacheMut);
+  payloadCache.Put (blk.hash, res);
+  return res;
+}
+
+void
+ZmqPub::SendBlock (const std::string& cmdPrefix, const std::string& fullTopic,
+                   const BlockData& blk,
+                   const std::string& reqtoken, const std::string& gameId)
+{
+  SendBlockJson (cmdPrefix, blk, reqtoken, gameId);
+  if (!binary)
+    return;
+
+  /* Both binary notifications need the game index, which is computed
+     at most once for them if the block does not have it.  */
+  std::optional<BlockData::GameIndex> computedIndex;
+  SendBlockBinary (cmdPrefix, blk, computedIndex, reqtoken, gameId);
+  if (reqtoken.empty () && gameId.empty ())
+    SendFullBlock (fullTopic, blk, computedIndex);
+}
+
+void
+ZmqPub::SendFullBlock (const std::string& topic, const BlockData& blk,
+                       std::optional<BlockData::GameIndex>& computedIndex)
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ProcessSubscriptions ();
+    if (CountSubscribers (topic) == 0)
+      return;
+  }
+
+  TraceSpan span("zmq.build_full");
+
+  /* The block is sent in its raw serialised form (including the game
+     index), independent of the local compression settings.  */
+  proto::BlockNotification notification;
+  CHECK (notification.mutable_block ()->ParseFromString (
+      GetRawBlockData (blk.Serialise (GetGameIndex (blk, computedIndex)))));
+
+  std::string data;
+  notification.SerializeToString (&data);
+
+  std::lock_guard<std::mutex> lock(mut);
+  SendMessage (topic, data);
+}
+
+void
+ZmqPub::SendBlockJson (const std::string& cmdPrefix, const BlockData& blk,
+                       const std::string& reqtoken, const std::string& gameId)
+{
+  /* The payload is prepared without holding the main lock, so that other
+     notifications and (un)tracking of games are not blocked by it.  Only
+     the actual sending is done while holding the lock.  */
+
+  /* Games that nobody is subscribed to are skipped, so that we do not
+     prepare any payload for them.  This must be called with mut held.  */
+  const auto isSelected = [this, &cmdPrefix, &gameId] (const std::string& g)
+    {
+      if (!gameId.empty () && g != gameId)
+        return false;
+      return CountSubscribers (cmdPrefix + " json " + g) > 0;
+    };
+
+  std::set<std::string> forGames;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ProcessSubscriptions ();
+    for (const auto& entry : games)
+      if (isSelected (entry.first))
+        forGames.insert (entry.first);
+  }
+
+  if (forGames.empty ())
+    {
+      VLOG (1) << "No subscribed games for " << cmdPrefix << " " << blk.hash;
+      return;
+    }
+
+  while (true)
+    {
+      const auto payload = GetBlockPayload (blk, forGames);
+
+      std::lock_guard<std::mutex> lock(mut);
+      ProcessSubscriptions ();
+
+      /* If some game has been tracked while we prepared the payload and
+         it is not covered, we need to try again.  */
+      bool coversAll = true;
+      for (const auto& entry : games)
+        if (isSelected (entry.first) && !payload->Covers (entry.first))
+          {
+            forGames.insert (entry.first);
+            coversAll = false;
+          }
+      if (!coversAll)
+        continue;
+
+      /* Send out notifications for all selected tracked games.  */
+      for (const auto& entry : games)
+        {
+          CHECK_GT (entry.second, 0);
+          if (!isSelected (entry.first))
+            continue;
+
+          const auto mit = payload->perGame.find (entry.first);
+          const std::string& data
+              = (mit == payload->perGame.end ()
+                    ? payload->empty : mit->second);
+
+          SendMessage (cmdPrefix + " json " + entry.first,
+                       AddReqToken (data, reqtoken));
+        }
+
+      return;
+    }
+}
+
+void
+ZmqPub::SendBlockBinary (const std::string& cmdPrefix, const BlockData& blk,
+                         std::optional<BlockData::GameIndex>& computedIndex,
+                         const std::string& reqtoken,
+                         const std::string& gameId)
+{
+  const auto isSelected = [this, &cmdPrefix, &gameId] (const std::string& g)
     {
-      CHECK_GT (entry.second, 0);
+      if (!gameId.empty () && g != gameId)
+        return false;
+      return CountSubscribers (cmdPrefix + " bin " + g) > 0;
+    };
 
-      const auto mitMv = perGameMoves.find (entry.first);
-      CHECK (mitMv != perGameMoves.end ());
-      CHECK (mitMv->second.isArray ());
+  std::set<std::string> forGames;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ProcessSubscriptions ();
+    for (const auto& entry : games)
+      if (isSelected (entry.first))
+        forGames.insert (entry.first);
+  }
 
-      const auto mitCmd = perGameAdmin.find (entry.first);
-      CHECK (mitCmd != perGameAdmin.end ());
-      CHECK (mitCmd->second.isArray ());
+  if (forGames.empty ())
+    return;
 
-      Json::Value thisGame = blkTemplate;
-      thisGame["moves"] = mitMv->second;
-      thisGame["admin"] = mitCmd->second;
+  TraceSpan span("zmq.build_binary");
 
-      SendMessage (cmdPrefix + " json " + entry.first, thisGame);
+  proto::BlockNotification base;
+  base.set_reqtoken (reqtoken);
+  auto& header = *base.mutable_block ();
+  header.set_hash (blk.hash);
+  header.set_parent (blk.parent);
+  header.set_height (blk.height);
+  header.set_rngseed (blk.rngseed);
+  header.set_metadata (StoreJson (blk.metadata));
+
+  const auto& index = GetGameIndex (blk, computedIndex);
+  std::map<std::string, std::string> serialised;
+  for (const auto& g : forGames)
+    {
+      proto::BlockNotification cur = base;
+
+      const auto mit = index.find (g);
+      if (mit != index.end ())
+        for (const auto i : mit->second)
+          {
+            CHECK_LT (i, blk.moves.size ()) << "Invalid game index";
+            const auto& mv = blk.moves[i];
+
+            auto& mpb = *cur.mutable_block ()->add_moves ();
+            mpb.set_txid (mv.txid);
+            mpb.set_ns (mv.ns);
+            mpb.set_name (mv.name);
+            mpb.set_mv (mv.mv);
+            mpb.set_metadata (StoreJson (mv.metadata));
+
+            const auto burnIt = mv.burns.find (g);
+            if (burnIt != mv.burns.end ())
+              mpb.mutable_burns ()->insert ({g, StoreJson (burnIt->second)});
+          }
+
+      cur.SerializeToString (&serialised[g]);
     }
+
+  /* Games that have been tracked (or subscribed to) in the mean time
+     are just skipped, as they have not been tracked when the block
+     notification was triggered.  */
+  std::lock_guard<std::mutex> lock(mut);
+  ProcessSubscriptions ();
+  for (const auto& entry : serialised)
+    if (games.count (entry.first) > 0 && isSelected (entry.first))
+      SendMessage (cmdPrefix + " bin " + entry.first, entry.second);
 }
 
 void
 ZmqPub::SendBlockAttach (const BlockData& blk, const std::string& reqtoken)
+{
+  SendBlockAttach (blk, reqtoken, "");
+}
+
+void
+ZmqPub::SendBlockAttach (const BlockData& blk, const std::string& reqtoken,
+                         const std::string& gameId)
 {
   VLOG (1) << "Block attach: " << blk.hash;
-  SendBlock (PREFIX_ATTACH, blk, reqtoken);
+  SendBlock (PREFIX_ATTACH, TOPIC_FULL_ATTACH, blk, reqtoken, gameId);
 }
 
 void
 ZmqPub::SendBlockDetach (const BlockData& blk, const std::string& reqtoken)
+{
+  SendBlockDetach (blk, reqtoken, "");
+}
+
+void
+ZmqPub::SendBlockDetach (const BlockData& blk, const std::string& reqtoken,
+                         const std::string& gameId)
 {
   VLOG (1) << "Block detach: " << blk.hash;
-  SendBlock (PREFIX_DETACH, blk, reqtoken);
+  SendBlock (PREFIX_DETACH, TOPIC_FULL_DETACH, blk, reqtoken, gameId);
 }
 
 void
@@ -426,18 +1103,26 @@ ZmqPub::SendPendingMoves (const std::vector<MoveData>& moves)
 {
   CHECK (!moves.empty ());
   VLOG (1) << "Pending moves for transaction: " << moves.front ().txid;
-  std::lock_guard<std::mutex> lock(mut);
 
-  /* We start with an empty array of moves for each game that we track.  */
-  std::map<std::string, Json::Value> movesPerGame;
-  for (const auto& entry : games)
+  /* Determine the tracked games that have subscribers for pending moves.
+     If there are none, we can skip all processing.  */
+  std::set<std::string> subscribed;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ProcessSubscriptions ();
+    for (const auto& entry : games)
+      if (CountSubscribers (PREFIX_MOVE + (" json " + entry.first)) > 0)
+        subscribed.insert (entry.first);
+  }
+  if (subscribed.empty ())
     {
-      CHECK_GT (entry.second, 0);
-      movesPerGame.emplace (entry.first, Json::Value (Json::arrayValue));
+      VLOG (1) << "No subscribed games for pending moves";
+      return;
     }
 
-  /* Process all the MoveData instances, adding to the list of moves
-     per game.  */
+  /* Process all the MoveData instances without holding the lock, building
+     up the list of moves for each game (tracked or not).  */
+  std::map<std::string, Json::Value> movesPerGame;
   std::string lastTxid;
   for (const auto& mv : moves)
     {
@@ -448,19 +1133,59 @@ ZmqPub::SendPendingMoves (const std::vector<MoveData>& moves)
       const PerTxData data(mv);
       for (const auto& entry : data.GetMovesPerGame ())
         {
-          const auto mit = movesPerGame.find (entry.first);
+          auto mit = movesPerGame.find (entry.first);
           if (mit == movesPerGame.end ())
-            continue;
-
-          CHECK_EQ (games.count (entry.first), 1);
+            mit = movesPerGame.emplace (entry.first,
+                                        Json::Value (Json::arrayValue)).first;
           mit->second.append (entry.second);
         }
     }
 
-  /* Send out all the notifications.  */
+  std::map<std::string, std::string> serialised;
   for (const auto& entry : movesPerGame)
-    if (entry.second.size () > 0)
+    if (subscribed.count (entry.first) > 0)
+      serialised.emplace (entry.first, WriteJson (entry.second));
+
+  /* Send out the notifications for all tracked games.  */
+  std::lock_guard<std::mutex> lock(mut);
+  for (const auto& entry : serialised)
+    {
+      const auto mit = games.find (entry.first);
+      if (mit == games.end ())
+        continue;
+
+      CHECK_GT (mit->second, 0);
       SendMessage (PREFIX_MOVE + (" json " + entry.first), entry.second);
+    }
+}
+
+std::map<std::string, ZmqPub::TrackedGame>
+ZmqPub::GetTrackedGames ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  ProcessSubscriptions ();
+
+  std::map<std::string, TrackedGame> res;
+  for (const auto& entry : games)
+    {
+      const std::string suffix = " json " + entry.first;
+
+      TrackedGame& g = res[entry.first];
+      g.depth = entry.second;
+      g.attachSubscribers = CountSubscribers (PREFIX_ATTACH + suffix);
+      g.detachSubscribers = CountSubscribers (PREFIX_DETACH + suffix);
+      g.pendingSubscribers = CountSubscribers (PREFIX_MOVE + suffix);
+    }
+
+  return res;
+}
+
+void
+ZmqPub::GetPayloadCacheStats (uint64_t& hits, uint64_t& misses)
+{
+  std::lock_guard<std::mutex> lock(cacheMut);
+  hits = payloadCache.GetHits ();
+  misses = payloadCache.GetMisses ();
 }
 
 } // namespace xayax
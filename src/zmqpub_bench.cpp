@@ -0,0 +1,97 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "private/zmqpub.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace xayax
+{
+namespace
+{
+
+/** ZMQ address used for the benchmarks.  */
+constexpr const char* ZMQ_ADDR = "tcp://127.0.0.1:49838";
+
+/**
+ * Sends attach notifications for blocks, with the number of tracked games
+ * given as first argument and moves per block (spread over the games)
+ * as second argument.  The payload cache is disabled, so that the full
+ * processing of each block is measured.
+ */
+void
+BM_ZmqPubSendBlock (benchmark::State& state)
+{
+  const unsigned numGames = state.range (0);
+
+  BlockGenerator gen;
+  gen.SetNumGames (numGames);
+
+  ZmqPub pub(ZMQ_ADDR, 0);
+  for (unsigned i = 0; i < numGames; ++i)
+    pub.TrackGame (BlockGenerator::GameId (i));
+
+  const auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (1));
+  for (auto _ : state)
+    pub.SendBlockAttach (blk, "");
+
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_ZmqPubSendBlock)
+    ->ArgsProduct ({{1, 10, 100}, {1, 100, 5'000}});
+
+/**
+ * Sends notifications for blocks that already carry a game index
+ * (as blocks retrieved from storage do).
+ */
+void
+BM_ZmqPubSendIndexedBlock (benchmark::State& state)
+{
+  const unsigned numGames = state.range (0);
+
+  BlockGenerator gen;
+  gen.SetNumGames (numGames);
+
+  ZmqPub pub(ZMQ_ADDR, 0);
+  pub.TrackGame (BlockGenerator::GameId (0));
+
+  auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (1));
+  blk.IndexGames ();
+  for (auto _ : state)
+    pub.SendBlockAttach (blk, "");
+
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_ZmqPubSendIndexedBlock)
+    ->ArgsProduct ({{1, 100}, {100, 5'000}});
+
+/**
+ * Sends a detach and attach for the same block, as happens for reorgs;
+ * this hits the payload cache for the second notification.
+ */
+void
+BM_ZmqPubSendBlockCached (benchmark::State& state)
+{
+  BlockGenerator gen;
+  gen.SetNumGames (10);
+
+  ZmqPub pub(ZMQ_ADDR, 100);
+  for (unsigned i = 0; i < 10; ++i)
+    pub.TrackGame (BlockGenerator::GameId (i));
+
+  const auto blk = gen.NewBlock (gen.NewHash (), 100, state.range (0));
+  for (auto _ : state)
+    {
+      pub.SendBlockDetach (blk, "");
+      pub.SendBlockAttach (blk, "");
+    }
+
+  state.SetItemsProcessed (state.iterations () * blk.moves.size ());
+}
+BENCHMARK (BM_ZmqPubSendBlockCached)->Arg (100)->Arg (5'000);
+
+} // anonymous namespace
+} // namespace xayax
@@ -4,14 +4,27 @@
 
 #include "private/zmqpub.hpp"
 
+#include "metrics.hpp"
+#include "proto/blockdata.pb.h"
 #include "testutils.hpp"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <zmq.hpp>
+
+#include <memory>
+
 namespace xayax
 {
+
+DECLARE_bool (xayax_zmq_binary);
+DECLARE_int32 (xayax_zmq_prepare_threads);
+DECLARE_int32 (xayax_zmq_queue_mb);
+DECLARE_int32 (xayax_zmq_send_hwm);
+
 namespace
 {
 
@@ -32,8 +45,13 @@ protected:
   ZmqPub pub;
   TestZmqSubscriber sub;
 
-  ZmqPubTests ()
-    : pub(ZMQ_ADDR), sub(ZMQ_ADDR)
+  /**
+   * Constructs the test fixture.  By default, the block-payload cache
+   * is disabled, as the tests send different data for the same block hash
+   * (which would not happen with real blocks).
+   */
+  explicit ZmqPubTests (const size_t payloadCacheSize = 0)
+    : pub(ZMQ_ADDR, payloadCacheSize), sub(ZMQ_ADDR)
   {
     /* Give the ZMQ publisher and subscriber some time to get connected
        before continuing with the test.  */
@@ -511,6 +529,261 @@ TEST_F (ZmqPubTests, TrackedGames)
   ));
 }
 
+TEST_F (ZmqPubTests, GameFilter)
+{
+  BlockData blk;
+  blk.hash = "block";
+  blk.moves.push_back (Move ("p", "domob", "tx", R"(
+    {"g": {"foo": 1, "bar": 2}}
+  )"));
+
+  pub.TrackGame ("foo");
+  pub.TrackGame ("bar");
+
+  pub.SendBlockAttach (blk, "token", "foo");
+  pub.SendBlockDetach (blk, "token", "bar");
+  /* Untracked games do not get notifications even if requested.  */
+  pub.SendBlockAttach (blk, "token", "baz");
+
+  EXPECT_THAT (WithoutBlock (sub.AwaitMessages (Attach ("foo"), 1)),
+               ElementsAre (ParseJson (R"({
+    "reqtoken": "token",
+    "admin": [],
+    "moves": [{"txid": "tx", "name": "domob", "move": 1, "burnt": 0}]
+  })")));
+  EXPECT_THAT (WithoutBlock (sub.AwaitMessages (Detach ("bar"), 1)),
+               ElementsAre (ParseJson (R"({
+    "reqtoken": "token",
+    "admin": [],
+    "moves": [{"txid": "tx", "name": "domob", "move": 2, "burnt": 0}]
+  })")));
+}
+
+TEST (ZmqPubParallelTests, MoveProcessing)
+{
+  /* The number of threads is fixed when the publisher is constructed,
+     so this test sets up its own instead of using the fixture.  */
+  const auto oldThreads = FLAGS_xayax_zmq_prepare_threads;
+  FLAGS_xayax_zmq_prepare_threads = 3;
+  ZmqPub pub(ZMQ_ADDR, 0);
+  TestZmqSubscriber sub(ZMQ_ADDR);
+  SleepSome ();
+
+  /* Build a block with enough moves to be split across multiple threads,
+     and verify that the moves and admin commands are still in order.  */
+  constexpr unsigned numMoves = 2'000;
+  BlockData blk;
+  Json::Value expectedMoves(Json::arrayValue);
+  Json::Value expectedAdmin(Json::arrayValue);
+  for (unsigned i = 0; i < numMoves; ++i)
+    {
+      const std::string txid = "tx " + std::to_string (i);
+      if (i % 7 == 0)
+        {
+          blk.moves.push_back (Move ("g", "game", txid,
+                                     R"({"cmd": )" + std::to_string (i) + "}"));
+
+          Json::Value cmd(Json::objectValue);
+          cmd["txid"] = txid;
+          cmd["cmd"] = static_cast<int> (i);
+          cmd["burnt"] = 0;
+          expectedAdmin.append (cmd);
+        }
+      else if (i % 5 == 0)
+        blk.moves.push_back (Move ("p", "domob", txid, "invalid"));
+      else
+        {
+          blk.moves.push_back (Move ("p", "domob", txid,
+                                     R"({"g": {"game": )"
+                                        + std::to_string (i) + "}}"));
+
+          Json::Value mv(Json::objectValue);
+          mv["txid"] = txid;
+          mv["name"] = "domob";
+          mv["move"] = static_cast<int> (i);
+          mv["burnt"] = 0;
+          expectedMoves.append (mv);
+        }
+    }
+
+  pub.TrackGame ("game");
+  pub.SendBlockAttach (blk, "");
+
+  const auto received
+      = sub.AwaitMessages ("game-block-attach json game", 1);
+  ASSERT_EQ (received.size (), 1);
+  EXPECT_EQ (received[0]["moves"], expectedMoves);
+  EXPECT_EQ (received[0]["admin"], expectedAdmin);
+
+  FLAGS_xayax_zmq_prepare_threads = oldThreads;
+}
+
+TEST_F (ZmqPubTests, UsesGameIndex)
+{
+  BlockData blk;
+  blk.moves.push_back (Move ("p", "domob", "tx1", R"({"g": {"foo": 1}})"));
+  blk.moves.push_back (Move ("p", "domob", "tx2",
+                             R"({"g": {"foo": 2, "bar": 3}})"));
+
+  /* Only the moves in the index are processed for each game.  To verify
+     this, we use an index that misses one of the moves.  */
+  blk.gameIndex = BlockData::GameIndex ({{"foo", {0}}, {"bar", {1}}});
+
+  pub.TrackGame ("foo");
+  pub.TrackGame ("bar");
+  pub.TrackGame ("baz");
+  pub.SendBlockAttach (blk, "");
+
+  EXPECT_THAT (WithoutBlock (sub.AwaitMessages (Attach ("foo"), 1)),
+               ElementsAre (ParseJson (R"({
+    "admin": [],
+    "moves": [{"txid": "tx1", "name": "domob", "move": 1, "burnt": 0}]
+  })")));
+  EXPECT_THAT (WithoutBlock (sub.AwaitMessages (Attach ("bar"), 1)),
+               ElementsAre (ParseJson (R"({
+    "admin": [],
+    "moves": [{"txid": "tx2", "name": "domob", "move": 3, "burnt": 0}]
+  })")));
+  EXPECT_THAT (WithoutBlock (sub.AwaitMessages (Attach ("baz"), 1)),
+               ElementsAre (ParseJson (R"({"admin": [], "moves": []})")));
+}
+
+class ZmqPubPayloadCacheTests : public ZmqPubTests
+{
+
+protected:
+
+  ZmqPubPayloadCacheTests ()
+    : ZmqPubTests(2)
+  {}
+
+  /**
+   * Returns a block with the given hash and a move for game "foo".
+   */
+  static BlockData
+  BlockWithMove (const std::string& hash)
+  {
+    BlockData res;
+    res.hash = hash;
+    res.moves.push_back (Move ("p", "domob", "tx " + hash, R"(
+      {"g": {"foo": 42}}
+    )"));
+    return res;
+  }
+
+  /**
+   * Expects the given hits and misses of the payload cache.
+   */
+  void
+  ExpectStats (const uint64_t expectedHits, const uint64_t expectedMisses)
+  {
+    uint64_t hits, misses;
+    pub.GetPayloadCacheStats (hits, misses);
+    EXPECT_EQ (hits, expectedHits);
+    EXPECT_EQ (misses, expectedMisses);
+  }
+
+};
+
+TEST_F (ZmqPubPayloadCacheTests, ReusedPayload)
+{
+  const auto blk = BlockWithMove ("abc");
+
+  pub.TrackGame ("foo");
+  pub.TrackGame ("bar");
+  pub.SendBlockAttach (blk, "");
+  pub.SendBlockDetach (blk, "token");
+  pub.SendBlockAttach (blk, "other");
+  ExpectStats (2, 1);
+
+  const auto fooAttach = sub.AwaitMessages (Attach ("foo"), 2);
+  const auto fooDetach = sub.AwaitMessages (Detach ("foo"), 1);
+  const auto barAttach = sub.AwaitMessages (Attach ("bar"), 2);
+  sub.AwaitMessages (Detach ("bar"), 1);
+
+  const auto expectedMoves = ParseJson (R"([
+    {
+      "txid": "tx abc",
+      "name": "domob",
+      "move": 42,
+      "burnt": 0
+    }
+  ])");
+
+  ASSERT_EQ (fooAttach.size (), 2);
+  EXPECT_FALSE (fooAttach[0].isMember ("reqtoken"));
+  EXPECT_EQ (fooAttach[0]["moves"], expectedMoves);
+  EXPECT_EQ (fooAttach[0]["block"]["hash"], "abc");
+  EXPECT_EQ (fooAttach[1]["reqtoken"], "other");
+  EXPECT_EQ (fooAttach[1]["moves"], expectedMoves);
+
+  ASSERT_EQ (fooDetach.size (), 1);
+  EXPECT_EQ (fooDetach[0]["reqtoken"], "token");
+  EXPECT_EQ (fooDetach[0]["moves"], expectedMoves);
+
+  EXPECT_THAT (WithoutBlock (barAttach), ElementsAre (
+    ParseJson (R"({"admin": [], "moves": []})"),
+    ParseJson (R"({"reqtoken": "other", "admin": [], "moves": []})")
+  ));
+}
+
+TEST_F (ZmqPubPayloadCacheTests, Eviction)
+{
+  pub.TrackGame ("foo");
+
+  pub.SendBlockAttach (BlockWithMove ("a"), "");
+  pub.SendBlockAttach (BlockWithMove ("b"), "");
+  pub.SendBlockAttach (BlockWithMove ("a"), "");
+  ExpectStats (1, 2);
+
+  /* This evicts b, which was used least recently.  */
+  pub.SendBlockAttach (BlockWithMove ("c"), "");
+  pub.SendBlockAttach (BlockWithMove ("a"), "");
+  ExpectStats (2, 3);
+  pub.SendBlockAttach (BlockWithMove ("b"), "");
+  ExpectStats (2, 4);
+
+  sub.AwaitMessages (Attach ("foo"), 6);
+}
+
+TEST_F (ZmqPubPayloadCacheTests, ExtendedForNewGames)
+{
+  auto blk = BlockWithMove ("abc");
+  blk.moves.push_back (Move ("p", "andy", "tx bar", R"(
+    {"g": {"bar": 10}}
+  )"));
+  blk.IndexGames ();
+
+  pub.TrackGame ("foo");
+  pub.SendBlockAttach (blk, "");
+  ExpectStats (0, 1);
+
+  /* The cached payload only covers foo, so it has to be extended.  */
+  pub.TrackGame ("bar");
+  pub.SendBlockAttach (blk, "");
+  ExpectStats (1, 1);
+
+  pub.SendBlockDetach (blk, "");
+  ExpectStats (2, 1);
+
+  const auto fooAttach = sub.AwaitMessages (Attach ("foo"), 2);
+  const auto barAttach = sub.AwaitMessages (Attach ("bar"), 1);
+  const auto barDetach = sub.AwaitMessages (Detach ("bar"), 1);
+  sub.AwaitMessages (Detach ("foo"), 1);
+
+  ASSERT_EQ (fooAttach.size (), 2);
+  EXPECT_EQ (fooAttach[0], fooAttach[1]);
+  EXPECT_EQ (fooAttach[0]["moves"].size (), 1);
+
+  const auto expectedBar = ParseJson (R"([
+    {"txid": "tx bar", "name": "andy", "move": 10, "burnt": 0}
+  ])");
+  ASSERT_EQ (barAttach.size (), 1);
+  EXPECT_EQ (barAttach[0]["moves"], expectedBar);
+  ASSERT_EQ (barDetach.size (), 1);
+  EXPECT_EQ (barDetach[0]["moves"], expectedBar);
+}
+
 TEST_F (ZmqPubTests, PendingMoves)
 {
   const auto mv1 = Move ("p", "domob", "txid", R"(
@@ -573,5 +846,415 @@ TEST_F (ZmqPubTests, PendingMoves)
   ));
 }
 
+TEST_F (ZmqPubTests, Burst)
+{
+  /* A burst of messages is queued and sent out in order.  */
+  constexpr unsigned num = 500;
+
+  pub.TrackGame ("g");
+  for (unsigned i = 0; i < num; ++i)
+    pub.SendPendingMoves ({Move ("p", "domob", "txid", R"({"g": 42})")});
+
+  const auto received = sub.AwaitMessages (Pending ("g"), num);
+  ASSERT_EQ (received.size (), num);
+  for (const auto& msg : received)
+    EXPECT_EQ (msg[0]["move"].asInt (), 42);
+}
+
+/**
+ * Tests for the outbound queue and the handling of slow subscribers.
+ * They construct their own publishers with specific settings.
+ */
+class ZmqPubQueueTests : public testing::Test
+{
+
+private:
+
+  const int32_t oldQueueMb;
+  const int32_t oldHwm;
+
+protected:
+
+  zmq::context_t ctx;
+
+  ZmqPubQueueTests ()
+    : oldQueueMb(FLAGS_xayax_zmq_queue_mb),
+      oldHwm(FLAGS_xayax_zmq_send_hwm)
+  {}
+
+  ~ZmqPubQueueTests ()
+  {
+    FLAGS_xayax_zmq_queue_mb = oldQueueMb;
+    FLAGS_xayax_zmq_send_hwm = oldHwm;
+  }
+
+  /**
+   * Returns a pending move for game "g" with a payload of roughly
+   * the given size.
+   */
+  static MoveData
+  LargeMove (const size_t size)
+  {
+    MoveData res;
+    res.ns = "p";
+    res.name = "domob";
+    res.txid = "txid";
+    res.mv = R"({"g": {"g": ")" + std::string (size, 'x') + R"("}})";
+    return res;
+  }
+
+  /**
+   * Returns the number of dropped pending-move messages from the metrics.
+   */
+  static uint64_t
+  GetDropped ()
+  {
+    return MetricsRegistry::Get ()
+        .GetCounter ("xayax_zmq_dropped_total", "",
+                     {{"topic", "game-pending-move"}})
+        .Get ();
+  }
+
+  /**
+   * Constructs a raw subscriber socket, which is not read from in the
+   * background (unlike TestZmqSubscriber).
+   */
+  zmq::socket_t
+  RawSubscriber (const std::string& topic)
+  {
+    zmq::socket_t res(ctx, zmq::socket_type::sub);
+    res.set (zmq::sockopt::linger, 0);
+    res.set (zmq::sockopt::rcvhwm, 10);
+    res.set (zmq::sockopt::rcvtimeo, 10'000);
+    res.set (zmq::sockopt::subscribe, topic);
+    res.connect (ZMQ_ADDR);
+    return res;
+  }
+
+  /**
+   * Receives a message on a raw subscriber, returning its topic and
+   * sequence number.
+   */
+  static uint32_t
+  ReceiveSeq (zmq::socket_t& sock, std::string& topic)
+  {
+    zmq::message_t msg;
+    CHECK (sock.recv (msg)) << "Timed out waiting for message";
+    topic = msg.to_string ();
+    CHECK (sock.recv (msg));
+    CHECK (sock.recv (msg));
+    CHECK_EQ (msg.size (), sizeof (uint32_t));
+
+    const uint8_t* seqBytes = static_cast<const uint8_t*> (msg.data ());
+    uint32_t seq = 0;
+    for (unsigned i = 0; i < sizeof (seq); ++i)
+      seq |= seqBytes[i] << (8 * i);
+    return seq;
+  }
+
+};
+
+TEST_F (ZmqPubQueueTests, DropsWhenQueueFull)
+{
+  FLAGS_xayax_zmq_queue_mb = 1;
+  ZmqPub pub(ZMQ_ADDR, 0);
+  auto sub = RawSubscriber ("game-pending-move json g");
+  SleepSome ();
+  pub.TrackGame ("g");
+
+  /* A message larger than the whole queue is dropped right away,
+     but still uses up its sequence number.  */
+  const uint64_t before = GetDropped ();
+  pub.SendPendingMoves ({LargeMove (2 << 20)});
+  EXPECT_EQ (GetDropped (), before + 1);
+
+  pub.SendPendingMoves ({LargeMove (10)});
+  std::string topic;
+  EXPECT_EQ (ReceiveSeq (sub, topic), 1);
+  EXPECT_EQ (topic, "game-pending-move json g");
+  EXPECT_EQ (GetDropped (), before + 1);
+}
+
+TEST_F (ZmqPubQueueTests, StalledSubscriberDoesNotBlockOthers)
+{
+  FLAGS_xayax_zmq_send_hwm = 10;
+  ZmqPub pub(ZMQ_ADDR, 0);
+  TestZmqSubscriber healthy(ZMQ_ADDR, "game-pending-move");
+  auto stalled = RawSubscriber ("");
+  SleepSome ();
+  pub.TrackGame ("g");
+
+  /* The stalled subscriber never reads, so it reaches its high-water mark
+     (and fills up the TCP buffers) long before all the data is sent.  The
+     healthy subscriber still receives every message.  It is sent rounds
+     below the high-water mark and waits for them, so it never falls
+     behind itself.  */
+  constexpr unsigned rounds = 40;
+  constexpr unsigned perRound = 5;
+  constexpr size_t moveSize = 200'000;
+  for (unsigned i = 0; i < rounds; ++i)
+    {
+      for (unsigned j = 0; j < perRound; ++j)
+        pub.SendPendingMoves ({LargeMove (moveSize)});
+      ASSERT_EQ (healthy.AwaitMessages ("game-pending-move json g",
+                                        perRound).size (),
+                 perRound);
+    }
+
+  /* The stalled subscriber has lost messages (rather than blocking the
+     publisher).  Each message consists of three parts.  */
+  stalled.set (zmq::sockopt::rcvtimeo, 1'000);
+  unsigned parts = 0;
+  zmq::message_t msg;
+  while (stalled.recv (msg))
+    ++parts;
+  EXPECT_LT (parts, 3 * rounds * perRound);
+}
+
+/**
+ * Tests for the tracking of subscribers.  They do not use the catch-all
+ * subscriber from ZmqPubTests, but set up specific ones as needed.
+ */
+class ZmqPubSubscriptionTests : public testing::Test
+{
+
+protected:
+
+  ZmqPub pub;
+
+  ZmqPubSubscriptionTests ()
+    : pub(ZMQ_ADDR, 0)
+  {}
+
+};
+
+TEST_F (ZmqPubSubscriptionTests, CountsSubscribers)
+{
+  pub.TrackGame ("a");
+  pub.TrackGame ("a");
+  pub.TrackGame ("b");
+
+  auto games = pub.GetTrackedGames ();
+  ASSERT_EQ (games.size (), 2);
+  EXPECT_EQ (games.at ("a").depth, 2);
+  EXPECT_EQ (games.at ("a").attachSubscribers, 0);
+
+  {
+    TestZmqSubscriber sub1(ZMQ_ADDR, "game-block-attach json a");
+    TestZmqSubscriber sub2(ZMQ_ADDR, "game-block-");
+    SleepSome ();
+
+    games = pub.GetTrackedGames ();
+    EXPECT_EQ (games.at ("a").attachSubscribers, 2);
+    EXPECT_EQ (games.at ("a").detachSubscribers, 1);
+    EXPECT_EQ (games.at ("a").pendingSubscribers, 0);
+    EXPECT_EQ (games.at ("b").attachSubscribers, 1);
+    EXPECT_EQ (games.at ("b").detachSubscribers, 1);
+  }
+  SleepSome ();
+
+  games = pub.GetTrackedGames ();
+  EXPECT_EQ (games.at ("a").attachSubscribers, 0);
+  EXPECT_EQ (games.at ("b").detachSubscribers, 0);
+}
+
+TEST_F (ZmqPubSubscriptionTests, SkipsUnsubscribedGames)
+{
+  pub.TrackGame ("a");
+  pub.TrackGame ("b");
+
+  BlockData blk;
+  blk.hash = "block";
+
+  {
+    TestZmqSubscriber sub(ZMQ_ADDR, "game-block-attach json a");
+    SleepSome ();
+
+    pub.SendBlockAttach (blk, "");
+    EXPECT_EQ (sub.AwaitMessages ("game-block-attach json a", 1).size (), 1);
+    SleepSome ();
+  }
+
+  /* If the notification for "b" had been sent before, its sequence number
+     would be one now (which the subscriber would reject).  */
+  TestZmqSubscriber sub(ZMQ_ADDR, "game-block-attach json b");
+  SleepSome ();
+  pub.SendBlockAttach (blk, "");
+  EXPECT_EQ (sub.AwaitMessages ("game-block-attach json b", 1).size (), 1);
+  SleepSome ();
+}
+
+/**
+ * Tests for the binary block notifications.  They enable the feature before
+ * constructing the publisher.
+ */
+class ZmqPubBinaryTests : public testing::Test
+{
+
+protected:
+
+  std::unique_ptr<ZmqPub> pub;
+  std::unique_ptr<TestZmqSubscriber> sub;
+
+  ZmqPubBinaryTests ()
+  {
+    FLAGS_xayax_zmq_binary = true;
+    pub = std::make_unique<ZmqPub> (ZMQ_ADDR, 0);
+    sub = std::make_unique<TestZmqSubscriber> (ZMQ_ADDR);
+    SleepSome ();
+  }
+
+  ~ZmqPubBinaryTests ()
+  {
+    SleepSome ();
+    sub.reset ();
+    pub.reset ();
+    FLAGS_xayax_zmq_binary = false;
+  }
+
+  /**
+   * Waits for a single binary notification on the given topic and
+   * returns it parsed.
+   */
+  proto::BlockNotification
+  AwaitBinary (const std::string& cmd)
+  {
+    const auto raw = sub->AwaitRawMessages (cmd, 1);
+    CHECK_EQ (raw.size (), 1);
+
+    proto::BlockNotification res;
+    CHECK (res.ParseFromString (raw[0]));
+    return res;
+  }
+
+};
+
+TEST_F (ZmqPubBinaryTests, AttachAndDetach)
+{
+  ASSERT_TRUE (pub->HasBinary ());
+  pub->TrackGame ("a");
+
+  BlockData blk;
+  blk.hash = "block";
+  blk.parent = "parent";
+  blk.height = 42;
+  blk.rngseed = "seed";
+  blk.metadata = ParseJson (R"({"timestamp": 100})");
+
+  MoveData mv;
+  mv.txid = "tx1";
+  mv.ns = "p";
+  mv.name = "domob";
+  mv.mv = R"({"g": {"a": 1, "b": 2}})";
+  mv.burns["a"] = 5;
+  mv.burns["b"] = 10;
+  blk.moves.push_back (mv);
+
+  mv.txid = "tx2";
+  mv.mv = R"({"g": {"b": 3}})";
+  mv.burns.clear ();
+  blk.moves.push_back (mv);
+
+  mv.txid = "tx3";
+  mv.ns = "g";
+  mv.name = "a";
+  mv.mv = R"({"cmd": "admin"})";
+  blk.moves.push_back (mv);
+
+  pub->SendBlockAttach (blk, "token");
+  pub->SendBlockDetach (blk, "");
+
+  /* The JSON notifications are still sent as well.  */
+  sub->AwaitMessages ("game-block-attach json a", 1);
+  sub->AwaitMessages ("game-block-detach json a", 1);
+
+  const auto attach = AwaitBinary ("game-block-attach bin a");
+  EXPECT_EQ (attach.reqtoken (), "token");
+  EXPECT_EQ (attach.block ().hash (), "block");
+  EXPECT_EQ (attach.block ().parent (), "parent");
+  EXPECT_EQ (attach.block ().height (), 42);
+  EXPECT_EQ (attach.block ().rngseed (), "seed");
+  EXPECT_EQ (ParseJson (attach.block ().metadata ()), blk.metadata);
+  EXPECT_FALSE (attach.block ().has_game_index ());
+
+  ASSERT_EQ (attach.block ().moves_size (), 2);
+  const auto& mv1 = attach.block ().moves (0);
+  EXPECT_EQ (mv1.txid (), "tx1");
+  EXPECT_EQ (mv1.ns (), "p");
+  EXPECT_EQ (mv1.name (), "domob");
+  EXPECT_EQ (mv1.mv (), blk.moves[0].mv);
+  ASSERT_EQ (mv1.burns_size (), 1);
+  EXPECT_EQ (ParseJson (mv1.burns ().at ("a")), 5);
+  EXPECT_EQ (attach.block ().moves (1).txid (), "tx3");
+
+  const auto detach = AwaitBinary ("game-block-detach bin a");
+  EXPECT_EQ (detach.reqtoken (), "");
+  EXPECT_EQ (detach.block ().moves_size (), 2);
+
+  /* The detach is a live notification, so it is also sent as full block
+     (but the attach with reqtoken is not).  */
+  EXPECT_EQ (AwaitBinary ("block-detach bin").block ().moves_size (), 3);
+}
+
+TEST_F (ZmqPubBinaryTests, FullBlocks)
+{
+  sub = std::make_unique<TestZmqSubscriber> (ZMQ_ADDR, "block-attach bin");
+  SleepSome ();
+
+  BlockData blk;
+  blk.hash = "block";
+  blk.parent = "parent";
+  blk.height = 42;
+
+  MoveData mv;
+  mv.txid = "tx1";
+  mv.ns = "p";
+  mv.name = "domob";
+  mv.mv = R"({"g": {"a": 1, "b": 2}})";
+  mv.burns["a"] = 5;
+  mv.burns["b"] = 10;
+  blk.moves.push_back (mv);
+
+  mv.txid = "tx2";
+  mv.mv = "invalid";
+  mv.burns.clear ();
+  blk.moves.push_back (mv);
+
+  /* Full blocks are sent independently of tracked games, but only for
+     live notifications.  */
+  pub->SendBlockAttach (blk, "token");
+  pub->SendBlockAttach (blk, "", "a");
+  pub->SendBlockAttach (blk, "");
+
+  const auto attach = AwaitBinary ("block-attach bin");
+  EXPECT_EQ (attach.reqtoken (), "");
+
+  std::string data;
+  ASSERT_TRUE (attach.block ().SerializeToString (&data));
+  BlockData received;
+  received.Deserialise (data);
+  EXPECT_EQ (received, blk);
+  ASSERT_TRUE (received.gameIndex.has_value ());
+  EXPECT_EQ (*received.gameIndex, blk.GetGameIndex ());
+}
+
+TEST_F (ZmqPubBinaryTests, BinaryOnlySubscriber)
+{
+  /* The catch-all subscriber is replaced by one only for binary
+     notifications of "a".  */
+  sub = std::make_unique<TestZmqSubscriber> (ZMQ_ADDR,
+                                             "game-block-attach bin");
+  SleepSome ();
+
+  pub->TrackGame ("a");
+
+  BlockData blk;
+  blk.hash = "block";
+  pub->SendBlockAttach (blk, "");
+
+  EXPECT_EQ (AwaitBinary ("game-block-attach bin a").block ().hash (),
+             "block");
+}
+
 } // anonymous namespace
 } // namespace xayax
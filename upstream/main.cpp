@@ -0,0 +1,101 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "config.h"
+
+#include "controller.hpp"
+#include "metrics.hpp"
+
+#include "upstreamchain.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+DEFINE_string (upstream_rpc_url, "",
+               "URL at which the JSON-RPC interface of the upstream Xaya X"
+               " instance is available");
+
+DEFINE_string (datadir, "",
+               "base data directory for the Xaya X state");
+
+DEFINE_int32 (port, 0,
+              "the port where Xaya X should listen for RPC requests");
+DEFINE_bool (listen_locally, true,
+             "whether or not the RPC server should only bind on localhost");
+DEFINE_string (zmq_address, "",
+               "the address to bind the ZMQ publisher to");
+DEFINE_int32 (metrics_port, 0,
+              "if set, serve metrics in the Prometheus format over HTTP"
+              " on this port");
+
+DEFINE_int32 (max_reorg_depth, 1'000,
+              "maximum supported depth of reorgs");
+DEFINE_string (import_snapshot, "",
+               "if set and there is no local state yet, bootstrap from this"
+               " snapshot file (as written by the exportsnapshot RPC method)");
+
+DEFINE_bool (sanity_checks, false,
+             "whether or not to run slow sanity checks for testing");
+
+} // anonymous namespace
+
+int
+main (int argc, char* argv[])
+{
+  google::InitGoogleLogging (argv[0]);
+
+  gflags::SetUsageMessage ("Run Xaya X following another Xaya X instance");
+  gflags::SetVersionString (PACKAGE_VERSION);
+  gflags::ParseCommandLineFlags (&argc, &argv, true);
+
+  try
+    {
+      if (FLAGS_upstream_rpc_url.empty ())
+        throw std::runtime_error ("--upstream_rpc_url must be set");
+      if (FLAGS_port == 0)
+        throw std::runtime_error ("--port must be set");
+      if (FLAGS_zmq_address.empty ())
+        throw std::runtime_error ("--zmq_address must be set");
+      if (FLAGS_datadir.empty ())
+        throw std::runtime_error ("--datadir must be set");
+      if (FLAGS_max_reorg_depth < 0)
+        throw std::runtime_error ("--max_reorg_depth must not be negative");
+      if (FLAGS_metrics_port < 0)
+        throw std::runtime_error ("--metrics_port must not be negative");
+
+      xayax::UpstreamChain base(FLAGS_upstream_rpc_url);
+      base.Start ();
+      xayax::InstrumentedChain instrumented(base);
+
+      xayax::Controller controller(instrumented, FLAGS_datadir);
+      controller.SetMaxReorgDepth (FLAGS_max_reorg_depth);
+      controller.SetZmqEndpoint (FLAGS_zmq_address);
+      controller.SetRpcBinding (FLAGS_port, FLAGS_listen_locally);
+      controller.SetMetricsPort (FLAGS_metrics_port);
+      if (!FLAGS_import_snapshot.empty ())
+        controller.SetSnapshot (FLAGS_import_snapshot);
+      if (FLAGS_sanity_checks)
+        controller.EnableSanityChecks ();
+
+      controller.Run ();
+    }
+  catch (const std::exception& exc)
+    {
+      std::cerr << "Error: " << exc.what () << std::endl;
+      return EXIT_FAILURE;
+    }
+  catch (...)
+    {
+      std::cerr << "Exception caught" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2024 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Tests a xayax-upstream instance chained to a running Xaya X:  Syncing,
+reorgs and the mempool are all passed through from the upstream.
+"""
+
+
+import upstreamtest
+
+from xayax.testcase import ZmqSubscriber
+
+import jsonrpclib
+
+import time
+
+
+def waitForMempool (xrpc, expected):
+  """
+  Waits until the mempool reported by the given Xaya X RPC interface
+  is the expected one.
+  """
+
+  for _ in range (100):
+    if xrpc.getrawmempool () == expected:
+      return
+    time.sleep (0.1)
+
+  raise AssertionError ("mempool is not as expected: %s" % expected)
+
+
+if __name__ == "__main__":
+  with upstreamtest.Fixture () as f:
+    sub = ZmqSubscriber (f.zmqCtx, f.env.getXRpcUrl (), "game")
+    sub.subscribe ("game-block-attach")
+    sub.subscribe ("game-block-detach")
+    with sub.run ():
+      rpc = f.env.createCoreRpc ()
+      xrpc = jsonrpclib.ServerProxy (f.env.getXRpcUrl ())
+      urpc = jsonrpclib.ServerProxy (f.env.getUpstreamRpcUrl ())
+
+      f.mainLogger.info ("Syncing blocks...")
+      base = f.generate (10)
+      f.assertZmqBlocks (sub, "attach", base)
+      f.syncBlocks ()
+      f.assertEqual (xrpc.getblockchaininfo ()["bestblockhash"], base[-1])
+      f.assertEqual (xrpc.getblockchaininfo ()["chain"],
+                     urpc.getblockchaininfo ()["chain"])
+
+      f.mainLogger.info ("Reorg...")
+      branch1 = f.generate (5)
+      f.assertZmqBlocks (sub, "attach", branch1)
+      rpc.invalidateblock (branch1[0])
+      branch2 = f.generate (3)
+      f.assertZmqBlocks (sub, "detach", branch1[::-1])
+      f.assertZmqBlocks (sub, "attach", branch2)
+
+      rpc.reconsiderblock (branch1[0])
+      f.assertZmqBlocks (sub, "detach", branch2[::-1])
+      f.assertZmqBlocks (sub, "attach", branch1)
+      f.syncBlocks ()
+
+      data = xrpc.game_sendupdates (gameid="game", fromblock=branch2[-1])
+      f.assertEqual (data["steps"], {
+        "detach": 3,
+        "attach": 5,
+      })
+      f.assertEqual (data["toblock"], branch1[-1])
+      f.assertZmqBlocks (sub, "detach", branch2[::-1],
+                         reqtoken=data["reqtoken"])
+      f.assertZmqBlocks (sub, "attach", branch1, reqtoken=data["reqtoken"])
+
+      f.mainLogger.info ("Pending moves...")
+      f.env.register ("p", "domob")
+      [blk] = f.generate (1)
+      f.assertZmqBlocks (sub, "attach", [blk])
+      f.syncBlocks ()
+
+      txid1 = f.sendMove ("p/domob", {"g": {"game": 1}})
+      txid2 = f.sendMove ("p/domob", {"g": {"game": 2}})
+      waitForMempool (xrpc, [txid1, txid2])
+      f.assertEqual (xrpc.getrawmempool (), urpc.getrawmempool ())
+
+      [blk] = f.generate (1)
+      _, data = sub.receive ()
+      f.assertEqual (data["block"]["hash"], blk)
+      f.assertEqual ([m["txid"] for m in data["moves"]], [txid1, txid2])
+      f.syncBlocks ()
+      waitForMempool (xrpc, [])
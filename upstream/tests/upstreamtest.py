@@ -0,0 +1,63 @@
+# Copyright (C) 2024 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Test fixture for testing xayax-upstream, following a Xaya X instance
+that is itself connected to Xaya Core.
+"""
+
+
+from xayax import testcase, upstream
+
+from xayagametest import premine
+
+from contextlib import contextmanager
+import os
+import os.path
+
+
+XAYAD_BINARY_DEFAULT = "/usr/local/bin/xayad"
+
+
+class Fixture (testcase.BaseChainFixture):
+
+  def addArguments (self, parser):
+    parser.add_argument ("--xayad_binary", default=XAYAD_BINARY_DEFAULT,
+                         help="xayad binary to use")
+    parser.add_argument ("--xcore_binary", default="",
+                         help="xayax-core binary to use")
+    parser.add_argument ("--xupstream_binary", default="",
+                         help="xayax-upstream binary to use")
+
+  @contextmanager
+  def environment (self):
+    with super ().environment ():
+      premine.collect (self.env.createCoreRpc (), logger=self.log)
+      self.syncBlocks ()
+      yield
+
+  def getBinary (self, override, subdir, name):
+    if override:
+      return override
+
+    top_builddir = os.getenv ("top_builddir")
+    if top_builddir is None:
+      top_builddir = "../.."
+
+    return os.path.join (top_builddir, subdir, name)
+
+  def createBaseChain (self):
+    xcoreBin = self.getBinary (self.args.xcore_binary,
+                               "xayacore", "xayax-core")
+    upstreamBin = self.getBinary (self.args.xupstream_binary,
+                                  "upstream", "xayax-upstream")
+
+    # The upstream instance needs to publish full blocks, which is what
+    # xayax-upstream listens to for following the tip.
+    xcoreCmd = [xcoreBin, "--xayax_zmq_binary"]
+
+    env = upstream.Environment (self.basedir, self.portgen,
+                                self.args.xayad_binary, xcoreCmd,
+                                upstreamBin)
+    return env.run ()
@@ -0,0 +1,558 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "upstreamchain.hpp"
+
+#include "proto/blockdata.pb.h"
+#include "rpcutils.hpp"
+
+#include "rpc-stubs/upstreamrpcclient.h"
+
+#include <xayautil/base64.hpp>
+
+#include <jsonrpccpp/client.h>
+#include <jsonrpccpp/common/exception.h>
+#include <zmq.hpp>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+namespace xayax
+{
+
+DEFINE_int32 (upstream_rpc_timeout_ms, 10'000,
+              "timeout for RPC calls to the upstream Xaya X instance");
+DEFINE_int32 (upstream_rpc_pool_size, 8,
+              "maximum number of idle keep-alive connections to the"
+              " upstream Xaya X instance");
+DEFINE_int32 (upstream_recent_blocks, 1'000,
+              "number of blocks received through ZMQ from the upstream"
+              " that are kept in memory");
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/** ZMQ topic for full-block attach notifications from the upstream.  */
+constexpr const char* TOPIC_ATTACH = "block-attach bin";
+/** ZMQ topic for full-block detach notifications from the upstream.  */
+constexpr const char* TOPIC_DETACH = "block-detach bin";
+
+using UpstreamRpcPool
+    = RpcClientPool<UpstreamRpcClient, jsonrpc::JSONRPC_CLIENT_V1>;
+
+/**
+ * RPC client for a single request (or sequence of requests), checked out
+ * from a pool of connections.
+ */
+class UpstreamRpc : public UpstreamRpcPool::Handle
+{
+
+public:
+
+  explicit UpstreamRpc (UpstreamRpcPool& pool)
+    : Handle(pool)
+  {}
+
+};
+
+/**
+ * Decodes a block in the raw serialised form (as returned by getblockrange
+ * and in full-block notifications).  The cached serialised data is reset,
+ * so that the block is stored with the local compression settings.
+ */
+BlockData
+DecodeBlock (const std::string& data)
+{
+  BlockData res;
+  res.Deserialise (data);
+  res.serialised.reset ();
+  return res;
+}
+
+} // anonymous namespace
+
+/* ************************************************************************** */
+
+class UpstreamChain::RpcPool : public UpstreamRpcPool
+{
+
+public:
+
+  explicit RpcPool (const std::string& ep)
+    : UpstreamRpcPool(ep, FLAGS_upstream_rpc_pool_size, [] (Client& c)
+        {
+          c.SetTimeout (
+              std::chrono::milliseconds (FLAGS_upstream_rpc_timeout_ms));
+        })
+  {
+    CHECK_GE (FLAGS_upstream_rpc_pool_size, 0)
+        << "Invalid --upstream_rpc_pool_size";
+  }
+
+};
+
+/* ************************************************************************** */
+
+/**
+ * ZMQ listener for the full-block notifications of the upstream.  Like the
+ * listener for Xaya Core, the receiver thread blocks in zmq::poll on the
+ * data socket and an internal control socket used to stop it.
+ */
+class UpstreamChain::ZmqListener
+{
+
+private:
+
+  /** Control message to stop the receiver thread.  */
+  static constexpr const char* CONTROL_STOP = "stop";
+
+  /** Counter used to generate unique addresses for the control sockets.  */
+  static std::atomic<unsigned> nextControlId;
+
+  /** Parent instance that the listener notifies about updates.  */
+  UpstreamChain& parent;
+
+  /** ZMQ socket for this listener, used only from the receiver thread.  */
+  zmq::socket_t sock;
+
+  /** Receiving end of the control socket pair (used by the receiver).  */
+  zmq::socket_t controlRecv;
+
+  /** Sending end of the control socket pair.  */
+  zmq::socket_t controlSend;
+
+  /**
+   * The next expected sequence number for each topic.  A gap means that
+   * notifications have been dropped.
+   */
+  std::map<std::string, uint32_t> nextSeq;
+
+  /** Background thread running the ZMQ receiver.  */
+  std::unique_ptr<std::thread> receiver;
+
+  /**
+   * Worker method that runs on the receiver thread.
+   */
+  void ReceiveLoop ();
+
+  /**
+   * Receives and handles a notification from the data socket.
+   */
+  void ReceiveNotification ();
+
+public:
+
+  /**
+   * Constructs the listener, connecting it to the given address and
+   * starting the receiver thread.
+   */
+  explicit ZmqListener (UpstreamChain& p, zmq::context_t& ctx,
+                        const std::string& addr)
+    : parent(p), sock(ctx, ZMQ_SUB),
+      controlRecv(ctx, ZMQ_PAIR), controlSend(ctx, ZMQ_PAIR)
+  {
+    std::ostringstream controlAddr;
+    controlAddr << "inproc://xayax-upstream-zmq-control-" << nextControlId++;
+    controlRecv.bind (controlAddr.str ());
+    controlSend.connect (controlAddr.str ());
+
+    sock.set (zmq::sockopt::subscribe, TOPIC_ATTACH);
+    sock.set (zmq::sockopt::subscribe, TOPIC_DETACH);
+    sock.connect (addr);
+
+    receiver = std::make_unique<std::thread> ([this] ()
+      {
+        ReceiveLoop ();
+      });
+  }
+
+  /**
+   * Destructs and stops the listener.
+   */
+  ~ZmqListener ()
+  {
+    CHECK (receiver != nullptr);
+    CHECK (controlSend.send (zmq::message_t (std::string (CONTROL_STOP)),
+                             zmq::send_flags::none));
+    receiver->join ();
+    receiver.reset ();
+    sock.close ();
+    controlSend.close ();
+    controlRecv.close ();
+  }
+
+};
+
+std::atomic<unsigned> UpstreamChain::ZmqListener::nextControlId(0);
+
+void
+UpstreamChain::ZmqListener::ReceiveLoop ()
+{
+  while (true)
+    {
+      zmq::pollitem_t items[] = {
+        {controlRecv.handle (), 0, ZMQ_POLLIN, 0},
+        {sock.handle (), 0, ZMQ_POLLIN, 0},
+      };
+      try
+        {
+          zmq::poll (items, 2, std::chrono::milliseconds (-1));
+        }
+      catch (const zmq::error_t& exc)
+        {
+          if (exc.num () != EINTR)
+            throw;
+          continue;
+        }
+
+      if (items[0].revents & ZMQ_POLLIN)
+        {
+          zmq::message_t msg;
+          CHECK (controlRecv.recv (msg, zmq::recv_flags::dontwait));
+          CHECK_EQ (msg.to_string (), CONTROL_STOP)
+              << "Unexpected control message";
+          return;
+        }
+
+      if (items[1].revents & ZMQ_POLLIN)
+        ReceiveNotification ();
+    }
+}
+
+void
+UpstreamChain::ZmqListener::ReceiveNotification ()
+{
+  zmq::message_t msg;
+  if (!sock.recv (msg, zmq::recv_flags::dontwait))
+    return;
+  const std::string topic = msg.to_string ();
+
+  CHECK (sock.get (zmq::sockopt::rcvmore));
+  CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
+  const std::string payload = msg.to_string ();
+
+  CHECK (sock.get (zmq::sockopt::rcvmore));
+  CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
+  CHECK_EQ (msg.size (), 4);
+  CHECK (!sock.get (zmq::sockopt::rcvmore));
+
+  const auto* seqBytes = static_cast<const uint8_t*> (msg.data ());
+  uint32_t seq = 0;
+  for (int i = 3; i >= 0; --i)
+    seq = (seq << 8) | seqBytes[i];
+
+  /* If we missed a notification (e.g. because the upstream dropped it),
+     our view of the recent main chain may be wrong.  */
+  const auto mit = nextSeq.find (topic);
+  if (mit != nextSeq.end () && mit->second != seq)
+    {
+      LOG (WARNING)
+          << "Missed upstream notifications on " << topic
+          << ", expected sequence number " << mit->second << " but got " << seq;
+      parent.ClearRecentMainchain ();
+    }
+  nextSeq[topic] = seq + 1;
+
+  proto::BlockNotification notification;
+  CHECK (notification.ParseFromString (payload))
+      << "Invalid full-block notification from upstream";
+  std::string data;
+  CHECK (notification.block ().SerializeToString (&data));
+  auto blk = DecodeBlock (data);
+
+  if (topic == TOPIC_ATTACH)
+    parent.BlockAttached (std::move (blk));
+  else if (topic == TOPIC_DETACH)
+    parent.BlockDetached (std::move (blk));
+  else
+    LOG (FATAL) << "Unexpected topic: " << topic;
+}
+
+/* ************************************************************************** */
+
+UpstreamChain::UpstreamChain (const std::string& ep)
+  : endpoint(ep), rpcPool(std::make_unique<RpcPool> (endpoint)),
+    recentSize(std::max (0, FLAGS_upstream_recent_blocks)),
+    recentBlocks(recentSize),
+    zmqCtx(new zmq::context_t ())
+{}
+
+UpstreamChain::~UpstreamChain ()
+{
+  listener.reset ();
+  zmqCtx.reset ();
+}
+
+void
+UpstreamChain::Start ()
+{
+  UpstreamRpc rpc(*rpcPool);
+
+  std::string addr;
+  for (const auto& n : rpc->getzmqnotifications ())
+    {
+      CHECK (n.isObject ());
+      if (n["type"].asString () == "pubblocksbin")
+        addr = n["address"].asString ();
+    }
+
+  if (addr.empty ())
+    {
+      LOG (WARNING)
+          << "Upstream Xaya X has no full-block notifications"
+          << " (--xayax_zmq_binary), relying on periodic polling only";
+      return;
+    }
+
+  LOG (INFO)
+      << "Using full-block notifications at " << addr
+      << " for receiving tip updates from the upstream";
+  listener = std::make_unique<ZmqListener> (*this, *zmqCtx, addr);
+}
+
+void
+UpstreamChain::BlockAttached (BlockData&& blk)
+{
+  const std::string hash = blk.hash;
+  {
+    std::lock_guard<std::mutex> lock(mutRecent);
+
+    /* An attached block is the new tip, so everything at or above its
+       height is not on the main chain anymore.  If we do not know its
+       parent, we cannot tell what the main chain below it is.  */
+    recentMainchain.erase (recentMainchain.lower_bound (blk.height),
+                           recentMainchain.end ());
+    if (!recentMainchain.empty ()
+          && (recentMainchain.rbegin ()->first + 1 != blk.height
+                || recentMainchain.rbegin ()->second != blk.parent))
+      recentMainchain.clear ();
+
+    recentMainchain[blk.height] = hash;
+    while (recentMainchain.size () > recentSize)
+      recentMainchain.erase (recentMainchain.begin ());
+
+    recentBlocks.Put (hash, std::move (blk));
+  }
+
+  TipChanged (hash);
+}
+
+void
+UpstreamChain::BlockDetached (BlockData&& blk)
+{
+  const std::string hash = blk.hash;
+  const std::string newTip = blk.parent;
+  {
+    std::lock_guard<std::mutex> lock(mutRecent);
+
+    /* Detaches happen from the tip downwards, so the detached block
+       should be our current tip.  */
+    if (recentMainchain.empty ()
+          || recentMainchain.rbegin ()->second != blk.hash)
+      recentMainchain.clear ();
+    else
+      recentMainchain.erase (blk.height);
+
+    recentBlocks.Put (hash, std::move (blk));
+  }
+
+  TipChanged (newTip);
+}
+
+void
+UpstreamChain::ClearRecentMainchain ()
+{
+  std::lock_guard<std::mutex> lock(mutRecent);
+  recentMainchain.clear ();
+}
+
+bool
+UpstreamChain::GetRecentRange (const uint64_t start, const uint64_t count,
+                               std::vector<BlockData>& blocks)
+{
+  std::lock_guard<std::mutex> lock(mutRecent);
+
+  if (recentMainchain.empty () || start < recentMainchain.begin ()->first)
+    return false;
+
+  blocks.clear ();
+  for (auto it = recentMainchain.find (start);
+       it != recentMainchain.end () && blocks.size () < count; ++it)
+    {
+      BlockData blk;
+      if (!recentBlocks.Get (it->second, blk))
+        return false;
+      if (!blocks.empty () && blk.parent != blocks.back ().hash)
+        return false;
+      blocks.push_back (std::move (blk));
+    }
+
+  return !blocks.empty ();
+}
+
+uint64_t
+UpstreamChain::GetTipHeight ()
+{
+  UpstreamRpc rpc(*rpcPool);
+  const auto info = rpc->getblockchaininfo ();
+  const auto blocks = info["blocks"].asInt64 ();
+  if (blocks < 0)
+    throw std::runtime_error ("upstream Xaya X has no blocks yet");
+  return blocks;
+}
+
+std::vector<BlockData>
+UpstreamChain::GetBlockRange (const uint64_t start, const uint64_t count)
+{
+  if (count == 0)
+    return {};
+
+  std::vector<BlockData> res;
+  if (GetRecentRange (start, count, res))
+    return res;
+
+  /* The upstream returns at most its own --xayax_block_range blocks per
+     call, so we may need multiple requests.  */
+  UpstreamRpc rpc(*rpcPool);
+  while (res.size () < count)
+    {
+      const uint64_t height = start + res.size ();
+      const auto data = rpc->getblockrange (count - res.size (), height);
+      CHECK (data.isArray ());
+      if (data.empty ())
+        break;
+
+      for (const auto& entry : data)
+        {
+          std::string raw;
+          CHECK (xaya::DecodeBase64 (entry.asString (), raw))
+              << "Invalid block data from upstream";
+          auto blk = DecodeBlock (raw);
+          CHECK_EQ (blk.height, start + res.size ());
+
+          /* A reorg on the upstream between calls may break the chain,
+             in which case we just return what we have (and the sync
+             will request the rest again).  */
+          if (!res.empty () && blk.parent != res.back ().hash)
+            {
+              LOG (WARNING)
+                  << "Upstream blocks from " << start << " do not match up,"
+                  << " race condition?";
+              return res;
+            }
+          res.push_back (std::move (blk));
+        }
+    }
+
+  return res;
+}
+
+bool
+UpstreamChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutRecent);
+    if (recentBlocks.Get (hash, blk))
+      return true;
+  }
+
+  /* Otherwise, we can only retrieve the block if it is on the upstream's
+     main chain.  */
+  const int64_t height = GetMainchainHeight (hash);
+  if (height == -1)
+    return false;
+
+  const auto blocks = GetBlockRange (height, 1);
+  if (blocks.size () != 1 || blocks[0].hash != hash)
+    return false;
+
+  blk = blocks[0];
+  return true;
+}
+
+int64_t
+UpstreamChain::GetMainchainHeight (const std::string& hash)
+{
+  UpstreamRpc rpc(*rpcPool);
+
+  /* The upstream's getblockheader also knows blocks on side branches
+     of its chainstate, so we verify that the block is on the main chain
+     with getblockhash for its height.  */
+  try
+    {
+      const auto data = rpc->getblockheader (hash);
+      CHECK (data.isObject ());
+      const int64_t height = data["height"].asInt64 ();
+      CHECK_GE (height, 0);
+      if (rpc->getblockhash (height) != hash)
+        return -1;
+      return height;
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      VLOG (1) << "RPC error from upstream: " << exc.what ();
+      return -1;
+    }
+}
+
+std::vector<std::string>
+UpstreamChain::GetMempool ()
+{
+  UpstreamRpc rpc(*rpcPool);
+
+  const auto mempool = rpc->getrawmempool ();
+  CHECK (mempool.isArray ());
+
+  std::vector<std::string> res;
+  for (const auto& txid : mempool)
+    res.push_back (txid.asString ());
+
+  return res;
+}
+
+bool
+UpstreamChain::VerifyMessage (const std::string& msg,
+                              const std::string& signature, std::string& addr)
+{
+  UpstreamRpc rpc(*rpcPool);
+
+  const auto res
+      = rpc->verifymessage ("", msg, xaya::EncodeBase64 (signature));
+  CHECK (res.isObject ());
+
+  if (!res["valid"].asBool ())
+    return false;
+
+  addr = res["address"].asString ();
+  return true;
+}
+
+std::string
+UpstreamChain::GetChain ()
+{
+  UpstreamRpc rpc(*rpcPool);
+  const auto info = rpc->getblockchaininfo ();
+  return info["chain"].asString ();
+}
+
+uint64_t
+UpstreamChain::GetVersion ()
+{
+  UpstreamRpc rpc(*rpcPool);
+  const auto info = rpc->getnetworkinfo ();
+  return info["version"].asUInt64 ();
+}
+
+/* ************************************************************************** */
+
+} // namespace xayax
@@ -0,0 +1,120 @@
+// Copyright (C) 2024 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAX_UPSTREAM_UPSTREAMCHAIN_HPP
+#define XAYAX_UPSTREAM_UPSTREAMCHAIN_HPP
+
+#include "basechain.hpp"
+#include "lrucache.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace zmq
+{
+  class context_t;
+} // namespace zmq
+
+namespace xayax
+{
+
+/**
+ * BaseChain connector that follows another Xaya X instance instead of
+ * talking to a blockchain node itself.  Blocks are retrieved through the
+ * upstream's getblockrange RPC method (which serves them from its chainstate
+ * and block cache), and live updates are received as full blocks on its
+ * binary ZMQ notifications.  This allows running many Xaya X instances
+ * (e.g. one per region) while only one of them queries the chain node.
+ *
+ * The most recent blocks received through ZMQ are kept in memory, so that
+ * following the tip does not need any RPC calls for them.
+ */
+class UpstreamChain : public BaseChain
+{
+
+private:
+
+  class RpcPool;
+  class ZmqListener;
+
+  /** RPC endpoint of the upstream Xaya X instance.  */
+  const std::string endpoint;
+
+  /** Pool of RPC clients for the endpoint.  */
+  std::unique_ptr<RpcPool> rpcPool;
+
+  /** Number of recent blocks kept in memory.  */
+  const size_t recentSize;
+
+  /** Lock for the recently notified blocks.  */
+  std::mutex mutRecent;
+
+  /** Blocks received through ZMQ notifications by hash.  */
+  LruCache<std::string, BlockData> recentBlocks;
+
+  /**
+   * Hashes of the upstream's main chain by height, as far as we know them
+   * from attach and detach notifications.  This ends at the upstream's tip
+   * (unless notifications are in flight) and is cleared whenever we may have
+   * missed a notification.
+   */
+  std::map<uint64_t, std::string> recentMainchain;
+
+  /** ZMQ context used to listen to the upstream.  */
+  std::unique_ptr<zmq::context_t> zmqCtx;
+
+  /** The ZMQ listener, if connected.  */
+  std::unique_ptr<ZmqListener> listener;
+
+  /**
+   * Processes a block attached to the upstream's main chain.
+   */
+  void BlockAttached (BlockData&& blk);
+
+  /**
+   * Processes a block detached from the upstream's main chain.
+   */
+  void BlockDetached (BlockData&& blk);
+
+  /**
+   * Forgets the known recent main chain (e.g. because we missed
+   * notifications).
+   */
+  void ClearRecentMainchain ();
+
+  /**
+   * Tries to answer GetBlockRange from the recently notified blocks.
+   * Returns false if they do not cover the range.
+   */
+  bool GetRecentRange (uint64_t start, uint64_t count,
+                       std::vector<BlockData>& blocks);
+
+public:
+
+  explicit UpstreamChain (const std::string& ep);
+  ~UpstreamChain ();
+
+  void Start () override;
+
+  uint64_t GetTipHeight () override;
+  std::vector<BlockData> GetBlockRange (uint64_t start,
+                                        uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
+  int64_t GetMainchainHeight (const std::string& hash) override;
+  std::vector<std::string> GetMempool () override;
+  bool VerifyMessage (const std::string& msg, const std::string& signature,
+                      std::string& addr) override;
+  std::string GetChain () override;
+  uint64_t GetVersion () override;
+
+};
+
+} // namespace xayax
+
+#endif // XAYAX_UPSTREAM_UPSTREAMCHAIN_HPP
@@ -20,8 +20,11 @@
 
 #include <atomic>
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <future>
 #include <map>
+#include <sstream>
 #include <thread>
 
 namespace xayax
@@ -29,6 +32,14 @@ namespace xayax
 
 DEFINE_int32 (core_rpc_timeout_ms, 10'000,
               "timeout for RPC calls to Xaya Core");
+DEFINE_int32 (core_rpc_pool_size, 8,
+              "maximum number of idle keep-alive connections to Xaya Core");
+DEFINE_int32 (core_block_batch_size, 16,
+              "number of blocks requested from Xaya Core in a single"
+              " batched RPC call");
+DEFINE_int32 (core_parallel_batches, 4,
+              "maximum number of block batches requested in parallel"
+              " from Xaya Core");
 
 /* ************************************************************************** */
 
@@ -165,20 +176,77 @@ ConstructBlockData (const Json::Value& data)
   return res;
 }
 
-class CoreRpc
-    : public RpcClient<CoreRpcClient, jsonrpc::JSONRPC_CLIENT_V1>
+using CoreRpcPool = RpcClientPool<CoreRpcClient, jsonrpc::JSONRPC_CLIENT_V1>;
+
+/**
+ * RPC client for a single request (or sequence of requests), checked out
+ * from a pool of connections.
+ */
+class CoreRpc : public CoreRpcPool::Handle
 {
 
 public:
 
-  CoreRpc (const std::string& ep)
-    : RpcClient(ep)
-  {
-    SetTimeout (std::chrono::milliseconds (FLAGS_core_rpc_timeout_ms));
-  }
+  explicit CoreRpc (CoreRpcPool& pool)
+    : Handle(pool)
+  {}
 
 };
 
+/**
+ * Sends a batch of calls to the given method with each of the given
+ * (positional) parameter lists, and returns the results in order.
+ * If any of the calls fails, a JsonRpcException with its error is thrown.
+ */
+std::vector<Json::Value>
+CallBatch (CoreRpc& rpc, const std::string& method,
+           const std::vector<Json::Value>& params)
+{
+  jsonrpc::BatchCall req;
+  std::vector<int> ids;
+  for (const auto& p : params)
+    ids.push_back (req.addCall (method, p));
+
+  jsonrpc::BatchResponse resp = rpc->CallProcedures (req);
+
+  std::vector<Json::Value> res;
+  for (const auto id : ids)
+    {
+      Json::Value idVal(id);
+      const int err = resp.getErrorCode (idVal);
+      if (err != 0)
+        throw jsonrpc::JsonRpcException (err, resp.getErrorMessage (idVal));
+      res.push_back (resp.getResult (id));
+    }
+
+  return res;
+}
+
+/**
+ * Retrieves the blocks from the given end hash back to the start height
+ * one by one, following the parent links.  This is atomic with respect
+ * to reorgs by construction, but needs one round trip per block.
+ */
+std::vector<BlockData>
+GetBlocksBackwards (CoreRpc& rpc, std::string endHash, const uint64_t start)
+{
+  std::vector<BlockData> res;
+  do
+    {
+      const auto data = rpc->getblock (endHash, 2);
+      auto cur = ConstructBlockData (data);
+
+      CHECK_GE (cur.height, start);
+      endHash = cur.parent;
+
+      res.push_back (std::move (cur));
+    }
+  while (res.back ().height > start);
+
+  std::reverse (res.begin (), res.end ());
+  return res;
+}
+
 /**
  * Queries for enabled ZMQ notifications on the Xaya Core node and
  * tries to find the address for a given type of notification.  If that type
@@ -204,45 +272,96 @@ GetNotificationAddress (CoreRpc& rpc, const std::string& type)
 
 /* ************************************************************************** */
 
+class CoreChain::RpcPool : public CoreRpcPool
+{
+
+public:
+
+  explicit RpcPool (const std::string& ep)
+    : CoreRpcPool(ep, FLAGS_core_rpc_pool_size, [] (Client& c)
+        {
+          c.SetTimeout (std::chrono::milliseconds (FLAGS_core_rpc_timeout_ms));
+        })
+  {
+    CHECK_GE (FLAGS_core_rpc_pool_size, 0) << "Invalid --core_rpc_pool_size";
+  }
+
+};
+
+/* ************************************************************************** */
+
 /**
  * ZMQ listener that can handle tip updates as well as pending transactions
  * from Xaya Core (pubhashblock and pubrawtx).
+ *
+ * The receiver thread blocks in zmq::poll on the data socket and an internal
+ * control socket (an inproc pair), through which other threads request
+ * subscription changes or stopping.  This way, the listener does not use
+ * any CPU while idle and handles notifications as soon as they arrive.
  */
 class CoreChain::ZmqListener
 {
 
 private:
 
+  /** Control message to stop the receiver thread.  */
+  static constexpr const char* CONTROL_STOP = "stop";
+  /** Prefix of control messages to subscribe to a topic.  */
+  static constexpr const char* CONTROL_SUBSCRIBE = "subscribe ";
+
+  /** Counter used to generate unique addresses for the control sockets.  */
+  static std::atomic<unsigned> nextControlId;
+
   /** Parent instance that the listener notifies about updates.  */
   CoreChain& parent;
 
   /**
-   * Mutex used to synchronise the socket.  We need this when we add
-   * a subscription topic to an already connected socket.
+   * ZMQ socket for this listener.  It is only used from the receiver thread
+   * while that is running.
    */
-  std::mutex mut;
-
-  /** ZMQ socket for this listener.  */
   zmq::socket_t sock;
 
-  /** Flag to indicate if the receiver thread should stop.  */
-  std::atomic<bool> shouldStop;
+  /** Receiving end of the control socket pair (used by the receiver).  */
+  zmq::socket_t controlRecv;
+
+  /**
+   * Sending end of the control socket pair.  ZMQ sockets are not thread-safe,
+   * so this is protected by the mutex.
+   */
+  zmq::socket_t controlSend;
+
+  /** Mutex for sending control messages.  */
+  std::mutex mut;
 
   /** Background thread running the ZMQ receiver.  */
   std::unique_ptr<std::thread> receiver;
 
   /**
-   * The RPC connection used from the rawtx handler.  This will only
-   * be used from the receiver thread, so it is fine to have one instance
-   * here that is shared between calls.
+   * Sends a control message to the receiver thread.
    */
-  CoreRpc rpc;
+  void
+  SendControl (const std::string& msg)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    CHECK (controlSend.send (zmq::message_t (msg), zmq::send_flags::none));
+  }
 
   /**
    * Worker method that runs on the receiver thread.
    */
   void ReceiveLoop ();
 
+  /**
+   * Handles a control message in the receiver thread.  Returns false if
+   * the receiver should stop.
+   */
+  bool HandleControl (const std::string& msg);
+
+  /**
+   * Receives and handles a notification from the data socket.
+   */
+  void ReceiveNotification ();
+
   /**
    * Handles a tip-update notification payload.
    */
@@ -261,8 +380,14 @@ public:
    */
   explicit ZmqListener (CoreChain& p, zmq::context_t& ctx,
                         const std::string& addr)
-    : parent(p), sock(ctx, ZMQ_SUB), shouldStop(false), rpc(parent.endpoint)
+    : parent(p), sock(ctx, ZMQ_SUB),
+      controlRecv(ctx, ZMQ_PAIR), controlSend(ctx, ZMQ_PAIR)
   {
+    std::ostringstream controlAddr;
+    controlAddr << "inproc://xayax-core-zmq-control-" << nextControlId++;
+    controlRecv.bind (controlAddr.str ());
+    controlSend.connect (controlAddr.str ());
+
     sock.connect (addr);
     receiver = std::make_unique<std::thread> ([this] ()
       {
@@ -271,13 +396,13 @@ public:
   }
 
   /**
-   * Subscribes the socket to the given topic.
+   * Subscribes the socket to the given topic.  The subscription is done
+   * asynchronously by the receiver thread.
    */
   void
   Subscribe (const std::string& topic)
   {
-    std::lock_guard<std::mutex> lock(mut);
-    sock.set (zmq::sockopt::subscribe, topic);
+    SendControl (CONTROL_SUBSCRIBE + topic);
   }
 
   /**
@@ -286,59 +411,101 @@ public:
   ~ZmqListener ()
   {
     CHECK (receiver != nullptr);
-    shouldStop = true;
+    SendControl (CONTROL_STOP);
     receiver->join ();
     receiver.reset ();
     sock.close ();
+    controlSend.close ();
+    controlRecv.close ();
   }
 
 };
 
+std::atomic<unsigned> CoreChain::ZmqListener::nextControlId(0);
+
 void
 CoreChain::ZmqListener::ReceiveLoop ()
 {
-  while (!shouldStop)
+  while (true)
     {
-      std::unique_lock<std::mutex> lock(mut);
-
-      zmq::message_t msg;
-      if (!sock.recv (msg, zmq::recv_flags::dontwait))
+      zmq::pollitem_t items[] = {
+        {controlRecv.handle (), 0, ZMQ_POLLIN, 0},
+        {sock.handle (), 0, ZMQ_POLLIN, 0},
+      };
+      try
         {
-          /* No messages available.  Just sleep a bit and try again.  Make sure
-             to release the lock so a subscription request from another thread
-             can get through easily.  */
-          lock.unlock ();
-          std::this_thread::sleep_for (std::chrono::milliseconds (1));
+          zmq::poll (items, 2, std::chrono::milliseconds (-1));
+        }
+      catch (const zmq::error_t& exc)
+        {
+          /* The poll may be interrupted by a signal (e.g. while we are
+             being shut down), in which case we just try again.  */
+          if (exc.num () != EINTR)
+            throw;
           continue;
         }
-      const std::string topic = msg.to_string ();
-
-      /* Multipart messages are delivered atomically.  As long as
-         there are more parts, they are guaranteed to be available
-         now as well.  */
-      CHECK (sock.get (zmq::sockopt::rcvmore));
-      CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
-      const std::string payload = msg.to_string ();
-
-      /* Ignore the sequence number.  */
-      CHECK (sock.get (zmq::sockopt::rcvmore));
-      CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
-      CHECK_EQ (msg.size (), 4);
-      CHECK (!sock.get (zmq::sockopt::rcvmore));
-
-      /* No need to keep the lock while processing.  */
-      lock.unlock ();
-
-      if (topic == "hashblock")
-        HandleHashBlock (payload);
-      else if (topic == "rawtx")
-        HandleRawTx (payload);
-      else
+
+      /* Handle control messages first, so that we stop quickly even if
+         a lot of notifications are coming in.  */
+      if (items[0].revents & ZMQ_POLLIN)
         {
-          /* We should not have subscribed to any other topic (independent
-             of what Xaya Core is configured to send).  */
-          LOG (FATAL) << "Unexpected topic: " << topic;
+          zmq::message_t msg;
+          CHECK (controlRecv.recv (msg, zmq::recv_flags::dontwait));
+          if (!HandleControl (msg.to_string ()))
+            return;
         }
+
+      if (items[1].revents & ZMQ_POLLIN)
+        ReceiveNotification ();
+    }
+}
+
+bool
+CoreChain::ZmqListener::HandleControl (const std::string& msg)
+{
+  if (msg == CONTROL_STOP)
+    return false;
+
+  const std::string prefix(CONTROL_SUBSCRIBE);
+  CHECK_EQ (msg.substr (0, prefix.size ()), prefix)
+      << "Unexpected control message: " << msg;
+  const std::string topic = msg.substr (prefix.size ());
+  VLOG (1) << "Subscribing to ZMQ topic " << topic;
+  sock.set (zmq::sockopt::subscribe, topic);
+
+  return true;
+}
+
+void
+CoreChain::ZmqListener::ReceiveNotification ()
+{
+  zmq::message_t msg;
+  if (!sock.recv (msg, zmq::recv_flags::dontwait))
+    return;
+  const std::string topic = msg.to_string ();
+
+  /* Multipart messages are delivered atomically.  As long as
+     there are more parts, they are guaranteed to be available
+     now as well.  */
+  CHECK (sock.get (zmq::sockopt::rcvmore));
+  CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
+  const std::string payload = msg.to_string ();
+
+  /* Ignore the sequence number.  */
+  CHECK (sock.get (zmq::sockopt::rcvmore));
+  CHECK (sock.recv (msg, zmq::recv_flags::dontwait));
+  CHECK_EQ (msg.size (), 4);
+  CHECK (!sock.get (zmq::sockopt::rcvmore));
+
+  if (topic == "hashblock")
+    HandleHashBlock (payload);
+  else if (topic == "rawtx")
+    HandleRawTx (payload);
+  else
+    {
+      /* We should not have subscribed to any other topic (independent
+         of what Xaya Core is configured to send).  */
+      LOG (FATAL) << "Unexpected topic: " << topic;
     }
 }
 
@@ -354,6 +521,7 @@ CoreChain::ZmqListener::HandleRawTx (const std::string& payload)
   Json::Value tx;
   try
     {
+      CoreRpc rpc(*parent.rpcPool);
       tx = rpc->decoderawtransaction (ethutils::Hexlify (payload));
     }
   catch (const jsonrpc::JsonRpcException& exc)
@@ -372,7 +540,8 @@ CoreChain::ZmqListener::HandleRawTx (const std::string& payload)
 /* ************************************************************************** */
 
 CoreChain::CoreChain (const std::string& ep)
-  : endpoint(ep), zmqCtx(new zmq::context_t ())
+  : endpoint(ep), rpcPool(std::make_unique<RpcPool> (endpoint)),
+    zmqCtx(new zmq::context_t ())
 {}
 
 CoreChain::~CoreChain ()
@@ -402,7 +571,7 @@ CoreChain::GetListenerForAddress (const std::string& addr)
 void
 CoreChain::Start ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
 
   /* We need at least Xaya Core 1.6, which supports burns in the
      scriptPubKey JSON and returns a single address (rather than addresses)
@@ -430,7 +599,7 @@ CoreChain::Start ()
 bool
 CoreChain::EnablePending ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
 
   const std::string addr = GetNotificationAddress (rpc, "pubrawtx");
   if (addr.empty ())
@@ -452,7 +621,7 @@ CoreChain::EnablePending ()
 uint64_t
 CoreChain::GetTipHeight ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
   const auto blockchain = rpc->getblockchaininfo ();
   return blockchain["blocks"].asUInt64 ();
 }
@@ -463,7 +632,7 @@ CoreChain::GetBlockRange (const uint64_t start, const uint64_t count)
   if (count == 0)
     return {};
 
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
   const uint64_t endHeight = start + count - 1;
   CHECK_GE (endHeight, start);
 
@@ -472,6 +641,7 @@ CoreChain::GetBlockRange (const uint64_t start, const uint64_t count)
      we can go back from there and retrieve all block data leading up to
      it until the start height, in an atomic fashion.  */
   std::string endHash;
+  uint64_t lastHeight;
   while (true)
     {
       const auto blockchain = rpc->getblockchaininfo ();
@@ -480,12 +650,14 @@ CoreChain::GetBlockRange (const uint64_t start, const uint64_t count)
       if (blockchain["blocks"].asUInt64 () <= endHeight)
         {
           endHash = blockchain["bestblockhash"].asString ();
+          lastHeight = blockchain["blocks"].asUInt64 ();
           break;
         }
 
       try
         {
           endHash = rpc->getblockhash (endHeight);
+          lastHeight = endHeight;
           break;
         }
       catch (const jsonrpc::JsonRpcException& exc)
@@ -498,27 +670,127 @@ CoreChain::GetBlockRange (const uint64_t start, const uint64_t count)
         }
     }
 
-  std::vector<BlockData> res;
-  do
+  /* For a single block, there is nothing to batch.  */
+  if (lastHeight == start)
+    return GetBlocksBackwards (rpc, endHash, start);
+
+  /* Otherwise, resolve all other hashes with a batch of getblockhash
+     calls, and then retrieve the block data in batches (that are sent
+     in parallel on separate connections).  If a reorg happens in the
+     mean time, the parent links will not match up (or a height will
+     be missing); in that case, we fall back to walking back from the end
+     hash one block at a time, which is atomic by construction.  */
+  std::vector<std::string> hashes;
+  try
     {
-      const auto data = rpc->getblock (endHash, 2);
-      auto cur = ConstructBlockData (data);
+      std::vector<Json::Value> params;
+      for (uint64_t h = start; h < lastHeight; ++h)
+        {
+          Json::Value cur(Json::arrayValue);
+          cur.append (static_cast<Json::UInt64> (h));
+          params.push_back (cur);
+        }
+      for (const auto& val : CallBatch (rpc, "getblockhash", params))
+        hashes.push_back (val.asString ());
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      if (exc.GetCode () != -8)
+        throw;
+      LOG (WARNING)
+          << "Block hashes from " << start << " to " << lastHeight
+          << " changed while querying, race condition?";
+      return GetBlocksBackwards (rpc, endHash, start);
+    }
+  hashes.push_back (endHash);
+  CHECK_EQ (hashes.size (), lastHeight - start + 1);
 
-      CHECK_GE (cur.height, start);
-      endHash = cur.parent;
+  CHECK_GT (FLAGS_core_block_batch_size, 0) << "Invalid --core_block_batch_size";
+  const size_t batchSize = FLAGS_core_block_batch_size;
+  std::vector<std::vector<Json::Value>> batches;
+  for (size_t i = 0; i < hashes.size (); i += batchSize)
+    {
+      std::vector<Json::Value> params;
+      for (size_t j = i; j < std::min (i + batchSize, hashes.size ()); ++j)
+        {
+          Json::Value cur(Json::arrayValue);
+          cur.append (hashes[j]);
+          cur.append (2);
+          params.push_back (cur);
+        }
+      batches.push_back (std::move (params));
+    }
 
-      res.push_back (std::move (cur));
+  /* The first batch is sent on the connection we already have, and further
+     ones (if any) on additional ones checked out from the pool.  */
+  const size_t parallel = std::max (1, FLAGS_core_parallel_batches);
+  std::vector<std::vector<Json::Value>> parts(batches.size ());
+  for (size_t i = 0; i < batches.size (); i += parallel)
+    {
+      std::vector<std::future<void>> running;
+      for (size_t j = i + 1; j < std::min (i + parallel, batches.size ()); ++j)
+        running.push_back (std::async (std::launch::async,
+            [this, &batches, &parts, j] ()
+              {
+                CoreRpc r(*rpcPool);
+                parts[j] = CallBatch (r, "getblock", batches[j]);
+              }));
+
+      parts[i] = CallBatch (rpc, "getblock", batches[i]);
+      for (auto& f : running)
+        f.get ();
     }
-  while (res.back ().height > start);
 
-  std::reverse (res.begin (), res.end ());
+  std::vector<BlockData> res;
+  for (const auto& part : parts)
+    for (const auto& data : part)
+      {
+        auto cur = ConstructBlockData (data);
+        CHECK_EQ (cur.hash, hashes[res.size ()]);
+        CHECK_EQ (cur.height, start + res.size ());
+
+        if (!res.empty () && cur.parent != res.back ().hash)
+          {
+            LOG (WARNING)
+                << "Mismatch between parent hash of block " << cur.height
+                << " (" << cur.parent << ") and previous block hash "
+                << res.back ().hash << ", race condition?";
+            return GetBlocksBackwards (rpc, endHash, start);
+          }
+
+        res.push_back (std::move (cur));
+      }
+  CHECK_EQ (res.size (), hashes.size ());
+
   return res;
 }
 
+bool
+CoreChain::GetBlockByHash (const std::string& hash, BlockData& blk)
+{
+  CoreRpc rpc(*rpcPool);
+
+  Json::Value data;
+  try
+    {
+      data = rpc->getblock (hash, 2);
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      /* -5 is the error code Xaya Core returns if the block is not known.  */
+      if (exc.GetCode () != -5)
+        throw;
+      return false;
+    }
+
+  blk = ConstructBlockData (data);
+  return true;
+}
+
 int64_t
 CoreChain::GetMainchainHeight (const std::string& hash)
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
 
   try
     {
@@ -538,10 +810,133 @@ CoreChain::GetMainchainHeight (const std::string& hash)
     }
 }
 
+std::vector<BlockData>
+CoreChain::GetBlockHeaders (const uint64_t start, const uint64_t count)
+{
+  if (count == 0)
+    return {};
+
+  CoreRpc rpc(*rpcPool);
+  const uint64_t endHeight = start + count - 1;
+  CHECK_GE (endHeight, start);
+
+  /* Resolve the hashes and then the headers with a batch each.  Since
+     this is cheap, we just retry everything if a reorg in between makes
+     a height disappear or the headers not link up.  */
+  while (true)
+    {
+      const auto blockchain = rpc->getblockchaininfo ();
+      const uint64_t tip = blockchain["blocks"].asUInt64 ();
+      if (tip < start)
+        return {};
+      const uint64_t lastHeight = std::min (tip, endHeight);
+
+      std::vector<Json::Value> headers;
+      try
+        {
+          std::vector<Json::Value> params;
+          for (uint64_t h = start; h <= lastHeight; ++h)
+            {
+              Json::Value cur(Json::arrayValue);
+              cur.append (static_cast<Json::UInt64> (h));
+              params.push_back (cur);
+            }
+
+          params = CallBatch (rpc, "getblockhash", params);
+          for (auto& p : params)
+            {
+              Json::Value cur(Json::arrayValue);
+              cur.append (p.asString ());
+              p = cur;
+            }
+
+          headers = CallBatch (rpc, "getblockheader", params);
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          if (exc.GetCode () != -8)
+            throw;
+          LOG (WARNING)
+              << "Block hashes from " << start << " to " << lastHeight
+              << " changed while querying, race condition?";
+          continue;
+        }
+
+      /* The header JSON has the same fields we need as getblock, just
+         without the transactions.  */
+      std::vector<BlockData> res;
+      for (const auto& data : headers)
+        {
+          auto cur = ConstructBlockData (data);
+          CHECK_EQ (cur.height, start + res.size ());
+          if (!res.empty () && cur.parent != res.back ().hash)
+            break;
+          res.push_back (std::move (cur));
+        }
+
+      if (res.size () == headers.size ())
+        return res;
+
+      LOG (WARNING)
+          << "Block headers from " << start << " to " << lastHeight
+          << " do not match up, race condition?";
+    }
+}
+
+std::vector<int64_t>
+CoreChain::GetMainchainHeights (const std::vector<std::string>& hashes)
+{
+  if (hashes.empty ())
+    return {};
+
+  CoreRpc rpc(*rpcPool);
+
+  jsonrpc::BatchCall req;
+  std::vector<int> ids;
+  for (const auto& h : hashes)
+    {
+      Json::Value params(Json::arrayValue);
+      params.append (h);
+      ids.push_back (req.addCall ("getblockheader", params));
+    }
+
+  jsonrpc::BatchResponse resp = rpc->CallProcedures (req);
+
+  /* Errors (e.g. for unknown blocks) just mean that the block is not
+     on the main chain, like in GetMainchainHeight.  */
+  std::vector<int64_t> res;
+  for (const auto id : ids)
+    {
+      Json::Value idVal(id);
+      if (resp.getErrorCode (idVal) != 0)
+        {
+          LOG (WARNING)
+              << "RPC error from getblockheader: "
+              << resp.getErrorMessage (idVal);
+          res.push_back (-1);
+          continue;
+        }
+
+      const auto data = resp.getResult (id);
+      CHECK (data.isObject ());
+      const auto conf = data["confirmations"];
+      CHECK (conf.isInt64 ());
+      if (conf.asInt64 () == -1)
+        {
+          res.push_back (-1);
+          continue;
+        }
+      CHECK_GE (conf.asInt64 (), 0);
+      res.push_back (data["height"].asUInt64 ());
+    }
+
+  return res;
+}
+
 std::vector<std::string>
 CoreChain::GetMempool ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
 
   const auto mempool = rpc->getrawmempool ();
   CHECK (mempool.isArray ());
@@ -557,7 +952,7 @@ bool
 CoreChain::VerifyMessage (const std::string& msg, const std::string& signature,
                           std::string& addr)
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
 
   Json::Value res;
   try
@@ -582,7 +977,7 @@ CoreChain::VerifyMessage (const std::string& msg, const std::string& signature,
 std::string
 CoreChain::GetChain ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
   const auto info = rpc->getblockchaininfo ();
   return info["chain"].asString ();
 }
@@ -590,7 +985,7 @@ CoreChain::GetChain ()
 uint64_t
 CoreChain::GetVersion ()
 {
-  CoreRpc rpc(endpoint);
+  CoreRpc rpc(*rpcPool);
   const auto info = rpc->getnetworkinfo ();
   return info["version"].asUInt64 ();
 }
@@ -27,14 +27,18 @@ class CoreChain : public BaseChain
 
 private:
 
+  class RpcPool;
   class ZmqListener;
 
+  /** RPC endpoint for Xaya Core.  */
+  const std::string endpoint;
+
   /**
-   * RPC endpoint for Xaya Core.  We store the endpoint as string and
-   * establish a new HTTP connection and RPC client for each request, so
-   * that they work in a thread-safe way without any fuss.
+   * Pool of RPC clients for the endpoint.  Each request checks out a client
+   * (so that it works in a thread-safe way without any fuss), but the
+   * underlying keep-alive connections are reused.
    */
-  const std::string endpoint;
+  std::unique_ptr<RpcPool> rpcPool;
 
   /** ZMQ context used to listen to Xaya Core.  */
   std::unique_ptr<zmq::context_t> zmqCtx;
@@ -64,7 +68,12 @@ public:
   uint64_t GetTipHeight () override;
   std::vector<BlockData> GetBlockRange (uint64_t start,
                                         uint64_t count) override;
+  bool GetBlockByHash (const std::string& hash, BlockData& blk) override;
   int64_t GetMainchainHeight (const std::string& hash) override;
+  std::vector<BlockData> GetBlockHeaders (uint64_t start,
+                                          uint64_t count) override;
+  std::vector<int64_t> GetMainchainHeights (
+      const std::vector<std::string>& hashes) override;
   std::vector<std::string> GetMempool () override;
   bool VerifyMessage (const std::string& msg, const std::string& signature,
                       std::string& addr) override;
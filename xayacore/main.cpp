@@ -5,6 +5,7 @@
 #include "config.h"
 
 #include "controller.hpp"
+#include "metrics.hpp"
 
 #include "corechain.hpp"
 
@@ -29,9 +30,15 @@ DEFINE_bool (listen_locally, true,
              "whether or not the RPC server should only bind on localhost");
 DEFINE_string (zmq_address, "",
                "the address to bind the ZMQ publisher to");
+DEFINE_int32 (metrics_port, 0,
+              "if set, serve metrics in the Prometheus format over HTTP"
+              " on this port");
 
 DEFINE_int32 (max_reorg_depth, 1'000,
               "maximum supported depth of reorgs");
+DEFINE_string (import_snapshot, "",
+               "if set and there is no local state yet, bootstrap from this"
+               " snapshot file (as written by the exportsnapshot RPC method)");
 
 DEFINE_bool (pending_moves, true,
              "whether to enable tracking of pending moves");
@@ -61,14 +68,20 @@ main (int argc, char* argv[])
         throw std::runtime_error ("--datadir must be set");
       if (FLAGS_max_reorg_depth < 0)
         throw std::runtime_error ("--max_reorg_depth must not be negative");
+      if (FLAGS_metrics_port < 0)
+        throw std::runtime_error ("--metrics_port must not be negative");
 
       xayax::CoreChain base(FLAGS_core_rpc_url);
       base.Start ();
+      xayax::InstrumentedChain instrumented(base);
 
-      xayax::Controller controller(base, FLAGS_datadir);
+      xayax::Controller controller(instrumented, FLAGS_datadir);
       controller.SetMaxReorgDepth (FLAGS_max_reorg_depth);
       controller.SetZmqEndpoint (FLAGS_zmq_address);
       controller.SetRpcBinding (FLAGS_port, FLAGS_listen_locally);
+      controller.SetMetricsPort (FLAGS_metrics_port);
+      if (!FLAGS_import_snapshot.empty ())
+        controller.SetSnapshot (FLAGS_import_snapshot);
       if (FLAGS_pending_moves)
         controller.EnablePending ();
       if (FLAGS_sanity_checks)
@@ -69,7 +69,7 @@ class Instance:
 
     self.log.info ("Starting new XayaX process")
     args = list (self.binaryCmd)
-    args.append ("--core_rpc_url=%s" % xayarpc)
+    args.extend (self.getBaseChainArgs (xayarpc))
     args.append ("--port=%d" % self.port)
     args.append ("--zmq_address=tcp://127.0.0.1:%d" % self.zmqPort)
     args.append ("--datadir=%s" % self.datadir)
@@ -88,6 +88,14 @@ class Instance:
       except:
         time.sleep (0.1)
 
+  def getBaseChainArgs (self, url):
+    """
+    Returns the command-line arguments that tell the process which
+    base chain (at the given RPC URL) to connect to.
+    """
+
+    return ["--core_rpc_url=%s" % url]
+
   def stop (self):
     if self.proc is None:
       self.log.error ("No Xaya X process is running, cannot stop it")
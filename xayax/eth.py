@@ -100,9 +100,11 @@ class Instance:
 
     self.proc = None
 
-  def start (self, accountsContract, ethrpc, ws=None, watchForPending=[]):
+  def start (self, accountsContract, ethrpc, ws=None, watchForPending=[],
+             sanityChecks=True):
     """
-    Starts the process, waiting until its RPC interface is up.
+    Starts the process, waiting until its RPC interface is up.  Sanity checks
+    are on by default for tests, but can be turned off e.g. for benchmarks.
     """
 
     if self.proc is not None:
@@ -119,7 +121,8 @@ class Instance:
     args.append ("--zmq_address=tcp://127.0.0.1:%d" % self.zmqPort)
     args.append ("--datadir=%s" % self.datadir)
     args.append ("--watch_for_pending_moves=%s" % ",".join (watchForPending))
-    args.append ("--sanity_checks")
+    if sanityChecks:
+      args.append ("--sanity_checks")
     envVars = dict (os.environ)
     envVars["GLOG_log_dir"] = self.datadir
     self.proc = subprocess.Popen (args, env=envVars)
@@ -0,0 +1,270 @@
+# Copyright (C) 2024 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Recording and replaying of the EVM JSON-RPC interface used by Xaya X.
+
+A fixture with the blocks and move logs of some chain can be recorded
+from a live node, and then be served back by a mock JSON-RPC server
+with configurable injected latency.  This allows reproducible benchmarks
+of syncing without depending on a real node.
+"""
+
+import contextlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+import json
+import logging
+import threading
+import time
+
+
+def hexInt (value):
+  """
+  Encodes an integer value as hex literal in the Ethereum RPC format.
+  """
+
+  return "0x%x" % value
+
+
+def record (rpc, contract, fromHeight, toHeight):
+  """
+  Records a fixture from a live EVM node (accessed through the given
+  jsonrpclib proxy).  The fixture contains all blocks in the given range
+  of heights (as returned by eth_getBlockByNumber without full transactions)
+  and all logs emitted by the given contract in that range.
+  """
+
+  log = logging.getLogger ("xayax.replay")
+  log.info ("Recording blocks %d to %d" % (fromHeight, toHeight))
+
+  blocks = []
+  for h in range (fromHeight, toHeight + 1):
+    blocks.append (rpc.eth_getBlockByNumber (hexInt (h), False))
+
+  logs = rpc.eth_getLogs ({
+    "address": contract,
+    "fromBlock": hexInt (fromHeight),
+    "toBlock": hexInt (toHeight),
+  })
+  log.info ("Recorded %d blocks with %d logs" % (len (blocks), len (logs)))
+
+  return {
+    "chainId": rpc.eth_chainId (),
+    "contract": contract,
+    "blocks": blocks,
+    "logs": logs,
+  }
+
+
+def saveFixture (fileName, fixture):
+  with open (fileName, "wt") as f:
+    json.dump (fixture, f)
+
+
+def loadFixture (fileName):
+  with open (fileName, "rt") as f:
+    return json.load (f)
+
+
+class RequestHandler (BaseHTTPRequestHandler):
+  """
+  Request handler that answers (single or batched) JSON-RPC requests
+  from the fixture data of the server.
+  """
+
+  def do_POST (self):
+    request = self.rfile.read (int (self.headers["Content-Length"]))
+    data = json.loads (request)
+    self.server.replay.countHttpRequest ()
+
+    # The latency is injected once per HTTP request, which is what
+    # a round-trip to a remote node would cost.
+    if self.server.latency > 0:
+      time.sleep (self.server.latency)
+
+    if isinstance (data, list):
+      result = [self.server.replay.call (r) for r in data]
+    else:
+      result = self.server.replay.call (data)
+
+    body = json.dumps (result).encode ("ascii")
+    self.send_response (200)
+    self.send_header ("Content-Length", str (len (body)))
+    self.send_header ("Content-Type", "application/json")
+    self.end_headers ()
+    self.wfile.write (body)
+
+  def log_message (self, fmt, *args):
+    pass
+
+
+class ReplayServer:
+  """
+  Mock EVM JSON-RPC server, which answers the calls needed by
+  Xaya X for syncing from a recorded fixture.  The server counts the
+  calls made to it, so that benchmarks can relate them to the number
+  of blocks synced.
+  """
+
+  def __init__ (self, addr, fixture, latency=0.0):
+    """
+    Sets up the server for the given (host, port) address.  latency is
+    the time in seconds by which each HTTP request is delayed.
+    """
+
+    self.log = logging.getLogger ("xayax.replay")
+    self.address = addr
+    self.url = "http://%s:%d" % addr
+    self.latency = latency
+
+    self.chainId = fixture["chainId"]
+    self.blocksByHeight = {}
+    self.blocksByHash = {}
+    for blk in fixture["blocks"]:
+      self.blocksByHeight[int (blk["number"], 16)] = blk
+      self.blocksByHash[blk["hash"]] = blk
+    self.tipHeight = max (self.blocksByHeight.keys ())
+
+    self.logsByHeight = {}
+    for l in fixture["logs"]:
+      height = int (l["blockNumber"], 16)
+      self.logsByHeight.setdefault (height, []).append (l)
+
+    self.log.info ("Replaying %d blocks up to height %d at %s"
+                      % (len (self.blocksByHeight), self.tipHeight, self.url))
+
+    self.lock = threading.Lock ()
+    self.resetStats ()
+
+    self.server = None
+    self.runner = None
+
+  def start (self):
+    """
+    Starts the server in a background thread.
+    """
+
+    assert not self.server, "server is already running"
+
+    self.server = ThreadingHTTPServer (self.address, RequestHandler)
+    self.server.replay = self
+    self.server.latency = self.latency
+
+    self.runner = threading.Thread (target=self.server.serve_forever)
+    self.runner.start ()
+
+  def stop (self):
+    """
+    Stops the running server.
+    """
+
+    assert self.server, "server is not running"
+    self.server.shutdown ()
+    self.runner.join ()
+    self.runner = None
+    self.server.server_close ()
+    self.server = None
+
+  @contextlib.contextmanager
+  def run (self):
+    self.start ()
+    try:
+      yield self
+    finally:
+      if self.server:
+        self.stop ()
+
+  def resetStats (self):
+    with self.lock:
+      self.httpRequests = 0
+      self.calls = {}
+
+  def getStats (self):
+    """
+    Returns the number of HTTP requests made so far and a dictionary
+    of the number of calls per method.
+    """
+
+    with self.lock:
+      return self.httpRequests, dict (self.calls)
+
+  def call (self, request):
+    """
+    Processes a single JSON-RPC request and returns the response object.
+    """
+
+    method = request["method"]
+    params = request.get ("params", [])
+    with self.lock:
+      self.calls[method] = self.calls.get (method, 0) + 1
+
+    res = {"jsonrpc": "2.0", "id": request.get ("id")}
+    handler = getattr (self, "rpc_%s" % method, None)
+    if handler is None:
+      res["error"] = {
+        "code": -32_601,
+        "message": "method not found: %s" % method,
+      }
+    else:
+      res["result"] = handler (*params)
+
+    return res
+
+  def countHttpRequest (self):
+    with self.lock:
+      self.httpRequests += 1
+
+  def parseHeight (self, value):
+    if value in ["latest", "safe", "finalized", "pending"]:
+      return self.tipHeight
+    if value == "earliest":
+      return 0
+    return int (value, 16)
+
+  def rpc_eth_chainId (self):
+    return self.chainId
+
+  def rpc_eth_blockNumber (self):
+    return hexInt (self.tipHeight)
+
+  def rpc_eth_getBlockByNumber (self, height, fullTx=False):
+    return self.blocksByHeight.get (self.parseHeight (height))
+
+  def rpc_eth_getBlockByHash (self, hash, fullTx=False):
+    return self.blocksByHash.get (hash.lower ())
+
+  def rpc_eth_getLogs (self, options):
+    if "blockHash" in options:
+      blk = self.blocksByHash.get (options["blockHash"].lower ())
+      if blk is None:
+        return []
+      heights = [int (blk["number"], 16)]
+    else:
+      start = self.parseHeight (options.get ("fromBlock", "latest"))
+      end = self.parseHeight (options.get ("toBlock", "latest"))
+      heights = range (start, end + 1)
+
+    address = options.get ("address")
+    if address is not None:
+      address = address.lower ()
+    topics = options.get ("topics", [])
+
+    def matches (l):
+      if address is not None and l["address"].lower () != address:
+        return False
+      for i, t in enumerate (topics):
+        if t is None:
+          continue
+        if i >= len (l["topics"]):
+          return False
+        allowed = t if isinstance (t, list) else [t]
+        if l["topics"][i].lower () not in [a.lower () for a in allowed]:
+          return False
+      return True
+
+    res = []
+    for h in heights:
+      res.extend ([l for l in self.logsByHeight.get (h, []) if matches (l)])
+
+    return res
@@ -0,0 +1,61 @@
+# Copyright (C) 2024 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+"""
+Utilities for running a Xaya X instance that follows another (upstream)
+Xaya X instance, e.g. for regression testing.
+"""
+
+
+from xayax import core
+
+from contextlib import contextmanager
+import logging
+
+
+class Instance (core.Instance):
+  """
+  An instance of the xayax-upstream process.  It is managed just like
+  the Xaya-X-on-Xaya-Core process, except that it is connected to the
+  RPC interface of another Xaya X instance.
+  """
+
+  def __init__ (self, basedir, portgen, binary):
+    super ().__init__ (basedir, portgen, binary, dirname="xayax-upstream")
+    self.log = logging.getLogger ("xayax.upstream")
+
+  def getBaseChainArgs (self, url):
+    return ["--upstream_rpc_url=%s" % url]
+
+
+class Environment (core.Environment):
+  """
+  A test environment consisting of a Xaya Core instance, a Xaya X
+  process connected to it, and a second Xaya X process following the
+  first one through xayax-upstream.  The RPC interface exposed for GSPs
+  is the one of the downstream instance, so that tests exercise the
+  full chain.
+  """
+
+  def __init__ (self, basedir, portgen, coreBinary, xayaxBinary,
+                upstreamBinary):
+    super ().__init__ (basedir, portgen, coreBinary, xayaxBinary)
+    self.downstream = Instance (basedir, portgen, upstreamBinary)
+
+  @contextmanager
+  def run (self):
+    with super ().run (), \
+         self.downstream.run (self.xnode.rpcurl):
+      yield self
+
+  def getUpstreamRpcUrl (self):
+    """
+    Returns the RPC URL of the upstream Xaya X instance (the one
+    connected directly to Xaya Core).
+    """
+
+    return self.xnode.rpcurl
+
+  def getXRpcUrl (self):
+    return self.downstream.rpcurl